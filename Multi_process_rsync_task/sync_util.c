@@ -1,11 +1,10 @@
+#define _GNU_SOURCE
 #include "sync_util.h"
 #include <string.h>
 #include <stdlib.h>
+#include <signal.h>
 
-// 
-void sync_directory_structure(const char *path, const sync_config_t *config);
-
-// ʼļб
+// 初始化文件列表
 void init_file_list(file_list_t *list) {
     list->capacity = 100;
     list->count = 0;
@@ -16,7 +15,7 @@ void init_file_list(file_list_t *list) {
     }
 }
 
-// ͷļб
+// 释放文件列表
 void free_file_list(file_list_t *list) {
     if (list->files) {
         free(list->files);
@@ -27,8 +26,8 @@ void free_file_list(file_list_t *list) {
 }
 
 
-// ļб
-void add_file_to_list(file_list_t *list, const char *path) {
+// 添加文件到列表
+void add_file_to_list(file_list_t *list, const char *path, const struct stat *st) {
     if (list->count >= list->capacity) {
         list->capacity *= 2;
         list->files = realloc(list->files, list->capacity * sizeof(file_info_t));
@@ -40,43 +39,82 @@ void add_file_to_list(file_list_t *list, const char *path) {
     
     strncpy(list->files[list->count].path, path, MAX_PATH_LEN - 1);
     list->files[list->count].path[MAX_PATH_LEN - 1] = '\0';
-    list->files[list->count].size = get_file_size(path);
+    list->files[list->count].size = st->st_size;
+    list->files[list->count].mode = st->st_mode;
     list->count++;
 }
 
-// Ŀ¼
-void traverse_directory(const char *path, file_list_t *list) {
-    DIR *dir = opendir(path);
-    if (!dir) {
-        fprintf(stderr, "޷Ŀ¼: %s\n", path);
-        return;
-    }
-    
-    struct dirent *entry;
+// 遍历源目录时共享的状态，文件列表由多个遍历线程追加，需要加锁
+typedef struct {
+    const sync_config_t *config;
+    file_list_t *list;
+    pthread_mutex_t lock;
+} source_walk_t;
+
+// 遍历到的目录项：文件加入列表，子目录在目标中相对父目录 fd 用 mkdirat/openat 创建并打开，
+// 打开的 fd 作为该目录的用户数据，创建失败时为 -1
+static int traverse_entry(void *ctx, const walk_entry_t *entry, void **child) {
+    source_walk_t *walk = ctx;
+    int target_fd = (int)(intptr_t)entry->dir_data;
     char full_path[MAX_PATH_LEN];
-    
-    while ((entry = readdir(dir)) != NULL) {
-        //  .  ..
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    int n = snprintf(full_path, sizeof(full_path), "%s/%s", walk->config->source_dir, entry->path);
+    if (n < 0 || n >= (int)sizeof(full_path)) {
+        fprintf(stderr, "路径过长: %s/%s\n", walk->config->source_dir, entry->path);
+        return WALK_SKIP;
+    }
+
+    if (entry->type == WALK_NS) {
+        fprintf(stderr, "无法获取文件信息: %s\n", full_path);
+    } else if (entry->type == WALK_D) {
+        int fd = -1;
+        if (target_fd >= 0 && (mkdirat(target_fd, entry->name, 0755) == 0 || errno == EEXIST)) {
+            fd = openat(target_fd, entry->name, O_RDONLY | O_DIRECTORY);
         }
-        
-        snprintf(full_path, sizeof(full_path) - 1, "%s/%s", path, entry->d_name);
-        full_path[sizeof(full_path) - 1] = '\0';
-        
-        if (is_directory(full_path)) {
-            // ݹĿ¼
-            traverse_directory(full_path, list);
-        } else {
-            // ӵļб
-            add_file_to_list(list, full_path);
+        if (fd < 0) {
+            fprintf(stderr, "无法创建目录: %s/%s\n", walk->config->target_dir, entry->path);
         }
+        *child = (void *)(intptr_t)fd;
+    } else if (S_ISREG(entry->st->st_mode)) {
+        pthread_mutex_lock(&walk->lock);
+        add_file_to_list(walk->list, full_path, entry->st);
+        pthread_mutex_unlock(&walk->lock);
+    } else {
+        fprintf(stderr, "跳过非普通文件: %s\n", full_path);
     }
-    
-    closedir(dir);
+    return WALK_CONTINUE;
 }
 
-// ǷΪĿ¼
+// 一个目录处理完，关闭对应的目标目录
+static void traverse_dir_done(void *ctx, const walk_entry_t *dir) {
+    source_walk_t *walk = ctx;
+    int target_fd = (int)(intptr_t)dir->dir_data;
+    if (dir->type == WALK_DNR) {
+        fprintf(stderr, "无法打开目录: %s%s%s\n", walk->config->source_dir,
+                dir->path_len ? "/" : "", dir->path);
+    }
+    if (target_fd >= 0) {
+        close(target_fd);
+    }
+}
+
+// 用多个线程遍历源目录，收集文件列表，同时在目标中建立同样的目录结构（包括空目录）
+// 每个条目最多 stat 一次，目录都相对父目录 fd 打开和创建
+void traverse_directory(const sync_config_t *config, file_list_t *list) {
+    int root_fd = open(config->target_dir, O_RDONLY | O_DIRECTORY);
+    if (root_fd < 0) {
+        fprintf(stderr, "无法打开目录: %s\n", config->target_dir);
+    }
+
+    source_walk_t walk;
+    walk.config = config;
+    walk.list = list;
+    pthread_mutex_init(&walk.lock, NULL);
+    walk_options_t opts = {traverse_entry, traverse_dir_done, &walk, config->process_count, WALK_FOLLOW};
+    walk_tree(config->source_dir, (void *)(intptr_t)root_fd, &opts);
+    pthread_mutex_destroy(&walk.lock);
+}
+
+// 检查是否为目录
 int is_directory(const char *path) {
     struct stat stat_buf;
     if (stat(path, &stat_buf) != 0) {
@@ -85,12 +123,12 @@ int is_directory(const char *path) {
     return S_ISDIR(stat_buf.st_mode);
 }
 
-// ļǷ
+// 检查文件是否存在
 int file_exists(const char *path) {
     return access(path, F_OK) == 0;
 }
 
-// ȡļС
+// 获取文件大小
 off_t get_file_size(const char *path) {
     struct stat stat_buf;
     if (stat(path, &stat_buf) != 0) {
@@ -99,52 +137,31 @@ off_t get_file_size(const char *path) {
     return stat_buf.st_size;
 }
 
-// ȽļǷͬ
-int compare_files(const char *file1, const char *file2) {
-    if (!file_exists(file2)) {
+// 比较两个文件是否相同，源文件大小使用遍历时的结果，目标只 stat 一次
+int compare_files(const file_info_t *source, const char *target_file) {
+    struct stat target_stat;
+    if (stat(target_file, &target_stat) != 0) {
         return 0;
     }
     
-    // ȽļС
-    off_t size1 = get_file_size(file1);
-    off_t size2 = get_file_size(file2);
-    
-    if (size1 != size2) {
+    // 比较文件大小
+    if (source->size != target_stat.st_size) {
         return 0;
     }
     
-    // Ƚļ
-    FILE *f1 = fopen(file1, "rb");
-    FILE *f2 = fopen(file2, "rb");
-    
-    if (!f1 || !f2) {
-        if (f1) fclose(f1);
-        if (f2) fclose(f2);
-        return 0;
+    // 比较文件内容：两边按 HASH_WINDOW 分段读入，比较每段的哈希，某段不同即停止
+    int source_fd = open(source->path, O_RDONLY);
+    int target_fd = open(target_file, O_RDONLY);
+    int result = 0;
+    if (source_fd >= 0 && target_fd >= 0) {
+        result = hash_compare_fd(source_fd, target_fd, source->size, NULL) == 1;
     }
-    
-    unsigned char buffer1[BUFFER_SIZE];
-    unsigned char buffer2[BUFFER_SIZE];
-    size_t bytes_read1, bytes_read2;
-    int result = 1;
-    
-    do {
-        bytes_read1 = fread(buffer1, 1, BUFFER_SIZE, f1);
-        bytes_read2 = fread(buffer2, 1, BUFFER_SIZE, f2);
-        
-        if (bytes_read1 != bytes_read2 || 
-            memcmp(buffer1, buffer2, bytes_read1) != 0) {
-            result = 0;
-            break;
-        }
-    } while (bytes_read1 > 0);
-    
-    fclose(f1);
-    fclose(f2);
+    if (source_fd >= 0) close(source_fd);
+    if (target_fd >= 0) close(target_fd);
     return result;
 }
 
-// Ŀ¼
+// 创建目录
 int create_directory(const char *path) {
     if (file_exists(path)) {
         return 1;
@@ -154,16 +171,16 @@ int create_directory(const char *path) {
     char *p = NULL;
     size_t len;
     
-    // ·ַ
+    // 复制路径字符串
     snprintf(tmp, sizeof(tmp), "%s", path);
     len = strlen(tmp);
     
-    // Ƴĩβ/
+    // 移除末尾的/
     if (tmp[len - 1] == '/') {
         tmp[len - 1] = 0;
     }
     
-    // ݹ鴴Ŀ¼
+    // 递归创建目录
     for (p = tmp + 1; *p; p++) {
         if (*p == '/') {
             *p = 0;
@@ -174,7 +191,7 @@ int create_directory(const char *path) {
         }
     }
     
-    // һĿ¼
+    // 创建最后一级目录
     if (mkdir(tmp, 0755) != 0 && errno != EEXIST) {
         return 0;
     }
@@ -182,14 +199,36 @@ int create_directory(const char *path) {
     return 1;
 }
 
-// ͬļ
-int sync_file(const char *source_file, const char *target_file) {
-    // ĿļǷͬ
-    if (compare_files(source_file, target_file)) {
-        return 1; // ļͬͬ
+// 增量更新已存在的目标文件，目标不存在或太小时返回 -1，由调用者整体复制
+static int sync_delta(int source_fd, off_t source_size, const char *target_file,
+                      delta_stats_t *delta_stats) {
+    struct stat target_stat;
+    if (stat(target_file, &target_stat) != 0 || !S_ISREG(target_stat.st_mode) ||
+        target_stat.st_size < DELTA_MIN_SIZE) {
+        return -1;
     }
-    
-    // ĿĿ¼
+
+    int target_fd = open(target_file, O_RDWR);
+    if (target_fd < 0) {
+        return -1;
+    }
+    int rc = delta_sync_fd(source_fd, source_size, target_fd, target_stat.st_size, delta_stats);
+    int saved_errno = errno;
+    close(target_fd);
+    errno = saved_errno;
+    return rc < 0 ? 0 : 1;
+}
+
+// 同步单个文件，method 返回本次使用的复制方式
+// 调用者先用 compare_files 排除相同的文件，以便分别统计比较和复制的时间
+// delta 非 0 时对已存在的大文件做增量传输，delta_stats 返回写入情况
+int sync_file(const file_info_t *source, const char *target_file, int delta,
+              copy_method_t *method, delta_stats_t *delta_stats) {
+    const char *source_file = source->path;
+    *method = COPY_NONE;
+    memset(delta_stats, 0, sizeof(*delta_stats));
+    
+    // 创建目标目录
     char target_dir[MAX_PATH_LEN];
     char *last_slash = strrchr(target_file, '/');
     if (last_slash) {
@@ -198,45 +237,55 @@ int sync_file(const char *source_file, const char *target_file) {
         target_dir[dir_len] = '\0';
         
         if (!create_directory(target_dir)) {
-            fprintf(stderr, "޷Ŀ¼: %s\n", target_dir);
+            fprintf(stderr, "无法创建目录: %s\n", target_dir);
             return 0;
         }
     }
     
-    // ļ
-    FILE *source_fp = fopen(source_file, "rb");
-    if (!source_fp) {
-        fprintf(stderr, "޷Դļ: %s\n", source_file);
+    // 复制文件
+    int source_fd = open(source_file, O_RDONLY);
+    if (source_fd < 0) {
+        fprintf(stderr, "无法打开源文件: %s\n", source_file);
         return 0;
     }
     
-    FILE *target_fp = fopen(target_file, "wb");
-    if (!target_fp) {
-        fprintf(stderr, "޷Ŀļ: %s\n", target_file);
-        fclose(source_fp);
+    struct stat stat_buf;
+    if (fstat(source_fd, &stat_buf) != 0) {
+        fprintf(stderr, "无法获取源文件信息: %s\n", source_file);
+        close(source_fd);
         return 0;
     }
     
-    // ļ
-    unsigned char buffer[BUFFER_SIZE];
-    size_t bytes_read;
-    int success = 1;
-    
-    while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, source_fp)) > 0) {
-        if (fwrite(buffer, 1, bytes_read, target_fp) != bytes_read) {
-            fprintf(stderr, "дļʧ: %s\n", target_file);
-            success = 0;
-            break;
+    int delta_rc = delta ? sync_delta(source_fd, stat_buf.st_size, target_file, delta_stats) : -1;
+    if (delta_rc >= 0) {
+        *method = COPY_DELTA;
+        if (!delta_rc) {
+            fprintf(stderr, "增量更新失败: %s (%s)\n", target_file, strerror(errno));
         }
+        close(source_fd);
+        return delta_rc;
+    }
+    
+    int target_fd = open(target_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (target_fd < 0) {
+        fprintf(stderr, "无法创建目标文件: %s\n", target_file);
+        close(source_fd);
+        return 0;
     }
     
-    fclose(source_fp);
-    fclose(target_fp);
+    // 复制文件内容：优先在内核中完成，都不支持时才经过用户态缓冲区
+    int success = copy_fd(source_fd, target_fd, stat_buf.st_size, method) == 0;
+    if (!success) {
+        fprintf(stderr, "写入文件失败: %s (%s)\n", target_file, strerror(errno));
+    }
+    
+    close(source_fd);
+    close(target_fd);
     
     return success;
 }
 
-// ȡ·
+// 获取相对路径
 char* get_relative_path(const char *base, const char *full_path) {
     static char relative[MAX_PATH_LEN];
     const char *pos = strstr(full_path, base);
@@ -252,66 +301,211 @@ char* get_relative_path(const char *base, const char *full_path) {
     return relative;
 }
 
-// ̺
-void worker_process(int worker_id, file_list_t *files, const sync_config_t *config) {
-    printf(" %d ʼ %d ļ\n", worker_id, files->count);
-    
+// 排序用的临时结构
+typedef struct {
+    off_t size;
+    int index;
+} size_index_t;
+
+static int size_desc_cmp(const void *a, const void *b) {
+    off_t x = ((const size_index_t *)a)->size;
+    off_t y = ((const size_index_t *)b)->size;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// 创建共享工作队列：大文件排在前面先被领取，最后剩下的小文件用来填平各进程的差距
+work_queue_t* create_work_queue(const file_list_t *files, int worker_count) {
+    size_t map_len = sizeof(work_queue_t) + worker_count * sizeof(worker_stats_t) +
+                     files->count * sizeof(int);
+    work_queue_t *queue = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (queue == MAP_FAILED) {
+        perror("mmap failed");
+        return NULL;
+    }
+    queue->next = 0;
+    queue->count = files->count;
+    queue->workers = (worker_stats_t *)(queue + 1);
+    queue->order = (int *)(queue->workers + worker_count);
+    queue->map_len = map_len;
+    memset(queue->workers, 0, worker_count * sizeof(worker_stats_t));
+    
+    size_index_t *sorted = malloc(files->count * sizeof(size_index_t));
+    if (!sorted) {
+        perror("malloc failed");
+        exit(1);
+    }
     for (int i = 0; i < files->count; i++) {
-        const char *source_file = files->files[i].path;
+        sorted[i].size = files->files[i].size;
+        sorted[i].index = i;
+    }
+    qsort(sorted, files->count, sizeof(size_index_t), size_desc_cmp);
+    for (int i = 0; i < files->count; i++) {
+        queue->order[i] = sorted[i].index;
+    }
+    free(sorted);
+    return queue;
+}
+
+void destroy_work_queue(work_queue_t *queue) {
+    munmap(queue, queue->map_len);
+}
+
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 父进程会在子进程运行时读取计数，因此用原子操作
+static void stat_add(long long *counter, long long n) {
+    __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+static long long stat_get(const long long *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// 工作进程函数：从共享队列领取文件直到取完
+void worker_process(int worker_id, const file_list_t *files, work_queue_t *queue,
+                    const sync_config_t *config) {
+    worker_stats_t *stats = &queue->workers[worker_id];
+    long long start = now_us();
+    printf("工作进程 %d 开始\n", worker_id);
+    
+    for (;;) {
+        int pos = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+        if (pos >= queue->count) {
+            break;
+        }
+        const file_info_t *file = &files->files[queue->order[pos]];
+        const char *source_file = file->path;
         char *relative_path = get_relative_path(config->source_dir, source_file);
         
         char target_file[MAX_PATH_LEN];
         snprintf(target_file, sizeof(target_file), "%s%s", config->target_dir, relative_path);
         
-        if (sync_file(source_file, target_file)) {
-            printf(" %d ͬɹ: %s\n", worker_id, relative_path);
+        long long t0 = now_us();
+        int same = compare_files(file, target_file);
+        long long t1 = now_us();
+        stat_add(&stats->compare_us, t1 - t0);
+        stat_add(&stats->checked, 1);
+        if (same) {
+            stat_add(&stats->skipped, 1);
+            continue;
+        }
+        
+        copy_method_t method;
+        delta_stats_t delta_stats;
+        int ok = sync_file(file, target_file, config->delta, &method, &delta_stats);
+        stat_add(&stats->copy_us, now_us() - t1);
+        if (ok) {
+            stat_add(&stats->copied, 1);
+            stat_add(&stats->bytes, file->size);
+            if (method == COPY_DELTA) {
+                off_t changed = delta_stats.moved_bytes + delta_stats.literal_bytes;
+                printf("进程 %d 同步成功: %s [delta: 改写 %lld / %lld 字节]\n", worker_id,
+                       relative_path, (long long)changed,
+                       (long long)(delta_stats.matched_bytes + changed));
+            } else {
+                printf("进程 %d 同步成功: %s [%s]\n", worker_id, relative_path, copy_method_name(method));
+            }
         } else {
-            fprintf(stderr, " %d ͬʧ: %s\n", worker_id, relative_path);
+            stat_add(&stats->errors, 1);
+            fprintf(stderr, "进程 %d 同步失败: %s\n", worker_id, relative_path);
         }
     }
     
-    printf(" %d \n", worker_id);
+    stats->elapsed_us = now_us() - start;
+    printf("工作进程 %d 完成\n", worker_id);
+}
+
+static double per_second(double value, long long us) {
+    return us > 0 ? value * 1e6 / us : 0.0;
+}
+
+// 汇总所有子进程的计数
+static void sum_worker_stats(const work_queue_t *queue, int worker_count, worker_stats_t *total) {
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < worker_count; i++) {
+        const worker_stats_t *w = &queue->workers[i];
+        total->checked += stat_get(&w->checked);
+        total->copied += stat_get(&w->copied);
+        total->skipped += stat_get(&w->skipped);
+        total->errors += stat_get(&w->errors);
+        total->bytes += stat_get(&w->bytes);
+        total->compare_us += stat_get(&w->compare_us);
+        total->copy_us += stat_get(&w->copy_us);
+    }
+}
+
+// 运行中的进度行
+static void print_progress(const work_queue_t *queue, int worker_count, long long elapsed_us) {
+    worker_stats_t total;
+    sum_worker_stats(queue, worker_count, &total);
+    printf("进度: 已检查 %lld/%d, 复制 %lld, 跳过 %lld, 失败 %lld, %.2f MB, %.1f 文件/秒\n",
+           total.checked, queue->count, total.copied, total.skipped, total.errors,
+           total.bytes / 1048576.0, per_second(total.checked, elapsed_us));
+    fflush(stdout);
+}
+
+// 最终报告：每个子进程一行，用于找出负载下变慢的进程
+static void print_worker_stats(const work_queue_t *queue, int worker_count, long long elapsed_us) {
+    printf("\n=== 进程统计 ===\n");
+    for (int i = 0; i < worker_count; i++) {
+        const worker_stats_t *w = &queue->workers[i];
+        printf("进程 %d: 检查 %lld, 复制 %lld, 跳过 %lld, 失败 %lld, %.2f MB, "
+               "比较 %.3f 秒, 复制 %.3f 秒, 共 %.3f 秒, %.2f MB/s, %.1f 文件/秒\n",
+               i, w->checked, w->copied, w->skipped, w->errors, w->bytes / 1048576.0,
+               w->compare_us / 1e6, w->copy_us / 1e6, w->elapsed_us / 1e6,
+               per_second(w->bytes / 1048576.0, w->elapsed_us), per_second(w->checked, w->elapsed_us));
+    }
+    
+    worker_stats_t total;
+    sum_worker_stats(queue, worker_count, &total);
+    printf("合计: 检查 %lld, 复制 %lld, 跳过 %lld, 失败 %lld, %.2f MB, %.3f 秒, %.2f MB/s, %.1f 文件/秒\n",
+           total.checked, total.copied, total.skipped, total.errors, total.bytes / 1048576.0,
+           elapsed_us / 1e6, per_second(total.bytes / 1048576.0, elapsed_us),
+           per_second(total.checked, elapsed_us));
+    printf("===============\n");
 }
 
-// ִͬ
+// 执行同步
 int perform_sync(const sync_config_t *config) {
-    printf("ʼͬ: %s -> %s\n", config->source_dir, config->target_dir);
+    printf("开始同步: %s -> %s\n", config->source_dir, config->target_dir);
     
-// ϸԴĿ¼
+// 严格检查源目录
     struct stat stat_buf;
     if (stat(config->source_dir, &stat_buf) != 0) {
-        fprintf(stderr, ": ԴĿ¼: %s\n", config->source_dir);
+        fprintf(stderr, "错误: 源目录不存在: %s\n", config->source_dir);
         return 0;
     }
     
     if (!S_ISDIR(stat_buf.st_mode)) {
-        fprintf(stderr, ": Դ·Ŀ¼: %s\n", config->source_dir);
+        fprintf(stderr, "错误: 源路径不是目录: %s\n", config->source_dir);
         return 0;
     }
 
-      // ĿĿ¼
+      // 创建目标根目录
     if (!create_directory(config->target_dir)) {
-        fprintf(stderr, ": ޷ĿĿ¼: %s\n", config->target_dir);
+        fprintf(stderr, "错误: 无法创建目标目录: %s\n", config->target_dir);
         return 0;
     }
     
- // ͬĿ¼ṹ
-    sync_directory_structure(config->source_dir, config);
-
- // ȡļбͬ
+ // 获取文件列表并同步目录结构
     file_list_t files;
     init_file_list(&files);
-    traverse_directory(config->source_dir, &files);
+    traverse_directory(config, &files);
     
-    printf("ҵ %d ļҪͬ\n", files.count);
+    printf("找到 %d 个文件需要同步\n", files.count);
     
     if (files.count == 0) {
-        printf("ûļҪͬ\n");
+        printf("没有文件需要同步\n");
         free_file_list(&files);
         return 1;
     }
     
-    // ̽ͬ
+    // 创建多个进程进行同步
     pid_t *pids = malloc(config->process_count * sizeof(pid_t));
     if (!pids) {
         perror("malloc failed");
@@ -319,96 +513,86 @@ int perform_sync(const sync_config_t *config) {
         return 0;
     }
     
-    int files_per_process = files.count / config->process_count;
-    int remaining_files = files.count % config->process_count;
-    int start_index = 0;
+    // 子进程直接读取 fork 时继承的文件列表，只有队列位置和统计放在共享内存中
+    work_queue_t *queue = create_work_queue(&files, config->process_count);
+    if (!queue) {
+        free(pids);
+        free_file_list(&files);
+        return 0;
+    }
+    long long start = now_us();
+    
+    // 屏蔽 SIGCHLD，父进程用 sigtimedwait 等待子进程结束或下一次打印进度
+    sigset_t chld_set, old_set;
+    sigemptyset(&chld_set);
+    sigaddset(&chld_set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld_set, &old_set);
     
     for (int i = 0; i < config->process_count; i++) {
         pid_t pid = fork();
         
-        if (pid == 0) { // ӽ
-            file_list_t worker_files;
-            init_file_list(&worker_files);
-            
-            int end_index = start_index + files_per_process;
-            if (i == config->process_count - 1) {
-                end_index += remaining_files;
-            }
-            
-            // ļбƬ
-            for (int j = start_index; j < end_index; j++) {
-                add_file_to_list(&worker_files, files.files[j].path);
-            }
-            
-            worker_process(i, &worker_files, config);
-            free_file_list(&worker_files);
-            exit(0);
-        } else if (pid > 0) { // 
+        if (pid == 0) { // 子进程
+            sigprocmask(SIG_SETMASK, &old_set, NULL);
+            worker_process(i, &files, queue, config);
+            exit(queue->workers[i].errors ? 1 : 0);
+        } else if (pid > 0) { // 父进程
             pids[i] = pid;
-            start_index += files_per_process;
         } else {
-            perror("ʧ");
+            perror("创建进程失败");
+            // 已启动的子进程会把队列取完，等它们结束再返回
+            for (int j = 0; j < i; j++) {
+                waitpid(pids[j], NULL, 0);
+            }
+            sigprocmask(SIG_SETMASK, &old_set, NULL);
+            destroy_work_queue(queue);
             free(pids);
             free_file_list(&files);
             return 0;
         }
     }
     
-    // ȴӽ
+    // 等待所有子进程完成，期间定时打印进度
     int all_success = 1;
-    for (int i = 0; i < config->process_count; i++) {
-        int status;
-        waitpid(pids[i], &status, 0);
-        if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
-            fprintf(stderr, "ӽ %d ͬʧ\n", i);
-            all_success = 0;
+    int running = config->process_count;
+    long long last_progress = start;
+    while (running > 0) {
+        for (int i = 0; i < config->process_count; i++) {
+            int status;
+            if (pids[i] <= 0 || waitpid(pids[i], &status, WNOHANG) != pids[i]) {
+                continue;
+            }
+            pids[i] = 0;
+            running--;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "子进程 %d 同步失败\n", i);
+                all_success = 0;
+            }
+        }
+        if (running == 0) {
+            break;
         }
+        
+        long long now = now_us();
+        if (now - last_progress >= PROGRESS_INTERVAL_US) {
+            print_progress(queue, config->process_count, now - start);
+            last_progress = now;
+        }
+        long long wait_us = last_progress + PROGRESS_INTERVAL_US - now;
+        struct timespec timeout = {wait_us / 1000000, (wait_us % 1000000) * 1000};
+        sigtimedwait(&chld_set, NULL, &timeout);
     }
+    sigprocmask(SIG_SETMASK, &old_set, NULL);
     
+    print_worker_stats(queue, config->process_count, now_us() - start);
+    destroy_work_queue(queue);
     free(pids);
     free_file_list(&files);
     
     if (all_success) {
-        printf("ͬ\n");
+        printf("同步完成\n");
     } else {
-        fprintf(stderr, "ͬгִ\n");
+        fprintf(stderr, "同步过程中出现错误\n");
     }
     
     return all_success;
 }
-
-
-
-// ͬĿ¼ṹ
-void sync_directory_structure(const char *path, const sync_config_t *config) {
-    DIR *dir = opendir(path);
-    if (!dir) return;
-    
-    struct dirent *entry;
-    char full_path[MAX_PATH_LEN];
-    char target_path[MAX_PATH_LEN];
-    
-    // ǰĿ¼Ŀλ
-    char *relative = get_relative_path(config->source_dir, path);
-    if (strlen(relative) > 0) {
-        snprintf(target_path, sizeof(target_path) - 1, "%s/%s", config->target_dir, relative);
-        target_path[sizeof(target_path) - 1] = '\0';
-        create_directory(target_path);
-    }
-    
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-        
-        snprintf(full_path, sizeof(full_path) - 1, "%s/%s", path, entry->d_name);
-        full_path[sizeof(full_path) - 1] = '\0';
-        
-        if (is_directory(full_path)) {
-            // ݹͬĿ¼
-            sync_directory_structure(full_path, config);
-        }
-    }
-    
-    closedir(dir);
-}
\ No newline at end of file
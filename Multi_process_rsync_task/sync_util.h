@@ -11,43 +11,82 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "copy_engine.h"
+#include "delta.h"
+#include "hash.h"
+#include "walk.h"
 
 #define MAX_PATH_LEN 1024
 #define MAX_FILES 10000
 #define BUFFER_SIZE 4096
 
-// ļϢṹ
+// 文件信息结构体
 typedef struct {
     char path[MAX_PATH_LEN];
-    off_t size;
+    off_t size;               // 遍历时 stat 的结果，比较时不再重复获取
+    mode_t mode;
 } file_info_t;
 
-// ļбṹ
+// 文件列表结构体
 typedef struct {
     file_info_t *files;
     int count;
     int capacity;
 } file_list_t;
 
-// ͬ
+#define PROGRESS_INTERVAL_US 1000000   // 父进程打印进度的间隔
+
+// 每个子进程的计数，放在共享内存中。子进程用原子加更新，
+// 父进程运行中读取打印进度，结束后汇总
+typedef struct {
+    long long checked;        // 已比较的文件数
+    long long copied;
+    long long skipped;        // 目标已相同，未复制
+    long long errors;
+    long long bytes;          // 复制的字节数
+    long long compare_us;     // 比较文件所用时间
+    long long copy_us;        // 复制文件所用时间
+    long long elapsed_us;
+} worker_stats_t;
+
+// 子进程共享的工作队列（mmap MAP_SHARED，fork 后地址不变）
+// 文件按大小从大到小排列，子进程用原子操作领取下一个，直到取完
+typedef struct {
+    int next;                 // 下一个待领取的位置
+    int count;
+    int *order;               // 文件在列表中的下标
+    worker_stats_t *workers;
+    size_t map_len;
+} work_queue_t;
+
+// 同步配置
 typedef struct {
     char source_dir[MAX_PATH_LEN];
     char target_dir[MAX_PATH_LEN];
     int process_count;
+    int delta;                // 目标已存在时只改写变化的块
 } sync_config_t;
 
-// 
+// 函数声明
 void init_file_list(file_list_t *list);
 void free_file_list(file_list_t *list);
-void add_file_to_list(file_list_t *list, const char *path);
-void traverse_directory(const char *path, file_list_t *list);
+void add_file_to_list(file_list_t *list, const char *path, const struct stat *st);
+void traverse_directory(const sync_config_t *config, file_list_t *list);
 int is_directory(const char *path);
 int file_exists(const char *path);
 off_t get_file_size(const char *path);
-int compare_files(const char *file1, const char *file2);
+int compare_files(const file_info_t *source, const char *target_file);
 int create_directory(const char *path);
-int sync_file(const char *source_file, const char *target_file);
-void worker_process(int worker_id, file_list_t *files, const sync_config_t *config);
+int sync_file(const file_info_t *source, const char *target_file, int delta,
+              copy_method_t *method, delta_stats_t *delta_stats);
+work_queue_t* create_work_queue(const file_list_t *files, int worker_count);
+void destroy_work_queue(work_queue_t *queue);
+void worker_process(int worker_id, const file_list_t *files, work_queue_t *queue,
+                    const sync_config_t *config);
 int perform_sync(const sync_config_t *config);
 char* get_relative_path(const char *base, const char *full_path);
 
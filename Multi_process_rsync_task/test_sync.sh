@@ -1,128 +1,151 @@
 #!/bin/bash
 
-# Խű for Cļͬ
+# 测试脚本 for C语言文件同步程序
 
 set -e
 
-# ɫ
+# 颜色定义
 RED='\033[0;31m'
 GREEN='\033[0;32m'
 YELLOW='\033[1;33m'
 NC='\033[0m' # No Color
 
-# 
+# 程序名称
 PROGRAM="./file_sync"
 TEST_DIR="./test_dir"
 SOURCE_DIR="$TEST_DIR/source"
 TARGET_DIR="$TEST_DIR/target"
 
-# Ŀ¼ṹ
+# 创建测试目录结构
 create_test_structure() {
-    echo -e "${YELLOW}Ŀ¼ṹ...${NC}"
+    echo -e "${YELLOW}创建测试目录结构...${NC}"
     
-    # ɲĿ¼
+    # 清理旧测试目录
     rm -rf "$TEST_DIR"
     
-    # Ŀ¼ṹ
+    # 创建目录结构
     mkdir -p "$SOURCE_DIR/dir1"
     mkdir -p "$SOURCE_DIR/dir2/subdir"
     mkdir -p "$SOURCE_DIR/empty_dir"
     
-    # ļ
-    echo "ļ1" > "$SOURCE_DIR/file1.txt"
-    echo "ļ2ݣԳһЩ" > "$SOURCE_DIR/file2.txt"
-    echo "dir1еļ" > "$SOURCE_DIR/dir1/file3.txt"
-    echo "Ŀ¼еļ" > "$SOURCE_DIR/dir2/subdir/file4.txt"
+    # 创建测试文件
+    echo "这是文件1的内容" > "$SOURCE_DIR/file1.txt"
+    echo "这是文件2的内容，稍长一些" > "$SOURCE_DIR/file2.txt"
+    echo "dir1中的文件" > "$SOURCE_DIR/dir1/file3.txt"
+    echo "子目录中的文件" > "$SOURCE_DIR/dir2/subdir/file4.txt"
     
-    # һϴļڲ
+    # 创建一个较大的文件用于测试
     dd if=/dev/zero of="$SOURCE_DIR/large_file.bin" bs=1M count=2 2>/dev/null
     
-    echo -e "${GREEN}Ŀ¼ṹ${NC}"
+    echo -e "${GREEN}测试目录结构创建完成${NC}"
 }
 
-# 
+# 编译程序
 compile_program() {
-    echo -e "${YELLOW}...${NC}"
-    gcc -std=c99 -Wall -O2 -o file_sync main.c sync_util.c
+    echo -e "${YELLOW}编译程序...${NC}"
+    gcc -std=c99 -Wall -O2 -pthread -I../sync_common -o file_sync main.c sync_util.c ../sync_common/copy_engine.c ../sync_common/delta.c ../sync_common/hash.c ../sync_common/walk.c
     if [ $? -ne 0 ]; then
-        echo -e "${RED}ʧ${NC}"
+        echo -e "${RED}编译失败${NC}"
         exit 1
     fi
-    echo -e "${GREEN}ɹ${NC}"
+    echo -e "${GREEN}编译成功${NC}"
 }
 
-# ܲ
+# 基本功能测试
 test_basic_function() {
-    echo -e "${YELLOW}Ի...${NC}"
+    echo -e "${YELLOW}测试基本功能...${NC}"
     
-    # ִͬ
+    # 执行同步
     $PROGRAM -p 2 "$SOURCE_DIR" "$TARGET_DIR"
     
-    # ͬ
+    # 检查同步结果
     if [ ! -d "$TARGET_DIR" ]; then
-        echo -e "${RED}: ĿĿ¼δ${NC}"
+        echo -e "${RED}错误: 目标目录未创建${NC}"
         return 1
     fi
     
-    # ļǷͬ
+    # 检查文件是否同步
     check_files_synced
     
-    echo -e "${GREEN}ܲͨ${NC}"
+    echo -e "${GREEN}基本功能测试通过${NC}"
 }
 
-# ̲
+# 多进程测试
 test_multiprocess() {
-    echo -e "${YELLOW}Զ̹...${NC}"
+    echo -e "${YELLOW}测试多进程功能...${NC}"
     
-    # ʹòͬ
+    # 使用不同进程数测试
     for processes in 1 2 4; do
-        echo -e "ʹ $processes ̽ͬ..."
+        echo -e "使用 $processes 个进程进行同步..."
         rm -rf "$TARGET_DIR"
         $PROGRAM -p $processes "$SOURCE_DIR" "$TARGET_DIR"
         
         if [ $? -ne 0 ]; then
-            echo -e "${RED}: $processes ͬʧ${NC}"
+            echo -e "${RED}错误: $processes 个进程同步失败${NC}"
             return 1
         fi
         
         check_files_synced
-        echo -e "${GREEN}$processes ̲ͨ${NC}"
+        echo -e "${GREEN}$processes 个进程测试通过${NC}"
     done
 }
 
-# ͬ
+# 增量同步测试
 test_incremental_sync() {
-    echo -e "${YELLOW}ͬ...${NC}"
+    echo -e "${YELLOW}测试增量同步...${NC}"
     
-    # ޸Դļ
-    echo "޸ĺ" >> "$SOURCE_DIR/file1.txt"
+    # 修改源文件
+    echo "修改后的内容" >> "$SOURCE_DIR/file1.txt"
     
-    # ٴͬ
+    # 再次同步
     $PROGRAM "$SOURCE_DIR" "$TARGET_DIR"
     
-    # ļǷ
+    # 检查文件是否更新
     if ! diff "$SOURCE_DIR/file1.txt" "$TARGET_DIR/file1.txt" > /dev/null; then
-        echo -e "${RED}: ͬʧ${NC}"
+        echo -e "${RED}错误: 增量同步失败${NC}"
         return 1
     fi
     
-    echo -e "${GREEN}ͬͨ${NC}"
+    echo -e "${GREEN}增量同步测试通过${NC}"
 }
 
-# Ŀ¼
+# 增量传输测试：大文件中改写少量字节后用 -D 同步
+test_delta_sync() {
+    echo -e "${YELLOW}测试增量传输...${NC}"
+    
+    printf 'XXXX' | dd of="$SOURCE_DIR/large_file.bin" bs=1 seek=1500000 conv=notrunc 2>/dev/null
+    head -c 3000 /dev/urandom >> "$SOURCE_DIR/large_file.bin"
+    
+    local output
+    output=$($PROGRAM -D "$SOURCE_DIR" "$TARGET_DIR")
+    
+    if ! cmp -s "$SOURCE_DIR/large_file.bin" "$TARGET_DIR/large_file.bin"; then
+        echo -e "${RED}错误: 增量传输后文件内容不一致${NC}"
+        return 1
+    fi
+    
+    if ! echo "$output" | grep -q "large_file.bin \[delta"; then
+        echo -e "${RED}错误: 未使用增量传输${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}增量传输测试通过${NC}"
+}
+
+# 空目录测试
 test_empty_directory() {
-    echo -e "${YELLOW}ԿĿ¼ͬ...${NC}"
+    echo -e "${YELLOW}测试空目录同步...${NC}"
     
-    # Ŀ¼Ƿͬ
+    # 检查空目录是否同步
     if [ ! -d "$TARGET_DIR/empty_dir" ]; then
-        echo -e "${RED}: Ŀ¼δͬ${NC}"
+        echo -e "${RED}错误: 空目录未同步${NC}"
         return 1
     fi
     
-    echo -e "${GREEN}Ŀ¼ͨ${NC}"
+    echo -e "${GREEN}空目录测试通过${NC}"
 }
 
-# ļǷͬ
+# 检查文件是否同步
 check_files_synced() {
     local files=(
         "file1.txt"
@@ -134,49 +157,66 @@ check_files_synced() {
     
     for file in "${files[@]}"; do
         if ! diff "$SOURCE_DIR/$file" "$TARGET_DIR/$file" > /dev/null; then
-            echo -e "${RED}: ļ $file ͬʧ${NC}"
+            echo -e "${RED}错误: 文件 $file 同步失败${NC}"
             return 1
         fi
     done
 }
 
-# 
+# 错误处理测试
 test_error_handling() {
-    echo -e "${YELLOW}Դ...${NC}"
+    echo -e "${YELLOW}测试错误处理...${NC}"
     
-    # ԲڵԴĿ¼
+    # 测试不存在的源目录
     $PROGRAM "/nonexistent/source" "$TARGET_DIR/error_test" 2>/dev/null
     if [ $? -eq 0 ]; then
-        echo -e "${RED}: Ӧü⵽ڵԴĿ¼${NC}"
+        echo -e "${RED}错误: 应该检测到不存在的源目录${NC}"
+        return 1
+    fi
+    
+    # 单个文件同步失败时退出码也应非 0：目标位置已有同名目录，无法写入
+    local fail_src="$TEST_DIR/fail_source"
+    local fail_dst="$TEST_DIR/fail_target"
+    mkdir -p "$fail_src" "$fail_dst/blocked.txt"
+    echo "无法写入的文件" > "$fail_src/blocked.txt"
+    echo "正常文件" > "$fail_src/ok.txt"
+    
+    if $PROGRAM -p 2 "$fail_src" "$fail_dst" > /dev/null 2>&1; then
+        echo -e "${RED}错误: 文件同步失败时退出码应为非 0${NC}"
+        return 1
+    fi
+    if ! diff "$fail_src/ok.txt" "$fail_dst/ok.txt" > /dev/null; then
+        echo -e "${RED}错误: 其他文件应继续同步${NC}"
         return 1
     fi
     
-    echo -e "${GREEN}ͨ${NC}"
+    echo -e "${GREEN}错误处理测试通过${NC}"
 }
 
-# 
+# 清理函数
 cleanup() {
-    echo -e "${YELLOW}ļ...${NC}"
+    echo -e "${YELLOW}清理测试文件...${NC}"
     rm -rf "$TEST_DIR"
     rm -f file_sync
-    echo -e "${GREEN}${NC}"
+    echo -e "${GREEN}清理完成${NC}"
 }
 
-# Ժ
+# 主测试函数
 main() {
-    echo -e "${YELLOW}ʼCļͬ${NC}"
+    echo -e "${YELLOW}开始C语言文件同步程序测试${NC}"
     
-    # 
+    # 编译程序
     compile_program
     
-    # Խṹ
+    # 创建测试结构
     create_test_structure
     
-    # в
+    # 运行测试
     local tests=(
         test_basic_function
         test_multiprocess
         test_incremental_sync
+        test_delta_sync
         test_empty_directory
         test_error_handling
     )
@@ -185,26 +225,26 @@ main() {
     
     for test_func in "${tests[@]}"; do
         if $test_func; then
-            echo -e "${GREEN}77 $test_func ͨ${NC}"
+            echo -e "${GREEN}✓ $test_func 通过${NC}"
         else
-            echo -e "${RED}71 $test_func ʧ${NC}"
+            echo -e "${RED}✗ $test_func 失败${NC}"
             ((failed_tests++))
         fi
         echo
     done
     
-    # ʾԽ
+    # 显示测试结果
     if [ $failed_tests -eq 0 ]; then
-        echo -e "${GREEN}вͨ! 95${NC}"
+        echo -e "${GREEN}所有测试通过! 🎉${NC}"
     else
-        echo -e "${RED}$failed_tests ʧ${NC}"
+        echo -e "${RED}$failed_tests 个测试失败${NC}"
     fi
     
-    # 
+    # 清理
     cleanup
     
     return $failed_tests
 }
 
-# в
+# 运行测试
 main
\ No newline at end of file
@@ -0,0 +1,82 @@
+#!/bin/bash
+
+# 增量传输基准测试：大文件中零星改写后，比较整体复制和 -D 增量传输
+# 用法: ./bench_delta.sh [文件大小(MB)] [改写处数]
+# 例如: ./bench_delta.sh 4096 16
+
+set -e
+
+# 颜色定义
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+PROGRAM="./file_sync"
+BENCH_DIR="./bench_dir"
+SOURCE_DIR="$BENCH_DIR/source"
+FULL_TARGET="$BENCH_DIR/target_full"
+DELTA_TARGET="$BENCH_DIR/target_delta"
+
+SIZE_MB=${1:-1024}
+EDITS=${2:-16}
+
+# 创建随机内容的大文件，并同步出两份相同的目标
+create_large_file() {
+    echo -e "${YELLOW}创建 ${SIZE_MB}MB 的测试文件...${NC}"
+    rm -rf "$BENCH_DIR"
+    mkdir -p "$SOURCE_DIR"
+    head -c $((SIZE_MB * 1024 * 1024)) /dev/urandom > "$SOURCE_DIR/image.bin"
+
+    $PROGRAM -t 1 "$SOURCE_DIR" "$FULL_TARGET" >/dev/null
+    $PROGRAM -t 1 "$SOURCE_DIR" "$DELTA_TARGET" >/dev/null
+    echo -e "${GREEN}测试数据创建完成${NC}"
+}
+
+# 在源文件中均匀分布的 EDITS 个位置各改写 4KB
+sparse_edit() {
+    local size=$((SIZE_MB * 1024 * 1024))
+    for ((i = 0; i < EDITS; i++)); do
+        local offset=$(( (size / EDITS) * i + 12345 ))
+        head -c 4096 /dev/urandom | \
+            dd of="$SOURCE_DIR/image.bin" bs=4096 seek=$offset oflag=seek_bytes conv=notrunc 2>/dev/null
+    done
+    touch "$SOURCE_DIR/image.bin"
+    echo "已改写 $EDITS 处，每处 4096 字节"
+}
+
+# 同步一次并输出耗时，$1 为说明，其余为 file_sync 的参数
+run_once() {
+    local label=$1
+    shift
+    sync
+    start_time=$(date +%s.%N)
+    local output
+    output=$($PROGRAM -t 1 "$@")
+    end_time=$(date +%s.%N)
+
+    local written
+    written=$(echo "$output" | sed -n 's/^增量改写字节数: //p')
+    awk -v l="$label" -v s=$start_time -v e=$end_time -v w="${written:-全部}" \
+        'BEGIN { printf "%-10s %-12.3f %s\n", l, e - s, w }'
+}
+
+main() {
+    if [ ! -x "$PROGRAM" ]; then
+        make
+    fi
+
+    create_large_file
+    sparse_edit
+
+    printf "%-10s %-12s %s\n" "方式" "耗时(s)" "改写字节数"
+    run_once "整体复制" "$SOURCE_DIR" "$FULL_TARGET"
+    run_once "增量传输" -D "$SOURCE_DIR" "$DELTA_TARGET"
+
+    cmp "$SOURCE_DIR/image.bin" "$FULL_TARGET/image.bin"
+    cmp "$SOURCE_DIR/image.bin" "$DELTA_TARGET/image.bin"
+    echo -e "${GREEN}两种方式结果一致${NC}"
+
+    rm -rf "$BENCH_DIR"
+}
+
+main
@@ -0,0 +1,71 @@
+#!/bin/bash
+
+# 多线程文件同步吞吐量基准测试
+# 用法: ./bench_sync.sh [文件数] [线程数列表]
+# 例如: ./bench_sync.sh 1000000 "1 2 4 8 16 32 64"
+
+set -e
+
+# 颜色定义
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+PROGRAM="./file_sync"
+BENCH_DIR="./bench_dir"
+SOURCE_DIR="$BENCH_DIR/source"
+TARGET_DIR="$BENCH_DIR/target"
+
+FILE_COUNT=${1:-1000000}
+THREAD_LIST=${2:-"1 2 4 8 16 32 64"}
+FILES_PER_DIR=1000
+
+# 创建大量小文件: 每个目录 FILES_PER_DIR 个，每个文件一行内容
+create_tiny_files() {
+    echo -e "${YELLOW}创建 $FILE_COUNT 个小文件...${NC}"
+    rm -rf "$BENCH_DIR"
+    mkdir -p "$SOURCE_DIR"
+
+    local dirs=$(( (FILE_COUNT + FILES_PER_DIR - 1) / FILES_PER_DIR ))
+    local remaining=$FILE_COUNT
+    for ((d = 0; d < dirs; d++)); do
+        local n=$FILES_PER_DIR
+        if [ $remaining -lt $n ]; then
+            n=$remaining
+        fi
+        mkdir -p "$SOURCE_DIR/d$d"
+        seq 1 $n | split -l 1 -a 4 - "$SOURCE_DIR/d$d/f_"
+        remaining=$((remaining - n))
+    done
+
+    echo -e "${GREEN}测试数据创建完成${NC}"
+}
+
+# 对每个线程数做一次全量同步，输出耗时和每秒文件数
+run_bench() {
+    printf "%-8s %-12s %-12s\n" "线程数" "耗时(s)" "文件/秒"
+    for threads in $THREAD_LIST; do
+        rm -rf "$TARGET_DIR"
+        sync
+
+        start_time=$(date +%s.%N)
+        $PROGRAM -t $threads "$SOURCE_DIR" "$TARGET_DIR" >/dev/null 2>&1
+        end_time=$(date +%s.%N)
+
+        awk -v t=$threads -v s=$start_time -v e=$end_time -v n=$FILE_COUNT \
+            'BEGIN { d = e - s; printf "%-8d %-12.3f %-12.0f\n", t, d, n / d }'
+    done
+}
+
+main() {
+    if [ ! -x "$PROGRAM" ]; then
+        make
+    fi
+
+    create_tiny_files
+    run_bench
+
+    rm -rf "$BENCH_DIR"
+}
+
+main
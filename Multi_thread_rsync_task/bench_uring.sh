@@ -0,0 +1,86 @@
+#!/bin/bash
+
+# io_uring 复制基准测试：小文件为主的目录树上，比较线程池复制和 -U
+# 用法: ./bench_uring.sh [文件数] [文件大小(字节)] [线程数列表]
+# 例如: ./bench_uring.sh 200000 4096 "1 2 4 8"
+#       BENCH_DIR=/dev/shm/bench ./bench_uring.sh
+
+set -e
+
+# 颜色定义
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+PROGRAM="./file_sync"
+BENCH_DIR="${BENCH_DIR:-./bench_dir}"   # 可指向 tmpfs，排除磁盘回写的干扰
+SOURCE_DIR="$BENCH_DIR/source"
+TARGET_DIR="$BENCH_DIR/target"
+
+FILE_COUNT=${1:-100000}
+FILE_SIZE=${2:-4096}
+THREAD_LIST=${3:-"1 2 4 8"}
+FILES_PER_DIR=1000
+
+# 每个目录 FILES_PER_DIR 个文件，内容来自同一块随机数据
+create_small_files() {
+    echo -e "${YELLOW}创建 $FILE_COUNT 个 ${FILE_SIZE} 字节的文件...${NC}"
+    rm -rf "$BENCH_DIR"
+    mkdir -p "$SOURCE_DIR"
+
+    local block="$BENCH_DIR/block"
+    head -c $((FILE_SIZE * FILES_PER_DIR)) /dev/urandom > "$block"
+
+    local dirs=$(( (FILE_COUNT + FILES_PER_DIR - 1) / FILES_PER_DIR ))
+    local remaining=$FILE_COUNT
+    for ((d = 0; d < dirs; d++)); do
+        local n=$FILES_PER_DIR
+        if [ $remaining -lt $n ]; then
+            n=$remaining
+        fi
+        mkdir -p "$SOURCE_DIR/d$d"
+        head -c $((FILE_SIZE * n)) "$block" | split -b $FILE_SIZE -a 4 - "$SOURCE_DIR/d$d/f_"
+        remaining=$((remaining - n))
+    done
+    rm -f "$block"
+
+    echo -e "${GREEN}测试数据创建完成${NC}"
+}
+
+# 全量同步一次，输出耗时和每秒文件数
+run_once() {
+    local mode=$1
+    local threads=$2
+    local flags=$3
+
+    rm -rf "$TARGET_DIR"
+    sync
+
+    start_time=$(date +%s.%N)
+    $PROGRAM $flags -t $threads "$SOURCE_DIR" "$TARGET_DIR" >/dev/null 2>&1
+    end_time=$(date +%s.%N)
+
+    awk -v m=$mode -v t=$threads -v s=$start_time -v e=$end_time -v n=$FILE_COUNT \
+        'BEGIN { d = e - s; printf "%-10s %-8d %-12.3f %-12.0f\n", m, t, d, n / d }'
+}
+
+run_bench() {
+    printf "%-10s %-8s %-12s %-12s\n" "模式" "线程数" "耗时(s)" "文件/秒"
+    for threads in $THREAD_LIST; do
+        run_once "线程池" $threads ""
+        run_once "io_uring" $threads "-U"
+    done
+}
+
+main() {
+    if [ ! -x "$PROGRAM" ]; then
+        make
+    fi
+
+    create_small_files
+    run_bench
+
+    rm -rf "$BENCH_DIR"
+}
+
+main
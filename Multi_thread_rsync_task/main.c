@@ -1,32 +1,123 @@
 #include "sync_util.h"
+#include "watch.h"
 #include <getopt.h>
 
 void print_usage(const char *program_name) {
-    printf("÷: %s [ѡ] ԴĿ¼ ĿĿ¼\n", program_name);
-    printf("ѡ:\n");
-    printf("  -t NUM    ߳ (Ĭ: 4)\n");
-    printf("  -v        ϸ\n");
-    printf("  -n        ģʽʵʸļ\n");
-    printf("  -h        ʾϢ\n");
-    printf("\nʾ:\n");
+    printf("用法: %s [选项] 源目录 目标目录\n", program_name);
+    printf("选项:\n");
+    printf("  -t NUM    设置线程数 (默认: 4)\n");
+    printf("  -s NUM    设置扫描线程数 (默认: 2)\n");
+    printf("  -v        详细输出\n");
+    printf("  -n        干运行模式（不实际复制文件）\n");
+    printf("  -D        增量传输：目标已存在的大文件只改写变化的块\n");
+    printf("  -F        忽略目标目录中的清单 (%s)，逐个比较源和目标\n", MANIFEST_NAME);
+    printf("  -U        用 io_uring 异步复制小文件，内核不支持时自动改用普通复制\n");
+    printf("  -C MB     超过此大小的文件分块由多个线程并行复制 (默认: %d，0 表示不分块)\n",
+           CHUNK_THRESHOLD_MB);
+    printf("  -A        原子替换：先写同目录下的临时文件再改名覆盖目标（不做增量传输）\n");
+    printf("  -Y        原子替换并保证落盘：每批文件一次 syncfs，改名后每个目录 fsync 一次\n");
+    printf("  --delete  镜像模式：删除目标中源已不存在的文件和目录（-n 时只列出）\n");
+    printf("  -H        保留硬链接：同一 inode 的多个路径只复制一次，其余在目标中链接\n");
+    printf("  --dedup=clone|link\n");
+    printf("            内容相同的文件只复制第一个，其余用 reflink 克隆（不支持时照常复制）\n");
+    printf("            或硬链接到它（共用时间和权限，隐含 -A）\n");
+    printf("  --bwlimit=RATE      每秒最多读写的字节数，可带 K/M/G 后缀\n");
+    printf("  --iops=NUM          每秒最多的读写批次\n");
+    printf("  --max-latency=MS    单批写入延迟超过 MS 毫秒时自动降速，恢复后逐步加回\n");
+    printf("  --limit-file=FILE   从 FILE 读取限速 (bwlimit=10M iops=500 max-latency=50)，\n");
+    printf("                      文件修改或收到 SIGHUP 时在运行中重新读取\n");
+    printf("  --progress[=MS]     每隔 MS 毫秒 (默认 1000) 在标准错误输出进度：文件/秒、MB/秒、剩余时间\n");
+    printf("  --report=FILE       结束时把各阶段耗时和 open/stat/compare/copy/utimes 的延迟分布写成 JSON\n");
+    printf("  --checkpoint        记录断点日志 (%s)：已完成的文件和大文件分块分批落盘，\n", JOURNAL_NAME);
+    printf("                      中断后再次运行从未完成处继续（已有日志时总会使用）\n");
+    printf("  --watch[=MS]        初次同步后用 inotify 持续监视源目录，事件合并 MS 毫秒 (默认 %d)\n",
+           WATCH_DELAY_MS);
+    printf("                      后只同步改动过的路径；事件队列溢出时完整同步一次\n");
+    printf("  --daemon            以守护进程方式在后台持续同步 (隐含 --watch)，日志写入 syslog\n");
+    printf("  -h        显示帮助信息\n");
+    printf("\n示例:\n");
     printf("  %s -t 8 /path/to/source /path/to/target\n", program_name);
     printf("  %s -v -n /backup/src /backup/dst\n", program_name);
 }
 
+// 相对路径前面补上当前目录，结果写入 buf（可以与 path 相同）。失败返回 0
+static int absolute_path(const char *path, char *buf, size_t size) {
+    char cwd[MAX_PATH_LEN];
+    char tmp[MAX_PATH_LEN];
+    if (path[0] == '/') {
+        int n = snprintf(tmp, sizeof(tmp), "%s", path);
+        if (n < 0 || (size_t)n >= size) {
+            return 0;
+        }
+    } else {
+        if (!getcwd(cwd, sizeof(cwd))) {
+            return 0;
+        }
+        int n = snprintf(tmp, sizeof(tmp), "%s/%s", cwd, path);
+        if (n < 0 || (size_t)n >= sizeof(tmp) || (size_t)n >= size) {
+            return 0;
+        }
+    }
+    memcpy(buf, tmp, strlen(tmp) + 1);
+    return 1;
+}
+
 int main(int argc, char *argv[]) {
     sync_config_t config;
     config.thread_count = 4;
+    config.scan_threads = 2;
     config.verbose = 0;
     config.dry_run = 0;
+    config.delta = 0;
+    config.full_compare = 0;
+    config.uring = 0;
+    config.chunk_threshold = (off_t)CHUNK_THRESHOLD_MB * 1024 * 1024;
+    config.atomic = 0;
+    config.durable = 0;
+    config.delete_extra = 0;
+    config.hardlinks = 0;
+    config.dedup = DEDUP_OFF;
+    config.bwlimit = 0;
+    config.iops = 0;
+    config.max_latency_ms = 0;
+    config.limit_file = NULL;
+    config.progress_ms = 0;
+    config.report_path = NULL;
+    config.checkpoint = 0;
+    config.watch_ms = 0;
+    config.daemon = 0;
+    config.only_paths = NULL;
+    config.only_count = 0;
     
-    // в
+    // 解析命令行参数
     int opt;
-    while ((opt = getopt(argc, argv, "t:vnh")) != -1) {
+    static const struct option long_options[] = {
+        {"delete", no_argument, NULL, 'X'},
+        {"dedup", required_argument, NULL, 'Z'},
+        {"bwlimit", required_argument, NULL, 'B'},
+        {"iops", required_argument, NULL, 'I'},
+        {"max-latency", required_argument, NULL, 'L'},
+        {"limit-file", required_argument, NULL, 'W'},
+        {"progress", optional_argument, NULL, 'P'},
+        {"report", required_argument, NULL, 'R'},
+        {"checkpoint", no_argument, NULL, 'K'},
+        {"watch", optional_argument, NULL, 'O'},
+        {"daemon", no_argument, NULL, 'G'},
+        {NULL, 0, NULL, 0}
+    };
+    while ((opt = getopt_long(argc, argv, "t:s:vnDFUC:AYHh", long_options, NULL)) != -1) {
         switch (opt) {
             case 't':
                 config.thread_count = atoi(optarg);
                 if (config.thread_count <= 0 || config.thread_count > MAX_THREADS) {
-                    fprintf(stderr, ": ߳ 1-%d ֮\n", MAX_THREADS);
+                    fprintf(stderr, "错误: 线程数必须在 1-%d 之间\n", MAX_THREADS);
+                    return 1;
+                }
+                break;
+            case 's':
+                config.scan_threads = atoi(optarg);
+                if (config.scan_threads <= 0 || config.scan_threads > MAX_THREADS) {
+                    fprintf(stderr, "错误: 扫描线程数必须在 1-%d 之间\n", MAX_THREADS);
                     return 1;
                 }
                 break;
@@ -36,6 +127,91 @@ int main(int argc, char *argv[]) {
             case 'n':
                 config.dry_run = 1;
                 break;
+            case 'D':
+                config.delta = 1;
+                break;
+            case 'F':
+                config.full_compare = 1;
+                break;
+            case 'U':
+                config.uring = 1;
+                break;
+            case 'C':
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "错误: 分块阈值不能为负数\n");
+                    return 1;
+                }
+                config.chunk_threshold = (off_t)atoi(optarg) * 1024 * 1024;
+                break;
+            case 'A':
+                config.atomic = 1;
+                break;
+            case 'Y':
+                config.durable = 1;
+                break;
+            case 'X':
+                config.delete_extra = 1;
+                break;
+            case 'H':
+                config.hardlinks = 1;
+                break;
+            case 'Z':
+                if (strcmp(optarg, "clone") == 0) {
+                    config.dedup = DEDUP_CLONE;
+                } else if (strcmp(optarg, "link") == 0) {
+                    config.dedup = DEDUP_LINK;
+                } else {
+                    fprintf(stderr, "错误: 去重方式必须是 clone 或 link\n");
+                    return 1;
+                }
+                break;
+            case 'B':
+                config.bwlimit = throttle_parse_size(optarg);
+                if (config.bwlimit < 0) {
+                    fprintf(stderr, "错误: 无效的带宽限制: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'I':
+                config.iops = atoll(optarg);
+                if (config.iops < 0) {
+                    fprintf(stderr, "错误: 每秒批次数不能为负数\n");
+                    return 1;
+                }
+                break;
+            case 'L':
+                config.max_latency_ms = atoi(optarg);
+                if (config.max_latency_ms < 0) {
+                    fprintf(stderr, "错误: 延迟阈值不能为负数\n");
+                    return 1;
+                }
+                break;
+            case 'W':
+                config.limit_file = optarg;
+                break;
+            case 'P':
+                config.progress_ms = optarg ? atoi(optarg) : 1000;
+                if (config.progress_ms <= 0) {
+                    fprintf(stderr, "错误: 进度间隔必须大于 0\n");
+                    return 1;
+                }
+                break;
+            case 'R':
+                config.report_path = optarg;
+                break;
+            case 'K':
+                config.checkpoint = 1;
+                break;
+            case 'O':
+                config.watch_ms = optarg ? atoi(optarg) : WATCH_DELAY_MS;
+                if (config.watch_ms <= 0) {
+                    fprintf(stderr, "错误: 事件合并窗口必须大于 0\n");
+                    return 1;
+                }
+                break;
+            case 'G':
+                config.daemon = 1;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -46,20 +222,20 @@ int main(int argc, char *argv[]) {
     }
     
     if (optind + 2 != argc) {
-        fprintf(stderr, ": ҪָԴĿ¼ĿĿ¼\n");
+        fprintf(stderr, "错误: 需要指定源目录和目标目录\n");
         print_usage(argv[0]);
         return 1;
     }
     
-    // Ŀ¼·
+    // 处理目录路径
     const char *source_dir = argv[optind];
     const char *target_dir = argv[optind + 1];
     
-    // ȷĿ¼ʽȷ
+    // 确保目录格式正确
     snprintf(config.source_dir, sizeof(config.source_dir), "%s", source_dir);
     snprintf(config.target_dir, sizeof(config.target_dir), "%s", target_dir);
     
-    // Ƴĩβ/
+    // 移除末尾的/
     size_t source_len = strlen(config.source_dir);
     if (source_len > 0 && config.source_dir[source_len - 1] == '/') {
         config.source_dir[source_len - 1] = '\0';
@@ -70,9 +246,43 @@ int main(int argc, char *argv[]) {
         config.target_dir[target_len - 1] = '\0';
     }
     
-    // ִͬ
+    // 持续同步
+    if (config.watch_ms > 0 || config.daemon) {
+        if (config.dry_run) {
+            fprintf(stderr, "错误: 持续同步不能与 -n 一起使用\n");
+            return 1;
+        }
+        if (config.watch_ms == 0) {
+            config.watch_ms = WATCH_DELAY_MS;
+        }
+        if (config.daemon) {
+            // 守护进程的工作目录是根目录，先把相对路径都转成绝对路径
+            static char limit_file[MAX_PATH_LEN];
+            static char report_path[MAX_PATH_LEN];
+            if (!absolute_path(config.source_dir, config.source_dir, sizeof(config.source_dir)) ||
+                !absolute_path(config.target_dir, config.target_dir, sizeof(config.target_dir)) ||
+                (config.limit_file &&
+                 !absolute_path(config.limit_file, limit_file, sizeof(limit_file))) ||
+                (config.report_path &&
+                 !absolute_path(config.report_path, report_path, sizeof(report_path)))) {
+                fprintf(stderr, "错误: 路径过长或无法获取当前目录\n");
+                return 1;
+            }
+            if (config.limit_file) {
+                config.limit_file = limit_file;
+            }
+            if (config.report_path) {
+                config.report_path = report_path;
+            }
+            const char *cmd = strrchr(argv[0], '/');
+            daemonize(cmd ? cmd + 1 : argv[0]);
+        }
+        return watch_sync(&config) ? 0 : 1;
+    }
+    
+    // 执行同步
     if (!perform_sync(&config)) {
-        fprintf(stderr, "ͬʧ\n");
+        fprintf(stderr, "同步失败\n");
         return 1;
     }
     
@@ -0,0 +1,749 @@
+#define _GNU_SOURCE
+#include "scan.h"
+#include "sched.h"
+#include <limits.h>
+
+// 创建目录节点，引用计数初始为 1（由扫描线程持有）
+// parent 为空时 name 是源根目录
+dir_node_t* dir_node_new(const dir_node_t *parent, const char *name) {
+    dir_node_t *node = calloc(1, sizeof(dir_node_t));
+    if (!node) {
+        perror("calloc failed");
+        exit(1);
+    }
+    if (parent) {
+        size_t len = strlen(parent->source_path) + 1 + strlen(name) + 1;
+        node->source_path = malloc(len);
+        if (node->source_path) {
+            snprintf(node->source_path, len, "%s/%s", parent->source_path, name);
+        }
+        node->rel_off = parent->rel_off + (parent->source_path[parent->rel_off] == '\0');
+    } else {
+        node->source_path = strdup(name);
+        node->rel_off = strlen(name);
+    }
+    if (!node->source_path) {
+        perror("malloc failed");
+        exit(1);
+    }
+    node->refcount = 1;
+    return node;
+}
+
+// 把文件名存入目录节点的名字区，返回存放地址
+const char* dir_node_add_name(dir_node_t *node, const char *name, size_t len) {
+    name_block_t *block = node->names;
+    if (!block || block->used + len + 1 > block->capacity) {
+        // 块从 256 字节开始按倍数增长，文件少的目录只占很少内存
+        size_t capacity = block ? block->capacity * 2 : 256;
+        if (capacity > 65536) {
+            capacity = 65536;
+        }
+        if (capacity < len + 1) {
+            capacity = len + 1;
+        }
+        block = malloc(sizeof(name_block_t) + capacity);
+        if (!block) {
+            perror("malloc failed");
+            exit(1);
+        }
+        block->next = node->names;
+        block->used = 0;
+        block->capacity = capacity;
+        node->names = block;
+    }
+
+    char *p = block->data + block->used;
+    memcpy(p, name, len);
+    p[len] = '\0';
+    block->used += len + 1;
+    return p;
+}
+
+// 相对源根目录的路径，根目录为空串
+const char* dir_node_rel(const dir_node_t *node) {
+    return node->source_path + node->rel_off;
+}
+
+// 拼出对应的目标目录路径，路径过长时返回 0
+int dir_node_target(const dir_node_t *node, const char *target_dir, char *buf, size_t size) {
+    const char *rel = dir_node_rel(node);
+    int n = snprintf(buf, size, "%s%s%s", target_dir, *rel ? "/" : "", rel);
+    return n >= 0 && (size_t)n < size;
+}
+
+// 第一次往目录里放文件时才创建目标目录
+// 多个线程同时创建没有关系，create_directory 会忽略 EEXIST
+int dir_node_ensure(dir_node_t *node, const char *target_dir) {
+    if (__atomic_load_n(&node->created, __ATOMIC_ACQUIRE)) {
+        return 1;
+    }
+    char path[MAX_PATH_LEN];
+    if (!dir_node_target(node, target_dir, path, sizeof(path)) || !create_directory(path)) {
+        return 0;
+    }
+    __atomic_store_n(&node->created, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// 释放一个引用，最后一个引用释放时回收节点和其中的文件名
+void dir_node_release(dir_node_t *node) {
+    if (__atomic_sub_fetch(&node->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        name_block_t *block = node->names;
+        while (block) {
+            name_block_t *next = block->next;
+            free(block);
+            block = next;
+        }
+        free(node->source_path);
+        free(node);
+    }
+}
+
+static void name_list_add(name_list_t *list, const char *name, unsigned char type) {
+    size_t len = strlen(name) + 1;
+    if (list->len + len > list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 4096;
+        while (list->cap < list->len + len) {
+            list->cap *= 2;
+        }
+        list->buf = realloc(list->buf, list->cap);
+        if (!list->buf) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->offs = realloc(list->offs, list->capacity * sizeof(size_t));
+        list->types = realloc(list->types, list->capacity);
+        if (!list->offs || !list->types) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    memcpy(list->buf + list->len, name, len);
+    list->offs[list->count] = list->len;
+    list->types[list->count] = type;
+    list->count++;
+    list->len += len;
+}
+
+static void name_list_free(name_list_t *list) {
+    free(list->buf);
+    free(list->offs);
+    free(list->types);
+    memset(list, 0, sizeof(*list));
+}
+
+// 排序用：按名字比较下标，比较函数拿不到缓冲区，经由线程变量传入
+static __thread const name_list_t *sort_list;
+
+static int name_index_cmp(const void *a, const void *b) {
+    const char *buf = sort_list->buf;
+    const size_t *offs = sort_list->offs;
+    return strcmp(buf + offs[*(const int *)a], buf + offs[*(const int *)b]);
+}
+
+// 返回按名字排好序的下标数组
+static int* name_list_sorted(const name_list_t *list) {
+    int *order = malloc((list->count + 1) * sizeof(int));
+    if (!order) {
+        perror("malloc failed");
+        exit(1);
+    }
+    for (int i = 0; i < list->count; i++) {
+        order[i] = i;
+    }
+    sort_list = list;
+    qsort(order, list->count, sizeof(int), name_index_cmp);
+    return order;
+}
+
+// 在排好序的名字中二分查找
+static int name_list_contains(const name_list_t *list, const int *order, const char *name) {
+    int lo = 0, hi = list->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int c = strcmp(list->buf + list->offs[order[mid]], name);
+        if (c == 0) {
+            return 1;
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return 0;
+}
+
+// 删除目标中的整个目录：只按 d_type 判断类型，不知道时才 fstatat
+static int remove_tree(int parent_fd, const char *name) {
+    int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (fd < 0) {
+        return -1;
+    }
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return -1;
+    }
+    int rc = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        int is_dir = entry->d_type == DT_DIR;
+        struct stat st;
+        if (entry->d_type == DT_UNKNOWN &&
+            fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            is_dir = S_ISDIR(st.st_mode);
+        }
+        if (is_dir ? remove_tree(fd, entry->d_name) != 0
+                   : unlinkat(fd, entry->d_name, 0) != 0) {
+            rc = -1;
+        }
+    }
+    closedir(dir);
+    if (rc == 0 && unlinkat(parent_fd, name, AT_REMOVEDIR) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+// 目标中不能删除的条目：根目录下的清单，以及本次同步正在写入的临时文件
+static int keep_target_entry(const dir_node_t *node, const name_list_t *source, const int *order,
+                             const char *name) {
+    if (*dir_node_rel(node) == '\0' &&
+        strncmp(name, MANIFEST_NAME, sizeof(MANIFEST_NAME) - 1) == 0) {
+        return 1;
+    }
+    char base[NAME_MAX + 1];
+    return atomic_temp_base(name, base, sizeof(base)) && name_list_contains(source, order, base);
+}
+
+// 镜像模式：把源目录的条目名与目标目录的列表分别排序后合并比较，
+// 只读目标目录，不 stat 目标中的文件；源中没有的条目相对目标目录 fd 一起删除
+static void mirror_dir(scanner_t *scanner, scan_slot_t *slot, dir_node_t *node) {
+    const sync_config_t *config = scanner->config;
+    name_list_t *source = &slot->names;
+    name_list_t *target = &slot->target;
+    char path[MAX_PATH_LEN];
+    if (!dir_node_target(node, config->target_dir, path, sizeof(path))) {
+        return;
+    }
+    DIR *dir = opendir(path);
+    if (!dir) {
+        // 目标目录还不存在，源中的条目都要新建
+        __atomic_add_fetch(&scanner->targets_missing, source->count, __ATOMIC_RELAXED);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            name_list_add(target, entry->d_name, entry->d_type);
+        }
+    }
+
+    int *src_order = name_list_sorted(source);
+    int *dst_order = name_list_sorted(target);
+    int missing = 0, present = 0, deleted = 0;
+    int i = 0, j = 0;
+    while (i < source->count || j < target->count) {
+        const char *src_name = i < source->count ? source->buf + source->offs[src_order[i]] : NULL;
+        const char *dst_name = j < target->count ? target->buf + target->offs[dst_order[j]] : NULL;
+        int c = !dst_name ? -1 : !src_name ? 1 : strcmp(src_name, dst_name);
+        if (c < 0) {
+            missing++;
+            i++;
+            continue;
+        }
+        if (c == 0) {
+            present++;
+            i++;
+            j++;
+            continue;
+        }
+        // 只在目标中存在
+        j++;
+        if (keep_target_entry(node, source, src_order, dst_name)) {
+            continue;
+        }
+        if (config->dry_run) {
+            printf("干运行: 删除 %s/%s\n", path, dst_name);
+            deleted++;
+            continue;
+        }
+        unsigned char type = target->types[dst_order[j - 1]];
+        struct stat st;
+        if (type == DT_UNKNOWN && fstatat(dirfd(dir), dst_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        }
+        if (type == DT_DIR ? remove_tree(dirfd(dir), dst_name) != 0
+                           : unlinkat(dirfd(dir), dst_name, 0) != 0) {
+            fprintf(stderr, "无法删除: %s/%s (%s)\n", path, dst_name, strerror(errno));
+            continue;
+        }
+        if (config->verbose) {
+            printf("删除: %s/%s\n", path, dst_name);
+        }
+        deleted++;
+    }
+    closedir(dir);
+    free(src_order);
+    free(dst_order);
+
+    __atomic_add_fetch(&scanner->targets_missing, missing, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&scanner->targets_present, present, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&scanner->targets_deleted, deleted, __ATOMIC_RELAXED);
+}
+
+static size_t link_hash(dev_t dev, ino_t ino) {
+    uint64_t h = ((uint64_t)dev * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)ino;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    return (size_t)(h ^ (h >> 32));
+}
+
+// 组数超过桶数时桶数翻倍，调用时持有 link_lock
+static void link_table_grow(scanner_t *scanner) {
+    size_t buckets = scanner->links ? (scanner->link_mask + 1) * 2 : 1024;
+    link_group_t **table = calloc(buckets, sizeof(link_group_t *));
+    if (!table) {
+        perror("calloc failed");
+        exit(1);
+    }
+    for (size_t i = 0; scanner->links && i <= scanner->link_mask; i++) {
+        link_group_t *g = scanner->links[i];
+        while (g) {
+            link_group_t *next = g->next;
+            size_t b = link_hash(g->dev, g->ino) & (buckets - 1);
+            g->next = table[b];
+            table[b] = g;
+            g = next;
+        }
+    }
+    free(scanner->links);
+    scanner->links = table;
+    scanner->link_mask = buckets - 1;
+}
+
+// 记下一个链接数大于 1 的文件。同一 inode 第一次出现时建组并返回 0，照常提交；
+// 之后出现的路径挂到组里，返回 1，不再提交
+static int link_note(scanner_t *scanner, const walk_entry_t *entry, const struct stat *st) {
+    pthread_mutex_lock(&scanner->link_lock);
+    if (!scanner->links || scanner->link_groups > scanner->link_mask) {
+        link_table_grow(scanner);
+    }
+    size_t b = link_hash(st->st_dev, st->st_ino) & scanner->link_mask;
+    link_group_t *g = scanner->links[b];
+    while (g && (g->dev != st->st_dev || g->ino != st->st_ino)) {
+        g = g->next;
+    }
+
+    int follower = g != NULL;
+    if (!g) {
+        g = malloc(sizeof(link_group_t) + entry->path_len + 1);
+        if (!g) {
+            perror("malloc failed");
+            exit(1);
+        }
+        g->dev = st->st_dev;
+        g->ino = st->st_ino;
+        g->size = st->st_size;
+        g->paths = NULL;
+        memcpy(g->rel, entry->path, entry->path_len + 1);
+        g->next = scanner->links[b];
+        scanner->links[b] = g;
+        scanner->link_groups++;
+    } else {
+        link_path_t *p = malloc(sizeof(link_path_t) + entry->path_len + 1);
+        if (!p) {
+            perror("malloc failed");
+            exit(1);
+        }
+        memset(&p->entry, 0, sizeof(p->entry));
+        p->entry.ino = st->st_ino;
+        p->entry.size = st->st_size;
+        p->entry.mtime_ns = timespec_ns(&st->st_mtim);
+        p->entry.ctime_ns = timespec_ns(&st->st_ctim);
+        memcpy(p->rel, entry->path, entry->path_len + 1);
+        p->next = g->paths;
+        g->paths = p;
+    }
+    pthread_mutex_unlock(&scanner->link_lock);
+    return follower;
+}
+
+// 扫描一个目录项：子目录建立节点，文件按批提交给调度器
+// readdir 已给出类型的目录不再 stat，其余条目由 walk_tree 相对目录 fd 只 fstatat 一次；
+// 与清单记录完全相同、或断点日志中已完成的文件直接记入新清单，不再提交
+static int scan_entry(void *ctx, const walk_entry_t *entry, void **child) {
+    scanner_t *scanner = ctx;
+    scan_slot_t *slot = &scanner->slots[entry->thread];
+    dir_node_t *node = entry->dir_data;
+
+    // 只遍历一棵子树时 walk_tree 给出的路径相对子树根，补成相对源根目录的路径
+    char full[MAX_PATH_LEN];
+    walk_entry_t rebased;
+    if (scanner->prefix) {
+        rebased = *entry;
+        int n = snprintf(full, sizeof(full), "%s/%s", scanner->prefix, entry->path);
+        rebased.path = full;
+        rebased.path_len = n < 0 ? sizeof(full) : (size_t)n;
+        entry = &rebased;
+    }
+
+    // 镜像模式记下所有条目名，包括跳过的，目标中同名的条目不删除
+    if (scanner->config->delete_extra) {
+        name_list_add(&slot->names, entry->name, 0);
+    }
+    if (entry->type == WALK_NS) {
+        fprintf(stderr, "无法获取文件信息: %s/%s\n", node->source_path, entry->name);
+        return WALK_CONTINUE;
+    }
+    if (entry->type == WALK_D) {
+        // 包括指向目录的符号链接
+        *child = dir_node_new(node, entry->name);
+        slot->subdirs++;
+        return WALK_CONTINUE;
+    }
+    const struct stat *st = entry->st;
+    if (!S_ISREG(st->st_mode)) {
+        fprintf(stderr, "跳过非普通文件: %s/%s\n", node->source_path, entry->name);
+        return WALK_CONTINUE;
+    }
+    if (entry->path_len >= MAX_PATH_LEN) {
+        fprintf(stderr, "路径过长: %s/%s\n", node->source_path, entry->name);
+        return WALK_CONTINUE;
+    }
+    // 同一 inode 的其余路径等全部复制完再链接，清单也在链接时记录
+    if (scanner->config->hardlinks && st->st_nlink > 1 && link_note(scanner, entry, st)) {
+        slot->files++;
+        return WALK_CONTINUE;
+    }
+
+    file_info_t *file = &slot->batch[slot->nbatch];
+    file->size = st->st_size;
+    file->mode = st->st_mode;
+    file->ino = st->st_ino;
+    file->atime_ns = timespec_ns(&st->st_atim);
+    file->mtime_ns = timespec_ns(&st->st_mtim);
+    file->ctime_ns = timespec_ns(&st->st_ctim);
+    file->content_hash = 0;
+    file->chunk = NULL;
+    slot->files++;
+
+    const manifest_entry_t *known = manifest_lookup(scanner->manifest, entry->path, entry->path_len);
+    if (known && known->ino == file->ino && known->size == st->st_size) {
+        if (known->mtime_ns == file->mtime_ns && known->ctime_ns == file->ctime_ns) {
+            if (!scanner->config->dry_run) {
+                manifest_builder_add(&scanner->builders[entry->thread], entry->path,
+                                     entry->path_len, known);
+            }
+            slot->unchanged++;
+            return WALK_CONTINUE;
+        }
+        file->content_hash = known->content_hash;
+    }
+    if (scanner->resume) {
+        journal_record_t key;
+        memset(&key, 0, sizeof(key));
+        key.path_hash = journal_path_hash(entry->path, entry->path_len);
+        key.ino = file->ino;
+        key.size = file->size;
+        key.mtime_ns = file->mtime_ns;
+        key.ctime_ns = file->ctime_ns;
+        const journal_record_t *done = journal_find(scanner->resume, &key);
+        if (done) {
+            manifest_entry_t resumed;
+            memset(&resumed, 0, sizeof(resumed));
+            resumed.ino = done->ino;
+            resumed.size = done->size;
+            resumed.mtime_ns = done->mtime_ns;
+            resumed.ctime_ns = done->ctime_ns;
+            resumed.content_hash = done->content_hash;
+            manifest_builder_add(&scanner->builders[entry->thread], entry->path,
+                                 entry->path_len, &resumed);
+            slot->resumed++;
+            return WALK_CONTINUE;
+        }
+    }
+
+    slot->nbatch++;
+    slot->queued++;
+    slot->queued_bytes += file->size;
+    file->needs_sync = 1;
+    file->dir = node;
+    file->name = dir_node_add_name(node, entry->name, strlen(entry->name));
+    __atomic_add_fetch(&node->refcount, 1, __ATOMIC_RELAXED);
+
+    if (slot->nbatch == SCHED_CHUNK) {
+        sched_submit(scanner->sched, slot->batch, slot->nbatch);
+        slot->nbatch = 0;
+    }
+    return WALK_CONTINUE;
+}
+
+// 已提交的文件计入统计，清空扫描线程的积累以便处理下一个目录
+static void slot_flush(scanner_t *scanner, scan_slot_t *slot) {
+    __atomic_add_fetch(&scanner->files_found, slot->files, __ATOMIC_RELAXED);
+    metrics_add_found(slot->queued, slot->queued_bytes);
+    __atomic_add_fetch(&scanner->files_unchanged, slot->unchanged, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&scanner->files_resumed, slot->resumed, __ATOMIC_RELAXED);
+    slot->nbatch = 0;
+    slot->files = 0;
+    slot->unchanged = 0;
+    slot->resumed = 0;
+    slot->subdirs = 0;
+    slot->queued = 0;
+    slot->queued_bytes = 0;
+    slot->names.len = slot->names.count = 0;
+    slot->target.len = slot->target.count = 0;
+}
+
+// 一个目录读完：提交剩余的文件，让工作线程尽早开始，并释放扫描线程持有的节点引用
+static void scan_dir_done(void *ctx, const walk_entry_t *dir) {
+    scanner_t *scanner = ctx;
+    scan_slot_t *slot = &scanner->slots[dir->thread];
+    dir_node_t *node = dir->dir_data;
+
+    sched_submit(scanner->sched, slot->batch, slot->nbatch);
+    if (dir->type == WALK_DNR) {
+        fprintf(stderr, "无法打开目录: %s\n", node->source_path);
+    } else {
+        // 空目录不会有文件触发创建，在这里直接创建
+        if (slot->files == 0 && slot->subdirs == 0 && !scanner->config->dry_run) {
+            if (!dir_node_ensure(node, scanner->config->target_dir)) {
+                fprintf(stderr, "无法创建目录: %s\n", dir_node_rel(node));
+            }
+        }
+        // 源目录读不全时不知道哪些条目已删除，只在完整读完时比较
+        if (scanner->config->delete_extra) {
+            mirror_dir(scanner, slot, node);
+        }
+        __atomic_add_fetch(&scanner->dirs_found, 1, __ATOMIC_RELAXED);
+    }
+
+    slot_flush(scanner, slot);
+    dir_node_release(node);
+}
+
+// 源中已不存在的路径：镜像模式下从目标删除
+static void scan_removed(scanner_t *scanner, const char *rel) {
+    const sync_config_t *config = scanner->config;
+    char path[MAX_PATH_LEN];
+    int n = snprintf(path, sizeof(path), "%s/%s", config->target_dir, rel);
+    struct stat st;
+    if (!config->delete_extra || n <= 0 || n >= (int)sizeof(path) || lstat(path, &st) != 0) {
+        return;
+    }
+    if (config->dry_run) {
+        printf("干运行: 删除 %s\n", path);
+    } else if (S_ISDIR(st.st_mode) ? remove_tree(AT_FDCWD, path) != 0 : unlink(path) != 0) {
+        fprintf(stderr, "无法删除: %s (%s)\n", path, strerror(errno));
+        return;
+    } else if (config->verbose) {
+        printf("删除: %s\n", path);
+    }
+    scanner->targets_deleted++;
+}
+
+// 只扫描 config->only_paths 列出的路径：目录遍历整棵子树，文件单独提交，
+// 源中已不存在的按镜像模式处理。列表中不应有互为祖先的路径
+static void scan_paths(scanner_t *scanner, dir_node_t *root, const walk_options_t *opts) {
+    const sync_config_t *config = scanner->config;
+    scan_slot_t *slot = &scanner->slots[0];
+    for (int i = 0; i < config->only_count; i++) {
+        const char *rel = config->only_paths[i];
+        char path[MAX_PATH_LEN];
+        int n = snprintf(path, sizeof(path), "%s/%s", config->source_dir, rel);
+        if (n <= 0 || n >= (int)sizeof(path)) {
+            fprintf(stderr, "路径过长: %s\n", rel);
+            continue;
+        }
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            if (errno == ENOENT) {
+                scan_removed(scanner, rel);
+            } else {
+                fprintf(stderr, "无法获取文件信息: %s\n", path);
+            }
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            dir_node_t *node = dir_node_new(root, rel);
+            scanner->prefix = rel;
+            if (walk_tree(node->source_path, node, opts) != 0) {
+                fprintf(stderr, "无法打开目录: %s\n", node->source_path);
+                dir_node_release(node);
+            }
+            scanner->prefix = NULL;
+            continue;
+        }
+
+        // 单个文件：放进所在目录的节点，像遍历时一样交给 scan_entry，但不做目录级的镜像比较
+        const char *slash = strrchr(rel, '/');
+        char dir_rel[MAX_PATH_LEN];
+        snprintf(dir_rel, sizeof(dir_rel), "%.*s", slash ? (int)(slash - rel) : 0, rel);
+        dir_node_t *node = *dir_rel ? dir_node_new(root, dir_rel) : root;
+        walk_entry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.dir_fd = -1;
+        entry.name = slash ? slash + 1 : rel;
+        entry.path = rel;
+        entry.path_len = strlen(rel);
+        entry.st = &st;
+        entry.type = WALK_F;
+        entry.dir_data = node;
+        void *child = NULL;
+        scan_entry(scanner, &entry, &child);
+        sched_submit(scanner->sched, slot->batch, slot->nbatch);
+        slot_flush(scanner, slot);
+        if (node != root) {
+            dir_node_release(node);
+        }
+    }
+}
+
+// 扫描整棵源目录树，返回找到的文件数
+int scan_tree(scanner_t *scanner, const sync_config_t *config, scheduler_t *sched,
+              const manifest_t *manifest, const journal_index_t *resume) {
+    memset(scanner, 0, sizeof(*scanner));
+    scanner->config = config;
+    scanner->sched = sched;
+    scanner->manifest = manifest;
+    scanner->resume = resume;
+    scanner->builder_count = config->scan_threads;
+    scanner->builders = calloc(config->scan_threads, sizeof(manifest_builder_t));
+    scanner->slots = calloc(config->scan_threads, sizeof(scan_slot_t));
+    if (!scanner->builders || !scanner->slots) {
+        perror("calloc failed");
+        exit(1);
+    }
+    pthread_mutex_init(&scanner->link_lock, NULL);
+    manifest_builder_init(&scanner->link_manifest);
+
+    dir_node_t *root = dir_node_new(NULL, config->source_dir);
+    root->created = !config->dry_run;   // 根目录已由 perform_sync 创建
+
+    // 源目录的符号链接照常跟随
+    walk_options_t opts = {scan_entry, scan_dir_done, scanner, config->scan_threads, WALK_FOLLOW};
+    if (config->only_count > 0) {
+        scan_paths(scanner, root, &opts);
+        dir_node_release(root);
+    } else {
+        walk_tree(config->source_dir, root, &opts);
+    }
+
+    for (int i = 0; i < config->scan_threads; i++) {
+        name_list_free(&scanner->slots[i].names);
+        name_list_free(&scanner->slots[i].target);
+    }
+    free(scanner->slots);
+    scanner->slots = NULL;
+    return scanner->files_found;
+}
+
+// 把 path 链接到 leader，目标中已有的文件用改名原子替换。成功返回 1
+static int link_target(const char *leader, const char *path) {
+    char temp[MAX_PATH_LEN];
+    if (atomic_temp_name(path, temp, sizeof(temp)) != 0 ||
+        linkat(AT_FDCWD, leader, AT_FDCWD, temp, 0) != 0) {
+        return 0;
+    }
+    if (rename(temp, path) != 0) {
+        int saved_errno = errno;
+        unlink(temp);
+        errno = saved_errno;
+        return 0;
+    }
+    return 1;
+}
+
+// 工作线程全部结束后调用，第一个路径的目标文件这时已经复制好
+void scan_link_paths(scanner_t *scanner) {
+    const sync_config_t *config = scanner->config;
+    char leader[MAX_PATH_LEN];
+    char path[MAX_PATH_LEN];
+    for (size_t b = 0; scanner->links && b <= scanner->link_mask; b++) {
+        for (link_group_t *g = scanner->links[b]; g; g = g->next) {
+            if (!g->paths) {
+                continue;
+            }
+            struct stat leader_stat;
+            int n = snprintf(leader, sizeof(leader), "%s/%s", config->target_dir, g->rel);
+            int leader_ok = n > 0 && n < (int)sizeof(leader) && stat(leader, &leader_stat) == 0;
+            for (link_path_t *p = g->paths; p; p = p->next) {
+                n = snprintf(path, sizeof(path), "%s/%s", config->target_dir, p->rel);
+                if (n <= 0 || n >= (int)sizeof(path)) {
+                    fprintf(stderr, "路径过长: %s\n", p->rel);
+                    scanner->link_errors++;
+                    continue;
+                }
+                if (config->dry_run) {
+                    printf("干运行: 硬链接 %s => %s\n", p->rel, g->rel);
+                    continue;
+                }
+                if (!leader_ok) {
+                    fprintf(stderr, "无法创建硬链接: %s (第一个路径 %s 未同步)\n", p->rel, g->rel);
+                    scanner->link_errors++;
+                    continue;
+                }
+
+                struct stat st;
+                if (lstat(path, &st) == 0 && st.st_dev == leader_stat.st_dev &&
+                    st.st_ino == leader_stat.st_ino) {
+                    scanner->links_existing++;
+                } else {
+                    // 目录中只有链接路径时还没有人创建目标目录
+                    char *slash = strrchr(path, '/');
+                    *slash = '\0';
+                    int dir_ok = create_directory(path);
+                    *slash = '/';
+                    if (!dir_ok || !link_target(leader, path)) {
+                        fprintf(stderr, "无法创建硬链接: %s (%s)\n", p->rel, strerror(errno));
+                        scanner->link_errors++;
+                        continue;
+                    }
+                    scanner->links_created++;
+                    scanner->link_bytes += g->size;
+                    if (config->verbose) {
+                        printf("硬链接: %s => %s\n", p->rel, g->rel);
+                    }
+                }
+                manifest_builder_add(&scanner->link_manifest, p->rel, strlen(p->rel), &p->entry);
+            }
+        }
+    }
+}
+
+// 释放扫描线程积累的清单记录和硬链接组
+void scan_free(scanner_t *scanner) {
+    for (int i = 0; i < scanner->builder_count; i++) {
+        manifest_builder_free(&scanner->builders[i]);
+    }
+    free(scanner->builders);
+    scanner->builders = NULL;
+    manifest_builder_free(&scanner->link_manifest);
+    for (size_t b = 0; scanner->links && b <= scanner->link_mask; b++) {
+        link_group_t *g = scanner->links[b];
+        while (g) {
+            link_group_t *next = g->next;
+            link_path_t *p = g->paths;
+            while (p) {
+                link_path_t *pn = p->next;
+                free(p);
+                p = pn;
+            }
+            free(g);
+            g = next;
+        }
+    }
+    free(scanner->links);
+    scanner->links = NULL;
+    pthread_mutex_destroy(&scanner->link_lock);
+}
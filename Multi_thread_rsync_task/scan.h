@@ -0,0 +1,96 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "sync_util.h"
+#include "sched.h"
+#include "walk.h"
+
+// 一组名字，存放在连续的缓冲区中，用于镜像模式合并比较
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t *offs;
+    unsigned char *types;     // 目标目录项的 d_type
+    int count;
+    int capacity;
+} name_list_t;
+
+// 扫描线程正在处理的目录中积累的结果，目录读完时提交
+typedef struct {
+    file_info_t batch[SCHED_CHUNK];
+    int nbatch;
+    int files;
+    int unchanged;
+    int resumed;
+    int subdirs;
+    int queued;               // 提交给工作线程的文件数和字节数，用于进度统计
+    off_t queued_bytes;
+    name_list_t names;        // --delete：本目录源中的全部条目名
+    name_list_t target;       // --delete：对应目标目录的条目
+} scan_slot_t;
+
+// -H：源中链接数大于 1 的 inode，第一个扫描到的路径照常复制，
+// 其余路径不提交，全部复制完后在目标中用硬链接重建
+typedef struct link_path {
+    struct link_path *next;
+    manifest_entry_t entry;   // 链接成功后记入清单
+    char rel[];
+} link_path_t;
+
+typedef struct link_group {
+    struct link_group *next;  // 同一哈希桶
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    link_path_t *paths;       // 需要链接到第一个路径的其余路径
+    char rel[];               // 第一个路径，照常复制
+} link_group_t;
+
+// 扫描器：多个扫描线程（walk_tree）边遍历边把文件提交给调度器
+typedef struct {
+    const sync_config_t *config;
+    scheduler_t *sched;
+    const manifest_t *manifest;    // 上次同步的清单，与之相同的文件不再提交
+    const journal_index_t *resume; // 上次中断时的断点日志，其中已完成的文件也不再提交
+    const char *prefix;            // 正在遍历的子树相对源根目录的路径，遍历整棵树时为 NULL
+    manifest_builder_t *builders;  // 每个扫描线程一个，记录未变化的文件
+    int builder_count;
+    scan_slot_t *slots;            // 每个扫描线程一个
+    int files_found;
+    int dirs_found;
+    int files_unchanged;
+    int files_resumed;
+    int targets_missing;      // --delete：合并比较时目标中没有的源条目
+    int targets_present;      // 两边都有的条目
+    int targets_deleted;      // 源中已不存在、从目标删除的条目
+    link_group_t **links;     // -H：按 (dev, ino) 分桶的硬链接组
+    size_t link_mask;
+    size_t link_groups;
+    pthread_mutex_t link_lock;
+    int links_created;        // 在目标中新建的硬链接
+    int links_existing;       // 目标中已经是同一文件的路径
+    int link_errors;
+    off_t link_bytes;         // 硬链接省去复制的字节数
+    manifest_builder_t link_manifest;   // 链接成功的路径
+} scanner_t;
+
+// 目录节点
+dir_node_t* dir_node_new(const dir_node_t *parent, const char *name);
+const char* dir_node_add_name(dir_node_t *node, const char *name, size_t len);
+const char* dir_node_rel(const dir_node_t *node);
+int dir_node_target(const dir_node_t *node, const char *target_dir, char *buf, size_t size);
+int dir_node_ensure(dir_node_t *node, const char *target_dir);
+void dir_node_release(dir_node_t *node);
+
+// 扫描整棵源目录树，返回找到的文件数
+// manifest 可以为空清单，resume 可以为 NULL；扫描结束后 builders 留给调用者写入新清单。
+// config->only_count 大于 0 时只扫描其中列出的路径
+int scan_tree(scanner_t *scanner, const sync_config_t *config, scheduler_t *sched,
+              const manifest_t *manifest, const journal_index_t *resume);
+
+// 工作线程全部结束后，把每组硬链接的其余路径链接到第一个路径的目标文件
+void scan_link_paths(scanner_t *scanner);
+void scan_free(scanner_t *scanner);
+
+#endif
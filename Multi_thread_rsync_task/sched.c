@@ -0,0 +1,258 @@
+#include "sched.h"
+
+// 持有 dq->lock 时修改 head/tail/bytes；其他线程会不加锁读取这些字段
+static void deque_set(work_deque_t *dq, int head, int tail, off_t bytes) {
+    __atomic_store_n(&dq->head, head, __ATOMIC_RELAXED);
+    __atomic_store_n(&dq->tail, tail, __ATOMIC_RELAXED);
+    __atomic_store_n(&dq->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+// 保证队列至少能再容纳 n 个任务
+static void deque_reserve(work_deque_t *dq, int n) {
+    if (dq->head > 0 && dq->head == dq->tail) {
+        deque_set(dq, 0, 0, dq->bytes);
+    }
+    if (dq->tail + n <= dq->capacity) {
+        return;
+    }
+
+    // 先把有效部分挪到数组开头，仍不够再扩容
+    int live = dq->tail - dq->head;
+    if (dq->head > 0) {
+        memmove(dq->items, dq->items + dq->head, live * sizeof(file_info_t));
+        deque_set(dq, 0, live, dq->bytes);
+    }
+    if (live + n > dq->capacity) {
+        int capacity = dq->capacity ? dq->capacity : SCHED_CHUNK;
+        while (capacity < live + n) {
+            capacity *= 2;
+        }
+        dq->items = realloc(dq->items, capacity * sizeof(file_info_t));
+        if (!dq->items) {
+            perror("realloc failed");
+            exit(1);
+        }
+        dq->capacity = capacity;
+    }
+}
+
+// 初始化调度器
+void sched_init(scheduler_t *sched, int thread_count) {
+    memset(sched, 0, sizeof(*sched));
+    sched->count = thread_count;
+    sched->deques = calloc(thread_count, sizeof(work_deque_t));
+    if (!sched->deques) {
+        perror("calloc failed");
+        exit(1);
+    }
+    for (int i = 0; i < thread_count; i++) {
+        pthread_mutex_init(&sched->deques[i].lock, NULL);
+    }
+    pthread_mutex_init(&sched->wait_lock, NULL);
+    pthread_cond_init(&sched->not_empty, NULL);
+    pthread_cond_init(&sched->not_full, NULL);
+}
+
+// 释放调度器
+void sched_destroy(scheduler_t *sched) {
+    for (int i = 0; i < sched->count; i++) {
+        free(sched->deques[i].items);
+        pthread_mutex_destroy(&sched->deques[i].lock);
+    }
+    free(sched->deques);
+    sched->deques = NULL;
+    sched->count = 0;
+    pthread_mutex_destroy(&sched->wait_lock);
+    pthread_cond_destroy(&sched->not_empty);
+    pthread_cond_destroy(&sched->not_full);
+}
+
+// 提交一批文件：交给当前字节数最少的队列，使各线程负载按大小均衡
+// 排队总数超过 SCHED_CAPACITY 时阻塞，直到工作线程消化掉一部分
+void sched_submit(scheduler_t *sched, const file_info_t *batch, int n) {
+    if (n <= 0) {
+        return;
+    }
+
+    if (__atomic_load_n(&sched->pending, __ATOMIC_SEQ_CST) + n > SCHED_CAPACITY) {
+        pthread_mutex_lock(&sched->wait_lock);
+        __atomic_add_fetch(&sched->waiting_producers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&sched->pending, __ATOMIC_SEQ_CST) + n > SCHED_CAPACITY) {
+            pthread_cond_wait(&sched->not_full, &sched->wait_lock);
+        }
+        __atomic_sub_fetch(&sched->waiting_producers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&sched->wait_lock);
+    }
+
+    off_t batch_bytes = 0;
+    for (int i = 0; i < n; i++) {
+        batch_bytes += batch[i].size;
+    }
+
+    // 无锁读取各队列字节数，只作为选择目标的提示
+    work_deque_t *target = &sched->deques[0];
+    off_t least = __atomic_load_n(&target->bytes, __ATOMIC_RELAXED);
+    for (int i = 1; i < sched->count; i++) {
+        off_t bytes = __atomic_load_n(&sched->deques[i].bytes, __ATOMIC_RELAXED);
+        if (bytes < least) {
+            least = bytes;
+            target = &sched->deques[i];
+        }
+    }
+
+    pthread_mutex_lock(&target->lock);
+    deque_reserve(target, n);
+    memcpy(target->items + target->tail, batch, n * sizeof(file_info_t));
+    deque_set(target, target->head, target->tail + n, target->bytes + batch_bytes);
+    pthread_mutex_unlock(&target->lock);
+
+    __atomic_add_fetch(&sched->pending, n, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sched->idle_workers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&sched->wait_lock);
+        pthread_cond_broadcast(&sched->not_empty);
+        pthread_mutex_unlock(&sched->wait_lock);
+    }
+}
+
+// 工作线程在处理任务时提交新任务（大文件的分块）：放入自己的队列，
+// 空闲线程会来窃取。不受 SCHED_CAPACITY 限制，否则所有线程同时提交时会互相等待
+void sched_submit_local(scheduler_t *sched, int self, const file_info_t *batch, int n) {
+    if (n <= 0) {
+        return;
+    }
+
+    off_t batch_bytes = 0;
+    for (int i = 0; i < n; i++) {
+        batch_bytes += batch[i].size;
+    }
+
+    work_deque_t *mine = &sched->deques[self];
+    pthread_mutex_lock(&mine->lock);
+    deque_reserve(mine, n);
+    memcpy(mine->items + mine->tail, batch, n * sizeof(file_info_t));
+    deque_set(mine, mine->head, mine->tail + n, mine->bytes + batch_bytes);
+    pthread_mutex_unlock(&mine->lock);
+
+    __atomic_add_fetch(&sched->pending, n, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sched->idle_workers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&sched->wait_lock);
+        pthread_cond_broadcast(&sched->not_empty);
+        pthread_mutex_unlock(&sched->wait_lock);
+    }
+}
+
+// 扫描结束，唤醒所有等待任务的工作线程
+void sched_close(scheduler_t *sched) {
+    pthread_mutex_lock(&sched->wait_lock);
+    sched->closed = 1;
+    pthread_cond_broadcast(&sched->not_empty);
+    pthread_mutex_unlock(&sched->wait_lock);
+}
+
+// 从 victim 的头部窃取一半任务到 self 的队列，返回窃取的个数
+// 两把锁按下标顺序获取，避免互相窃取时死锁
+static int steal_from(scheduler_t *sched, int self, int victim) {
+    work_deque_t *mine = &sched->deques[self];
+    work_deque_t *other = &sched->deques[victim];
+
+    if (self < victim) {
+        pthread_mutex_lock(&mine->lock);
+        pthread_mutex_lock(&other->lock);
+    } else {
+        pthread_mutex_lock(&other->lock);
+        pthread_mutex_lock(&mine->lock);
+    }
+
+    int n = (other->tail - other->head + 1) / 2;
+    if (n > 0) {
+        deque_reserve(mine, n);
+        off_t bytes = 0;
+        for (int i = 0; i < n; i++) {
+            file_info_t *file = &other->items[other->head + i];
+            bytes += file->size;
+            mine->items[mine->tail + i] = *file;
+        }
+        deque_set(other, other->head + n, other->tail, other->bytes - bytes);
+        deque_set(mine, mine->head, mine->tail + n, mine->bytes + bytes);
+    }
+
+    pthread_mutex_unlock(&other->lock);
+    pthread_mutex_unlock(&mine->lock);
+    return n;
+}
+
+// 是否已没有任务、也不会再有新任务
+static int sched_finished(scheduler_t *sched) {
+    return sched->closed && __atomic_load_n(&sched->pending, __ATOMIC_SEQ_CST) == 0 &&
+           __atomic_load_n(&sched->running, __ATOMIC_SEQ_CST) == 0;
+}
+
+// 取下一个任务：先取本线程队列，空了再去其他线程窃取，
+// 都没有时等待扫描线程或其他工作线程提交。
+// 扫描结束、所有任务取完且没有线程还在处理任务时返回 0
+int sched_next(scheduler_t *sched, int self, file_info_t *out) {
+    work_deque_t *mine = &sched->deques[self];
+
+    // 上一个任务已处理完；最后一个结束的线程唤醒等待者，让它们退出
+    if (mine->busy) {
+        mine->busy = 0;
+        if (__atomic_sub_fetch(&sched->running, 1, __ATOMIC_SEQ_CST) == 0 &&
+            __atomic_load_n(&sched->idle_workers, __ATOMIC_SEQ_CST) > 0) {
+            pthread_mutex_lock(&sched->wait_lock);
+            pthread_cond_broadcast(&sched->not_empty);
+            pthread_mutex_unlock(&sched->wait_lock);
+        }
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&mine->lock);
+        if (mine->tail > mine->head) {
+            *out = mine->items[mine->tail - 1];
+            deque_set(mine, mine->head, mine->tail - 1, mine->bytes - out->size);
+            pthread_mutex_unlock(&mine->lock);
+
+            // 先计入 running 再减 pending，其他线程不会看到两者同时为 0
+            mine->busy = 1;
+            __atomic_add_fetch(&sched->running, 1, __ATOMIC_SEQ_CST);
+            __atomic_sub_fetch(&sched->pending, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&sched->waiting_producers, __ATOMIC_SEQ_CST) > 0) {
+                pthread_mutex_lock(&sched->wait_lock);
+                pthread_cond_signal(&sched->not_full);
+                pthread_mutex_unlock(&sched->wait_lock);
+            }
+            return 1;
+        }
+        pthread_mutex_unlock(&mine->lock);
+
+        // 选择剩余任务最多的线程作为窃取对象（无锁读取，只作为提示）
+        int victim = -1;
+        int most = 0;
+        for (int i = 1; i < sched->count; i++) {
+            int idx = (self + i) % sched->count;
+            int queued = __atomic_load_n(&sched->deques[idx].tail, __ATOMIC_RELAXED) -
+                         __atomic_load_n(&sched->deques[idx].head, __ATOMIC_RELAXED);
+            if (queued > most) {
+                most = queued;
+                victim = idx;
+            }
+        }
+        if (victim >= 0 && steal_from(sched, self, victim) > 0) {
+            continue;
+        }
+
+        // 没有可取的任务：先登记为空闲再检查 pending，
+        // 与 sched_submit 先加 pending 再检查 idle_workers 配合，不会丢失唤醒
+        pthread_mutex_lock(&sched->wait_lock);
+        __atomic_add_fetch(&sched->idle_workers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&sched->pending, __ATOMIC_SEQ_CST) == 0 && !sched_finished(sched)) {
+            pthread_cond_wait(&sched->not_empty, &sched->wait_lock);
+        }
+        __atomic_sub_fetch(&sched->idle_workers, 1, __ATOMIC_SEQ_CST);
+        int finished = sched_finished(sched);
+        pthread_mutex_unlock(&sched->wait_lock);
+
+        if (finished) {
+            return 0;
+        }
+    }
+}
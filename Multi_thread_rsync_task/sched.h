@@ -0,0 +1,46 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "sync_util.h"
+
+#define SCHED_CHUNK 32        // 扫描线程每批提交的文件数
+#define SCHED_CAPACITY 8192   // 所有队列中最多排队的文件数，限制内存占用
+
+// 每个线程私有的双端队列
+// 本线程从尾部取任务，其他线程从头部窃取。
+// head/tail/bytes 只在持有 lock 时修改，但选择目标时不加锁读取，
+// 所以写入一律用 __atomic_store_n，不加锁的读取用 __atomic_load_n
+typedef struct {
+    file_info_t *items;
+    int head;                 // 窃取端
+    int tail;                 // 本地端
+    int capacity;
+    off_t bytes;              // 队列中剩余文件的总字节数
+    int busy;                 // 本线程正在处理取出的任务（只由本线程读写）
+    pthread_mutex_t lock;
+} work_deque_t;
+
+// 工作窃取调度器（scheduler_t 在 sync_util.h 中前向声明）
+// pending/running/idle_workers/waiting_producers 用 __atomic 内建函数访问，
+// 只有在需要睡眠或唤醒时才会拿 wait_lock
+struct scheduler {
+    work_deque_t *deques;
+    int count;
+    int pending;              // 所有队列中的文件总数
+    int running;              // 正在处理任务的工作线程数，处理中可能提交新任务（大文件的分块）
+    int closed;               // 扫描结束，不会再有新任务
+    int idle_workers;
+    int waiting_producers;
+    pthread_mutex_t wait_lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+void sched_init(scheduler_t *sched, int thread_count);
+void sched_destroy(scheduler_t *sched);
+void sched_submit(scheduler_t *sched, const file_info_t *batch, int n);
+void sched_submit_local(scheduler_t *sched, int self, const file_info_t *batch, int n);
+void sched_close(scheduler_t *sched);
+int sched_next(scheduler_t *sched, int self, file_info_t *out);
+
+#endif
@@ -1,77 +1,76 @@
+#define _GNU_SOURCE
 #include "sync_util.h"
+#include "sched.h"
+#include "scan.h"
 #include <string.h>
 #include <stdlib.h>
+#include <signal.h>
 
-// ʼļб
-void init_file_list(file_list_t *list) {
-    list->capacity = 100;
-    list->count = 0;
-    list->current_index = 0;
-    list->files = malloc(list->capacity * sizeof(file_info_t));
-    if (!list->files) {
-        perror("malloc failed");
-        exit(1);
-    }
-    pthread_mutex_init(&list->lock, NULL);
+// 本次运行的限速器，复制钩子、io_uring 和增量传输共用；不限速时为 NULL
+static throttle_t *sync_throttle;
+
+int64_t timespec_ns(const struct timespec *ts) {
+    return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
 }
 
-// ͷļб
-void free_file_list(file_list_t *list) {
-    if (list->files) {
-        free(list->files);
-        list->files = NULL;
-    }
-    list->count = 0;
-    list->capacity = 0;
-    list->current_index = 0;
-    pthread_mutex_destroy(&list->lock);
+// 把目标文件的访问和修改时间设置为源文件的时间（纳秒精度）
+static int set_file_times(const char *path, int64_t atime_ns, int64_t mtime_ns) {
+    struct timespec times[2];
+    times[0].tv_sec = atime_ns / 1000000000;
+    times[0].tv_nsec = atime_ns % 1000000000;
+    times[1].tv_sec = mtime_ns / 1000000000;
+    times[1].tv_nsec = mtime_ns % 1000000000;
+    int64_t start = metrics_start();
+    int rc = utimensat(AT_FDCWD, path, times, 0);
+    metrics_record(METRIC_UTIMES, start);
+    return rc;
 }
 
-// ļб
-void add_file_to_list(file_list_t *list, const char *source_path, const char *target_path, off_t size) {
-    pthread_mutex_lock(&list->lock);
-    
-    if (list->count >= list->capacity) {
-        list->capacity *= 2;
-        list->files = realloc(list->files, list->capacity * sizeof(file_info_t));
-        if (!list->files) {
-            perror("realloc failed");
-            pthread_mutex_unlock(&list->lock);
-            exit(1);
-        }
-    }
-    
-    file_info_t *file = &list->files[list->count];
-    strncpy(file->source_path, source_path, MAX_PATH_LEN - 1);
-    file->source_path[MAX_PATH_LEN - 1] = '\0';
-    
-    strncpy(file->target_path, target_path, MAX_PATH_LEN - 1);
-    file->target_path[MAX_PATH_LEN - 1] = '\0';
-    
-    file->size = size;
-    file->needs_sync = 1;
-    
-    list->count++;
-    pthread_mutex_unlock(&list->lock);
+static int set_fd_times(int fd, int64_t atime_ns, int64_t mtime_ns) {
+    struct timespec times[2];
+    times[0].tv_sec = atime_ns / 1000000000;
+    times[0].tv_nsec = atime_ns % 1000000000;
+    times[1].tv_sec = mtime_ns / 1000000000;
+    times[1].tv_nsec = mtime_ns % 1000000000;
+    int64_t start = metrics_start();
+    int rc = futimens(fd, times);
+    metrics_record(METRIC_UTIMES, start);
+    return rc;
 }
 
-// ȡһҪļ
-file_info_t* get_next_file(file_list_t *list) {
-    pthread_mutex_lock(&list->lock);
-    
-    if (list->current_index >= list->count) {
-        pthread_mutex_unlock(&list->lock);
-        return NULL;
+// 计时的 open/stat，启用统计时记入延迟分布
+static int open_timed(const char *path, int flags) {
+    int64_t start = metrics_start();
+    int fd = open(path, flags);
+    metrics_record(METRIC_OPEN, start);
+    return fd;
+}
+
+static int stat_timed(const char *path, struct stat *st) {
+    int64_t start = metrics_start();
+    int rc = stat(path, st);
+    metrics_record(METRIC_STAT, start);
+    return rc;
+}
+
+// 打开要写入的目标：原子替换时为同目录下的临时文件，否则新建或截断目标
+// target_stat 为目标当前的状态（不存在时为 NULL）。目标是与其他路径共享的硬链接时
+// （--dedup=link 或 -H 建立的）先删除这个路径再新建，截断改写不会波及其他路径
+static int open_target(commit_batch_t *commit, atomic_file_t *temp, const char *target_file,
+                       const struct stat *target_stat) {
+    int64_t start = metrics_start();
+    int fd = -1;
+    if (commit) {
+        fd = atomic_open(temp, target_file, 0644);
+    } else if (!target_stat || target_stat->st_nlink <= 1 ||
+               unlink(target_file) == 0 || errno == ENOENT) {
+        fd = open(target_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
     }
-    
-    file_info_t *file = &list->files[list->current_index];
-    list->current_index++;
-    
-    pthread_mutex_unlock(&list->lock);
-    return file;
+    metrics_record(METRIC_OPEN, start);
+    return fd;
 }
 
-// ǷΪĿ¼
+// 检查是否为目录
 int is_directory(const char *path) {
     struct stat stat_buf;
     if (stat(path, &stat_buf) != 0) {
@@ -80,12 +79,12 @@ int is_directory(const char *path) {
     return S_ISDIR(stat_buf.st_mode);
 }
 
-// ļǷ
+// 检查文件是否存在
 int file_exists(const char *path) {
     return access(path, F_OK) == 0;
 }
 
-// ȡļС
+// 获取文件大小
 off_t get_file_size(const char *path) {
     struct stat stat_buf;
     if (stat(path, &stat_buf) != 0) {
@@ -94,7 +93,7 @@ off_t get_file_size(const char *path) {
     return stat_buf.st_size;
 }
 
-// ȡļ޸ʱ
+// 获取文件修改时间
 time_t get_file_mtime(const char *path) {
     struct stat stat_buf;
     if (stat(path, &stat_buf) != 0) {
@@ -103,64 +102,35 @@ time_t get_file_mtime(const char *path) {
     return stat_buf.st_mtime;
 }
 
-// ȽļǷͬڴС޸ʱ䣩
-int compare_files(const char *file1, const char *file2) {
-    if (!file_exists(file2)) {
-        return 0;
-    }
-    
-    // ȽļС
-    off_t size1 = get_file_size(file1);
-    off_t size2 = get_file_size(file2);
-    
-    if (size1 != size2) {
+// 比较源文件和目标文件是否相同（基于大小和修改时间）
+// 源文件信息来自扫描时的 stat，目标只 stat 一次，由调用者传入
+// 修改时间不同时逐段比较两边内容的哈希，文件大小不限；
+// 相同时 source_hash 返回源文件的内容哈希，供写入清单
+int compare_files(const file_info_t *source, const file_paths_t *paths, const struct stat *target_stat,
+                  uint64_t *source_hash) {
+    if (source->size != target_stat->st_size) {
         return 0;
     }
     
-    // Ƚ޸ʱ䣨Ż
-    time_t mtime1 = get_file_mtime(file1);
-    time_t mtime2 = get_file_mtime(file2);
-    
-    if (mtime1 == mtime2 && size1 == size2) {
+    // 比较修改时间（精确到纳秒，同步时目标按纳秒设置）
+    if (source->mtime_ns == timespec_ns(&target_stat->st_mtim)) {
         return 1;
     }
     
-    // ҪȷȽϣԱȽ
-    if (size1 < 1024 * 1024) { // ֻСļݱȽ
-        FILE *f1 = fopen(file1, "rb");
-        FILE *f2 = fopen(file2, "rb");
-        
-        if (!f1 || !f2) {
-            if (f1) fclose(f1);
-            if (f2) fclose(f2);
-            return 0;
-        }
-        
-        unsigned char buffer1[BUFFER_SIZE];
-        unsigned char buffer2[BUFFER_SIZE];
-        size_t bytes_read1, bytes_read2;
-        int result = 1;
-        
-        do {
-            bytes_read1 = fread(buffer1, 1, BUFFER_SIZE, f1);
-            bytes_read2 = fread(buffer2, 1, BUFFER_SIZE, f2);
-            
-            if (bytes_read1 != bytes_read2 || 
-                memcmp(buffer1, buffer2, bytes_read1) != 0) {
-                result = 0;
-                break;
-            }
-        } while (bytes_read1 > 0);
-        
-        fclose(f1);
-        fclose(f2);
-        return result;
+    int64_t start = metrics_start();
+    int source_fd = open(paths->source_path, O_RDONLY);
+    int target_fd = open(paths->target_path, O_RDONLY);
+    int result = 0;
+    if (source_fd >= 0 && target_fd >= 0) {
+        result = hash_compare_fd(source_fd, target_fd, source->size, source_hash) == 1;
     }
-    
-    return 0;
+    if (source_fd >= 0) close(source_fd);
+    if (target_fd >= 0) close(target_fd);
+    metrics_record(METRIC_COMPARE, start);
+    return result;
 }
 
-// Ŀ¼
+// 创建目录
 int create_directory(const char *path) {
     if (file_exists(path)) {
         return 1;
@@ -170,16 +140,16 @@ int create_directory(const char *path) {
     char *p = NULL;
     size_t len;
     
-    // ·ַ
+    // 复制路径字符串
     snprintf(tmp, sizeof(tmp), "%s", path);
     len = strlen(tmp);
     
-    // Ƴĩβ/
+    // 移除末尾的/
     if (tmp[len - 1] == '/') {
         tmp[len - 1] = 0;
     }
     
-    // ݹ鴴Ŀ¼
+    // 递归创建目录
     for (p = tmp + 1; *p; p++) {
         if (*p == '/') {
             *p = 0;
@@ -190,7 +160,7 @@ int create_directory(const char *path) {
         }
     }
     
-    // һĿ¼
+    // 创建最后一级目录
     if (mkdir(tmp, 0755) != 0 && errno != EEXIST) {
         return 0;
     }
@@ -198,104 +168,168 @@ int create_directory(const char *path) {
     return 1;
 }
 
-// ޸ sync_file ȷģʽ
-int sync_file(const char *source_file, const char *target_file, int dry_run) {
-    // ĿļǷͬ
-    if (compare_files(source_file, target_file)) {
-        if (dry_run) {
-            printf(": ͬļ %s\n", source_file);
-        }
-        return 1; // ļͬͬ
+// 增量更新已存在的目标文件，目标不存在、太小或是共享的硬链接时返回 -1，由调用者整体复制
+// target_stat 为空表示目标不存在
+static int sync_delta(int source_fd, off_t source_size, const char *target_file,
+                      const struct stat *target_stat, delta_stats_t *delta_stats) {
+    if (!target_stat || !S_ISREG(target_stat->st_mode) || target_stat->st_size < DELTA_MIN_SIZE ||
+        target_stat->st_nlink > 1) {
+        return -1;
     }
-    
-    if (dry_run) {
-        printf(": Ҫͬ %s -> %s\n", source_file, target_file);
-        return 1; // ģʽǷسɹ
+
+    int target_fd = open(target_file, O_RDWR);
+    if (target_fd < 0) {
+        return -1;
     }
+    // 增量传输要读遍两边的文件，按文件大小一次取够配额
+    throttle_acquire(sync_throttle, source_size, 1);
+    int64_t start = metrics_start();
+    int rc = delta_sync_fd(source_fd, source_size, target_fd, target_stat->st_size, delta_stats);
+    int saved_errno = errno;
+    metrics_record(METRIC_COPY, start);
+    close(target_fd);
+    errno = saved_errno;
+    return rc < 0 ? 0 : 1;
+}
+
+// 原子替换：在改名前设置好临时文件的时间，替换后目标立即是完整的新文件
+// 持久模式下改名推迟到本线程整批提交时。成功返回 1
+static int commit_temp(commit_batch_t *commit, atomic_file_t *temp, const file_info_t *file,
+                       const char *target_file) {
+    if (set_fd_times(temp->fd, file->atime_ns, file->mtime_ns) != 0) {
+        fprintf(stderr, "警告: 无法设置文件时间: %s\n", target_file);
+    }
+    if (atomic_close(temp) != 0 ||
+        commit_batch_add(commit, temp->temp_path, target_file, file->size) != 0) {
+        fprintf(stderr, "无法替换目标文件: %s (%s)\n", target_file, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+// 同步单个文件，method 返回本次使用的复制方式
+// delta 非 0 时对已存在的大文件做增量传输，delta_stats 返回写入情况
+// force 非 0 表示已知内容不同，不再与目标比较
+// commit 非空时写入临时文件再由它替换目标（此时不做增量传输），为空时直接改写目标
+// content_hash 传入已知的源文件内容哈希（0 表示未知），返回要记入清单的哈希：
+// 已知的哈希、比较内容时得到的哈希，或复制后计算的（不超过 MANIFEST_HASH_MAX 的文件），否则为 0
+// 源文件的大小、时间等直接使用扫描时的结果
+int sync_file(const file_info_t *file, const file_paths_t *paths, int dry_run, int delta, int force,
+              commit_batch_t *commit, copy_method_t *method, delta_stats_t *delta_stats,
+              uint64_t *content_hash) {
+    const char *source_file = paths->source_path;
+    const char *target_file = paths->target_path;
+    uint64_t known_hash = *content_hash;
+    *method = COPY_NONE;
+    *content_hash = 0;
+    memset(delta_stats, 0, sizeof(*delta_stats));
     
-    // ĿĿ¼
-    char target_dir[MAX_PATH_LEN];
-    char *last_slash = strrchr(target_file, '/');
-    if (last_slash) {
-        size_t dir_len = last_slash - target_file;
-        strncpy(target_dir, target_file, dir_len);
-        target_dir[dir_len] = '\0';
-        
-        if (!create_directory(target_dir)) {
-            fprintf(stderr, "޷Ŀ¼: %s\n", target_dir);
-            return 0;
+    // 检查目标文件是否存在且相同，目标只 stat 一次
+    struct stat target_stat;
+    int target_exists = stat_timed(target_file, &target_stat) == 0;
+    if (!force && target_exists && compare_files(file, paths, &target_stat, content_hash)) {
+        if (dry_run) {
+            printf("干运行: 跳过相同文件 %s\n", source_file);
         }
+        return 1; // 文件相同，无需同步
     }
     
-  // ļ
-    int source_fd = open(source_file, O_RDONLY);
-    if (source_fd < 0) {
-        fprintf(stderr, "޷Դļ: %s\n", source_file);
-        return 0;
+    if (dry_run) {
+        printf("干运行: 需要同步 %s -> %s\n", source_file, target_file);
+        return 1; // 干运行模式，总是返回成功
     }
     
-    int target_fd = open(target_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (target_fd < 0) {
-        fprintf(stderr, "޷Ŀļ: %s\n", target_file);
-        close(source_fd);
+    // 目标目录由调用者通过 dir_node_ensure 按需创建
+    // 复制文件
+    int source_fd = open_timed(source_file, O_RDONLY);
+    if (source_fd < 0) {
+        fprintf(stderr, "无法打开源文件: %s\n", source_file);
         return 0;
     }
     
-    // ļ
-    unsigned char buffer[BUFFER_SIZE];
-    ssize_t bytes_read, bytes_written;
-    int success = 1;
-    
-    while ((bytes_read = read(source_fd, buffer, BUFFER_SIZE)) > 0) {
-        bytes_written = write(target_fd, buffer, bytes_read);
-        if (bytes_written != bytes_read) {
-            fprintf(stderr, "дļʧ: %s\n", target_file);
-            success = 0;
-            break;
+    int success;
+    int delta_rc = delta && !commit ? sync_delta(source_fd, file->size, target_file,
+                                      target_exists ? &target_stat : NULL, delta_stats) : -1;
+    if (delta_rc >= 0) {
+        *method = COPY_DELTA;
+        success = delta_rc;
+        if (!success) {
+            fprintf(stderr, "增量更新失败: %s (%s)\n", target_file, strerror(errno));
         }
-    }
-    
-       // ͬļʱ䣨ʹ utimes  futimes
-    if (success) {
-        struct stat stat_buf;
-        if (fstat(source_fd, &stat_buf) == 0) {
-            struct timeval times[2];
-            times[0].tv_sec = stat_buf.st_atime;
-            times[0].tv_usec = 0;
-            times[1].tv_sec = stat_buf.st_mtime;
-            times[1].tv_usec = 0;
-            
-            // ʹ utimes  futimes
-            close(target_fd); // ȹرļ
-            if (utimes(target_file, times) != 0) {
-                // ʱͬʧܲӰļͬ
-                fprintf(stderr, ": ޷ļʱ: %s\n", target_file);
+    } else {
+        atomic_file_t temp;
+        int target_fd = open_target(commit, &temp, target_file, target_exists ? &target_stat : NULL);
+        if (target_fd < 0) {
+            fprintf(stderr, "无法创建目标文件: %s\n", target_file);
+            close(source_fd);
+            return 0;
+        }
+        
+        // 复制文件内容：优先在内核中完成，都不支持时才经过用户态缓冲区
+        int64_t start = metrics_start();
+        success = copy_fd(source_fd, target_fd, file->size, method) == 0;
+        metrics_record(METRIC_COPY, start);
+        if (!success) {
+            fprintf(stderr, "写入文件失败: %s (%s)\n", target_file, strerror(errno));
+        }
+        if (commit) {
+            success = success && commit_temp(commit, &temp, file, target_file);
+            if (!success) {
+                atomic_abort(&temp);
             }
+        } else {
+            close(target_fd);
+        }
+        
+        // 小文件刚读过，仍在页缓存中，顺便记下内容哈希供下次比较
+        if (success && !known_hash && file->size <= MANIFEST_HASH_MAX &&
+            hash_fd(source_fd, file->size, content_hash) != 0) {
+            *content_hash = 0;
         }
-    } else {
-        close(target_fd);
+    }
+    close(source_fd);
+    if (success && known_hash) {
+        *content_hash = known_hash;
     }
     
-    if (source_fd >= 0) close(source_fd);
+    // 同步文件时间（原子替换时已在改名前设置）
+    if (success && !commit) {
+        if (set_file_times(target_file, file->atime_ns, file->mtime_ns) != 0) {
+            // 时间同步失败不影响文件内容同步
+            fprintf(stderr, "警告: 无法设置文件时间: %s\n", target_file);
+        }
+    }
     
     return success;
 }
 
-// ȡ·
+// 由目录节点和文件名拼出源路径和目标路径，路径过长时返回 0
+int file_paths(const file_info_t *file, const char *target_dir, file_paths_t *paths) {
+    int n = snprintf(paths->source_path, MAX_PATH_LEN, "%s/%s", file->dir->source_path, file->name);
+    if (n < 0 || n >= MAX_PATH_LEN) {
+        return 0;
+    }
+    const char *rel = dir_node_rel(file->dir);
+    n = snprintf(paths->target_path, MAX_PATH_LEN, "%s%s%s/%s",
+                 target_dir, *rel ? "/" : "", rel, file->name);
+    return n >= 0 && n < MAX_PATH_LEN;
+}
+
+// 获取相对路径
 char* get_relative_path(const char *base, const char *full_path) {
     static char relative[MAX_PATH_LEN];
     size_t base_len = strlen(base);
     
-    // ·Ի·ͷ
+    // 如果完整路径以基础路径开头
     if (strncmp(full_path, base, base_len) == 0) {
         const char *relative_start = full_path + base_len;
         
-        // ͷ/
+        // 跳过开头的/
         if (*relative_start == '/') {
             relative_start++;
         }
         
-        // ·Ϊգؿַ
+        // 如果相对路径为空，返回空字符串
         if (*relative_start == '\0') {
             relative[0] = '\0';
         } else {
@@ -303,7 +337,7 @@ char* get_relative_path(const char *base, const char *full_path) {
             relative[MAX_PATH_LEN - 1] = '\0';
         }
     } else {
-        // ƥ䣬·
+        // 如果不匹配，返回完整路径
         strncpy(relative, full_path, MAX_PATH_LEN - 1);
         relative[MAX_PATH_LEN - 1] = '\0';
     }
@@ -311,257 +345,1216 @@ char* get_relative_path(const char *base, const char *full_path) {
     return relative;
 }
 
-// Ŀ¼
-void traverse_directory(const char *source_path, const char *target_path, file_list_t *list) {
-    DIR *dir = opendir(source_path);
-    if (!dir) {
-        fprintf(stderr, "޷Ŀ¼: %s\n", source_path);
+// 清单中有内容哈希且大小未变：源文件内容与上次同步时相同时
+// 只需把目标的时间改成源文件的时间，不再读目标或复制数据
+// 返回 1 表示已处理，0 表示需要正常同步，-1 表示内容确实变了，
+// 此时 source_hash 返回新内容的哈希，复制时不必再读一遍
+static int sync_times_only(const file_info_t *file, const file_paths_t *paths, uint64_t *source_hash) {
+    int fd = open_timed(paths->source_path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    uint64_t h;
+    int hashed = hash_fd(fd, file->size, &h) == 0;
+    close(fd);
+    if (!hashed) {
+        return 0;
+    }
+    if (h != file->content_hash) {
+        *source_hash = h;
+        return -1;
+    }
+
+    struct stat target_stat;
+    if (stat_timed(paths->target_path, &target_stat) != 0 || target_stat.st_size != file->size) {
+        return 0;
+    }
+
+    return set_file_times(paths->target_path, file->atime_ns, file->mtime_ns) == 0;
+}
+
+// 原子替换模式下本线程提交临时文件用的批次，否则为 NULL（直接改写目标）
+static commit_batch_t* thread_commit(thread_args_t *args) {
+    return args->atomic && !args->dry_run ? &args->commit : NULL;
+}
+
+// 文件相对源根目录的路径，返回长度，过长时返回 -1
+static int file_rel(const file_info_t *file, char *rel, size_t size) {
+    const char *dir_rel = dir_node_rel(file->dir);
+    int len = snprintf(rel, size, "%s%s%s", dir_rel, *dir_rel ? "/" : "", file->name);
+    return len > 0 && len < (int)size ? len : -1;
+}
+
+// 断点记录的键：路径和扫描时源文件的身份（size 为整个文件的大小）
+static void journal_key(journal_record_t *record, uint64_t path_hash, const file_info_t *file) {
+    memset(record, 0, sizeof(*record));
+    record->path_hash = path_hash;
+    record->ino = file->ino;
+    record->size = file->size;
+    record->mtime_ns = file->mtime_ns;
+    record->ctime_ns = file->ctime_ns;
+}
+
+// 写出本线程攒下的断点记录。持久模式下推迟的改名先提交，记录才不会先于目标文件；
+// 提交中有文件失败时不知道是哪些，这批记录都不写，恢复时重做
+static void journal_commit(thread_args_t *args) {
+    commit_batch_t *commit = thread_commit(args);
+    if (commit) {
+        commit_batch_flush(commit);
+        if (commit->failed > args->journal_failed) {
+            args->journal_failed = commit->failed;
+            journal_discard(args->journal);
+            return;
+        }
+    }
+    if (journal_flush(args->journal) != 0) {
+        fprintf(stderr, "警告: 线程 %d 无法写入断点日志 (%s)，之后不再记录\n",
+                args->thread_id, strerror(errno));
+        args->journal = NULL;
+    }
+}
+
+static void journal_note(thread_args_t *args, const journal_record_t *record) {
+    journal_add(args->journal, record);
+    if (journal_due(args->journal)) {
+        journal_commit(args);
+    }
+}
+
+// 整批提交中替换失败的文件：持久模式下记入清单时还没改名，记下路径哈希，结束时删去
+static void commit_lost(void *ctx, const char *target) {
+    thread_args_t *args = ctx;
+    const char *rel = target + strlen(args->target_dir);
+    rel += *rel == '/';
+    if (args->commit_lost_count == args->commit_lost_cap) {
+        args->commit_lost_cap = args->commit_lost_cap ? args->commit_lost_cap * 2 : 64;
+        args->commit_lost = realloc(args->commit_lost, args->commit_lost_cap * sizeof(uint64_t));
+        if (!args->commit_lost) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    args->commit_lost[args->commit_lost_count++] = hash_xxh64(rel, strlen(rel), 0);
+}
+
+// 把同步成功的文件记入本线程的清单和断点日志
+static void record_manifest(thread_args_t *args, const file_info_t *file, uint64_t content_hash) {
+    manifest_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.ino = file->ino;
+    entry.size = file->size;
+    entry.mtime_ns = file->mtime_ns;
+    entry.ctime_ns = file->ctime_ns;
+    entry.content_hash = content_hash;
+
+    char rel[MAX_PATH_LEN];
+    int len = file_rel(file, rel, sizeof(rel));
+    if (len < 0) {
         return;
     }
-    
-    struct dirent *entry;
-    char source_full_path[MAX_PATH_LEN];
-    char target_full_path[MAX_PATH_LEN];
-    
-    while ((entry = readdir(dir)) != NULL) {
-        //  .  ..
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    manifest_builder_add(&args->manifest, rel, len, &entry);
+    if (args->journal) {
+        journal_record_t record;
+        journal_key(&record, journal_path_hash(rel, len), file);
+        record.content_hash = content_hash;
+        record.offset = JOURNAL_WHOLE;
+        journal_note(args, &record);
+    }
+}
+
+struct dedup_entry {
+    dedup_entry_t *next;
+    off_t size;
+    uint64_t hash;
+    char path[];              // 目标文件路径
+};
+
+void dedup_init(dedup_index_t *index) {
+    memset(index, 0, sizeof(*index));
+    pthread_mutex_init(&index->lock, NULL);
+}
+
+void dedup_free(dedup_index_t *index) {
+    for (size_t b = 0; index->buckets && b <= index->mask; b++) {
+        dedup_entry_t *e = index->buckets[b];
+        while (e) {
+            dedup_entry_t *next = e->next;
+            free(e);
+            e = next;
         }
-        
-        snprintf(source_full_path, sizeof(source_full_path) - 1, "%s/%s", source_path, entry->d_name);
-        source_full_path[sizeof(source_full_path) - 1] = '\0';
-        
-        snprintf(target_full_path, sizeof(target_full_path) - 1, "%s/%s", target_path, entry->d_name);
-        target_full_path[sizeof(target_full_path) - 1] = '\0';
-        
-        if (is_directory(source_full_path)) {
-            // ݹĿ¼
-            traverse_directory(source_full_path, target_full_path, list);
+    }
+    free(index->buckets);
+    pthread_mutex_destroy(&index->lock);
+}
+
+static size_t dedup_bucket(const dedup_index_t *index, off_t size, uint64_t hash) {
+    return (size_t)(hash ^ ((uint64_t)size * 0x9E3779B97F4A7C15ULL)) & index->mask;
+}
+
+// 记下一个内容已经完整写好的目标文件，同样内容已有记录时保留先记下的
+static void dedup_add(dedup_index_t *index, off_t size, uint64_t hash, const char *path) {
+    hash &= DEDUP_HASH_MASK;
+    pthread_mutex_lock(&index->lock);
+    if (!index->buckets || index->count > index->mask) {
+        size_t buckets = index->buckets ? (index->mask + 1) * 2 : 1024;
+        dedup_entry_t **table = calloc(buckets, sizeof(dedup_entry_t *));
+        if (!table) {
+            perror("calloc failed");
+            exit(1);
+        }
+        for (size_t b = 0; index->buckets && b <= index->mask; b++) {
+            dedup_entry_t *e = index->buckets[b];
+            while (e) {
+                dedup_entry_t *next = e->next;
+                size_t nb = (size_t)(e->hash ^ ((uint64_t)e->size * 0x9E3779B97F4A7C15ULL)) &
+                            (buckets - 1);
+                e->next = table[nb];
+                table[nb] = e;
+                e = next;
+            }
+        }
+        free(index->buckets);
+        index->buckets = table;
+        index->mask = buckets - 1;
+    }
+
+    size_t b = dedup_bucket(index, size, hash);
+    dedup_entry_t *e = index->buckets[b];
+    while (e && (e->size != size || e->hash != hash)) {
+        e = e->next;
+    }
+    if (!e) {
+        size_t len = strlen(path) + 1;
+        e = malloc(sizeof(dedup_entry_t) + len);
+        if (!e) {
+            perror("malloc failed");
+            exit(1);
+        }
+        e->size = size;
+        e->hash = hash;
+        memcpy(e->path, path, len);
+        e->next = index->buckets[b];
+        index->buckets[b] = e;
+        index->count++;
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+// 查找大小和哈希都相同的已复制文件，找到时把路径复制到 path 并返回 1。
+// 哈希可能碰撞，内容是否相同由调用者用 dedup_same 确认
+static int dedup_find(dedup_index_t *index, off_t size, uint64_t hash, char *path, size_t len) {
+    int found = 0;
+    hash &= DEDUP_HASH_MASK;
+    pthread_mutex_lock(&index->lock);
+    if (index->buckets) {
+        dedup_entry_t *e = index->buckets[dedup_bucket(index, size, hash)];
+        while (e && (e->size != size || e->hash != hash)) {
+            e = e->next;
+        }
+        if (e && strlen(e->path) < len) {
+            strcpy(path, e->path);
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&index->lock);
+    return found;
+}
+
+// 统计一个文件的同步结果，成功的记入清单
+static void sync_done(thread_args_t *args, const file_info_t *file, const file_paths_t *paths,
+                      int result, copy_method_t method, const delta_stats_t *delta_stats,
+                      uint64_t content_hash) {
+    int dry_run = args->dry_run;
+    // 分块复制的文件已在各分块完成时计入字节数
+    metrics_file_done(file->chunk ? 0 : file->size);
+    if (result) {
+        if (!dry_run) {
+            record_manifest(args, file, content_hash);
+        }
+        // 目标已是完整的新内容，之后内容相同的文件可以从它克隆或链接；
+        // 持久模式下改名推迟到整批提交，这时目标还是旧内容，不能记
+        commit_batch_t *commit = thread_commit(args);
+        if (args->dedup && !dry_run && content_hash && file->size >= DEDUP_MIN_SIZE &&
+            (!commit || commit->sync_fd < 0)) {
+            dedup_add(args->dedup, file->size, content_hash, paths->target_path);
+        }
+        args->files_synced++;
+        args->method_counts[method]++;
+        if (method == COPY_DELTA) {
+            off_t rewritten = delta_stats->moved_bytes + delta_stats->literal_bytes;
+            args->delta_written += rewritten;
+            args->delta_size += delta_stats->matched_bytes + rewritten;
+            if (args->verbose) {
+                printf("线程 %d 增量: %s (改写 %lld / %lld 字节)\n", args->thread_id,
+                       paths->source_path, (long long)rewritten,
+                       (long long)(delta_stats->matched_bytes + rewritten));
+            }
+        } else if (args->verbose && method != COPY_NONE) {
+            printf("线程 %d 复制: %s [%s]\n", args->thread_id,
+                   paths->source_path, copy_method_name(method));
+        } else if (args->thread_id == 0 && !dry_run) {
+            printf("线程 %d 同步成功: %s\n", args->thread_id, 
+                   get_relative_path("", paths->source_path));
+        }
+    } else {
+        args->errors++;
+        if (!dry_run) {
+            fprintf(stderr, "线程 %d 同步失败: %s\n", args->thread_id, 
+                    get_relative_path("", paths->source_path));
+        }
+    }
+}
+
+// 交给 io_uring 的文件，完成前持有目录节点的引用
+typedef struct {
+    thread_args_t *args;
+    file_info_t file;
+    file_paths_t paths;
+    uint64_t content_hash;    // 已知的源文件内容哈希，0 表示未知
+    char temp_path[PATH_MAX]; // 原子替换时实际写入的临时文件
+    int64_t start;            // 提交时间，完成时记入复制延迟
+} uring_job_t;
+
+// io_uring 复制结束后在本线程中调用：设置时间、统计结果；
+// 失败时按原来的方式再同步一次
+static void uring_done(void *user, int err, const void *data, size_t len) {
+    uring_job_t *job = user;
+    thread_args_t *args = job->args;
+    copy_method_t method = COPY_URING;
+    delta_stats_t delta_stats = {0, 0, 0};
+    uint64_t content_hash = job->content_hash;
+    commit_batch_t *commit = thread_commit(args);
+    int result;
+
+    metrics_record(METRIC_COPY, job->start);
+    if (err) {
+        if (commit) {
+            unlink(job->temp_path);
+        }
+        result = sync_file(&job->file, &job->paths, 0, args->delta, 1, commit,
+                           &method, &delta_stats, &content_hash);
+    } else {
+        // 一次读完的文件内容还在缓冲区中，哈希与 hash_fd 的结果相同
+        if (!content_hash && data && len > 0 && (off_t)len == job->file.size &&
+            len <= MANIFEST_HASH_MAX) {
+            content_hash = hash_fast64(data, len, 0);
+        }
+        const char *written = commit ? job->temp_path : job->paths.target_path;
+        if (set_file_times(written, job->file.atime_ns, job->file.mtime_ns) != 0) {
+            fprintf(stderr, "警告: 无法设置文件时间: %s\n", job->paths.target_path);
+        }
+        result = 1;
+        if (commit && commit_batch_add(commit, job->temp_path, job->paths.target_path,
+                                       job->file.size) != 0) {
+            fprintf(stderr, "无法替换目标文件: %s (%s)\n", job->paths.target_path, strerror(errno));
+            result = 0;
+        }
+    }
+
+    sync_done(args, &job->file, &job->paths, result, method, &delta_stats, content_hash);
+    dir_node_release(job->file.dir);
+    free(job);
+}
+
+// 用 io_uring 同步小文件：目标的比较仍在本线程中完成，需要复制时提交到环中
+// 返回 1 表示已提交，0 表示目标已相同、已统计，-1 表示不适用，由 sync_file 处理
+// content_hash 为已知的源文件内容哈希（0 表示未知）
+static int sync_file_uring(thread_args_t *args, const file_info_t *file, const file_paths_t *paths,
+                           int force, uint64_t content_hash) {
+    if (file->size > URING_MAX_FILE) {
+        return -1;
+    }
+
+    struct stat target_stat;
+    int target_exists = stat_timed(paths->target_path, &target_stat) == 0;
+    uint64_t same_hash = 0;
+    if (!force && target_exists && compare_files(file, paths, &target_stat, &same_hash)) {
+        sync_done(args, file, paths, 1, COPY_NONE, NULL, same_hash);
+        return 0;
+    }
+    if (args->delta && !args->atomic && target_exists && S_ISREG(target_stat.st_mode) &&
+        target_stat.st_size >= DELTA_MIN_SIZE) {
+        return -1;
+    }
+    // 环中直接截断目标；共享的硬链接要在源文件打开后先断开，交给 sync_file
+    if (!args->atomic && target_exists && target_stat.st_nlink > 1) {
+        return -1;
+    }
+
+    uring_job_t *job = malloc(sizeof(uring_job_t));
+    if (!job) {
+        perror("malloc failed");
+        exit(1);
+    }
+    job->args = args;
+    job->file = *file;
+    job->paths = *paths;
+    job->content_hash = content_hash;
+    job->start = metrics_start();
+    // 原子替换时写入临时文件，完成后在 uring_done 中改名
+    // 在提交前取配额：环中的读写不经过复制钩子，按每个缓冲区一批计
+    throttle_acquire(sync_throttle, file->size, (int)(file->size / URING_COPY_BUFFER) + 1);
+    int atomic = thread_commit(args) != NULL;
+    if (atomic && atomic_temp_name(paths->target_path, job->temp_path, sizeof(job->temp_path)) != 0) {
+        free(job);
+        return -1;
+    }
+    if (uring_copy_add(args->ring, paths->source_path,
+                       atomic ? job->temp_path : paths->target_path, 0644, job) != 0) {
+        free(job);
+        return -1;
+    }
+    return 1;
+}
+
+// 分块复制中的大文件，所有分块共享，最后完成的分块负责收尾
+typedef struct {
+    file_info_t file;         // 整个文件的信息，持有目录节点的引用
+    file_paths_t paths;
+    int source_fd;            // 各分块用 copy_range 按偏移读写同一对 fd
+    int target_fd;            // 原子替换时为 temp.fd
+    int atomic;
+    atomic_file_t temp;
+    int remaining;            // 尚未完成的分块数
+    int failed;
+    copy_method_t method;
+    uint64_t content_hash;    // 已知的源文件内容哈希，0 表示未知
+    uint64_t path_hash;       // 断点记录的键，只在写日志时使用
+} chunked_file_t;
+
+struct file_chunk {
+    chunked_file_t *owner;
+    off_t offset;
+};
+
+// 分块大小：让每个线程大约分到 4 块，不小于 CHUNK_MIN_SIZE，按 CHUNK_ALIGN 对齐
+static off_t chunk_size_for(off_t size, int threads) {
+    off_t chunk = size / ((off_t)threads * 4);
+    chunk = (chunk + CHUNK_ALIGN - 1) / CHUNK_ALIGN * CHUNK_ALIGN;
+    return chunk < CHUNK_MIN_SIZE ? CHUNK_MIN_SIZE : chunk;
+}
+
+// 最后一个分块完成后关闭文件、设置时间并统计结果
+static void finish_chunked(thread_args_t *args, chunked_file_t *owner) {
+    close(owner->source_fd);
+    int failed = owner->failed;
+    if (owner->atomic) {
+        if (failed || !commit_temp(thread_commit(args), &owner->temp, &owner->file,
+                                   owner->paths.target_path)) {
+            atomic_abort(&owner->temp);
+            failed = 1;
+        }
+    } else if (close(owner->target_fd) != 0 && !failed) {
+        fprintf(stderr, "写入文件失败: %s (%s)\n", owner->paths.target_path, strerror(errno));
+        failed = 1;
+    }
+    if (!failed && !owner->atomic && set_file_times(owner->paths.target_path, owner->file.atime_ns,
+                                  owner->file.mtime_ns) != 0) {
+        fprintf(stderr, "警告: 无法设置文件时间: %s\n", owner->paths.target_path);
+    }
+    sync_done(args, &owner->file, &owner->paths, !failed, owner->method, NULL, owner->content_hash);
+    dir_node_release(owner->file.dir);
+    free(owner);
+}
+
+// 复制一个分块，可能在任何工作线程中执行
+static void sync_chunk(thread_args_t *args, const file_info_t *item) {
+    file_chunk_t *chunk = item->chunk;
+    chunked_file_t *owner = chunk->owner;
+    copy_method_t method;
+    if (!__atomic_load_n(&owner->failed, __ATOMIC_RELAXED)) {
+        int64_t start = metrics_start();
+        int rc = copy_range(owner->source_fd, owner->target_fd, chunk->offset, item->size, &method);
+        metrics_record(METRIC_COPY, start);
+        metrics_add_bytes(item->size);
+        if (rc == 0) {
+            __atomic_store_n(&owner->method, method, __ATOMIC_RELAXED);
+            // 原地写入的分块完成后记入断点日志，临时文件中断后不会保留，不必记
+            if (args->journal && !owner->atomic) {
+                journal_record_t record;
+                journal_key(&record, owner->path_hash, &owner->file);
+                record.offset = chunk->offset;
+                record.length = item->size;
+                journal_note(args, &record);
+            }
         } else {
-            // ӵļб
-            off_t size = get_file_size(source_full_path);
-            add_file_to_list(list, source_full_path, target_full_path, size);
+            fprintf(stderr, "写入文件失败: %s 偏移 %lld (%s)\n", owner->paths.target_path,
+                    (long long)chunk->offset, strerror(errno));
+            __atomic_store_n(&owner->failed, 1, __ATOMIC_RELAXED);
         }
     }
-    
-    closedir(dir);
+    if (__atomic_sub_fetch(&owner->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+        finish_chunked(args, owner);
+    }
 }
 
-// ͬĿ¼ṹ
-void sync_directory_structure(const char *path, const sync_config_t *config) {
-    DIR *dir = opendir(path);
-    if (!dir) return;
-    
-    struct dirent *entry;
-    char source_full_path[MAX_PATH_LEN];
-    char target_full_path[MAX_PATH_LEN];
-    
-    // ǰĿ¼Ŀλ
-    char *relative = get_relative_path(config->source_dir, path);
-    if (strlen(relative) > 0) {
-        snprintf(target_full_path, sizeof(target_full_path) - 1, "%s/%s", config->target_dir, relative);
-        target_full_path[sizeof(target_full_path) - 1] = '\0';
-        create_directory(target_full_path);
+// 大文件拆成分块交给调度器：目标先按源文件大小预分配，各分块写入自己的区间。
+// 断点日志中有这个文件的分块、目标大小也对时，只复制其余的区间
+// 返回 1 表示已拆分，0 表示已在本函数中处理完（相同、reflink 或出错），
+// -1 表示不适用，由 sync_file 处理
+static int sync_file_chunked(thread_args_t *args, const file_info_t *file, const file_paths_t *paths,
+                             int force, uint64_t content_hash) {
+    commit_batch_t *commit = thread_commit(args);
+    struct stat target_stat;
+    int target_exists = stat_timed(paths->target_path, &target_stat) == 0;
+    uint64_t path_hash = 0;
+    journal_range_t *done = NULL;
+    int ndone = 0;
+    if (args->resume || args->journal) {
+        char rel[MAX_PATH_LEN];
+        int len = file_rel(file, rel, sizeof(rel));
+        path_hash = len < 0 ? 0 : journal_path_hash(rel, len);
     }
-    
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+    // 临时文件中断后不会保留，原子替换时只能从头复制；共享的硬链接要先断开，也从头复制
+    if (!commit && args->resume && target_exists && S_ISREG(target_stat.st_mode) &&
+        target_stat.st_size == file->size && target_stat.st_nlink == 1) {
+        journal_record_t key;
+        journal_key(&key, path_hash, file);
+        ndone = journal_ranges(args->resume, &key, &done);
+    }
+
+    uint64_t same_hash = 0;
+    if (ndone == 0 && !force && target_exists && compare_files(file, paths, &target_stat, &same_hash)) {
+        sync_done(args, file, paths, 1, COPY_NONE, NULL, same_hash);
+        return 0;
+    }
+    if (ndone == 0 && args->delta && !args->atomic && target_exists && S_ISREG(target_stat.st_mode) &&
+        target_stat.st_size >= DELTA_MIN_SIZE && target_stat.st_nlink == 1) {
+        return -1;
+    }
+
+    int source_fd = open_timed(paths->source_path, O_RDONLY);
+    if (source_fd < 0) {
+        fprintf(stderr, "无法打开源文件: %s\n", paths->source_path);
+        free(done);
+        sync_done(args, file, paths, 0, COPY_NONE, NULL, 0);
+        return 0;
+    }
+    atomic_file_t temp;
+    int target_fd = ndone > 0 ? open_timed(paths->target_path, O_WRONLY)
+                              : open_target(commit, &temp, paths->target_path,
+                                            target_exists ? &target_stat : NULL);
+    if (target_fd < 0) {
+        fprintf(stderr, "无法创建目标文件: %s\n", paths->target_path);
+        close(source_fd);
+        free(done);
+        sync_done(args, file, paths, 0, COPY_NONE, NULL, 0);
+        return 0;
+    }
+
+    // 能共享数据块时不需要复制，也就不必拆分
+    if (ndone == 0 && copy_reflink(source_fd, target_fd) == 0) {
+        close(source_fd);
+        int ok = 1;
+        if (commit) {
+            ok = commit_temp(commit, &temp, file, paths->target_path);
+            if (!ok) {
+                atomic_abort(&temp);
+            }
+        } else {
+            close(target_fd);
+            if (set_file_times(paths->target_path, file->atime_ns, file->mtime_ns) != 0) {
+                fprintf(stderr, "警告: 无法设置文件时间: %s\n", paths->target_path);
+            }
+        }
+        sync_done(args, file, paths, ok, COPY_REFLINK, NULL, content_hash);
+        return 0;
+    }
+
+    // 预分配减少并行写入造成的碎片；文件系统不支持时只设置大小
+    if (ndone == 0 && fallocate(target_fd, 0, 0, file->size) != 0 &&
+        ftruncate(target_fd, file->size) != 0) {
+        fprintf(stderr, "无法预分配目标文件: %s (%s)\n", paths->target_path, strerror(errno));
+        close(source_fd);
+        if (commit) {
+            atomic_abort(&temp);
+        } else {
+            close(target_fd);
+        }
+        sync_done(args, file, paths, 0, COPY_NONE, NULL, 0);
+        return 0;
+    }
+
+    // 已完成的区间之间的空隙按分块大小切开；上次的分块大小可能不同，不要求对齐
+    off_t chunk_size = chunk_size_for(file->size, args->sched->count);
+    int max = (int)((file->size + chunk_size - 1) / chunk_size) + ndone + 1;
+    chunked_file_t *owner = malloc(sizeof(chunked_file_t) + max * sizeof(file_chunk_t));
+    file_info_t *items = malloc(max * sizeof(file_info_t));
+    if (!owner || !items) {
+        perror("malloc failed");
+        exit(1);
+    }
+    file_chunk_t *chunks = (file_chunk_t *)(owner + 1);
+    int count = 0;
+    off_t skipped = 0;
+    off_t pos = 0;
+    int next = 0;
+    while (pos < file->size) {
+        if (next < ndone && done[next].offset <= pos) {
+            off_t end = done[next].offset + done[next].length;
+            if (end > file->size) {
+                end = file->size;
+            }
+            if (end > pos) {
+                skipped += end - pos;
+                pos = end;
+            }
+            next++;
             continue;
         }
-        
-        snprintf(source_full_path, sizeof(source_full_path) - 1, "%s/%s", path, entry->d_name);
-        source_full_path[sizeof(source_full_path) - 1] = '\0';
-        
-        if (is_directory(source_full_path)) {
-            // ݹͬĿ¼
-            sync_directory_structure(source_full_path, config);
+        off_t end = next < ndone ? done[next].offset : file->size;
+        off_t len = end - pos < chunk_size ? end - pos : chunk_size;
+        chunks[count].owner = owner;
+        chunks[count].offset = pos;
+        items[count] = *file;
+        items[count].chunk = &chunks[count];
+        items[count].size = len;
+        count++;
+        pos += len;
+    }
+    free(done);
+
+    if (ndone > 0) {
+        args->resumed_files++;
+        args->resumed_bytes += skipped;
+        if (args->verbose) {
+            printf("线程 %d 断点续传: %s (已完成 %lld / %lld 字节)\n", args->thread_id,
+                   paths->source_path, (long long)skipped, (long long)file->size);
         }
     }
-    
-    closedir(dir);
+    // 上次所有分块都已写完，只差收尾
+    if (count == 0) {
+        close(source_fd);
+        close(target_fd);
+        free(owner);
+        free(items);
+        if (set_file_times(paths->target_path, file->atime_ns, file->mtime_ns) != 0) {
+            fprintf(stderr, "警告: 无法设置文件时间: %s\n", paths->target_path);
+        }
+        sync_done(args, file, paths, 1, COPY_FILE_RANGE, NULL, content_hash);
+        return 0;
+    }
+    metrics_add_bytes(skipped);
+
+    owner->file = *file;
+    owner->file.chunk = chunks;   // 标记为分块文件，size 仍为整个文件的大小
+    owner->paths = *paths;
+    owner->source_fd = source_fd;
+    owner->target_fd = target_fd;
+    owner->atomic = commit != NULL;
+    if (commit) {
+        owner->temp = temp;
+    }
+    owner->remaining = count;
+    owner->failed = 0;
+    owner->method = COPY_FILE_RANGE;
+    owner->content_hash = content_hash;
+    owner->path_hash = path_hash;
+
+    if (args->verbose) {
+        printf("线程 %d 分块: %s (%d 块，每块 %lld 字节)\n", args->thread_id,
+               paths->source_path, count, (long long)chunk_size);
+    }
+    sched_submit_local(args->sched, args->thread_id, items, count);
+    free(items);
+    return 1;
+}
+
+// 从内容相同的已复制文件 first 克隆出目标，文件系统不支持 reflink 时返回 0，由调用者照常复制
+static int dedup_clone(thread_args_t *args, const char *first, const file_info_t *file,
+                       const file_paths_t *paths, const struct stat *target_stat) {
+    if (__atomic_load_n(&args->dedup->no_clone, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    int source_fd = open(first, O_RDONLY);
+    if (source_fd < 0) {
+        return 0;
+    }
+    commit_batch_t *commit = thread_commit(args);
+    atomic_file_t temp;
+    int target_fd = open_target(commit, &temp, paths->target_path, target_stat);
+    if (target_fd < 0) {
+        close(source_fd);
+        return 0;
+    }
+    int cloned = copy_reflink(source_fd, target_fd) == 0;
+    if (!cloned && (errno == EOPNOTSUPP || errno == ENOTTY || errno == EXDEV || errno == EINVAL)) {
+        __atomic_store_n(&args->dedup->no_clone, 1, __ATOMIC_RELAXED);
+    }
+    close(source_fd);
+    if (commit) {
+        if (!cloned || !commit_temp(commit, &temp, file, paths->target_path)) {
+            atomic_abort(&temp);
+            return 0;
+        }
+        return 1;
+    }
+    close(target_fd);
+    if (cloned && set_file_times(paths->target_path, file->atime_ns, file->mtime_ns) != 0) {
+        fprintf(stderr, "警告: 无法设置文件时间: %s\n", paths->target_path);
+    }
+    return cloned;
+}
+
+// 逐段比较 first 与源文件，内容完全相同才返回 1
+static int dedup_same(const char *first, const file_info_t *file, const file_paths_t *paths) {
+    int source_fd = open_timed(paths->source_path, O_RDONLY);
+    if (source_fd < 0) {
+        return 0;
+    }
+    int first_fd = open(first, O_RDONLY);
+    struct stat first_stat;
+    int same = first_fd >= 0 && fstat(first_fd, &first_stat) == 0 &&
+               first_stat.st_size == file->size &&
+               hash_compare_fd(source_fd, first_fd, file->size, NULL) == 1;
+    if (first_fd >= 0) {
+        close(first_fd);
+    }
+    close(source_fd);
+    return same;
+}
+
+// 把目标硬链接到内容相同的已复制文件 first，先链接到临时名再改名覆盖目标
+static int dedup_link(const char *first, const file_paths_t *paths) {
+    char temp[MAX_PATH_LEN];
+    if (atomic_temp_name(paths->target_path, temp, sizeof(temp)) != 0 ||
+        linkat(AT_FDCWD, first, AT_FDCWD, temp, 0) != 0) {
+        return 0;
+    }
+    if (rename(temp, paths->target_path) != 0) {
+        unlink(temp);
+        return 0;
+    }
+    return 1;
+}
+
+// 去重：先与目标比较，不同时计算源文件的内容哈希（已知时不再读），
+// 本次已经复制过相同内容（大小和 64 位哈希都相同，再逐字节确认）的文件时从它克隆或链接，不再复制数据
+// 返回 0 表示已处理，-1 表示需要照常复制（目标已比较过、确实不同），
+// 此时 content_hash 返回源文件的哈希，复制后记入清单和索引
+static int sync_file_dedup(thread_args_t *args, const file_info_t *file, const file_paths_t *paths,
+                           int force, uint64_t *content_hash) {
+    struct stat target_stat;
+    int target_exists = stat_timed(paths->target_path, &target_stat) == 0;
+    uint64_t same_hash = 0;
+    if (!force && target_exists && compare_files(file, paths, &target_stat, &same_hash)) {
+        sync_done(args, file, paths, 1, COPY_NONE, NULL, same_hash ? same_hash : *content_hash);
+        return 0;
+    }
+
+    if (!*content_hash) {
+        int fd = open_timed(paths->source_path, O_RDONLY);
+        if (fd < 0) {
+            return -1;
+        }
+        if (hash_fd(fd, file->size, content_hash) != 0) {
+            *content_hash = 0;
+        }
+        close(fd);
+        if (!*content_hash) {
+            return -1;
+        }
+    }
+
+    char first[MAX_PATH_LEN];
+    if (!dedup_find(args->dedup, file->size, *content_hash, first, sizeof(first)) ||
+        strcmp(first, paths->target_path) == 0 || !dedup_same(first, file, paths)) {
+        return -1;
+    }
+    copy_method_t method = args->dedup_mode == DEDUP_LINK ? COPY_LINK : COPY_REFLINK;
+    if (method == COPY_LINK ? !dedup_link(first, paths) : !dedup_clone(args, first, file, paths, target_exists ? &target_stat : NULL)) {
+        return -1;
+    }
+    args->dedup_files++;
+    args->dedup_bytes += file->size;
+    if (args->verbose) {
+        printf("线程 %d 去重: %s => %s\n", args->thread_id, paths->source_path, first);
+    }
+    sync_done(args, file, paths, 1, method, NULL, *content_hash);
+    return 0;
 }
 
-// ޸ worker_thread  dry_run 
+// 工作线程：从调度器取任务，统计计数只写入本线程的参数结构
 void* worker_thread(void *arg) {
     thread_args_t *args = (thread_args_t *)arg;
-    file_list_t *file_list = args->file_list;
-    int dry_run = args->dry_run;  // ֶε thread_args_t
+    int dry_run = args->dry_run;
     
     if (args->thread_id == 0 && !dry_run) {
-        printf("߳ %d \n", args->thread_id);
+        printf("线程 %d 启动\n", args->thread_id);
     }
     
-    while (1) {
-        file_info_t *file = get_next_file(file_list);
-        if (!file) {
-            break;
+    if (args->uring && !dry_run) {
+        args->ring = uring_copy_create(URING_COPY_DEPTH, uring_done);
+        if (!args->ring && args->thread_id == 0) {
+            fprintf(stderr, "警告: 无法使用 io_uring (%s)，改用普通复制\n", strerror(errno));
         }
+    }
+    
+    // 持久模式下整批 syncfs 需要目标文件系统上的一个 fd
+    int sync_fd = -1;
+    if (args->atomic && !dry_run) {
+        if (args->durable) {
+            sync_fd = open(args->target_dir, O_RDONLY | O_DIRECTORY);
+            if (sync_fd < 0) {
+                fprintf(stderr, "警告: 无法打开目标目录 (%s)，改名后不保证落盘\n", strerror(errno));
+            }
+        }
+        commit_batch_init(&args->commit, sync_fd, commit_lost, args);
+    }
+    
+    file_info_t file;
+    file_paths_t paths;
+    while (sched_next(args->sched, args->thread_id, &file)) {
+        if (file.chunk) {
+            sync_chunk(args, &file);
+            continue;   // 目录引用由整个文件持有，最后一块完成时释放
+        }
+        args->files_processed++;
         
-        // ͳϢ
-        pthread_mutex_lock(args->stats_lock);
-        (*args->files_processed)++;
-        pthread_mutex_unlock(args->stats_lock);
-        
-        if (file->needs_sync) {
-            int result = sync_file(file->source_path, file->target_path, dry_run);
-            
-            pthread_mutex_lock(args->stats_lock);
-            if (result) {
-                (*args->files_synced)++;
-                if (args->thread_id == 0 && !dry_run) {
-                    printf("߳ %d ͬɹ: %s\n", args->thread_id, 
-                           get_relative_path("", file->source_path));
+        if (file.needs_sync && !file_paths(&file, args->target_dir, &paths)) {
+            fprintf(stderr, "路径过长: %s/%s\n", file.dir->source_path, file.name);
+            args->errors++;
+            metrics_file_done(file.size);
+        } else if (file.needs_sync) {
+            int changed = 0;
+            uint64_t content_hash = 0;
+            if (!dry_run && file.content_hash) {
+                changed = sync_times_only(&file, &paths, &content_hash);
+                if (changed > 0) {
+                    args->content_skipped++;
+                    metrics_file_done(file.size);
+                    record_manifest(args, &file, file.content_hash);
+                    dir_node_release(file.dir);
+                    continue;
                 }
+            }
+            if (!dry_run && !dir_node_ensure(file.dir, args->target_dir)) {
+                fprintf(stderr, "无法创建目录: %s\n", dir_node_rel(file.dir));
+                sync_done(args, &file, &paths, 0, COPY_NONE, NULL, 0);
             } else {
-                (*args->errors)++;
-                if (!dry_run) {
-                    fprintf(stderr, "߳ %d ͬʧ: %s\n", args->thread_id, 
-                            get_relative_path("", file->source_path));
+                int queued = -1;
+                int force = changed < 0;
+                if (args->dedup && !dry_run && file.size >= DEDUP_MIN_SIZE) {
+                    queued = sync_file_dedup(args, &file, &paths, force, &content_hash);
+                    force = 1;   // 没有去重时目标已比较过，确实不同
+                }
+                if (queued < 0 && !dry_run && args->chunk_threshold > 0 &&
+                    file.size > args->chunk_threshold) {
+                    queued = sync_file_chunked(args, &file, &paths, force, content_hash);
+                } else if (queued < 0 && args->ring) {
+                    queued = sync_file_uring(args, &file, &paths, force, content_hash);
+                }
+                if (queued > 0) {
+                    continue;   // 目录引用由 uring_done 或最后完成的分块释放
+                }
+                if (queued < 0) {
+                    copy_method_t method = COPY_NONE;
+                    delta_stats_t delta_stats = {0, 0, 0};
+                    int result = sync_file(&file, &paths, dry_run, args->delta, force,
+                                           thread_commit(args), &method, &delta_stats,
+                                           &content_hash);
+                    sync_done(args, &file, &paths, result, method, &delta_stats, content_hash);
                 }
             }
-            pthread_mutex_unlock(args->stats_lock);
+        }
+        dir_node_release(file.dir);
+    }
+    
+    // 等待环中剩余的文件完成
+    if (args->ring) {
+        uring_copy_destroy(args->ring);
+        args->ring = NULL;
+    }
+    
+    // 写出剩余的断点记录（其中推迟改名的文件先提交）
+    if (args->journal) {
+        journal_commit(args);
+    }
+    
+    // 提交本线程剩余的临时文件，提交失败的文件改记为错误并从清单中删去
+    if (args->atomic && !dry_run) {
+        commit_batch_free(&args->commit);
+        if (sync_fd >= 0) {
+            close(sync_fd);
+        }
+        manifest_builder_drop(&args->manifest, args->commit_lost, args->commit_lost_count);
+        free(args->commit_lost);
+        args->commit_lost = NULL;
+        if (args->commit.failed > 0) {
+            fprintf(stderr, "线程 %d: %d 个文件未能替换目标\n", args->thread_id, args->commit.failed);
+            args->files_synced -= args->commit.failed;
+            args->errors += args->commit.failed;
         }
     }
     
     if (args->thread_id == 0 && !dry_run) {
-        printf("߳ %d \n", args->thread_id);
+        printf("线程 %d 完成\n", args->thread_id);
     }
     
     return NULL;
 }
 
-// ӡͳϢ
-void print_stats(const sync_config_t *config, int total_files, int files_synced, int errors) {
-    printf("\n=== ͬͳ ===\n");
-    printf("ԴĿ¼: %s\n", config->source_dir);
-    printf("ĿĿ¼: %s\n", config->target_dir);
-    printf("߳: %d\n", config->thread_count);
-    printf("ļ: %d\n", total_files);
-    printf("ͬļ: %d\n", files_synced);
-    printf("ļ: %d\n", total_files - files_synced - errors);
-    printf(": %d\n", errors);
+// 打印统计信息
+void print_stats(const sync_config_t *config, int total_files, int files_synced, int errors,
+                 const int *method_counts, off_t delta_written, off_t delta_size, off_t saved_bytes) {
+    printf("\n=== 同步统计 ===\n");
+    printf("源目录: %s\n", config->source_dir);
+    printf("目标目录: %s\n", config->target_dir);
+    printf("线程数: %d\n", config->thread_count);
+    printf("总文件数: %d\n", total_files);
+    printf("同步文件数: %d\n", files_synced);
+    printf("跳过文件数: %d\n", total_files - files_synced - errors);
+    printf("错误数: %d\n", errors);
+    for (int m = COPY_NONE + 1; m < COPY_METHOD_COUNT; m++) {
+        if (method_counts[m] > 0) {
+            printf("复制方式 %s: %d\n", copy_method_name(m), method_counts[m]);
+        }
+    }
+    if (method_counts[COPY_DELTA] > 0) {
+        printf("增量改写字节数: %lld / %lld\n", (long long)delta_written, (long long)delta_size);
+    }
+    if (saved_bytes > 0) {
+        printf("硬链接和去重省去复制的字节数: %lld\n", (long long)saved_bytes);
+    }
     printf("===============\n");
 }
 
-// ִͬ
-// ޸ perform_sync 
+static void throttle_before(void *ctx, off_t bytes) {
+    throttle_acquire(ctx, bytes, 1);
+}
+
+static void throttle_after(void *ctx, off_t bytes, long long latency_ns) {
+    throttle_report(ctx, bytes, latency_ns);
+}
+
+// SIGHUP：重新读取限速控制文件
+static void reload_throttle(int sig) {
+    (void)sig;
+    if (sync_throttle) {
+        throttle_request_reload(sync_throttle);
+    }
+}
+
+// 执行同步
+// 修改 perform_sync 函数
 int perform_sync(const sync_config_t *config) {
-    printf("ʼͬ: %s -> %s\n", config->source_dir, config->target_dir);
+    printf("开始同步: %s -> %s\n", config->source_dir, config->target_dir);
     
     if (config->dry_run) {
-        printf("ģʽ - ʵʸļ\n");
+        printf("干运行模式 - 不会实际复制文件\n");
     }
     
-    printf("ʹ %d ߳\n", config->thread_count);
+    printf("使用 %d 个线程\n", config->thread_count);
     
-    // ϸԴĿ¼
+    // 严格检查源目录
     struct stat stat_buf;
     if (stat(config->source_dir, &stat_buf) != 0) {
-        fprintf(stderr, ": ԴĿ¼: %s\n", config->source_dir);
+        fprintf(stderr, "错误: 源目录不存在: %s\n", config->source_dir);
         return 0;
     }
     
     if (!S_ISDIR(stat_buf.st_mode)) {
-        fprintf(stderr, ": Դ·Ŀ¼: %s\n", config->source_dir);
+        fprintf(stderr, "错误: 源路径不是目录: %s\n", config->source_dir);
         return 0;
     }
     
-    // ڸģʽҲĿĿ¼ڲĿ¼ṹ
+    // 在干运行模式下也创建目标根目录用于测试目录结构
     if (!config->dry_run) {
         if (!create_directory(config->target_dir)) {
-            fprintf(stderr, ": ޷ĿĿ¼: %s\n", config->target_dir);
+            fprintf(stderr, "错误: 无法创建目标目录: %s\n", config->target_dir);
             return 0;
         }
     }
     
-    // ͬĿ¼ṹڸģʽֻӡϢ
-    if (config->dry_run) {
-        printf(": Ŀ¼ṹ\n");
-    } else {
-        printf("ͬĿ¼ṹ...\n");
-        sync_directory_structure(config->source_dir, config);
+    // 读入上次同步的清单，扫描时与清单相同的文件不再比较目标
+    char manifest_path[MAX_PATH_LEN + sizeof(MANIFEST_NAME) + 1];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/%s", config->target_dir, MANIFEST_NAME);
+    manifest_t manifest;
+    memset(&manifest, 0, sizeof(manifest));
+    if (!config->full_compare && manifest_open(&manifest, manifest_path, config->source_dir) != 0) {
+        fprintf(stderr, "警告: 无法读取清单: %s (%s)\n", manifest_path, strerror(errno));
     }
     
-    // ȡļб
-    printf("ɨļ...\n");
-    file_list_t file_list;
-    init_file_list(&file_list);
-    traverse_directory(config->source_dir, config->target_dir, &file_list);
-    
-    printf("ҵ %d ļҪ\n", file_list.count);
-    
-    if (file_list.count == 0) {
-        printf("ûļҪͬ\n");
-        free_file_list(&file_list);
-        return 1;
+    // 上次运行中断时留下的断点日志：其中完成的文件不再处理，大文件只复制未完成的分块。
+    // 日志只在写好清单后删除，所以有日志就说明上次没有正常结束
+    char journal_path[MAX_PATH_LEN + sizeof(JOURNAL_NAME) + 1];
+    snprintf(journal_path, sizeof(journal_path), "%s/%s", config->target_dir, JOURNAL_NAME);
+    journal_index_t resume;
+    memset(&resume, 0, sizeof(resume));
+    if (!config->dry_run && config->only_count == 0) {
+        if (journal_load(&resume, journal_path, config->source_dir) != 0) {
+            fprintf(stderr, "警告: 无法读取断点日志: %s (%s)\n", journal_path, strerror(errno));
+        } else if (resume.count > 0) {
+            printf("发现上次中断的断点日志: %zu 条记录，从中断处继续\n", resume.count);
+        }
+    }
+    journal_t journal;
+    int journaling = 0;
+    if (config->checkpoint && !config->dry_run && config->only_count == 0) {
+        if (journal_open(&journal, journal_path, config->source_dir) != 0) {
+            fprintf(stderr, "警告: 无法创建断点日志: %s (%s)\n", journal_path, strerror(errno));
+        } else {
+            journaling = 1;
+        }
     }
     
-    // ڸģʽ£ֻӡϢʵʴ߳
-    if (config->dry_run) {
-        printf("\nģʽ:\n");
-        printf("ͬļ:\n");
-        
-        for (int i = 0; i < file_list.count; i++) {
-            file_info_t *file = &file_list.files[i];
-            if (!compare_files(file->source_path, file->target_path)) {
-                printf("  %s -> %s\n", file->source_path, file->target_path);
-            }
+    // 先启动工作线程，扫描线程边遍历边提交文件，
+    // 目标目录在第一次放入文件时才创建
+    scheduler_t sched;
+    sched_init(&sched, config->thread_count);
+    dedup_index_t dedup;
+    dedup_init(&dedup);
+    
+    // 统计：各线程记录操作延迟，按需输出进度和报告；不启用时记录函数不读时钟
+    metrics_t metrics;
+    int use_metrics = config->progress_ms > 0 || config->report_path;
+    if (use_metrics) {
+        metrics_init(&metrics);
+        if (config->progress_ms > 0 && metrics_start_progress(&metrics, config->progress_ms) != 0) {
+            fprintf(stderr, "警告: 无法启动进度线程\n");
         }
-        
-        free_file_list(&file_list);
-        printf("\nģʽ - δʵʸκļ\n");
-        return 1;
     }
     
-    // ʵʵͬ루Ǹģʽ
-    // ʼͳϢ
-    int files_processed = 0;
-    int files_synced = 0;
-    int errors = 0;
-    pthread_mutex_t stats_lock;
-    pthread_mutex_init(&stats_lock, NULL);
+    // 限速：所有工作线程共享一个令牌桶，复制时每批数据写入前取配额
+    throttle_t throttle;
+    copy_hook_t hook = {throttle_before, throttle_after, &throttle};
+    struct sigaction old_hup;
+    throttle_init(&throttle, config->bwlimit, config->iops, config->max_latency_ms, config->limit_file);
+    if (throttle_active(&throttle) && !config->dry_run) {
+        sync_throttle = &throttle;
+        copy_set_hook(&hook);
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = reload_throttle;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGHUP, &sa, &old_hup);
+    }
     
-    // ߳
+    // 创建线程
     pthread_t threads[MAX_THREADS];
     thread_args_t thread_args[MAX_THREADS];
     
-    printf(" %d ߳...\n", config->thread_count);
+    printf("启动 %d 个工作线程...\n", config->thread_count);
     
+    int started = 0;
     for (int i = 0; i < config->thread_count; i++) {
+        memset(&thread_args[i], 0, sizeof(thread_args[i]));
         thread_args[i].thread_id = i;
-        thread_args[i].file_list = &file_list;
-        thread_args[i].files_processed = &files_processed;
-        thread_args[i].files_synced = &files_synced;
-        thread_args[i].errors = &errors;
-        thread_args[i].stats_lock = &stats_lock;
+        thread_args[i].sched = &sched;
         thread_args[i].dry_run = config->dry_run;
+        thread_args[i].verbose = config->verbose;
+        thread_args[i].delta = config->delta;
+        thread_args[i].target_dir = config->target_dir;
+        thread_args[i].uring = config->uring;
+        thread_args[i].chunk_threshold = config->chunk_threshold;
+        // 去重硬链接后多个目标路径共用一个 inode，改写时必须换成新文件而不是原地改写
+        thread_args[i].atomic = config->atomic || config->durable || config->dedup == DEDUP_LINK;
+        thread_args[i].durable = config->durable;
+        thread_args[i].dedup_mode = config->dedup;
+        thread_args[i].dedup = config->dedup ? &dedup : NULL;
+        thread_args[i].resume = resume.count > 0 ? &resume : NULL;
+        if (journaling) {
+            thread_args[i].journal = malloc(sizeof(journal_writer_t));
+            if (!thread_args[i].journal) {
+                perror("malloc failed");
+                exit(1);
+            }
+            journal_writer_init(thread_args[i].journal, &journal);
+        }
+        manifest_builder_init(&thread_args[i].manifest);
         
         if (pthread_create(&threads[i], NULL, worker_thread, &thread_args[i]) != 0) {
-            fprintf(stderr, "߳ %d ʧ\n", i);
-            free_file_list(&file_list);
-            pthread_mutex_destroy(&stats_lock);
-            return 0;
+            fprintf(stderr, "创建线程 %d 失败\n", i);
+            free(thread_args[i].journal);
+            break;
         }
+        started++;
     }
     
-    // ȴ߳
-    for (int i = 0; i < config->thread_count; i++) {
+    if (started == 0) {
+        sched_destroy(&sched);
+        dedup_free(&dedup);
+        manifest_close(&manifest);
+        journal_index_free(&resume);
+        if (journaling) {
+            journal_close(&journal);
+        }
+        if (sync_throttle) {
+            sigaction(SIGHUP, &old_hup, NULL);
+        }
+        copy_set_hook(NULL);
+        sync_throttle = NULL;
+        if (use_metrics) {
+            metrics_free(&metrics);
+        }
+        return 0;
+    }
+    
+    printf("扫描文件 (%d 个扫描线程)...\n", config->scan_threads);
+    scanner_t scanner;
+    int total_files = scan_tree(&scanner, config, &sched, &manifest, resume.count > 0 ? &resume : NULL);
+    sched_close(&sched);
+    if (use_metrics) {
+        metrics_scan_done();
+        metrics_mark(&metrics, "scan");
+    }
+    printf("扫描完成: %d 个目录, %d 个文件\n", scanner.dirs_found, total_files);
+    if (scanner.files_unchanged > 0) {
+        printf("清单中未变化的文件: %d\n", scanner.files_unchanged);
+    }
+    if (scanner.files_resumed > 0) {
+        printf("断点日志中已完成的文件: %d\n", scanner.files_resumed);
+    }
+    if (config->delete_extra) {
+        printf("镜像比较: 目标中新建 %d, 已存在 %d, %s %d\n", scanner.targets_missing,
+               scanner.targets_present, config->dry_run ? "需删除" : "已删除", scanner.targets_deleted);
+    }
+    
+    // 等待所有线程完成，再汇总各线程的计数
+    int files_synced = 0;
+    int errors = 0;
+    int method_counts[COPY_METHOD_COUNT] = {0};
+    off_t delta_written = 0;
+    off_t delta_size = 0;
+    int content_skipped = 0;
+    int commit_failed = 0;
+    int dedup_files = 0;
+    off_t saved_bytes = 0;
+    int resumed_files = 0;
+    off_t resumed_bytes = 0;
+    for (int i = 0; i < started; i++) {
         pthread_join(threads[i], NULL);
+        files_synced += thread_args[i].files_synced;
+        content_skipped += thread_args[i].content_skipped;
+        commit_failed += thread_args[i].commit.failed;
+        errors += thread_args[i].errors;
+        for (int m = 0; m < COPY_METHOD_COUNT; m++) {
+            method_counts[m] += thread_args[i].method_counts[m];
+        }
+        delta_written += thread_args[i].delta_written;
+        delta_size += thread_args[i].delta_size;
+        dedup_files += thread_args[i].dedup_files;
+        saved_bytes += thread_args[i].dedup_bytes;
+        resumed_files += thread_args[i].resumed_files;
+        resumed_bytes += thread_args[i].resumed_bytes;
+        free(thread_args[i].journal);
+    }
+    if (use_metrics) {
+        metrics_mark(&metrics, "sync");
+    }
+    sched_destroy(&sched);
+    dedup_free(&dedup);
+    manifest_close(&manifest);
+    journal_index_free(&resume);
+    if (resumed_files > 0) {
+        printf("从中断处继续的大文件: %d (跳过已复制的 %.1f MB)\n", resumed_files,
+               resumed_bytes / (1024.0 * 1024.0));
+    }
+    if (sync_throttle) {
+        sigaction(SIGHUP, &old_hup, NULL);
+        copy_set_hook(NULL);
+        sync_throttle = NULL;
+        printf("限速等待: %.2f 秒 (各线程累计), 自适应降速 %d 次\n",
+               throttle.waited_ns / 1e9, throttle.backoffs);
+    }
+    
+    // 第一个路径都已复制好，再链接同一 inode 的其余路径
+    if (config->hardlinks) {
+        scan_link_paths(&scanner);
+        files_synced += scanner.links_created;
+        errors += scanner.link_errors;
+        saved_bytes += scanner.link_bytes;
+        printf("硬链接: 新建 %d, 已存在 %d, 失败 %d\n", scanner.links_created,
+               scanner.links_existing, scanner.link_errors);
+        if (use_metrics) {
+            metrics_mark(&metrics, "link");
+        }
+    }
+    if (dedup_files > 0) {
+        printf("内容重复、从已复制文件%s的文件: %d\n",
+               config->dedup == DEDUP_LINK ? "链接" : "克隆", dedup_files);
     }
     
-    // ӡͳϢ
-    print_stats(config, file_list.count, files_synced, errors);
+    // 新清单 = 扫描时未变化的文件 + 本次同步成功的文件，失败的文件下次重新比较；
+    // 只同步部分路径时不知道其余文件的状态，保留原来的清单（其中改动过的文件下次照常比较）
+    if (!config->dry_run && config->only_count == 0) {
+        manifest_builder_t *parts[MAX_THREADS * 2 + 2];
+        int nparts = 0;
+        for (int i = 0; i < scanner.builder_count; i++) {
+            parts[nparts++] = &scanner.builders[i];
+        }
+        parts[nparts++] = &scanner.link_manifest;
+        // 整批提交失败的文件已由各线程从清单中删去，下次重新比较
+        for (int i = 0; i < started; i++) {
+            parts[nparts++] = &thread_args[i].manifest;
+        }
+        if (manifest_write(manifest_path, config->source_dir, parts, nparts) != 0) {
+            fprintf(stderr, "警告: 无法写入清单: %s (%s)\n", manifest_path, strerror(errno));
+        } else if (commit_failed == 0) {
+            // 清单已记下本次完成的一切，断点日志不再需要
+            if (unlink(journal_path) != 0 && errno != ENOENT) {
+                fprintf(stderr, "警告: 无法删除断点日志: %s (%s)\n", journal_path, strerror(errno));
+            }
+        }
+        if (use_metrics) {
+            metrics_mark(&metrics, "manifest");
+        }
+    }
+    
+    // 持久模式：新建的目录项和清单最后再一起落盘
+    if (config->durable && !config->dry_run) {
+        int fd = open(config->target_dir, O_RDONLY | O_DIRECTORY);
+        if (fd < 0 || syncfs(fd) != 0) {
+            fprintf(stderr, "警告: 无法同步目标文件系统 (%s)\n", strerror(errno));
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (use_metrics) {
+            metrics_mark(&metrics, "durable");
+        }
+    }
+    if (journaling) {
+        journal_close(&journal);
+    }
+    scan_free(&scanner);
+    for (int i = 0; i < started; i++) {
+        manifest_builder_free(&thread_args[i].manifest);
+    }
+    if (content_skipped > 0) {
+        printf("内容未变、只更新时间的文件: %d\n", content_skipped);
+    }
+    
+    // 各操作的延迟分布：据此判断慢在元数据（open/stat/utimes）、比较还是复制
+    if (use_metrics) {
+        printf("\n=== 操作延迟 ===\n");
+        metrics_print(&metrics, stdout);
+        if (config->report_path && metrics_write_report(&metrics, config->report_path) != 0) {
+            fprintf(stderr, "警告: 无法写入统计报告: %s (%s)\n", config->report_path, strerror(errno));
+        }
+        metrics_free(&metrics);
+    }
+    
+    if (total_files == 0) {
+        printf("没有文件需要同步\n");
+        return 1;
+    }
+    
+    if (config->dry_run) {
+        printf("\n干运行模式完成 - 未实际复制任何文件\n");
+        return 1;
+    }
     
-    // Դ
-    free_file_list(&file_list);
-    pthread_mutex_destroy(&stats_lock);
+    // 打印统计信息
+    print_stats(config, total_files, files_synced, errors, method_counts, delta_written, delta_size,
+                saved_bytes);
     
     if (errors > 0) {
-        fprintf(stderr, "ͬɣ %d \n", errors);
+        fprintf(stderr, "同步完成，但有 %d 个错误\n", errors);
         return 0;
     }
     
-    printf("ͬɹ\n");
+    printf("同步成功完成\n");
     return 1;
 }
@@ -12,78 +12,182 @@
 #include <errno.h>
 #include <pthread.h>
 #include <time.h>
-#include <sys/time.h>  //  timeval ṹ֧
+#include <sys/time.h>  // 添加 timeval 结构体支持
+#include "copy_engine.h"
+#include "delta.h"
+#include "hash.h"
+#include "manifest.h"
+#include "uring_copy.h"
+#include "atomic_file.h"
+#include "throttle.h"
+#include "metrics.h"
+#include "journal.h"
 
 #define MAX_PATH_LEN 1024
 #define MAX_FILES 10000
 #define BUFFER_SIZE 8192
 #define MAX_THREADS 64
+#define URING_MAX_FILE (1024 * 1024)   // 更大的文件仍用 copy_fd，可以在内核中复制
+#define CHUNK_THRESHOLD_MB 64         // 默认超过此大小的文件分块并行复制
+#define CHUNK_MIN_SIZE (8 * 1024 * 1024)
+#define CHUNK_ALIGN (1024 * 1024)
+#define DEDUP_MIN_SIZE (64 * 1024)    // 更小的文件直接复制，不值得先算一遍哈希
+#ifndef DEDUP_HASH_MASK
+#define DEDUP_HASH_MASK (~0ULL)       // 去重索引使用的哈希位，测试时编译为 0 让同样大小的文件都碰撞
+#endif
 
-// ļϢṹ
+// 去重方式
+#define DEDUP_OFF   0
+#define DEDUP_CLONE 1                 // reflink 共享已复制文件的数据块，文件系统不支持时照常复制
+#define DEDUP_LINK  2                 // 硬链接到已复制的文件（各路径共用同一组时间和权限）
+
+// 大文件的一个分块，定义见 sync_util.c
+typedef struct file_chunk file_chunk_t;
+
+// 文件名存放区，按块分配，已存入的名字地址不变
+typedef struct name_block {
+    struct name_block *next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} name_block_t;
+
+// 目录节点，同一目录下的文件共享，首次放入文件时才创建目标目录
+// 只保存源目录的完整路径，目标路径由目标根目录和相对部分拼出
 typedef struct {
-    char source_path[MAX_PATH_LEN];
-    char target_path[MAX_PATH_LEN];
-    off_t size;
+    char *source_path;
+    size_t rel_off;           // source_path 中相对源根目录部分的起点，根目录指向结尾
+    name_block_t *names;      // 目录中文件的文件名，只由扫描该目录的线程追加
+    int refcount;             // 扫描线程和尚未处理的文件各持有一个引用
+    int created;
+} dir_node_t;
+
+// 文件信息结构体：定长、不含路径缓冲区，完整路径在处理时才拼出
+typedef struct {
+    dir_node_t *dir;
+    const char *name;         // 指向 dir->names 中的文件名
+    off_t size;               // 以下为扫描时 stat 的结果，同步时不再重复获取
+    uint64_t ino;
+    int64_t atime_ns;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint64_t content_hash;    // 清单中记录的内容哈希（大小未变时），0 表示没有
+    file_chunk_t *chunk;      // 非空时为大文件的一个分块，size 为分块长度
+    mode_t mode;
     int needs_sync;
 } file_info_t;
 
-// ļбṹ
+// 工作线程处理一个文件时拼出的完整路径
 typedef struct {
-    file_info_t *files;
-    int count;
-    int capacity;
-    int current_index;
+    char source_path[MAX_PATH_LEN];
+    char target_path[MAX_PATH_LEN];
+} file_paths_t;
+
+// 去重索引：本次已复制好的目标文件，按 (大小, 内容哈希) 查找，所有工作线程共享
+typedef struct dedup_entry dedup_entry_t;
+typedef struct {
+    dedup_entry_t **buckets;
+    size_t mask;
+    size_t count;
+    int no_clone;             // 目标文件系统不支持 reflink，不再尝试克隆
     pthread_mutex_t lock;
-} file_list_t;
+} dedup_index_t;
 
-//  sync_util.h ޸ thread_args_t ṹ
+// 工作窃取调度器，定义见 sched.h
+typedef struct scheduler scheduler_t;
+
+// 线程参数，统计计数为线程私有，线程结束后再汇总
 typedef struct {
     int thread_id;
-    file_list_t *file_list;
-    int *files_processed;
-    int *files_synced;
-    int *errors;
-    pthread_mutex_t *stats_lock;
-    int dry_run;  // ֶ
+    scheduler_t *sched;
+    int files_processed;
+    int files_synced;
+    int errors;
+    int method_counts[COPY_METHOD_COUNT];   // 各复制方式使用的次数
+    int dry_run;  // 添加这个字段
+    int verbose;
+    int delta;
+    off_t delta_written;      // 增量传输实际写入的字节数
+    off_t delta_size;         // 增量传输处理的文件总字节数
+    int content_skipped;      // 只是时间变了、内容与清单一致的文件数
+    const char *target_dir;
+    manifest_builder_t manifest;   // 本线程同步成功的文件，最后合并写入清单
+    int uring;
+    uring_copy_t *ring;       // 本线程的 io_uring 实例，创建失败时为 NULL
+    off_t chunk_threshold;    // 超过此大小的文件分块复制，0 表示不分块
+    int atomic;               // 写临时文件再改名替换目标
+    int durable;
+    commit_batch_t commit;    // 本线程写好、等待改名的临时文件
+    uint64_t *commit_lost;    // 整批提交失败的文件的路径哈希，结束时从清单中删去
+    size_t commit_lost_count;
+    size_t commit_lost_cap;
+    int dedup_mode;           // DEDUP_*
+    dedup_index_t *dedup;
+    int dedup_files;          // 从已复制的文件克隆或链接的文件数
+    off_t dedup_bytes;        // 因此省去复制的字节数
+    const journal_index_t *resume;  // 上次中断时留下的记录，没有时为 NULL
+    journal_writer_t *journal;      // 本线程的断点记录，不写日志时为 NULL
+    int journal_failed;       // 上次写出记录时 commit.failed 的值
+    int resumed_files;        // 从中断处继续复制的大文件数
+    off_t resumed_bytes;      // 因此不必重新复制的字节数
 } thread_args_t;
 
-// ͬ
+// 同步配置
 typedef struct {
     char source_dir[MAX_PATH_LEN];
     char target_dir[MAX_PATH_LEN];
     int thread_count;
+    int scan_threads;
     int verbose;
     int dry_run;
+    int delta;                // 目标已存在时只改写变化的块
+    int full_compare;         // 不使用清单，逐个比较源和目标
+    int uring;                // 用 io_uring 异步复制小文件
+    off_t chunk_threshold;    // 超过此大小的文件拆成多个分块由多个线程复制，0 表示不拆分
+    int atomic;               // 先写同目录下的临时文件再改名替换目标，不做增量传输
+    int durable;              // 原子替换并保证落盘：整批 syncfs 后改名，再 fsync 目录
+    int delete_extra;         // 镜像模式：删除目标中源已不存在的文件和目录
+    int hardlinks;            // 保留源中的硬链接：同一 inode 只复制一次，其余路径在目标中链接
+    int dedup;                // DEDUP_*：内容相同的文件只复制第一个，其余克隆或链接
+    int64_t bwlimit;          // 限速：每秒最多读写的字节数，0 表示不限
+    int64_t iops;             // 限速：每秒最多的读写批次，0 表示不限
+    int max_latency_ms;       // 单批写入超过此延迟时自动降速，0 表示不启用
+    const char *limit_file;   // 限速控制文件，修改或收到 SIGHUP 时重新读取
+    int progress_ms;          // 每隔多少毫秒输出一行进度，0 表示不输出
+    const char *report_path;  // 结束时写出 JSON 统计报告，NULL 表示不写
+    int checkpoint;           // 写断点日志，中断后再次运行从未完成处继续
+    int watch_ms;             // 持续监视源目录，事件合并这么多毫秒后同步，0 表示同步一次后退出
+    int daemon;               // 转入后台作为守护进程运行，隐含持续监视
+    const char *const *only_paths;  // 只同步这些相对路径（文件或整棵子树），不更新清单
+    int only_count;           // 0 表示同步整个源目录
 } sync_config_t;
 
-// 
-// ļб
-void init_file_list(file_list_t *list);
-void free_file_list(file_list_t *list);
-void add_file_to_list(file_list_t *list, const char *source_path, const char *target_path, off_t size);
-file_info_t* get_next_file(file_list_t *list);
-
-// Ŀ¼
-void traverse_directory(const char *source_path, const char *target_path, file_list_t *list);
-
-// ļ
+// 函数声明
+// 文件操作
 int is_directory(const char *path);
 int file_exists(const char *path);
 off_t get_file_size(const char *path);
 time_t get_file_mtime(const char *path);
-int compare_files(const char *file1, const char *file2);
+int64_t timespec_ns(const struct timespec *ts);
+int compare_files(const file_info_t *source, const file_paths_t *paths, const struct stat *target_stat,
+                  uint64_t *source_hash);
 int create_directory(const char *path);
-int sync_file(const char *source_file, const char *target_file, int dry_run);
+int sync_file(const file_info_t *file, const file_paths_t *paths, int dry_run, int delta, int force,
+              commit_batch_t *commit, copy_method_t *method, delta_stats_t *delta_stats,
+              uint64_t *content_hash);
+int file_paths(const file_info_t *file, const char *target_dir, file_paths_t *paths);
 char* get_relative_path(const char *base, const char *full_path);
 
-// Ŀ¼ͬ
-void sync_directory_structure(const char *path, const sync_config_t *config);
-
-// ̺߳
+// 线程函数
 void* worker_thread(void *arg);
 
-// ͬ
+// 主同步函数
 int perform_sync(const sync_config_t *config);
-void print_stats(const sync_config_t *config, int total_files, int files_synced, int errors);
+void print_stats(const sync_config_t *config, int total_files, int files_synced, int errors,
+                 const int *method_counts, off_t delta_written, off_t delta_size, off_t saved_bytes);
+
+// 去重索引
+void dedup_init(dedup_index_t *index);
+void dedup_free(dedup_index_t *index);
 
 #endif
\ No newline at end of file
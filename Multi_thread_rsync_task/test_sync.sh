@@ -1,92 +1,93 @@
 #!/bin/bash
 
-# ߳ļͬԽű
+# 多线程文件同步程序测试脚本
 
 set -e
 
-# ɫ
+# 颜色定义
 RED='\033[0;31m'
 GREEN='\033[0;32m'
 YELLOW='\033[1;33m'
 NC='\033[0m' # No Color
 
-# 
+# 程序名称
 PROGRAM="./file_sync"
+SOURCES=(main.c sync_util.c sched.c scan.c watch.c ../sync_common/copy_engine.c ../sync_common/delta.c ../sync_common/hash.c ../sync_common/manifest.c ../sync_common/uring_copy.c ../sync_common/atomic_file.c ../sync_common/walk.c ../sync_common/throttle.c ../sync_common/metrics.c ../sync_common/journal.c)
 TEST_DIR="./test_dir"
 SOURCE_DIR="$TEST_DIR/source"
 TARGET_DIR="$TEST_DIR/target"
 
-# Ŀ¼ṹ
+# 创建测试目录结构
 create_test_structure() {
-    echo -e "${YELLOW}Ŀ¼ṹ...${NC}"
+    echo -e "${YELLOW}创建测试目录结构...${NC}"
     
-    # ɲĿ¼
+    # 清理旧测试目录
     rm -rf "$TEST_DIR"
     
-    # Ŀ¼ṹ
+    # 创建目录结构
     mkdir -p "$SOURCE_DIR/dir1"
     mkdir -p "$SOURCE_DIR/dir2/subdir"
     mkdir -p "$SOURCE_DIR/empty_dir"
     mkdir -p "$SOURCE_DIR/large_files"
     
-    # ļ
-    echo "ļ1" > "$SOURCE_DIR/file1.txt"
-    echo "ļ2ݣԳһЩ" > "$SOURCE_DIR/file2.txt"
-    echo "dir1еļ" > "$SOURCE_DIR/dir1/file3.txt"
-    echo "Ŀ¼еļ" > "$SOURCE_DIR/dir2/subdir/file4.txt"
+    # 创建测试文件
+    echo "这是文件1的内容" > "$SOURCE_DIR/file1.txt"
+    echo "这是文件2的内容，稍长一些" > "$SOURCE_DIR/file2.txt"
+    echo "dir1中的文件" > "$SOURCE_DIR/dir1/file3.txt"
+    echo "子目录中的文件" > "$SOURCE_DIR/dir2/subdir/file4.txt"
     
-    # СļڲԶ߳
+    # 创建多个小文件用于测试多线程
     for i in {1..20}; do
-        echo "ļ $i " > "$SOURCE_DIR/dir1/small_file_$i.txt"
+        echo "文件 $i 的内容" > "$SOURCE_DIR/dir1/small_file_$i.txt"
     done
     
-    # ϴļ
+    # 创建较大的文件
     dd if=/dev/zero of="$SOURCE_DIR/large_files/large1.bin" bs=1M count=2 2>/dev/null
     dd if=/dev/zero of="$SOURCE_DIR/large_files/large2.bin" bs=1M count=1 2>/dev/null
     
-    echo -e "${GREEN}Ŀ¼ṹ${NC}"
+    echo -e "${GREEN}测试目录结构创建完成${NC}"
 }
 
-# 
+# 编译程序
 compile_program() {
-    echo -e "${YELLOW}...${NC}"
-    gcc -std=c99 -Wall -Wextra -O2 -pthread -o file_sync main.c sync_util.c
+    echo -e "${YELLOW}编译程序...${NC}"
+    gcc -std=c99 -Wall -Wextra -O2 -pthread -I../sync_common -o file_sync "${SOURCES[@]}"
     if [ $? -ne 0 ]; then
-        echo -e "${RED}ʧ${NC}"
+        echo -e "${RED}编译失败${NC}"
         exit 1
     fi
-    echo -e "${GREEN}ɹ${NC}"
+    echo -e "${GREEN}编译成功${NC}"
 }
 
-# ܲ
+# 基本功能测试
 test_basic_function() {
-    echo -e "${YELLOW}Ի...${NC}"
+    echo -e "${YELLOW}测试基本功能...${NC}"
     
-    # ִͬ
+    # 执行同步
     $PROGRAM -t 4 "$SOURCE_DIR" "$TARGET_DIR"
     
-    # ͬ
+    # 检查同步结果
     if [ ! -d "$TARGET_DIR" ]; then
-        echo -e "${RED}: ĿĿ¼δ${NC}"
+        echo -e "${RED}错误: 目标目录未创建${NC}"
         return 1
     fi
     
-    # ļǷͬ
+    # 检查文件是否同步
     check_files_synced
     
-    echo -e "${GREEN}ܲͨ${NC}"
+    echo -e "${GREEN}基本功能测试通过${NC}"
 }
 
-# ̲߳
+# 多线程测试
 test_multithread() {
-    echo -e "${YELLOW}Զ̹߳...${NC}"
+    echo -e "${YELLOW}测试多线程功能...${NC}"
     
-    # ʹòͬ߳
+    # 使用不同线程数测试
     for threads in 1 2 4 8; do
-        echo -e "ʹ $threads ߳̽ͬ..."
+        echo -e "使用 $threads 个线程进行同步..."
         rm -rf "$TARGET_DIR"
         
-        # ִʱ
+        # 测量执行时间
         start_time=$(date +%s.%N)
         $PROGRAM -t $threads "$SOURCE_DIR" "$TARGET_DIR"
         end_time=$(date +%s.%N)
@@ -94,49 +95,626 @@ test_multithread() {
         execution_time=$(echo "$end_time - $start_time" | bc)
         
         if [ $? -ne 0 ]; then
-            echo -e "${RED}: $threads ߳ͬʧ${NC}"
+            echo -e "${RED}错误: $threads 个线程同步失败${NC}"
             return 1
         fi
         
         check_files_synced
-        echo -e "${GREEN}$threads ̲߳ͨ (ʱ: ${execution_time}s)${NC}"
+        echo -e "${GREEN}$threads 个线程测试通过 (耗时: ${execution_time}s)${NC}"
     done
 }
 
-# ͬ
+# 增量同步测试
 test_incremental_sync() {
-    echo -e "${YELLOW}ͬ...${NC}"
+    echo -e "${YELLOW}测试增量同步...${NC}"
     
-    # ޸Դļ
-    echo "޸ĺ" >> "$SOURCE_DIR/file1.txt"
+    # 修改源文件
+    echo "修改后的内容" >> "$SOURCE_DIR/file1.txt"
     touch "$SOURCE_DIR/dir1/file3.txt"
     
-    # ٴͬ
+    # 再次同步
     $PROGRAM -t 2 "$SOURCE_DIR" "$TARGET_DIR"
     
-    # ļǷ
+    # 检查文件是否更新
     if ! diff "$SOURCE_DIR/file1.txt" "$TARGET_DIR/file1.txt" > /dev/null; then
-        echo -e "${RED}: ͬʧ${NC}"
+        echo -e "${RED}错误: 增量同步失败${NC}"
         return 1
     fi
     
-    echo -e "${GREEN}ͬͨ${NC}"
+    echo -e "${GREEN}增量同步测试通过${NC}"
 }
 
-# Ŀ¼
+# 增量传输测试：大文件中改写少量字节、追加和截断后用 -D 同步
+test_delta_sync() {
+    echo -e "${YELLOW}测试增量传输...${NC}"
+    
+    local delta_src="$TEST_DIR/delta_source"
+    local delta_dst="$TEST_DIR/delta_target"
+    mkdir -p "$delta_src"
+    head -c 3000000 /dev/urandom > "$delta_src/image.bin"
+    head -c 2000000 /dev/urandom > "$delta_src/shrink.bin"
+    $PROGRAM -t 2 "$delta_src" "$delta_dst" >/dev/null
+    
+    printf 'XXXX' | dd of="$delta_src/image.bin" bs=1 seek=123457 conv=notrunc 2>/dev/null
+    printf 'YYYY' | dd of="$delta_src/image.bin" bs=1 seek=2500000 conv=notrunc 2>/dev/null
+    head -c 5000 /dev/urandom >> "$delta_src/image.bin"
+    truncate -s 1500000 "$delta_src/shrink.bin"
+    touch "$delta_src/image.bin" "$delta_src/shrink.bin"
+    
+    local output
+    output=$($PROGRAM -D -t 2 "$delta_src" "$delta_dst")
+    
+    for file in image.bin shrink.bin; do
+        if ! cmp -s "$delta_src/$file" "$delta_dst/$file"; then
+            echo -e "${RED}错误: 增量传输后 $file 内容不一致${NC}"
+            return 1
+        fi
+    done
+    
+    if ! echo "$output" | grep -q "复制方式 delta: 2"; then
+        echo -e "${RED}错误: 未使用增量传输${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}增量传输测试通过${NC}"
+}
+
+# 清单测试：未变化的文件由清单跳过，改动和只改时间的文件能正确处理
+test_manifest() {
+    echo -e "${YELLOW}测试同步清单...${NC}"
+    
+    local src="$TEST_DIR/manifest_source"
+    local dst="$TEST_DIR/manifest_target"
+    mkdir -p "$src/sub"
+    for i in {1..10}; do
+        echo "清单文件 $i" > "$src/sub/m$i.txt"
+    done
+    $PROGRAM -t 2 "$src" "$dst" >/dev/null
+    
+    if [ ! -f "$dst/.file_sync.manifest" ]; then
+        echo -e "${RED}错误: 未生成清单${NC}"
+        return 1
+    fi
+    
+    local output
+    output=$($PROGRAM -t 2 "$src" "$dst")
+    if ! echo "$output" | grep -q "清单中未变化的文件: 10"; then
+        echo -e "${RED}错误: 未使用清单跳过未变化的文件${NC}"
+        return 1
+    fi
+    
+    # 同样大小的新内容，以及内容不变只改时间
+    echo "清单文件 X" > "$src/sub/m1.txt"
+    touch -d "2001-01-01" "$src/sub/m2.txt"
+    output=$($PROGRAM -t 2 "$src" "$dst")
+    if ! cmp -s "$src/sub/m1.txt" "$dst/sub/m1.txt"; then
+        echo -e "${RED}错误: 清单未发现内容变化${NC}"
+        return 1
+    fi
+    if ! echo "$output" | grep -q "内容未变、只更新时间的文件: 1"; then
+        echo -e "${RED}错误: 只改时间的文件未按内容哈希跳过${NC}"
+        return 1
+    fi
+    if [ "$(stat -c %Y "$src/sub/m2.txt")" != "$(stat -c %Y "$dst/sub/m2.txt")" ]; then
+        echo -e "${RED}错误: 目标文件时间未更新${NC}"
+        return 1
+    fi
+    
+    # -F 忽略清单
+    output=$($PROGRAM -F -t 2 "$src" "$dst")
+    if echo "$output" | grep -q "清单中未变化的文件"; then
+        echo -e "${RED}错误: -F 仍使用了清单${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}同步清单测试通过${NC}"
+}
+
+# io_uring 复制测试：各种大小的文件，内核不支持时应自动改用普通复制
+test_uring() {
+    echo -e "${YELLOW}测试 io_uring 复制...${NC}"
+    
+    local src="$TEST_DIR/uring_source"
+    local dst="$TEST_DIR/uring_target"
+    mkdir -p "$src/a/b" "$src/c"
+    : > "$src/empty.txt"
+    echo "小文件" > "$src/a/small.txt"
+    head -c 65536 /dev/urandom > "$src/a/b/exact.bin"
+    head -c 300000 /dev/urandom > "$src/c/medium.bin"
+    head -c 3000000 /dev/urandom > "$src/c/large.bin"
+    for i in {1..200}; do
+        echo "文件 $i" > "$src/a/b/f$i.txt"
+    done
+    
+    local output
+    output=$($PROGRAM -U -t 2 "$src" "$dst" 2>&1)
+    if ! diff -r -x .file_sync.manifest "$src" "$dst" > /dev/null; then
+        echo -e "${RED}错误: io_uring 复制后内容不一致${NC}"
+        return 1
+    fi
+    if ! echo "$output" | grep -q "无法使用 io_uring" && \
+       ! echo "$output" | grep -q "复制方式 io_uring"; then
+        echo -e "${RED}错误: 未使用 io_uring${NC}"
+        return 1
+    fi
+    if [ "$(stat -c %Y "$src/c/medium.bin")" != "$(stat -c %Y "$dst/c/medium.bin")" ]; then
+        echo -e "${RED}错误: 目标文件时间未同步${NC}"
+        return 1
+    fi
+    
+    # 再次同步：修改的文件被更新，只改时间的小文件按记录的内容哈希跳过
+    echo "修改后的小文件" > "$src/a/small.txt"
+    touch -d "2001-01-01" "$src/a/b/f1.txt"
+    output=$($PROGRAM -U -t 2 "$src" "$dst" 2>&1)
+    if ! cmp -s "$src/a/small.txt" "$dst/a/small.txt"; then
+        echo -e "${RED}错误: io_uring 增量同步失败${NC}"
+        return 1
+    fi
+    if ! echo "$output" | grep -q "内容未变、只更新时间的文件: 1"; then
+        echo -e "${RED}错误: io_uring 复制的文件未记录内容哈希${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}io_uring 复制测试通过${NC}"
+}
+
+# 内容比较测试：只改了时间的大文件按内容哈希判断相同，不再复制
+test_content_compare() {
+    echo -e "${YELLOW}测试内容比较...${NC}"
+    
+    local src="$TEST_DIR/compare_source"
+    local dst="$TEST_DIR/compare_target"
+    mkdir -p "$src"
+    head -c 3000000 /dev/urandom > "$src/same.bin"
+    head -c 3000000 /dev/urandom > "$src/changed.bin"
+    $PROGRAM -t 2 "$src" "$dst" >/dev/null
+    
+    touch -d "2001-01-01" "$src/same.bin"
+    printf 'X' | dd of="$src/changed.bin" bs=1 seek=2999999 conv=notrunc 2>/dev/null
+    touch -d "2001-01-01" "$src/changed.bin"
+    
+    local output
+    output=$($PROGRAM -F -v -t 2 "$src" "$dst")
+    if echo "$output" | grep -q "复制: .*same.bin"; then
+        echo -e "${RED}错误: 内容相同的大文件被重新复制${NC}"
+        return 1
+    fi
+    if ! cmp -s "$src/changed.bin" "$dst/changed.bin"; then
+        echo -e "${RED}错误: 末尾改动的大文件未同步${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}内容比较测试通过${NC}"
+}
+
+# 分块复制测试：超过阈值的大文件拆成多块由多个线程写入
+test_chunked_copy() {
+    echo -e "${YELLOW}测试大文件分块复制...${NC}"
+    
+    local src="$TEST_DIR/chunk_source"
+    local dst="$TEST_DIR/chunk_target"
+    mkdir -p "$src"
+    head -c 20000000 /dev/urandom > "$src/large.bin"
+    echo "small" > "$src/small.txt"
+    
+    local output
+    output=$($PROGRAM -v -C 1 -t 4 "$src" "$dst")
+    if ! echo "$output" | grep -q "分块: .*large.bin"; then
+        echo -e "${RED}错误: 大文件没有分块复制${NC}"
+        return 1
+    fi
+    if ! cmp -s "$src/large.bin" "$dst/large.bin" || ! cmp -s "$src/small.txt" "$dst/small.txt"; then
+        echo -e "${RED}错误: 分块复制的文件内容不一致${NC}"
+        return 1
+    fi
+    if [ "$(stat -c %Y "$src/large.bin")" != "$(stat -c %Y "$dst/large.bin")" ]; then
+        echo -e "${RED}错误: 分块复制后修改时间未同步${NC}"
+        return 1
+    fi
+    
+    # 文件变短后再次同步，目标应按新大小预分配
+    head -c 9000000 /dev/urandom > "$src/large.bin"
+    $PROGRAM -C 1 -t 4 "$src" "$dst" >/dev/null
+    if ! cmp -s "$src/large.bin" "$dst/large.bin"; then
+        echo -e "${RED}错误: 变短的大文件分块同步后不一致${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}大文件分块复制测试通过${NC}"
+}
+
+# 原子替换测试：目标被改名替换（inode 改变），不留下临时文件
+test_atomic_replace() {
+    echo -e "${YELLOW}测试原子替换...${NC}"
+    
+    local src="$TEST_DIR/atomic_source"
+    local dst="$TEST_DIR/atomic_target"
+    mkdir -p "$src/sub"
+    head -c 20000000 /dev/urandom > "$src/large.bin"
+    for i in $(seq 1 50); do
+        echo "file $i" > "$src/sub/f$i.txt"
+    done
+    $PROGRAM -A -t 4 "$src" "$dst" >/dev/null
+    if ! diff -r -x .file_sync.manifest "$src" "$dst" > /dev/null; then
+        echo -e "${RED}错误: 原子替换模式同步后内容不一致${NC}"
+        return 1
+    fi
+    
+    local old_large old_small
+    old_large=$(stat -c %i "$dst/large.bin")
+    old_small=$(stat -c %i "$dst/sub/f1.txt")
+    sleep 1
+    head -c 20000000 /dev/urandom > "$src/large.bin"
+    echo "changed" > "$src/sub/f1.txt"
+    
+    # 持久模式，同时走分块复制和 io_uring 两条路径
+    $PROGRAM -Y -U -C 1 -t 4 "$src" "$dst" >/dev/null
+    if ! cmp -s "$src/large.bin" "$dst/large.bin" || ! cmp -s "$src/sub/f1.txt" "$dst/sub/f1.txt"; then
+        echo -e "${RED}错误: 持久模式同步后内容不一致${NC}"
+        return 1
+    fi
+    if [ "$(stat -c %i "$dst/large.bin")" = "$old_large" ] || [ "$(stat -c %i "$dst/sub/f1.txt")" = "$old_small" ]; then
+        echo -e "${RED}错误: 目标文件被原地改写，而不是改名替换${NC}"
+        return 1
+    fi
+    if [ "$(stat -c %Y "$src/large.bin")" != "$(stat -c %Y "$dst/large.bin")" ]; then
+        echo -e "${RED}错误: 原子替换后修改时间未同步${NC}"
+        return 1
+    fi
+    if [ -n "$(find "$dst" -name '.*.??????' ! -name .file_sync.manifest)" ]; then
+        echo -e "${RED}错误: 目标目录中留下了临时文件${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}原子替换测试通过${NC}"
+}
+
+# 持久模式下推迟的改名失败时，只有失败的文件不记入清单，下次重新复制
+test_commit_failure() {
+    echo -e "${YELLOW}测试整批提交失败...${NC}"
+    
+    local src="$TEST_DIR/commit_fail_source"
+    local dst="$TEST_DIR/commit_fail_target"
+    mkdir -p "$src" "$dst/blocked"
+    echo "a" > "$src/a.txt"
+    echo "b" > "$src/b.txt"
+    echo "new" > "$src/blocked"
+    echo "keep" > "$dst/blocked/keep.txt"   # 目标处是非空目录，改名一定失败
+    
+    $PROGRAM -Y -t 2 "$src" "$dst" >/dev/null 2>&1
+    if [ ! -f "$dst/blocked/keep.txt" ] || ! cmp -s "$src/a.txt" "$dst/a.txt"; then
+        echo -e "${RED}错误: 提交失败的文件影响了其他文件${NC}"
+        return 1
+    fi
+    
+    rm -r "$dst/blocked"
+    local output
+    output=$($PROGRAM -t 2 "$src" "$dst" 2>&1)
+    if ! cmp -s "$src/blocked" "$dst/blocked"; then
+        echo -e "${RED}错误: 改名失败的文件被记入清单，下次没有重新复制${NC}"
+        return 1
+    fi
+    if ! echo "$output" | grep -q "同步文件数: 1"; then
+        echo -e "${RED}错误: 提交成功的文件没有记入清单${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}整批提交失败测试通过${NC}"
+}
+
+# 镜像模式测试：--delete 删除源中已不存在的文件和目录，干运行时只列出
+test_delete_mirror() {
+    echo -e "${YELLOW}测试镜像删除...${NC}"
+    
+    local src="$TEST_DIR/mirror_source"
+    local dst="$TEST_DIR/mirror_target"
+    mkdir -p "$src/sub/deep/deeper" "$src/gone_dir"
+    echo "keep" > "$src/keep.txt"
+    echo "old" > "$src/old.txt"
+    echo "b" > "$src/sub/b.txt"
+    echo "c" > "$src/sub/deep/c.txt"
+    echo "d" > "$src/sub/deep/deeper/d.txt"
+    $PROGRAM -t 2 "$src" "$dst" >/dev/null
+    
+    rm "$src/old.txt"
+    rm -r "$src/sub/deep" "$src/gone_dir"
+    echo "extra" > "$dst/sub/extra.txt"
+    
+    local output
+    output=$($PROGRAM -n --delete -t 2 "$src" "$dst")
+    if ! echo "$output" | grep -q "删除 .*old.txt" || [ ! -f "$dst/old.txt" ] || [ ! -d "$dst/sub/deep" ]; then
+        echo -e "${RED}错误: 干运行模式应只列出要删除的条目${NC}"
+        return 1
+    fi
+    
+    $PROGRAM --delete -t 2 "$src" "$dst" >/dev/null
+    if [ -e "$dst/old.txt" ] || [ -e "$dst/sub/deep" ] || [ -e "$dst/gone_dir" ] || [ -e "$dst/sub/extra.txt" ]; then
+        echo -e "${RED}错误: 源中已删除的条目仍在目标中${NC}"
+        return 1
+    fi
+    if [ ! -f "$dst/.file_sync.manifest" ] || ! diff -r -x .file_sync.manifest "$src" "$dst" > /dev/null; then
+        echo -e "${RED}错误: 镜像同步后目标与源不一致${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}镜像删除测试通过${NC}"
+}
+
+# 硬链接与去重测试
+test_hardlink_dedup() {
+    echo -e "${YELLOW}测试硬链接与去重...${NC}"
+    
+    local src="$TEST_DIR/link_source"
+    local dst="$TEST_DIR/link_target"
+    mkdir -p "$src/a" "$src/b"
+    dd if=/dev/urandom of="$src/a/data.bin" bs=1K count=256 2>/dev/null
+    ln "$src/a/data.bin" "$src/b/link.bin"
+    cp "$src/a/data.bin" "$src/b/copy.bin"
+    
+    local output
+    output=$($PROGRAM -H --dedup=link -t 1 "$src" "$dst")
+    local a=$(stat -c %i "$dst/a/data.bin")
+    if [ "$a" != "$(stat -c %i "$dst/b/link.bin")" ] || [ "$a" != "$(stat -c %i "$dst/b/copy.bin")" ]; then
+        echo -e "${RED}错误: 硬链接或重复内容没有链接到同一文件${NC}"
+        return 1
+    fi
+    if ! echo "$output" | grep -q "省去复制的字节数: 524288"; then
+        echo -e "${RED}错误: 没有报告省去的字节数${NC}"
+        return 1
+    fi
+    if ! diff -r -x .file_sync.manifest "$src" "$dst" > /dev/null; then
+        echo -e "${RED}错误: 目标与源不一致${NC}"
+        return 1
+    fi
+    
+    # 再次同步时链接已存在，不再复制
+    output=$($PROGRAM -H --dedup=link -t 1 "$src" "$dst")
+    if ! echo "$output" | grep -q "同步文件数: 0"; then
+        echo -e "${RED}错误: 已链接的文件被重新同步${NC}"
+        return 1
+    fi
+    
+    # 去重链接后改动其中一个源文件，各种原地写入的方式都要先断开链接，不能改到另一个目标
+    local case opts count
+    for case in "none:256" "-D:2048" "-U:256" "-C 1:2048"; do
+        opts=${case%%:*}
+        count=${case##*:}
+        [ "$opts" = none ] && opts=""
+        rm -rf "$src" "$dst"
+        mkdir -p "$src"
+        dd if=/dev/urandom of="$src/x.bin" bs=1K count=$count 2>/dev/null
+        cp "$src/x.bin" "$src/y.bin"
+        $PROGRAM --dedup=link -t 1 "$src" "$dst" >/dev/null
+        if [ "$(stat -c %i "$dst/x.bin")" != "$(stat -c %i "$dst/y.bin")" ]; then
+            echo -e "${RED}错误: 重复内容没有链接到同一文件${NC}"
+            return 1
+        fi
+        printf 'changed' | dd of="$src/y.bin" bs=1 seek=100 conv=notrunc 2>/dev/null
+        $PROGRAM $opts -t 2 "$src" "$dst" >/dev/null
+        if ! cmp -s "$src/x.bin" "$dst/x.bin" || ! cmp -s "$src/y.bin" "$dst/y.bin"; then
+            echo -e "${RED}错误: 改写硬链接的目标时波及了其他路径 (选项: ${opts:-无})${NC}"
+            return 1
+        fi
+    done
+    
+    echo -e "${GREEN}硬链接与去重测试通过${NC}"
+}
+
+# 去重哈希碰撞测试：去重索引的哈希编译为 0，同样大小的文件都算作重复，
+# 内容不同的不能克隆或链接
+test_dedup_collision() {
+    echo -e "${YELLOW}测试去重哈希碰撞...${NC}"
+    
+    local program="$TEST_DIR/file_sync_collide"
+    if ! gcc -std=c99 -Wall -Wextra -O2 -pthread -I../sync_common -DDEDUP_HASH_MASK=0 \
+         -o "$program" "${SOURCES[@]}"; then
+        echo -e "${RED}错误: 编译失败${NC}"
+        return 1
+    fi
+    
+    local mode
+    for mode in link clone; do
+        local src="$TEST_DIR/collide_source_$mode"
+        local dst="$TEST_DIR/collide_target_$mode"
+        mkdir -p "$src"
+        dd if=/dev/urandom of="$src/a.bin" bs=1K count=128 2>/dev/null
+        dd if=/dev/urandom of="$src/b.bin" bs=1K count=128 2>/dev/null
+        cp "$src/a.bin" "$src/c.bin"
+        
+        local output
+        output=$("$program" --dedup=$mode -t 1 "$src" "$dst")
+        if ! diff -r -x .file_sync.manifest "$src" "$dst" > /dev/null; then
+            echo -e "${RED}错误: $mode 模式下碰撞的文件写入了错误的内容${NC}"
+            return 1
+        fi
+        if [ "$mode" = link ] &&
+           [ "$(stat -c %i "$dst/b.bin")" = "$(stat -c %i "$dst/a.bin")" -o \
+             "$(stat -c %i "$dst/b.bin")" = "$(stat -c %i "$dst/c.bin")" ]; then
+            echo -e "${RED}错误: 内容不同的文件链接到了同一文件${NC}"
+            return 1
+        fi
+        if [ "$mode" = link ] && ! echo "$output" | grep -q "省去复制的字节数: 131072"; then
+            echo -e "${RED}错误: 内容相同的文件没有链接${NC}"
+            return 1
+        fi
+    done
+    
+    echo -e "${GREEN}去重哈希碰撞测试通过${NC}"
+}
+
+# 限速测试
+test_throttle() {
+    echo -e "${YELLOW}测试限速...${NC}"
+    
+    local src="$TEST_DIR/throttle_source"
+    mkdir -p "$src"
+    dd if=/dev/urandom of="$src/data.bin" bs=1M count=3 2>/dev/null
+    
+    # 3MB 限速 2MB/s，扣除突发量后至少要 1 秒多
+    local start=$(date +%s%N)
+    $PROGRAM --bwlimit=2M -t 2 "$src" "$TEST_DIR/throttle_target" >/dev/null
+    local elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+    if [ $elapsed -lt 1200 ] || ! cmp -s "$src/data.bin" "$TEST_DIR/throttle_target/data.bin"; then
+        echo -e "${RED}错误: 带宽限制没有生效 (${elapsed}ms)${NC}"
+        return 1
+    fi
+    
+    # 控制文件中的值覆盖命令行参数
+    echo "bwlimit=100M iops=0" > "$TEST_DIR/throttle.conf"
+    start=$(date +%s%N)
+    $PROGRAM --bwlimit=1M --limit-file="$TEST_DIR/throttle.conf" -t 2 "$src" "$TEST_DIR/throttle_target2" >/dev/null
+    elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+    if [ $elapsed -ge 2000 ]; then
+        echo -e "${RED}错误: 控制文件中的限速没有生效 (${elapsed}ms)${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}限速测试通过 (${elapsed}ms)${NC}"
+}
+
+# 进度与统计报告测试
+test_metrics_report() {
+    echo -e "${YELLOW}测试进度与统计报告...${NC}"
+    
+    local src="$TEST_DIR/metrics_source"
+    local report="$TEST_DIR/report.json"
+    mkdir -p "$src/sub"
+    for i in $(seq 1 20); do
+        echo "metrics $i" > "$src/sub/file$i.txt"
+    done
+    
+    local output
+    output=$($PROGRAM --progress=50 --report="$report" -t 2 "$src" "$TEST_DIR/metrics_target" 2>&1)
+    if [ ! -f "$report" ] || ! grep -q '"files_done": 20' "$report"; then
+        echo -e "${RED}错误: 统计报告缺失或文件数不对${NC}"
+        return 1
+    fi
+    for op in open stat copy utimes; do
+        if ! grep -q "\"$op\": {\"count\": [1-9]" "$report"; then
+            echo -e "${RED}错误: 报告中没有 $op 的延迟分布${NC}"
+            return 1
+        fi
+    done
+    if ! grep -q '"scan":' "$report" || ! grep -q '"busiest_op":' "$report" || ! echo "$output" | grep -q "操作延迟"; then
+        echo -e "${RED}错误: 报告缺少阶段耗时${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}进度与统计报告测试通过${NC}"
+}
+
+# 断点续传测试
+test_checkpoint() {
+    echo -e "${YELLOW}测试断点续传...${NC}"
+    
+    local src="$TEST_DIR/checkpoint_source"
+    local dst="$TEST_DIR/checkpoint_target"
+    mkdir -p "$src/sub"
+    for i in $(seq 1 5); do
+        echo "checkpoint $i" > "$src/sub/file$i.txt"
+    done
+    dd if=/dev/urandom of="$src/big.bin" bs=1M count=48 2>/dev/null
+    
+    # 48MB 分成 8MB 的块、限速 8MB/s 约需 6 秒；日志至少 2 秒写出一次，4.5 秒时强行中断
+    $PROGRAM --checkpoint --bwlimit=8M -C 8 -t 2 "$src" "$dst" >/dev/null 2>&1 &
+    local pid=$!
+    sleep 4.5
+    kill -9 $pid 2>/dev/null
+    wait $pid 2>/dev/null
+    if [ ! -s "$dst/.file_sync.manifest.journal" ]; then
+        echo -e "${RED}错误: 中断后没有留下断点日志${NC}"
+        return 1
+    fi
+    
+    local output
+    output=$($PROGRAM -v -C 8 -t 2 "$src" "$dst" 2>&1)
+    if ! echo "$output" | grep -q "断点日志中已完成的文件: 5" ||
+       ! echo "$output" | grep -q "断点续传: .*big.bin"; then
+        echo -e "${RED}错误: 没有从中断处继续${NC}"
+        echo "$output"
+        return 1
+    fi
+    if ! cmp -s "$src/big.bin" "$dst/big.bin" || ! diff -r "$src/sub" "$dst/sub" >/dev/null; then
+        echo -e "${RED}错误: 续传后内容不一致${NC}"
+        return 1
+    fi
+    if [ -e "$dst/.file_sync.manifest.journal" ]; then
+        echo -e "${RED}错误: 同步完成后断点日志没有删除${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}断点续传测试通过${NC}"
+}
+
+# 持续同步测试
+test_watch() {
+    echo -e "${YELLOW}测试持续同步...${NC}"
+    
+    local src="$TEST_DIR/watch_source"
+    local dst="$TEST_DIR/watch_target"
+    mkdir -p "$src/keep/sub"
+    echo "keep" > "$src/keep/sub/file.txt"
+    echo "old" > "$src/old.txt"
+    
+    $PROGRAM --watch=50 --delete -t 2 "$src" "$dst" >/dev/null 2>&1 &
+    local pid=$!
+    local i
+    for i in $(seq 1 50); do
+        [ -f "$dst/keep/sub/file.txt" ] && break
+        sleep 0.1
+    done
+    
+    # 新文件应在一秒内出现在目标中
+    local start=$(date +%s%N)
+    echo "new" > "$src/new.txt"
+    for i in $(seq 1 100); do
+        [ -f "$dst/new.txt" ] && break
+        sleep 0.01
+    done
+    local latency=$(( ($(date +%s%N) - start) / 1000000 ))
+    
+    # 新建目录树、删除文件、目录改名后修改其中的文件
+    mkdir -p "$src/made/deep"
+    echo "deep" > "$src/made/deep/file.txt"
+    rm "$src/old.txt"
+    mv "$src/keep" "$src/moved"
+    echo "changed" >> "$src/moved/sub/file.txt"
+    sleep 1
+    kill -TERM $pid
+    wait $pid
+    local rc=$?
+    
+    if [ $latency -ge 1000 ] || [ ! -f "$dst/new.txt" ]; then
+        echo -e "${RED}错误: 新文件没有及时同步 (${latency}ms)${NC}"
+        return 1
+    fi
+    if ! diff -r -x .file_sync.manifest "$src" "$dst" > /dev/null 2>&1 || [ -e "$dst/old.txt" ] || [ -e "$dst/keep" ]; then
+        echo -e "${RED}错误: 持续同步后目录不一致${NC}"
+        diff -r -x .file_sync.manifest "$src" "$dst"
+        return 1
+    fi
+    if [ $rc -ne 0 ]; then
+        echo -e "${RED}错误: 收到 SIGTERM 后没有正常退出 ($rc)${NC}"
+        return 1
+    fi
+    
+    echo -e "${GREEN}持续同步测试通过 (${latency}ms)${NC}"
+}
+
+# 空目录测试
 test_empty_directory() {
-    echo -e "${YELLOW}ԿĿ¼ͬ...${NC}"
+    echo -e "${YELLOW}测试空目录同步...${NC}"
     
-    # Ŀ¼Ƿͬ
+    # 检查空目录是否同步
     if [ ! -d "$TARGET_DIR/empty_dir" ]; then
-        echo -e "${RED}: Ŀ¼δͬ${NC}"
+        echo -e "${RED}错误: 空目录未同步${NC}"
         return 1
     fi
     
-    echo -e "${GREEN}Ŀ¼ͨ${NC}"
+    echo -e "${GREEN}空目录测试通过${NC}"
 }
 
-# ļǷͬ
+# 检查文件是否同步
 check_files_synced() {
     local files=(
         "file1.txt"
@@ -147,76 +725,76 @@ check_files_synced() {
         "large_files/large2.bin"
     )
     
-    # Сļ
+    # 检查小文件
     for i in {1..20}; do
         files+=("dir1/small_file_$i.txt")
     done
     
     for file in "${files[@]}"; do
         if ! diff "$SOURCE_DIR/$file" "$TARGET_DIR/$file" > /dev/null; then
-            echo -e "${RED}: ļ $file ͬʧ${NC}"
+            echo -e "${RED}错误: 文件 $file 同步失败${NC}"
             return 1
         fi
     done
 }
 
-# 
+# 错误处理测试
 test_error_handling() {
-    echo -e "${YELLOW}Դ...${NC}"
+    echo -e "${YELLOW}测试错误处理...${NC}"
     
-    # ԲڵԴĿ¼
+    # 测试不存在的源目录
     $PROGRAM "/nonexistent/source" "$TARGET_DIR/error_test" >/dev/null 2>&1
     local exit_code=$?
     if [ $exit_code -eq 0 ]; then
-        echo -e "${RED}: Ӧü⵽ڵԴĿ¼${NC}"
+        echo -e "${RED}错误: 应该检测到不存在的源目录${NC}"
         return 1
     fi
     
-    # ļΪԴĿ¼
+    # 测试文件作为源目录
     $PROGRAM "$SOURCE_DIR/file1.txt" "$TARGET_DIR/error_test2" >/dev/null 2>&1
     exit_code=$?
     if [ $exit_code -eq 0 ]; then
-        echo -e "${RED}: Ӧü⵽ļΪԴĿ¼${NC}"
+        echo -e "${RED}错误: 应该检测到文件作为源目录${NC}"
         return 1
     fi
     
-    echo -e "${GREEN}ͨ${NC}"
+    echo -e "${GREEN}错误处理测试通过${NC}"
 }
 
-# ģʽ
+# 干运行模式测试
 test_dry_run() {
-    echo -e "${YELLOW}Ըģʽ...${NC}"
+    echo -e "${YELLOW}测试干运行模式...${NC}"
     
     rm -rf "$TARGET_DIR"
     
-    # ģʽӦôĿļ
+    # 干运行模式不应该创建目标文件
     $PROGRAM -n -t 2 "$SOURCE_DIR" "$TARGET_DIR" >/dev/null 2>&1
     
     if [ -d "$TARGET_DIR" ]; then
-        echo -e "${RED}: ģʽӦôļ${NC}"
+        echo -e "${RED}错误: 干运行模式不应该创建文件${NC}"
         return 1
     fi
     
-    echo -e "${GREEN}ģʽͨ${NC}"
+    echo -e "${GREEN}干运行模式测试通过${NC}"
 }
 
-# ܲ
+# 性能测试
 test_performance() {
-    echo -e "${YELLOW}ܲ...${NC}"
+    echo -e "${YELLOW}性能测试...${NC}"
     
     local many_files_dir="$TEST_DIR/many_files_source"
     local many_files_target="$TEST_DIR/many_files_target"
     
     mkdir -p "$many_files_dir"
     
-    # Сļ
-    echo "ļ..."
+    # 创建大量小文件
+    echo "创建大量测试文件..."
     for i in {1..100}; do
-        echo "ļ $i " > "$many_files_dir/file$i.txt"
+        echo "文件 $i 的内容" > "$many_files_dir/file$i.txt"
     done
     
-    # Բͬ߳
-    echo -e "ܶԱȲ:"
+    # 测试不同线程数的性能
+    echo -e "性能对比测试:"
     for threads in 1 2 4 8; do
         rm -rf "$many_files_target"
         
@@ -225,35 +803,49 @@ test_performance() {
         end_time=$(date +%s.%N)
         
         execution_time=$(echo "$end_time - $start_time" | bc)
-        echo -e "  ߳ $threads: ${execution_time}s"
+        echo -e "  线程数 $threads: ${execution_time}s"
     done
     
-    echo -e "${GREEN}ܲ${NC}"
+    echo -e "${GREEN}性能测试完成${NC}"
 }
 
-# 
+# 清理函数
 cleanup() {
-    echo -e "${YELLOW}ļ...${NC}"
+    echo -e "${YELLOW}清理测试文件...${NC}"
     rm -rf "$TEST_DIR"
     rm -f file_sync
-    echo -e "${GREEN}${NC}"
+    echo -e "${GREEN}清理完成${NC}"
 }
 
-# Ժ
+# 主测试函数
 main() {
-    echo -e "${YELLOW}ʼ߳ļͬ${NC}"
+    echo -e "${YELLOW}开始多线程文件同步程序测试${NC}"
     
-    # 
+    # 编译程序
     compile_program
     
-    # Խṹ
+    # 创建测试结构
     create_test_structure
     
-    # в
+    # 运行测试
     local tests=(
         test_basic_function
         test_multithread
         test_incremental_sync
+        test_delta_sync
+        test_manifest
+        test_uring
+        test_content_compare
+        test_chunked_copy
+        test_atomic_replace
+        test_commit_failure
+        test_delete_mirror
+        test_hardlink_dedup
+        test_dedup_collision
+        test_throttle
+        test_metrics_report
+        test_checkpoint
+        test_watch
         test_empty_directory
         test_error_handling
         test_dry_run
@@ -264,26 +856,26 @@ main() {
     
     for test_func in "${tests[@]}"; do
         if $test_func; then
-            echo -e "${GREEN}77 $test_func ͨ${NC}"
+            echo -e "${GREEN}✓ $test_func 通过${NC}"
         else
-            echo -e "${RED}71 $test_func ʧ${NC}"
+            echo -e "${RED}✗ $test_func 失败${NC}"
             ((failed_tests++))
         fi
         echo
     done
     
-    # ʾԽ
+    # 显示测试结果
     if [ $failed_tests -eq 0 ]; then
-        echo -e "${GREEN}вͨ! 95${NC}"
+        echo -e "${GREEN}所有测试通过! 🎉${NC}"
     else
-        echo -e "${RED}$failed_tests ʧ${NC}"
+        echo -e "${RED}$failed_tests 个测试失败${NC}"
     fi
     
-    # 
+    # 清理
     cleanup
     
     return $failed_tests
 }
 
-# в
+# 运行测试
 main
\ No newline at end of file
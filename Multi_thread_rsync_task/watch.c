@@ -0,0 +1,446 @@
+#define _GNU_SOURCE
+#include "watch.h"
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <signal.h>
+#include <syslog.h>
+#include <stdarg.h>
+
+// 不监视 IN_MODIFY：写入中的文件每次 write 都会产生事件，等关闭时的 IN_CLOSE_WRITE 即可
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | \
+                    IN_ATTRIB | IN_ONLYDIR)
+
+typedef struct {
+    const sync_config_t *config;
+    int fd;                   // inotify 实例
+    char **dirs;              // 下标为 wd，被监视目录相对源根目录的路径
+    int dirs_cap;
+    int watches;
+    int watch_full;           // 已提示过监视数达到上限
+    char **pending;           // 合并窗口内改动过的相对路径，可能重复
+    int npending;
+    int pending_cap;
+    int rescan;               // 事件队列溢出，下一批完整同步
+    int64_t first_ns;         // 这一批第一个和最后一个事件的时间
+    int64_t last_ns;
+} watcher_t;
+
+static int watch_syslog;      // 转入后台后日志写入 syslog
+static volatile sig_atomic_t watch_stop;
+
+static void watch_log(int priority, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    if (watch_syslog) {
+        vsyslog(priority, fmt, ap);
+    } else {
+        FILE *fp = priority <= LOG_WARNING ? stderr : stdout;
+        vfprintf(fp, fmt, ap);
+        fputc('\n', fp);
+        fflush(fp);
+    }
+    va_end(ap);
+}
+
+static void stop_watching(int sig) {
+    (void)sig;
+    watch_stop = 1;
+}
+
+// 拼出 dir/name，dir 为空串（源根目录）时就是 name。路径过长时返回 0
+static int join_rel(char *buf, size_t size, const char *dir, const char *name) {
+    int n = snprintf(buf, size, "%s%s%s", dir, *dir ? "/" : "", name);
+    return n > 0 && (size_t)n < size;
+}
+
+static char* dup_string(const char *s) {
+    char *p = strdup(s);
+    if (!p) {
+        perror("strdup failed");
+        exit(1);
+    }
+    return p;
+}
+
+static void set_dir(watcher_t *w, int wd, const char *rel) {
+    if (wd >= w->dirs_cap) {
+        int cap = w->dirs_cap ? w->dirs_cap : 1024;
+        while (cap <= wd) {
+            cap *= 2;
+        }
+        w->dirs = realloc(w->dirs, cap * sizeof(char *));
+        if (!w->dirs) {
+            perror("realloc failed");
+            exit(1);
+        }
+        memset(w->dirs + w->dirs_cap, 0, (cap - w->dirs_cap) * sizeof(char *));
+        w->dirs_cap = cap;
+    }
+    // 同一目录再次添加（例如改名后）得到同一个 wd，只更新路径
+    if (w->dirs[wd]) {
+        free(w->dirs[wd]);
+    } else {
+        w->watches++;
+    }
+    w->dirs[wd] = dup_string(rel);
+}
+
+// 监视 rel 及其下所有子目录。先加监视再读目录，读的过程中新建的子目录不会漏掉；
+// 指向目录的符号链接不进入，其中的改动由完整同步补上
+static void watch_tree(watcher_t *w, const char *rel) {
+    char path[MAX_PATH_LEN];
+    if (!join_rel(path, sizeof(path), w->config->source_dir, rel)) {
+        return;
+    }
+    if (!*rel) {
+        snprintf(path, sizeof(path), "%s", w->config->source_dir);
+    }
+    int wd = inotify_add_watch(w->fd, path, WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC && !w->watch_full) {
+            w->watch_full = 1;
+            watch_log(LOG_WARNING, "警告: 监视的目录数达到上限 (fs.inotify.max_user_watches)，"
+                      "%s 等目录中的改动要等到下次完整同步", path);
+        }
+        return;
+    }
+    set_dir(w, wd, rel);
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+    struct dirent *entry;
+    char child[MAX_PATH_LEN];
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        int is_dir = entry->d_type == DT_DIR;
+        struct stat st;
+        if (entry->d_type == DT_UNKNOWN && fstatat(dirfd(dir), entry->d_name, &st,
+                                                   AT_SYMLINK_NOFOLLOW) == 0) {
+            is_dir = S_ISDIR(st.st_mode);
+        }
+        if (is_dir && join_rel(child, sizeof(child), rel, entry->d_name)) {
+            watch_tree(w, child);
+        }
+    }
+    closedir(dir);
+}
+
+// 目录移出了 rel：不再监视它和它的子目录，内核随后发来 IN_IGNORED 时释放路径
+static void unwatch_tree(watcher_t *w, const char *rel) {
+    size_t len = strlen(rel);
+    for (int wd = 0; wd < w->dirs_cap; wd++) {
+        const char *dir = w->dirs[wd];
+        if (dir && strncmp(dir, rel, len) == 0 && (dir[len] == '\0' || dir[len] == '/')) {
+            inotify_rm_watch(w->fd, wd);
+        }
+    }
+}
+
+static void pending_add(watcher_t *w, const char *rel) {
+    if (w->npending == w->pending_cap) {
+        w->pending_cap = w->pending_cap ? w->pending_cap * 2 : 256;
+        w->pending = realloc(w->pending, w->pending_cap * sizeof(char *));
+        if (!w->pending) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    w->pending[w->npending++] = dup_string(rel);
+}
+
+static void pending_clear(watcher_t *w) {
+    for (int i = 0; i < w->npending; i++) {
+        free(w->pending[i]);
+    }
+    w->npending = 0;
+    w->rescan = 0;
+}
+
+// 记下一批事件开始和最近一次的时间
+static void note_event(watcher_t *w) {
+    int64_t now = metrics_now_ns();
+    if (w->npending == 0 && !w->rescan) {
+        w->first_ns = now;
+    }
+    w->last_ns = now;
+}
+
+static void handle_event(watcher_t *w, const struct inotify_event *ev) {
+    if (ev->mask & IN_Q_OVERFLOW) {
+        note_event(w);
+        w->rescan = 1;
+        return;
+    }
+    if (ev->wd < 0 || ev->wd >= w->dirs_cap || !w->dirs[ev->wd]) {
+        return;
+    }
+    if (ev->mask & IN_IGNORED) {
+        free(w->dirs[ev->wd]);
+        w->dirs[ev->wd] = NULL;
+        w->watches--;
+        return;
+    }
+    if (ev->len == 0) {
+        return;   // 目录自身的事件，父目录中会有对应的事件
+    }
+
+    char rel[MAX_PATH_LEN];
+    if (!join_rel(rel, sizeof(rel), w->dirs[ev->wd], ev->name)) {
+        return;
+    }
+    if (ev->mask & IN_ISDIR) {
+        // 目录的属性不同步，只关心新建、移入和删除、移出
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+            watch_tree(w, rel);
+        } else if (ev->mask & IN_MOVED_FROM) {
+            unwatch_tree(w, rel);
+        } else if (!(ev->mask & IN_DELETE)) {
+            return;
+        }
+    }
+    note_event(w);
+    pending_add(w, rel);
+}
+
+static int rel_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// 列表中是否有 rel 的上级目录（列表已排序）
+static int has_ancestor(char **list, int n, const char *rel) {
+    char prefix[MAX_PATH_LEN];
+    for (const char *slash = strchr(rel, '/'); slash; slash = strchr(slash + 1, '/')) {
+        snprintf(prefix, sizeof(prefix), "%.*s", (int)(slash - rel), rel);
+        const char *key = prefix;
+        if (bsearch(&key, list, n, sizeof(char *), rel_cmp)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 排序去重，去掉上级目录也在列表中的路径（整棵子树会重新扫描）
+static void pending_normalize(watcher_t *w) {
+    qsort(w->pending, w->npending, sizeof(char *), rel_cmp);
+    int n = 0;
+    for (int i = 0; i < w->npending; i++) {
+        if (n > 0 && strcmp(w->pending[n - 1], w->pending[i]) == 0) {
+            free(w->pending[i]);
+        } else {
+            w->pending[n++] = w->pending[i];
+        }
+    }
+    // 上级目录排在前面，逐个判断时只看已保留的路径
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        if (has_ancestor(w->pending, kept, w->pending[i])) {
+            free(w->pending[i]);
+        } else {
+            w->pending[kept++] = w->pending[i];
+        }
+    }
+    w->npending = kept;
+}
+
+// 改动的路径太多时不逐个处理，改为重新扫描它们所在的目录；
+// 有改动在源根目录下时就是完整同步
+static void pending_collapse(watcher_t *w) {
+    for (int i = 0; i < w->npending; i++) {
+        char *slash = strrchr(w->pending[i], '/');
+        if (!slash) {
+            w->rescan = 1;
+            return;
+        }
+        *slash = '\0';
+    }
+    pending_normalize(w);
+}
+
+// 同步这一批改动
+static void watch_flush(watcher_t *w) {
+    int64_t start = metrics_now_ns();
+    sync_config_t batch = *w->config;
+    pending_normalize(w);
+    if (!w->rescan && w->npending > WATCH_MAX_PENDING) {
+        pending_collapse(w);
+    }
+
+    const char *what;
+    int count = w->npending;
+    int ok;
+    if (w->rescan) {
+        // 溢出时新建的目录可能还没有监视，重新加一遍（已监视的只更新路径）
+        what = "完整同步";
+        watch_tree(w, "");
+        ok = perform_sync(&batch);
+    } else {
+        what = "同步改动";
+        batch.only_paths = (const char *const *)w->pending;
+        batch.only_count = w->npending;
+        ok = perform_sync(&batch);
+    }
+    int64_t now = metrics_now_ns();
+    watch_log(ok ? LOG_INFO : LOG_WARNING, "%s%s: %d 个路径，耗时 %.0f ms，距第一个事件 %.0f ms",
+              what, ok ? "完成" : "有错误", count, (now - start) / 1e6, (now - w->first_ns) / 1e6);
+    pending_clear(w);
+}
+
+int watch_sync(const sync_config_t *config) {
+    if (!is_directory(config->source_dir)) {
+        watch_log(LOG_ERR, "错误: 源目录不存在: %s", config->source_dir);
+        return 0;
+    }
+
+    watcher_t w;
+    memset(&w, 0, sizeof(w));
+    w.config = config;
+    w.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w.fd < 0) {
+        watch_log(LOG_ERR, "错误: 无法创建 inotify 实例 (%s)", strerror(errno));
+        return 0;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_watching;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;   // 工作线程中的读写不被打断；poll 不论如何都会返回 EINTR
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    // 先加监视再做初次同步，同步期间的改动会在之后补上
+    watch_tree(&w, "");
+    watch_log(LOG_INFO, "监视 %s 下 %d 个目录，开始初次同步", config->source_dir, w.watches);
+    if (!perform_sync(config)) {
+        watch_log(LOG_WARNING, "初次同步有错误，继续监视");
+    }
+
+    char *buf = malloc(WATCH_EVENT_BUFFER);
+    if (!buf) {
+        perror("malloc failed");
+        exit(1);
+    }
+    int64_t delay = (int64_t)config->watch_ms * 1000000;
+    int64_t max_delay = (int64_t)WATCH_MAX_DELAY_MS * 1000000;
+    if (max_delay < delay) {
+        max_delay = delay;
+    }
+    while (!watch_stop) {
+        // 有待同步的改动时只等到合并窗口结束
+        int timeout = -1;
+        if (w.npending > 0 || w.rescan) {
+            int64_t now = metrics_now_ns();
+            int64_t due = w.last_ns + delay;
+            if (due > w.first_ns + max_delay) {
+                due = w.first_ns + max_delay;
+            }
+            if (due <= now) {
+                watch_flush(&w);
+                continue;
+            }
+            timeout = (int)((due - now + 999999) / 1000000);
+        }
+
+        struct pollfd pfd = {w.fd, POLLIN, 0};
+        int rc = poll(&pfd, 1, timeout);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            watch_log(LOG_ERR, "错误: 等待文件事件失败 (%s)", strerror(errno));
+            break;
+        }
+        if (rc == 0) {
+            continue;
+        }
+        ssize_t n;
+        while ((n = read(w.fd, buf, WATCH_EVENT_BUFFER)) > 0) {
+            for (char *p = buf; p < buf + n; ) {
+                const struct inotify_event *ev = (const struct inotify_event *)p;
+                handle_event(&w, ev);
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+    }
+
+    watch_log(LOG_INFO, "停止监视 %s", config->source_dir);
+    pending_clear(&w);
+    free(w.pending);
+    for (int i = 0; i < w.dirs_cap; i++) {
+        free(w.dirs[i]);
+    }
+    free(w.dirs);
+    free(buf);
+    close(w.fd);
+    return 1;
+}
+
+// 与 daemons/init.c 中的做法相同，出错时还没有转入后台，直接输出到标准错误
+void daemonize(const char *cmd) {
+    int i, fd0, fd1, fd2;
+    pid_t pid;
+    struct rlimit rl;
+    struct sigaction sa;
+
+    // 清除文件创建屏蔽字
+    umask(0);
+
+    // 取得最大文件描述符数
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        fprintf(stderr, "%s: 无法获取文件描述符上限\n", cmd);
+        exit(1);
+    }
+
+    // 成为会话首进程，脱离控制终端
+    if ((pid = fork()) < 0) {
+        fprintf(stderr, "%s: fork 失败\n", cmd);
+        exit(1);
+    } else if (pid != 0) {
+        exit(0);
+    }
+    setsid();
+
+    // 再 fork 一次，以后打开终端设备也不会成为控制终端
+    sa.sa_handler = SIG_IGN;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    if (sigaction(SIGHUP, &sa, NULL) < 0) {
+        fprintf(stderr, "%s: 无法忽略 SIGHUP\n", cmd);
+        exit(1);
+    }
+    if ((pid = fork()) < 0) {
+        fprintf(stderr, "%s: fork 失败\n", cmd);
+        exit(1);
+    } else if (pid != 0) {
+        exit(0);
+    }
+
+    // 工作目录改到根目录，不妨碍卸载文件系统
+    if (chdir("/") < 0) {
+        fprintf(stderr, "%s: 无法切换到根目录\n", cmd);
+        exit(1);
+    }
+
+    // 关闭所有打开的文件描述符，0、1、2 指向 /dev/null
+    if (rl.rlim_max == RLIM_INFINITY || rl.rlim_max > 1024) {
+        rl.rlim_max = 1024;
+    }
+    for (i = 0; i < (int)rl.rlim_max; i++) {
+        close(i);
+    }
+    fd0 = open("/dev/null", O_RDWR);
+    fd1 = dup(0);
+    fd2 = dup(0);
+
+    openlog(cmd, LOG_CONS | LOG_PID, LOG_DAEMON);
+    watch_syslog = 1;
+    if (fd0 != 0 || fd1 != 1 || fd2 != 2) {
+        syslog(LOG_ERR, "文件描述符异常 %d %d %d", fd0, fd1, fd2);
+        exit(1);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "sync_util.h"
+
+#define WATCH_DELAY_MS 100          // 默认的事件合并窗口：最后一个事件之后这么久没有新事件才同步
+#define WATCH_MAX_DELAY_MS 1000     // 事件持续不断时，第一个事件之后最多等这么久
+#define WATCH_MAX_PENDING 65536     // 一批中超过这么多路径时改为重新扫描它们所在的目录
+#define WATCH_EVENT_BUFFER (64 * 1024)
+
+// 持续同步：先完整同步一次，之后用 inotify 监视源目录树，
+// 把合并窗口内改动过的路径交给 perform_sync 只同步这些路径；
+// 事件队列溢出时丢失了哪些改动无从知道，改为完整同步一次。
+// 收到 SIGTERM 或 SIGINT 后返回，初次同步失败返回 0
+int watch_sync(const sync_config_t *config);
+
+// 脱离终端转入后台（两次 fork、setsid、chdir("/")，标准输入输出指向 /dev/null），
+// 之后的日志写入 syslog。调用前应把路径转成绝对路径
+void daemonize(const char *cmd);
+
+#endif
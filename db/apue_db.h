@@ -1,15 +1,24 @@
 #ifndef _APUE_DB_H
 #define _APUE_DB_H
 
+#include <sys/uio.h>	/* struct iovec */
+
 typedef	void *	DBHANDLE;
 
 DBHANDLE  db_open(const char *, int, ...);
+DBHANDLE  db_open_nhash(const char *, int, int, unsigned long);
 void      db_close(DBHANDLE);
 char     *db_fetch(DBHANDLE, const char *);
 int       db_store(DBHANDLE, const char *, const char *, int);
 int       db_delete(DBHANDLE, const char *);
 void      db_rewind(DBHANDLE);
 char     *db_nextrec(DBHANDLE, char *);
+int       db_convert(const char *);
+int       db_mmap(DBHANDLE, int);
+const char *db_fetch_ref(DBHANDLE, const char *, size_t *);
+ssize_t   db_fetch_into(DBHANDLE, const char *, void *, size_t, off_t);
+int       db_store_iov(DBHANDLE, const char *, const struct iovec *, int, int);
+int       db_wal(DBHANDLE);
 
 /*
  * Flags for db_store().
@@ -18,12 +27,17 @@ char     *db_nextrec(DBHANDLE, char *);
 #define DB_REPLACE	   2	/* replace existing record */
 #define DB_STORE	   3	/* replace or insert */
 
+/*
+ * Flags for db_mmap().
+ */
+#define DB_NOLOCK	   1	/* readers don't lock: no concurrent writers */
+
 /*
  * Implementation limits.
  */
-#define IDXLEN_MIN	   6	/* key, sep, start, sep, length, \n */
-#define IDXLEN_MAX	1024	/* arbitrary */
+#define IDXLEN_MIN	   1	/* key length */
+#define IDXLEN_MAX	1024	/* arbitrary; longer keys fail with EINVAL */
 #define DATLEN_MIN	   2	/* data byte, newline */
-#define DATLEN_MAX	1024	/* arbitrary */
+				/* no maximum: big records are stored as extents */
 
 #endif /* _APUE_DB_H */
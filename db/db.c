@@ -3,15 +3,17 @@
 #include <fcntl.h>		/* open & db_open flags */
 #include <stdarg.h>
 #include <errno.h>
+#include <stdint.h>
+#include <time.h>
 #include <sys/uio.h>	/* struct iovec */
+#include <sys/mman.h>
+#include <pthread.h>
 
 /*
  * Internal index file constants.
  * These are used to construct records in the
  * index file and data file.
  */
-#define IDXLEN_SZ	   4	/* index record length (ASCII chars) */
-#define SEP         ':'	/* separator char in index record */
 #define SPACE       ' '	/* space character */
 #define NEWLINE     '\n'	/* newline character */
 
@@ -19,13 +21,158 @@
  * The following definitions are for hash chains and free
  * list chain in the index file.
  */
-#define PTR_SZ        7	/* size of ptr field in hash chain */
-#define PTR_MAX 9999999	/* max file offset = 10**PTR_SZ - 1 */
-#define NHASH_DEF	 137	/* default hash table size */
-#define FREE_OFF      0	/* free list offset in index file */
-#define HASH_OFF PTR_SZ	/* hash table offset in index file */
+#define PTR_SZ        8	/* size of ptr field in hash chain */
+#define NHASH_DEF	 137	/* default initial hash table size */
 
-typedef unsigned long	DBHASH;	/* hash values */
+/*
+ * The index file starts with a fixed header identifying the
+ * format, followed by the free list pointer and the first
+ * segment of the hash table.  All integers in the index file
+ * are little-endian, so a lookup never has to parse ASCII.
+ *
+ * The hash table grows by linear hashing: when an insert finds
+ * a long chain, bucket "split" is split in two, its records
+ * divided between it and bucket split + nhash * 2^level.  Once
+ * every bucket has been split the table has doubled, level is
+ * incremented and split starts over at 0.  Segment 0 holds the
+ * first nhash buckets; segment k (k > 0) holds buckets
+ * nhash * 2^(k-1) through nhash * 2^k - 1, and is appended to
+ * the index file when the first of them is created.
+ */
+#define DB_MAGIC	"APUEDB\0\0"	/* 8 bytes */
+#define DB_VERSION	   2	/* version 1 was the ASCII format */
+#define HDR_MAGIC	   0
+#define HDR_VERSION	   8	/* uint32 */
+#define HDR_NHASH	  12	/* uint32: buckets in segment 0 */
+#define HDR_LEVEL	  16	/* uint32: times the table has doubled */
+#define HDR_FLAGS	  20	/* uint32: DBF_WAL */
+#define HDR_SPLIT	  24	/* uint64: next bucket to split */
+#define HDR_SEED	  32	/* 2 uint64: key of the hash function */
+#define HDR_SEGOFF	  48	/* NSEG uint64: offsets of segments */
+#define NSEG		  32	/* max segments */
+#define HDR_SZ	(HDR_SEGOFF + NSEG * PTR_SZ)
+#define SPLIT_CHAIN	   2	/* split when an insert walks this many */
+#define DBF_WAL		 0x1	/* changes go through the log */
+
+/*
+ * Bytes of the header we lock, but never write after creation.
+ */
+#define LOCK_APPEND	   0	/* appending to the index file */
+#define LOCK_SPLIT	   1	/* splitting a bucket */
+
+#define FREE_OFF  HDR_SZ	/* free list offset in index file */
+#define HASH_OFF (FREE_OFF + PTR_SZ)	/* hash table offset in index file */
+
+/*
+ * Each index record is a fixed-size header followed by the
+ * key bytes (no terminating null):
+ *
+ *	chain ptr | data offset | data length | key length | flags | key
+ *
+ * The header tells us everything, so a record is read with a
+ * single pread and compared without scanning for separators.
+ */
+#define IDX_PTR		   0	/* uint64: next record on chain */
+#define IDX_DATOFF	   8	/* uint64: offset of data record */
+#define IDX_DATLEN	  16	/* uint64: length of data record */
+#define IDX_KEYLEN	  24	/* uint32: length of key */
+#define IDX_FLAGS	  28	/* uint32: IDX_xxx flags */
+#define IDXHDR_SZ	  32	/* size of index record header */
+#define IDX_DELETED	 0x1	/* record is on the free list */
+#define IDX_SEGMENT	 0x2	/* hash table segment, datlen bytes */
+#define IDX_PENDING	 0x4	/* appended in WAL mode, not committed */
+
+/*
+ * A data record is its data followed by a newline, however long
+ * it is: the data file is only ever appended to, so a big record
+ * is one extent that can be read or written in place.  The data
+ * buffer starts out big enough for records up to DATLEN_INLINE,
+ * and grows for db_fetch of anything longer.
+ */
+#define DATLEN_INLINE	1024
+#define IOV_BATCH	  64	/* iovecs per pwritev */
+
+/*
+ * After db_wal, every change to the index and data files is
+ * first described in a log, name.wal.  An operation (a store,
+ * a delete, a bucket split) collects its writes as entries in
+ * memory.  Appends to fresh space at the end of a file go to the
+ * file at once: nothing points at them yet.  An appended index
+ * record is flagged IDX_PENDING, so db_nextrec skips it, and the
+ * transaction clears the flag with a held back write.  Overwrites
+ * are held back.  To commit, the entries are appended to the log
+ * as one transaction and the log is synced, together with any other
+ * transactions appended meanwhile (group commit).  Only then are
+ * the held back writes made, and the operation's locks released.
+ *
+ * A data record longer than DATLEN_INLINE isn't copied into the
+ * log, so a big value is neither buffered nor written twice.  It
+ * only ever goes to space nothing points at (the end of the file,
+ * or a record on the free list) and is written at once; the data
+ * file is synced before the log, whose entry holds just offset and
+ * length.  So a big record is never overwritten in place: a
+ * replace stores it anew.  Nor is it blanked when deleted, since
+ * replaying that would wipe out whatever reused its space since.
+ * A small record is blanked with a fill entry, which has no data.
+ *
+ * A checkpoint syncs the index and data files, after which the log
+ * isn't needed: it bumps the log's generation and empties it.
+ * db_open replays the committed transactions of the current
+ * generation, so a crash never leaves half an operation applied.
+ *
+ * Each transaction that appended logs where its appends ended, and
+ * the log header keeps the furthest end committed.  Whatever lies
+ * beyond that in either file was appended by an operation that
+ * never committed.  If no one else has the log open, db_open
+ * truncates the files back to it, so a crash leaves neither an
+ * orphan record nor a half-made hash table segment at the end.
+ * (Readers don't open the log; one scanning with db_nextrec at
+ * that moment may find the index file end sooner than it was.)
+ *
+ *	log:	header | transaction ...
+ *	header:	magic | generation | synced | index end | data end
+ *	transaction:	generation | length | checksum | entry ...
+ *	entry:	flags | offset | length | data (padded to 8 bytes, if any)
+ */
+#define WAL_MAGIC	"APUEWAL\0"	/* 8 bytes */
+#define WAL_GEN		   8	/* uint64: current generation */
+#define WAL_SYNCED	  16	/* uint64: log synced this far (a hint) */
+#define WAL_IDXEND	  24	/* uint64: index file committed this far */
+#define WAL_DATEND	  32	/* uint64: data file committed this far */
+#define WAL_HDR_SZ	  40
+#define TXN_GEN		   0	/* uint64 */
+#define TXN_LEN		   8	/* uint64: bytes of entries */
+#define TXN_SUM		  16	/* uint64: _db_hash of the entries */
+#define TXN_HDR_SZ	  24
+#define ENT_FLAGS	   0	/* uint32 */
+#define ENT_OFF		   8	/* uint64: offset in file */
+#define ENT_LEN		  16	/* uint64: bytes of data */
+#define ENT_HDR_SZ	  24
+#define ENT_DAT		 0x1	/* data file, not index file */
+#define ENT_DEFER	 0x2	/* don't write until committed */
+#define ENT_EXTEND	 0x4	/* extend file to offset, no data */
+#define ENT_SYNCED	 0x8	/* data synced before logged, not in log */
+#define ENT_FILL	0x10	/* fill with blanks, no data */
+#define ENT_END		0x20	/* appends end at offset/len in idx/dat */
+#define ENT_NODATA	(ENT_SYNCED | ENT_FILL | ENT_END)
+#define ENT_PAD(n)	(((n) + 7) & ~(uint64_t)7)
+#define ENT_SIZE(f, n)	(ENT_HDR_SZ + (((f) & ENT_NODATA) ? 0 : ENT_PAD(n)))
+
+#define WAL_LOCK_CKPT	   0	/* log bytes: checkpoint vs. commit */
+#define WAL_LOCK_SYNC	   1	/* log bytes: one fdatasync at a time */
+#define WAL_LOCK_OPEN	   2	/* log bytes: read locked while open */
+#define WAL_CKPT_SIZE	(8 * 1024 * 1024)	/* checkpoint when log is this big */
+#define WAL_CKPT_SEC	   5	/* and at least this often */
+
+/*
+ * The old ASCII format, read only by db_convert.
+ */
+#define OLD_PTR_SZ	   7	/* ASCII chain ptr */
+#define OLD_IDXLEN_SZ  4	/* ASCII index record length */
+#define OLD_SEP		 ':'	/* separator char in index record */
+#define OLD_NHASH	 137	/* hash table size was fixed */
+
+typedef uint64_t		DBHASH;	/* hash values */
 typedef unsigned long	COUNT;	/* unsigned counter */
 
 /*
@@ -34,22 +181,56 @@ typedef unsigned long	COUNT;	/* unsigned counter */
 typedef struct {
   int    idxfd;  /* fd for index file */
   int    datfd;  /* fd for data file */
-  char  *idxbuf; /* malloc'ed buffer for index record */
+  char  *recbuf; /* malloc'ed buffer for index record header and key */
+  char  *idxbuf; /* key in recbuf, null terminated */
+  char  *keyp;   /* key of last index record read: idxbuf, or */
+			      /* in idxmap (not null terminated) */
   char  *datbuf; /* malloc'ed buffer for data record*/
+  size_t datbufsz; /* size of datbuf */
   char  *name;   /* name db was opened under */
   off_t  idxoff; /* offset in index file of index record */
-			      /* key is at (idxoff + PTR_SZ + IDXLEN_SZ) */
-  size_t idxlen; /* length of index record */
-			      /* excludes IDXLEN_SZ bytes at front of record */
-			      /* includes newline at end of index record */
+			      /* key is at (idxoff + IDXHDR_SZ) */
+  size_t idxlen; /* length of key */
+  unsigned idxflags; /* flags of index record */
+  off_t  nextoff;  /* offset of next record for db_nextrec */
+  off_t  recoff;   /* offset of first index record */
   off_t  datoff; /* offset in data file of data record */
   size_t datlen; /* length of data record */
 			      /* includes newline at end */
   off_t  ptrval; /* contents of chain ptr in index record */
   off_t  ptroff; /* chain ptr offset pointing to this idx record */
   off_t  chainoff; /* offset of hash chain for this index record */
-  off_t  hashoff;  /* offset in index file of hash table */
-  DBHASH nhash;    /* current hash table size */
+  DBHASH nhash;    /* buckets in segment 0 */
+  DBHASH level;    /* table has doubled this many times */
+  DBHASH split;    /* next bucket to split */
+  unsigned flags;  /* DBF_WAL */
+  int    writable; /* not opened O_RDONLY */
+  int    logfd;    /* fd for log file, -1 unless DBF_WAL */
+  int    appendfd; /* log file again, opened O_APPEND */
+  char  *txnbuf;   /* log entries of the current operation */
+  size_t txnlen;   /* bytes used in txnbuf */
+  size_t txnsz;    /* size of txnbuf */
+  int    freelocked; /* free list to unlock when committed */
+  int    datsync;  /* sync data file before logging (ENT_SYNCED) */
+  off_t  idxend;   /* where the operation's appends to the index */
+  off_t  datend;   /* and data files end, 0 if none */
+  pthread_t       ckptthread; /* checkpointer */
+  int             ckptrunning;
+  int             ckptstop;   /* tells checkpointer to exit */
+  pthread_mutex_t ckptmutex;  /* protects ckptstop */
+  pthread_cond_t  ckptcond;   /* wakes checkpointer */
+  pthread_rwlock_t ckptlock;  /* commits vs. checkpoints, in process */
+  uint64_t seed[2]; /* key of the hash function */
+  off_t  segoff[NSEG]; /* offsets of segments, 0 if not read yet */
+  int    chainlen; /* records walked by _db_find_and_lock */
+  int    mapped;   /* db_mmap called: read through the maps */
+  int    nolock;   /* DB_NOLOCK: readers don't lock */
+  char  *idxmap;   /* mmap'ed index file */
+  size_t idxmapsz; /* size of idxmap */
+  size_t idxsize;  /* size of index file when last checked */
+  char  *datmap;   /* mmap'ed data file */
+  size_t datmapsz; /* size of datmap */
+  size_t datsize;  /* size of data file when last checked */
   COUNT  cnt_delok;    /* delete OK */
   COUNT  cnt_delerr;   /* delete error */
   COUNT  cnt_fetchok;  /* fetch OK */
@@ -60,6 +241,8 @@ typedef struct {
   COUNT  cnt_stor3;    /* store: DB_REPLACE, diff len, appended */
   COUNT  cnt_stor4;    /* store: DB_REPLACE, same len, overwrote */
   COUNT  cnt_storerr;  /* store error */
+  COUNT  cnt_commit;   /* transactions logged */
+  COUNT  cnt_logsync;  /* log syncs: fewer than commits with group commit */
 } DB;
 
 /*
@@ -68,28 +251,90 @@ typedef struct {
 static DB     *_db_alloc(int);
 static void    _db_dodelete(DB *);
 static int	    _db_find_and_lock(DB *, const char *, int);
-static int     _db_findfree(DB *, int, int);
+static int     _db_keyok(const char *);
+static int     _db_findfree(DB *, size_t, size_t);
+static int     _db_readhdr(DB *);
 static void    _db_free(DB *);
-static DBHASH  _db_hash(DB *, const char *);
+static DBHASH  _db_hash(DB *, const char *, size_t);
+static DBHASH  _db_bucket(DB *, DBHASH);
+static off_t   _db_bucketoff(DB *, DBHASH);
+static DB     *_db_open(const char *, int, int, DBHASH);
+static void    _db_readstate(DB *);
+static void    _db_split(DB *);
+static void    _db_newseg(DB *, int);
+static void    _db_statebuf(DB *, char *);
+static int     _db_write(DB *, unsigned, const struct iovec *, int, size_t,
+                         off_t);
+static void    _db_overlay(DB *, unsigned, char *, size_t, off_t);
+static void    _db_commit(DB *);
+static void    _db_logsync(DB *, off_t);
+static void    _db_unlockfree(DB *);
+static int     _db_walopen(DB *, int);
+static void    _db_recover(DB *, int);
+static void    _db_logreset(DB *);
+static void    _db_checkpoint(DB *);
+static void   *_db_ckptthread(void *);
 static char   *_db_readdat(DB *);
+static char   *_db_mapdat(DB *);
+static char   *_db_mapped(int, char **, size_t *, size_t *, off_t, size_t);
 static off_t   _db_readidx(DB *, off_t);
 static off_t   _db_readptr(DB *, off_t);
-static void    _db_writedat(DB *, const char *, off_t, int);
-static void    _db_writeidx(DB *, const char *, off_t, int, off_t);
+static void    _db_writedat(DB *, const struct iovec *, int, size_t,
+                            off_t, int);
+static int     _db_store(DB *, const char *, const struct iovec *, int,
+                         size_t, int);
+static int     _db_pread(int, char *, size_t, off_t);
+static int     _db_pwritev(int, const struct iovec *, int, off_t);
+static int     _db_fill(DB *, int, size_t, off_t);
+static void    _db_writeidx(DB *, const char *, off_t, int, off_t,
+                            unsigned);
 static void    _db_writeptr(DB *, off_t, off_t);
+static void    _db_inithdr(DB *);
+static void    _db_put32(char *, uint32_t);
+static void    _db_put64(char *, uint64_t);
+static uint32_t _db_get32(const char *);
+static uint64_t _db_get64(const char *);
 
 /*
  * Open or create a database.  Same arguments as open(2).
  */
 DBHANDLE
 db_open(const char *pathname, int oflag, ...)
+{
+	int			mode = 0;
+
+	if (oflag & O_CREAT) {
+		va_list ap;
+
+		va_start(ap, oflag);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	return(_db_open(pathname, oflag, mode, NHASH_DEF));
+}
+
+/*
+ * Same as db_open, except that a database we create starts
+ * with nhash buckets instead of NHASH_DEF (0 for the default).
+ * The table grows as needed either way; sizing it for the
+ * expected number of keys just saves the splits on the way.
+ */
+DBHANDLE
+db_open_nhash(const char *pathname, int oflag, int mode,
+              unsigned long nhash)
+{
+	if (nhash > 0xffffffffUL) {
+		errno = EINVAL;
+		return(NULL);
+	}
+	return(_db_open(pathname, oflag, mode, nhash ? nhash : NHASH_DEF));
+}
+
+static DB *
+_db_open(const char *pathname, int oflag, int mode, DBHASH nhash)
 {
 	DB			*db;
-	int			len, mode;
-	size_t		i;
-	char		asciiptr[PTR_SZ + 1],
-				hash[(NHASH_DEF + 1) * PTR_SZ + 2];
-					/* +2 for newline and null */
+	int			len;
 	struct stat	statbuff;
 
 	/*
@@ -99,39 +344,25 @@ db_open(const char *pathname, int oflag, ...)
 	if ((db = _db_alloc(len)) == NULL)
 		err_dump("db_open: _db_alloc error for DB");
 
-	db->nhash   = NHASH_DEF;/* hash table size */
-	db->hashoff = HASH_OFF;	/* offset in index file of hash table */
+	db->nhash   = nhash;	/* initial hash table size */
+	db->writable = (oflag & O_ACCMODE) != O_RDONLY;
 	strcpy(db->name, pathname);
 	strcat(db->name, ".idx");
 
-	if (oflag & O_CREAT) {
-		va_list ap;
-
-		va_start(ap, oflag);
-		mode = va_arg(ap, int);
-		va_end(ap);
-
-		/*
-		 * Open index file and data file.
-		 */
-		db->idxfd = open(db->name, oflag, mode);
-		strcpy(db->name + len, ".dat");
-		db->datfd = open(db->name, oflag, mode);
-	} else {
-		/*
-		 * Open index file and data file.
-		 */
-		db->idxfd = open(db->name, oflag);
-		strcpy(db->name + len, ".dat");
-		db->datfd = open(db->name, oflag);
-	}
+	/*
+	 * Open index file and data file.  The mode is
+	 * ignored unless O_CREAT is set.
+	 */
+	db->idxfd = open(db->name, oflag, mode);
+	strcpy(db->name + len, ".dat");
+	db->datfd = open(db->name, oflag, mode);
 
 	if (db->idxfd < 0 || db->datfd < 0) {
 		_db_free(db);
 		return(NULL);
 	}
 
-	if ((oflag & (O_CREAT | O_TRUNC)) == (O_CREAT | O_TRUNC)) {
+	if (oflag & O_CREAT) {
 		/*
 		 * If the database was created, we have to initialize
 		 * it.  Write lock the entire file so that we can stat
@@ -143,28 +374,184 @@ db_open(const char *pathname, int oflag, ...)
 		if (fstat(db->idxfd, &statbuff) < 0)
 			err_sys("db_open: fstat error");
 
-		if (statbuff.st_size == 0) {
-			/*
-			 * We have to build a list of (NHASH_DEF + 1) chain
-			 * ptrs with a value of 0.  The +1 is for the free
-			 * list pointer that precedes the hash table.
-			 */
-			sprintf(asciiptr, "%*d", PTR_SZ, 0);
-			hash[0] = 0;
-			for (i = 0; i < NHASH_DEF + 1; i++)
-				strcat(hash, asciiptr);
-			strcat(hash, "\n");
-			i = strlen(hash);
-			if (write(db->idxfd, hash, i) != i)
-				err_dump("db_open: index file init write error");
-		}
+		if (statbuff.st_size == 0)
+			_db_inithdr(db);
 		if (un_lock(db->idxfd, 0, SEEK_SET, 0) < 0)
 			err_dump("db_open: un_lock error");
 	}
+
+	/*
+	 * Pick up the hash table size from the header.  An index
+	 * file in the old ASCII format must be converted with
+	 * db_convert before it can be opened.
+	 */
+	if (_db_readhdr(db) < 0) {
+		_db_free(db);
+		errno = EINVAL;
+		return(NULL);
+	}
+
+	/*
+	 * If the database is in WAL mode, finish what the log says
+	 * was committed, in case someone crashed.  Readers leave that
+	 * to the next writer.
+	 */
+	if ((db->flags & DBF_WAL) && db->writable && _db_walopen(db, 0) < 0) {
+		_db_free(db);
+		return(NULL);
+	}
 	db_rewind(db);
 	return(db);
 }
 
+/*
+ * Write the header of an empty index file, followed by the
+ * free list pointer and (db->nhash) chain ptrs, all 0.
+ * Called with the index file write locked.
+ */
+static void
+_db_inithdr(DB *db)
+{
+	char	*hash;
+	size_t	len;
+	int		fd;
+
+	len = HASH_OFF + db->nhash * PTR_SZ;
+	if ((hash = calloc(1, len)) == NULL)
+		err_dump("_db_inithdr: calloc error for hash table");
+	memcpy(hash + HDR_MAGIC, DB_MAGIC, 8);
+	_db_put32(hash + HDR_VERSION, DB_VERSION);
+	_db_put32(hash + HDR_NHASH, db->nhash);
+
+	/*
+	 * A random key for the hash function, so no one can choose
+	 * keys that all land on the same chain.
+	 */
+	if ((fd = open("/dev/urandom", O_RDONLY)) < 0 ||
+	  read(fd, hash + HDR_SEED, 2 * 8) != 2 * 8) {
+		_db_put64(hash + HDR_SEED, (uint64_t)time(NULL));
+		_db_put64(hash + HDR_SEED + 8, (uint64_t)getpid());
+	}
+	if (fd >= 0)
+		close(fd);
+
+	if (pwrite(db->idxfd, hash, len, 0) != len)
+		err_dump("_db_inithdr: index file init write error");
+	free(hash);
+}
+
+/*
+ * Read and check the header of the index file, and set the
+ * hash table size and the offset of the first index record.
+ * Returns -1 if the file isn't in the current format.
+ */
+static int
+_db_readhdr(DB *db)
+{
+	char	hdr[HDR_SZ];
+	ssize_t	n;
+
+	/*
+	 * Wait for a process that is initializing the file.
+	 */
+	if (readw_lock(db->idxfd, 0, SEEK_SET, HDR_SZ) < 0)
+		err_dump("_db_readhdr: readw_lock error");
+	n = pread(db->idxfd, hdr, HDR_SZ, 0);
+	if (un_lock(db->idxfd, 0, SEEK_SET, HDR_SZ) < 0)
+		err_dump("_db_readhdr: un_lock error");
+
+	if (n != HDR_SZ || memcmp(hdr + HDR_MAGIC, DB_MAGIC, 8) != 0 ||
+	  _db_get32(hdr + HDR_VERSION) != DB_VERSION ||
+	  _db_get32(hdr + HDR_NHASH) == 0)
+		return(-1);
+	db->nhash = _db_get32(hdr + HDR_NHASH);
+	db->level = _db_get32(hdr + HDR_LEVEL);
+	db->flags = _db_get32(hdr + HDR_FLAGS);
+	db->split = _db_get64(hdr + HDR_SPLIT);
+	db->seed[0] = _db_get64(hdr + HDR_SEED);
+	db->seed[1] = _db_get64(hdr + HDR_SEED + 8);
+	db->recoff = HASH_OFF + db->nhash * PTR_SZ;
+	return(0);
+}
+
+/*
+ * Reread level, flags and split, which change as other processes
+ * split buckets.  All are written together by _db_split.
+ */
+static void
+_db_readstate(DB *db)
+{
+	char	state[HDR_SPLIT + 8 - HDR_LEVEL], *p;
+
+	if (db->mapped) {
+		if ((p = _db_mapped(db->idxfd, &db->idxmap, &db->idxmapsz,
+		  &db->idxsize, HDR_LEVEL, sizeof(state))) == NULL)
+			err_dump("_db_readstate: read error");
+	} else {
+		p = state;
+		if (pread(db->idxfd, p, sizeof(state), HDR_LEVEL) != sizeof(state))
+			err_dump("_db_readstate: read error");
+	}
+	db->level = _db_get32(p + HDR_LEVEL - HDR_LEVEL);
+	db->flags = _db_get32(p + HDR_FLAGS - HDR_LEVEL);
+	db->split = _db_get64(p + HDR_SPLIT - HDR_LEVEL);
+}
+
+/*
+ * The bytes _db_readstate reads, from the DB structure.
+ */
+static void
+_db_statebuf(DB *db, char *state)
+{
+	memset(state, 0, HDR_SPLIT + 8 - HDR_LEVEL);
+	_db_put32(state + HDR_LEVEL - HDR_LEVEL, db->level);
+	_db_put32(state + HDR_FLAGS - HDR_LEVEL, db->flags);
+	_db_put64(state + HDR_SPLIT - HDR_LEVEL, db->split);
+}
+
+/*
+ * Little-endian integers in the index file.
+ */
+static void
+_db_put32(char *p, uint32_t v)
+{
+	int		i;
+
+	for (i = 0; i < 4; i++)
+		p[i] = (char)(v >> (8 * i));
+}
+
+static void
+_db_put64(char *p, uint64_t v)
+{
+	int		i;
+
+	for (i = 0; i < 8; i++)
+		p[i] = (char)(v >> (8 * i));
+}
+
+static uint32_t
+_db_get32(const char *p)
+{
+	uint32_t	v = 0;
+	int			i;
+
+	for (i = 3; i >= 0; i--)
+		v = (v << 8) | (unsigned char)p[i];
+	return(v);
+}
+
+static uint64_t
+_db_get64(const char *p)
+{
+	uint64_t	v = 0;
+	int			i;
+
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | (unsigned char)p[i];
+	return(v);
+}
+
 /*
  * Allocate & initialize a DB structure and its buffers.
  */
@@ -179,6 +566,7 @@ _db_alloc(int namelen)
 	if ((db = calloc(1, sizeof(DB))) == NULL)
 		err_dump("_db_alloc: calloc error for DB");
 	db->idxfd = db->datfd = -1;				/* descriptors */
+	db->logfd = db->appendfd = -1;
 
 	/*
 	 * Allocate room for the name.
@@ -188,12 +576,16 @@ _db_alloc(int namelen)
 		err_dump("_db_alloc: malloc error for name");
 
 	/*
-	 * Allocate an index buffer and a data buffer.
-	 * +2 for newline and null at end.
+	 * Allocate an index buffer and a data buffer.  The index
+	 * buffer holds the record header followed by the key;
+	 * +1 for null at end of key, +2 for newline and null at
+	 * end of data.
 	 */
-	if ((db->idxbuf = malloc(IDXLEN_MAX + 2)) == NULL)
+	if ((db->recbuf = malloc(IDXHDR_SZ + IDXLEN_MAX + 1)) == NULL)
 		err_dump("_db_alloc: malloc error for index buffer");
-	if ((db->datbuf = malloc(DATLEN_MAX + 2)) == NULL)
+	db->idxbuf = db->recbuf + IDXHDR_SZ;
+	db->datbufsz = DATLEN_INLINE + 2;
+	if ((db->datbuf = malloc(db->datbufsz)) == NULL)
 		err_dump("_db_alloc: malloc error for data buffer");
 	return(db);
 }
@@ -214,12 +606,33 @@ db_close(DBHANDLE h)
 static void
 _db_free(DB *db)
 {
+	if (db->ckptrunning) {
+		pthread_mutex_lock(&db->ckptmutex);
+		db->ckptstop = 1;
+		pthread_cond_signal(&db->ckptcond);
+		pthread_mutex_unlock(&db->ckptmutex);
+		pthread_join(db->ckptthread, NULL);
+		_db_checkpoint(db);	/* leave the next open nothing to do */
+		pthread_mutex_destroy(&db->ckptmutex);
+		pthread_cond_destroy(&db->ckptcond);
+		pthread_rwlock_destroy(&db->ckptlock);
+	}
+	if (db->logfd >= 0)
+		close(db->logfd);
+	if (db->appendfd >= 0)
+		close(db->appendfd);
+	if (db->txnbuf != NULL)
+		free(db->txnbuf);
 	if (db->idxfd >= 0)
 		close(db->idxfd);
 	if (db->datfd >= 0)
 		close(db->datfd);
-	if (db->idxbuf != NULL)
-		free(db->idxbuf);
+	if (db->idxmap != NULL)
+		munmap(db->idxmap, db->idxmapsz);
+	if (db->datmap != NULL)
+		munmap(db->datmap, db->datmapsz);
+	if (db->recbuf != NULL)
+		free(db->recbuf);
 	if (db->datbuf != NULL)
 		free(db->datbuf);
 	if (db->name != NULL)
@@ -236,6 +649,10 @@ db_fetch(DBHANDLE h, const char *key)
 	DB      *db = h;
 	char	*ptr;
 
+	if (!_db_keyok(key)) {
+		db->cnt_fetcherr++;
+		return(NULL);
+	}
 	if (_db_find_and_lock(db, key, 0) < 0) {
 		ptr = NULL;				/* error, record not found */
 		db->cnt_fetcherr++;
@@ -247,11 +664,226 @@ db_fetch(DBHANDLE h, const char *key)
 	/*
 	 * Unlock the hash chain that _db_find_and_lock locked.
 	 */
-	if (un_lock(db->idxfd, db->chainoff, SEEK_SET, 1) < 0)
+	if (!db->nolock && un_lock(db->idxfd, db->chainoff, SEEK_SET, 1) < 0)
 		err_dump("db_fetch: un_lock error");
 	return(ptr);
 }
 
+/*
+ * Fetch a record without copying it.  Return a pointer to the
+ * data, which is not null terminated, and its length in *lenp.
+ * After db_mmap the pointer is into the mapped data file;
+ * either way it's good until the next call using this handle.
+ */
+const char *
+db_fetch_ref(DBHANDLE h, const char *key, size_t *lenp)
+{
+	DB      *db = h;
+	char	*ptr;
+
+	if (!_db_keyok(key)) {
+		db->cnt_fetcherr++;
+		return(NULL);
+	}
+	if (_db_find_and_lock(db, key, 0) < 0) {
+		ptr = NULL;				/* error, record not found */
+		db->cnt_fetcherr++;
+	} else {
+		ptr = db->mapped ? _db_mapdat(db) : _db_readdat(db);
+		*lenp = db->datlen - 1;	/* without the newline */
+		db->cnt_fetchok++;
+	}
+
+	if (!db->nolock && un_lock(db->idxfd, db->chainoff, SEEK_SET, 1) < 0)
+		err_dump("db_fetch_ref: un_lock error");
+	return(ptr);
+}
+
+/*
+ * Fetch up to len bytes of a record's data, starting offset
+ * bytes in, straight into the caller's buffer.  Returns the
+ * number of bytes copied (0 past the end of the data), or -1
+ * if the record doesn't exist.  A large record can be read a
+ * piece at a time without ever being in memory all at once.
+ */
+ssize_t
+db_fetch_into(DBHANDLE h, const char *key, void *buf, size_t len,
+              off_t offset)
+{
+	DB      *db = h;
+	ssize_t	n;
+	char	*ptr;
+
+	if (offset < 0) {
+		errno = EINVAL;
+		return(-1);
+	}
+	if (!_db_keyok(key)) {
+		db->cnt_fetcherr++;
+		return(-1);
+	}
+	if (_db_find_and_lock(db, key, 0) < 0) {
+		n = -1;					/* error, record not found */
+		db->cnt_fetcherr++;
+	} else {
+		/*
+		 * The data is datlen - 1 bytes, without the newline.
+		 */
+		if (offset >= db->datlen - 1)
+			n = 0;
+		else if (len < db->datlen - 1 - offset)
+			n = len;
+		else
+			n = db->datlen - 1 - offset;
+		if (n > 0 && db->mapped) {
+			if ((ptr = _db_mapped(db->datfd, &db->datmap, &db->datmapsz,
+			  &db->datsize, db->datoff + offset, n)) == NULL)
+				err_dump("db_fetch_into: read error");
+			memcpy(buf, ptr, n);
+		} else if (n > 0) {
+			if (_db_pread(db->datfd, buf, n, db->datoff + offset) < 0)
+				err_dump("db_fetch_into: read error");
+		}
+		db->cnt_fetchok++;
+	}
+
+	if (!db->nolock && un_lock(db->idxfd, db->chainoff, SEEK_SET, 1) < 0)
+		err_dump("db_fetch_into: un_lock error");
+	return(n);
+}
+
+/*
+ * Read the database through memory mappings of the index and
+ * data files instead of with read(2): following a hash chain
+ * becomes pointer arithmetic and fetching a record a memcpy.
+ * The maps are extended when the files grow.  Writers still
+ * lock as before.  With DB_NOLOCK readers don't lock either, so
+ * a lookup makes no system calls at all; use it only when no
+ * other process is writing the database.
+ * Returns 0 if OK, -1 on error.
+ */
+int
+db_mmap(DBHANDLE h, int flags)
+{
+	DB		*db = h;
+	int		val;
+
+	/*
+	 * PROT_READ needs a descriptor open for reading.
+	 */
+	if ((val = fcntl(db->idxfd, F_GETFL, 0)) < 0)
+		return(-1);
+	if ((val & O_ACCMODE) == O_WRONLY) {
+		errno = EACCES;
+		return(-1);
+	}
+	db->mapped = 1;
+	db->nolock = (flags & DB_NOLOCK) != 0;
+	return(0);
+}
+
+/*
+ * Switch the database to WAL mode, for good: from now on, every
+ * process's stores and deletes are logged first, so a crash
+ * leaves each one either done or not done, never half done.
+ * Stores wait for the log to reach the disk, but concurrent ones
+ * share an fdatasync.  Needs a handle opened for writing.
+ * Returns 0 if OK, -1 on error.
+ */
+int
+db_wal(DBHANDLE h)
+{
+	DB		*db = h;
+	char	state[HDR_SPLIT + 8 - HDR_LEVEL];
+	int		rc = 0;
+
+	if (!db->writable) {
+		errno = EBADF;
+		return(-1);
+	}
+	if (db->logfd >= 0)
+		return(0);
+
+	/*
+	 * The split lock keeps _db_split from writing the header
+	 * while we do.
+	 */
+	if (writew_lock(db->idxfd, LOCK_SPLIT, SEEK_SET, 1) < 0)
+		err_dump("db_wal: writew_lock error");
+	_db_readstate(db);
+	if (db->flags & DBF_WAL) {
+		rc = _db_walopen(db, 0);
+	} else if (fdatasync(db->idxfd) < 0 || fdatasync(db->datfd) < 0 ||
+	  _db_walopen(db, 1) < 0) {
+		rc = -1;
+	} else {
+		db->flags |= DBF_WAL;
+		_db_statebuf(db, state);
+		if (pwrite(db->idxfd, state, sizeof(state), HDR_LEVEL) !=
+		  sizeof(state) || fdatasync(db->idxfd) < 0)
+			err_sys("db_wal: write error of header");
+	}
+	if (un_lock(db->idxfd, LOCK_SPLIT, SEEK_SET, 1) < 0)
+		err_dump("db_wal: un_lock error");
+	return(rc);
+}
+
+/*
+ * Return a pointer to len bytes at offset in a mapped file.
+ * If they're past the end of the file as we last saw it, the
+ * file may have grown: check its size, and map it again if it
+ * has outgrown the map.  Returns NULL if the file is too short.
+ */
+static char *
+_db_mapped(int fd, char **map, size_t *mapsz, size_t *size,
+           off_t offset, size_t len)
+{
+	struct stat	statbuff;
+	char		*p;
+
+	if (offset + len <= *size)
+		return(*map + offset);
+
+	if (fstat(fd, &statbuff) < 0)
+		err_sys("_db_mapped: fstat error");
+	if (offset + len > statbuff.st_size)
+		return(NULL);
+	*size = statbuff.st_size;
+	if (*size > *mapsz) {
+		/*
+		 * Map twice the current size, so a growing file isn't
+		 * remapped on every append.  We never touch the pages
+		 * past the end of the file.
+		 */
+		if ((p = mmap(NULL, *size * 2, PROT_READ, MAP_SHARED, fd,
+		  0)) == MAP_FAILED)
+			err_sys("_db_mapped: mmap error");
+		if (*map != NULL)
+			munmap(*map, *mapsz);
+		*map = p;
+		*mapsz = *size * 2;
+	}
+	return(*map + offset);
+}
+
+/*
+ * Check a caller's key against the implementation limits, so a
+ * bad one is an error return, not a core dump in _db_writeidx.
+ * Returns 1 if OK; else sets errno to EINVAL and returns 0.
+ */
+static int
+_db_keyok(const char *key)
+{
+	size_t	len;
+
+	len = strlen(key);
+	if (len < IDXLEN_MIN || len > IDXLEN_MAX) {
+		errno = EINVAL;
+		return(0);
+	}
+	return(1);
+}
+
 /*
  * Find the specified record.  Called by db_delete, db_fetch,
  * and db_store.  Returns with the hash chain locked.
@@ -260,36 +892,65 @@ static int
 _db_find_and_lock(DB *db, const char *key, int writelock)
 {
 	off_t	offset, nextoffset;
+	size_t	keylen;
+	DBHASH	hval, bucket;
 
 	/*
 	 * Calculate the hash value for this key, then calculate the
 	 * byte offset of corresponding chain ptr in hash table.
-	 * This is where our search starts.  First we calculate the
-	 * offset in the hash table for this key.
+	 * This is where our search starts.
 	 */
-	db->chainoff = (_db_hash(db, key) * PTR_SZ) + db->hashoff;
+	keylen = strlen(key);
+	hval = _db_hash(db, key, keylen);
+	for ( ; ; ) {
+		bucket = _db_bucket(db, hval);
+		db->chainoff = _db_bucketoff(db, bucket);
+
+		/*
+		 * We lock the hash chain here.  The caller must unlock it
+		 * when done.  Note we lock and unlock only the first byte.
+		 */
+		if (writelock) {
+			if (writew_lock(db->idxfd, db->chainoff, SEEK_SET, 1) < 0)
+				err_dump("_db_find_and_lock: writew_lock error");
+		} else if (!db->nolock) {
+			if (readw_lock(db->idxfd, db->chainoff, SEEK_SET, 1) < 0)
+				err_dump("_db_find_and_lock: readw_lock error");
+		}
+
+		/*
+		 * We picked the bucket using the table size as of our last
+		 * call.  A split changes the size with both of the buckets
+		 * involved locked, so if the bucket is still right now that
+		 * we hold its lock, it stays right until we unlock it.
+		 */
+		_db_readstate(db);
+		if (_db_bucket(db, hval) == bucket)
+			break;
+		if ((writelock || !db->nolock) &&
+		  un_lock(db->idxfd, db->chainoff, SEEK_SET, 1) < 0)
+			err_dump("_db_find_and_lock: un_lock error");
+	}
 	db->ptroff = db->chainoff;
 
 	/*
-	 * We lock the hash chain here.  The caller must unlock it
-	 * when done.  Note we lock and unlock only the first byte.
+	 * Another process may have switched the database to WAL mode
+	 * since we opened it; from now on we log too.
 	 */
-	if (writelock) {
-		if (writew_lock(db->idxfd, db->chainoff, SEEK_SET, 1) < 0)
-			err_dump("_db_find_and_lock: writew_lock error");
-	} else {
-		if (readw_lock(db->idxfd, db->chainoff, SEEK_SET, 1) < 0)
-			err_dump("_db_find_and_lock: readw_lock error");
-	}
+	if (writelock && (db->flags & DBF_WAL) && db->logfd < 0 &&
+	  _db_walopen(db, 0) < 0)
+		err_sys("_db_find_and_lock: can't open log");
 
 	/*
 	 * Get the offset in the index file of first record
 	 * on the hash chain (can be 0).
 	 */
+	db->chainlen = 0;
 	offset = _db_readptr(db, db->ptroff);
 	while (offset != 0) {
 		nextoffset = _db_readidx(db, offset);
-		if (strcmp(db->idxbuf, key) == 0)
+		db->chainlen++;
+		if (db->idxlen == keylen && memcmp(db->keyp, key, keylen) == 0)
 			break;       /* found a match */
 		db->ptroff = offset; /* offset of this (unequal) record */
 		offset = nextoffset; /* next one to compare */
@@ -301,18 +962,208 @@ _db_find_and_lock(DB *db, const char *key, int writelock)
 }
 
 /*
- * Calculate the hash value for a key.
+ * Calculate the hash value for a key: SipHash-2-4, keyed with
+ * the seed in the index file header.
+ */
+#define ROTL(x, b)	(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND	do { \
+	v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+	v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+} while (0)
+
+static DBHASH
+_db_hash(DB *db, const char *key, size_t len)
+{
+	uint64_t	v0, v1, v2, v3, m;
+	size_t		i;
+	int			j;
+
+	v0 = db->seed[0] ^ 0x736f6d6570736575ULL;
+	v1 = db->seed[1] ^ 0x646f72616e646f6dULL;
+	v2 = db->seed[0] ^ 0x6c7967656e657261ULL;
+	v3 = db->seed[1] ^ 0x7465646279746573ULL;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		m = _db_get64(key + i);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+	m = (uint64_t)len << 56;	/* last 0-7 bytes and the length */
+	for (j = 0; i + j < len; j++)
+		m |= (uint64_t)(unsigned char)key[i + j] << (8 * j);
+	v3 ^= m;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= m;
+
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	return(v0 ^ v1 ^ v2 ^ v3);
+}
+
+/*
+ * Map a hash value to a bucket: modulo the table size before
+ * the current round of splits, or modulo twice that if the
+ * bucket has already been split this round.
+ */
+static DBHASH
+_db_bucket(DB *db, DBHASH hval)
+{
+	DBHASH	bucket;
+
+	bucket = hval % (db->nhash << db->level);
+	if (bucket < db->split)
+		bucket = hval % (db->nhash << (db->level + 1));
+	return(bucket);
+}
+
+/*
+ * Offset in the index file of the chain ptr for a bucket.
+ */
+static off_t
+_db_bucketoff(DB *db, DBHASH bucket)
+{
+	DBHASH	first;
+	int		k;
+
+	if (bucket < db->nhash)
+		return(HASH_OFF + bucket * PTR_SZ);
+
+	/*
+	 * Segment k starts with bucket nhash * 2^(k-1).  Segments
+	 * never move, so we remember where each one is.
+	 */
+	for (k = 1, first = db->nhash; bucket >= first * 2; k++)
+		first *= 2;
+	if (db->segoff[k] == 0 &&
+	  (db->segoff[k] = _db_readptr(db, HDR_SEGOFF + k * PTR_SZ)) == 0)
+		err_dump("_db_bucketoff: missing segment");
+	return(db->segoff[k] + (bucket - first) * PTR_SZ);
+}
+
+/*
+ * Split the next bucket.  Called by db_store, with no chain
+ * locked, after an insert found a long chain.
+ */
+static void
+_db_split(DB *db)
+{
+	DBHASH	size, newb;
+	off_t	oldoff, newoff, ptroff, offset, nextoffset;
+	char	state[HDR_SPLIT + 8 - HDR_LEVEL];
+	struct iovec	iov;
+
+	/*
+	 * One split at a time.  Whoever waited for the lock
+	 * splits the bucket after the one split before it.
+	 */
+	if (writew_lock(db->idxfd, LOCK_SPLIT, SEEK_SET, 1) < 0)
+		err_dump("_db_split: writew_lock error");
+	_db_readstate(db);
+	size = db->nhash << db->level;
+	newb = db->split + size;
+	if (db->split == 0) {
+		if (db->level + 1 >= NSEG)
+			goto doreturn;	/* as big as it gets */
+		_db_newseg(db, db->level + 1);
+	}
+
+	/*
+	 * Lock both buckets: no one can look up the new one until
+	 * we update split, but readers of the old one must wait
+	 * until its records have been divided.
+	 */
+	oldoff = _db_bucketoff(db, db->split);
+	newoff = _db_bucketoff(db, newb);
+	if (writew_lock(db->idxfd, oldoff, SEEK_SET, 1) < 0 ||
+	  writew_lock(db->idxfd, newoff, SEEK_SET, 1) < 0)
+		err_dump("_db_split: writew_lock error");
+
+	/*
+	 * Move the records that hash to the new bucket at the next
+	 * level to the front of its chain.
+	 */
+	ptroff = oldoff;
+	offset = _db_readptr(db, oldoff);
+	while (offset != 0) {
+		nextoffset = _db_readidx(db, offset);
+		if (_db_hash(db, db->keyp, db->idxlen) % (size * 2) == newb) {
+			_db_writeptr(db, ptroff, nextoffset);
+			_db_writeptr(db, offset + IDX_PTR, _db_readptr(db, newoff));
+			_db_writeptr(db, newoff, offset);
+		} else {
+			ptroff = offset + IDX_PTR;
+		}
+		offset = nextoffset;
+	}
+
+	if (++db->split == size) {
+		db->split = 0;		/* the table has doubled */
+		db->level++;
+	}
+	_db_statebuf(db, state);
+	iov.iov_base = state;
+	iov.iov_len  = sizeof(state);
+	if (_db_write(db, ENT_DEFER, &iov, 1, sizeof(state), HDR_LEVEL) < 0)
+		err_dump("_db_split: write error of table size");
+	_db_commit(db);
+
+	if (un_lock(db->idxfd, oldoff, SEEK_SET, 1) < 0 ||
+	  un_lock(db->idxfd, newoff, SEEK_SET, 1) < 0)
+		err_dump("_db_split: un_lock error");
+doreturn:
+	if (un_lock(db->idxfd, LOCK_SPLIT, SEEK_SET, 1) < 0)
+		err_dump("_db_split: un_lock error");
+}
+
+/*
+ * Append segment k of the hash table to the index file, unless
+ * it's already there (a split that created it didn't finish).
+ * Called with LOCK_SPLIT locked.  The segment is preceded by an
+ * index record header flagged IDX_SEGMENT, so db_nextrec can
+ * step over it.
  */
-static DBHASH
-_db_hash(DB *db, const char *key)
+static void
+_db_newseg(DB *db, int k)
 {
-	DBHASH		hval = 0;
-	char		c;
-	int			i;
+	off_t	offset;
+	size_t	len;
+	char	hdr[IDXHDR_SZ];
+	struct iovec	iov;
 
-	for (i = 1; (c = *key++) != 0; i++)
-		hval += c * i;		/* ascii char times its 1-based index */
-	return(hval % db->nhash);
+	if ((db->segoff[k] = _db_readptr(db, HDR_SEGOFF + k * PTR_SZ)) != 0)
+		return;
+	len = (db->nhash << (k - 1)) * PTR_SZ;
+
+	if (writew_lock(db->idxfd, LOCK_APPEND, SEEK_SET, 1) < 0)
+		err_dump("_db_newseg: writew_lock error");
+	if ((offset = lseek(db->idxfd, 0, SEEK_END)) == -1)
+		err_dump("_db_newseg: lseek error");
+
+	/*
+	 * Extending the file gives us the zeroed chain ptrs.
+	 */
+	memset(hdr, 0, sizeof(hdr));
+	_db_put64(hdr + IDX_DATLEN, len);
+	_db_put32(hdr + IDX_FLAGS, IDX_SEGMENT);
+	iov.iov_base = hdr;
+	iov.iov_len  = IDXHDR_SZ;
+	if (_db_write(db, ENT_EXTEND, NULL, 0, 0, offset + IDXHDR_SZ + len) < 0)
+		err_dump("_db_newseg: ftruncate error");
+	if (_db_write(db, 0, &iov, 1, IDXHDR_SZ, offset) < 0)
+		err_dump("_db_newseg: write error of segment");
+	if (un_lock(db->idxfd, LOCK_APPEND, SEEK_SET, 1) < 0)
+		err_dump("_db_newseg: un_lock error");
+
+	db->segoff[k] = offset + IDXHDR_SZ;
+	_db_writeptr(db, HDR_SEGOFF + k * PTR_SZ, db->segoff[k]);
 }
 
 /*
@@ -323,110 +1174,141 @@ _db_hash(DB *db, const char *key)
 static off_t
 _db_readptr(DB *db, off_t offset)
 {
-	char	asciiptr[PTR_SZ + 1];
-
-	if (lseek(db->idxfd, offset, SEEK_SET) == -1)
-		err_dump("_db_readptr: lseek error to ptr field");
-	if (read(db->idxfd, asciiptr, PTR_SZ) != PTR_SZ)
+	char	ptr[PTR_SZ], *p;
+
+	if (db->mapped) {
+		if ((p = _db_mapped(db->idxfd, &db->idxmap, &db->idxmapsz,
+		  &db->idxsize, offset, PTR_SZ)) == NULL)
+			err_dump("_db_readptr: read error of ptr field");
+		memcpy(ptr, p, PTR_SZ);
+	} else if (pread(db->idxfd, ptr, PTR_SZ, offset) != PTR_SZ) {
 		err_dump("_db_readptr: read error of ptr field");
-	asciiptr[PTR_SZ] = 0;		/* null terminate */
-	return(atol(asciiptr));
+	}
+	if (db->txnlen > 0)
+		_db_overlay(db, 0, ptr, PTR_SZ, offset);
+	return((off_t)_db_get64(ptr));
 }
 
 /*
  * Read the next index record.  We start at the specified offset
- * in the index file.  We read the index record into db->idxbuf
- * and replace the separators with null bytes.  If all is OK we
+ * in the index file.  We read the index record into db->recbuf
+ * and null terminate the key in db->idxbuf, or after db_mmap
+ * just point db->keyp at the key in the map.  If all is OK we
  * set db->datoff and db->datlen to the offset and length of the
  * corresponding data record in the data file.
  */
 static off_t
 _db_readidx(DB *db, off_t offset)
 {
-	ssize_t				i;
-	char			*ptr1, *ptr2;
-	char			asciiptr[PTR_SZ + 1], asciilen[IDXLEN_SZ + 1];
-	struct iovec	iov[2];
+	ssize_t	i;
+	int		sequential = offset == 0;
+	char	*rec;
 
 	/*
-	 * Position index file and record the offset.  db_nextrec
-	 * calls us with offset==0, meaning read from current offset.
-	 * We still need to call lseek to record the current offset.
+	 * db_nextrec calls us with offset==0, meaning read the
+	 * record following the one it read last time.
 	 */
-	if ((db->idxoff = lseek(db->idxfd, offset,
-	  offset == 0 ? SEEK_CUR : SEEK_SET)) == -1)
-		err_dump("_db_readidx: lseek error");
+	if (sequential)
+		offset = db->nextoff;
+	db->idxoff = offset;
+
+	if (db->mapped) {
+		if ((rec = _db_mapped(db->idxfd, &db->idxmap, &db->idxmapsz,
+		  &db->idxsize, offset, IDXHDR_SZ)) == NULL) {
+			if (sequential)
+				return(-1);		/* EOF for db_nextrec */
+			err_dump("_db_readidx: read error of index record");
+		}
+		i = IDXHDR_SZ;
+	} else {
+		/*
+		 * Read the header and the key with one pread.  We don't
+		 * know the key length until we have the header, so ask for
+		 * as much as the longest key needs; whatever follows the
+		 * key is ignored.
+		 */
+		rec = db->recbuf;
+		if ((i = pread(db->idxfd, rec, IDXHDR_SZ + IDXLEN_MAX,
+		  offset)) < IDXHDR_SZ) {
+			if (i == 0 && sequential)
+				return(-1);		/* EOF for db_nextrec */
+			err_dump("_db_readidx: read error of index record");
+		}
+	}
 
 	/*
-	 * Read the ascii chain ptr and the ascii length at
-	 * the front of the index record.  This tells us the
-	 * remaining size of the index record.
+	 * The header may have been rewritten by the operation we're
+	 * in the middle of, in WAL mode.
 	 */
-	iov[0].iov_base = asciiptr;
-	iov[0].iov_len  = PTR_SZ;
-	iov[1].iov_base = asciilen;
-	iov[1].iov_len  = IDXLEN_SZ;
-	if ((i = readv(db->idxfd, &iov[0], 2)) != PTR_SZ + IDXLEN_SZ) {
-		if (i == 0 && offset == 0)
-			return(-1);		/* EOF for db_nextrec */
-		err_dump("_db_readidx: readv error of index record");
+	if (db->txnlen > 0) {
+		if (rec != db->recbuf)
+			memcpy(db->recbuf, rec, IDXHDR_SZ);
+		rec = db->recbuf;
+		_db_overlay(db, 0, rec, IDXHDR_SZ, offset);
 	}
 
 	/*
 	 * This is our return value; always >= 0.
 	 */
-	asciiptr[PTR_SZ] = 0;        /* null terminate */
-	db->ptrval = atol(asciiptr); /* offset of next key in chain */
+	db->ptrval = (off_t)_db_get64(rec + IDX_PTR);
+	db->datoff = (off_t)_db_get64(rec + IDX_DATOFF);
+	db->datlen = (size_t)_db_get64(rec + IDX_DATLEN);
+	db->idxlen = _db_get32(rec + IDX_KEYLEN);
+	db->idxflags = _db_get32(rec + IDX_FLAGS);
 
-	asciilen[IDXLEN_SZ] = 0;     /* null terminate */
-	if ((db->idxlen = atoi(asciilen)) < IDXLEN_MIN ||
-	  db->idxlen > IDXLEN_MAX)
+	if (db->idxflags & IDX_SEGMENT) {
+		/*
+		 * A hash table segment; only db_nextrec comes across
+		 * these, and skips them.
+		 */
+		db->nextoff = offset + IDXHDR_SZ + db->datlen;
+		return(0);
+	}
+	if (db->idxlen < IDXLEN_MIN || db->idxlen > IDXLEN_MAX)
 		err_dump("_db_readidx: invalid length");
+	if (db->mapped) {
+		/*
+		 * Make sure the key is mapped too; this may move the map.
+		 */
+		if ((rec = _db_mapped(db->idxfd, &db->idxmap, &db->idxmapsz,
+		  &db->idxsize, offset, IDXHDR_SZ + db->idxlen)) == NULL)
+			err_dump("_db_readidx: read error of index record");
+		db->keyp = rec + IDXHDR_SZ;
+	} else {
+		if (i < IDXHDR_SZ + db->idxlen)
+			err_dump("_db_readidx: read error of index record");
+		db->idxbuf[db->idxlen] = 0;	 /* null terminate the key */
+		db->keyp = db->idxbuf;
+	}
+	db->nextoff = offset + IDXHDR_SZ + db->idxlen;
 
-	/*
-	 * Now read the actual index record.  We read it into the key
-	 * buffer that we malloced when we opened the database.
-	 */
-	if ((i = read(db->idxfd, db->idxbuf, db->idxlen)) != db->idxlen)
-		err_dump("_db_readidx: read error of index record");
-	if (db->idxbuf[db->idxlen-1] != NEWLINE)	/* sanity check */
-		err_dump("_db_readidx: missing newline");
-	db->idxbuf[db->idxlen-1] = 0;	 /* replace newline with null */
-
-	/*
-	 * Find the separators in the index record.
-	 */
-	if ((ptr1 = strchr(db->idxbuf, SEP)) == NULL)
-		err_dump("_db_readidx: missing first separator");
-	*ptr1++ = 0;				/* replace SEP with null */
-
-	if ((ptr2 = strchr(ptr1, SEP)) == NULL)
-		err_dump("_db_readidx: missing second separator");
-	*ptr2++ = 0;				/* replace SEP with null */
-
-	if (strchr(ptr2, SEP) != NULL)
-		err_dump("_db_readidx: too many separators");
-
-	/*
-	 * Get the starting offset and length of the data record.
-	 */
-	if ((db->datoff = atol(ptr1)) < 0)
-		err_dump("_db_readidx: starting offset < 0");
-	if ((db->datlen = atol(ptr2)) <= 0 || db->datlen > DATLEN_MAX)
+	if (db->ptrval < 0 || db->datoff < 0)
+		err_dump("_db_readidx: invalid offset");
+	if (db->datlen < DATLEN_MIN)
 		err_dump("_db_readidx: invalid length");
 	return(db->ptrval);		/* return offset of next key in chain */
 }
 
 /*
- * Read the current data record into the data buffer.
+ * Read the current data record into the data buffer, growing
+ * the buffer if the record is bigger than it.
  * Return a pointer to the null-terminated data buffer.
  */
 static char *
 _db_readdat(DB *db)
 {
-	if (lseek(db->datfd, db->datoff, SEEK_SET) == -1)
-		err_dump("_db_readdat: lseek error");
-	if (read(db->datfd, db->datbuf, db->datlen) != db->datlen)
+	if (db->datlen > db->datbufsz) {
+		free(db->datbuf);
+		if ((db->datbuf = malloc(db->datlen)) == NULL)
+			err_dump("_db_readdat: malloc error for data buffer");
+		db->datbufsz = db->datlen;
+	}
+	if (db->mapped) {
+		memcpy(db->datbuf, _db_mapdat(db), db->datlen - 1);
+		db->datbuf[db->datlen-1] = 0;
+		return(db->datbuf);
+	}
+	if (_db_pread(db->datfd, db->datbuf, db->datlen, db->datoff) < 0)
 		err_dump("_db_readdat: read error");
 	if (db->datbuf[db->datlen-1] != NEWLINE)	/* sanity check */
 		err_dump("_db_readdat: missing newline");
@@ -434,6 +1316,45 @@ _db_readdat(DB *db)
 	return(db->datbuf);		/* return pointer to data record */
 }
 
+/*
+ * Read len bytes at offset, however many reads it takes.
+ * Returns 0 if OK, -1 on error or end of file.
+ */
+static int
+_db_pread(int fd, char *buf, size_t len, off_t offset)
+{
+	ssize_t	n;
+
+	while (len > 0) {
+		if ((n = pread(fd, buf, len, offset)) <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			return(-1);
+		}
+		buf += n;
+		len -= n;
+		offset += n;
+	}
+	return(0);
+}
+
+/*
+ * Return a pointer to the current data record in the mapped
+ * data file.  It ends in a newline, not a null.
+ */
+static char *
+_db_mapdat(DB *db)
+{
+	char	*ptr;
+
+	if ((ptr = _db_mapped(db->datfd, &db->datmap, &db->datmapsz,
+	  &db->datsize, db->datoff, db->datlen)) == NULL)
+		err_dump("_db_mapdat: read error");
+	if (ptr[db->datlen-1] != NEWLINE)	/* sanity check */
+		err_dump("_db_mapdat: missing newline");
+	return(ptr);
+}
+
 /*
  * Delete the specified record.
  */
@@ -443,6 +1364,10 @@ db_delete(DBHANDLE h, const char *key)
 	DB		*db = h;
 	int		rc = 0;			/* assume record will be found */
 
+	if (!_db_keyok(key)) {
+		db->cnt_delerr++;
+		return(-1);
+	}
 	if (_db_find_and_lock(db, key, 1) == 0) {
 		_db_dodelete(db);
 		db->cnt_delok++;
@@ -450,6 +1375,7 @@ db_delete(DBHANDLE h, const char *key)
 		rc = -1;			/* not found */
 		db->cnt_delerr++;
 	}
+	_db_commit(db);
 	if (un_lock(db->idxfd, db->chainoff, SEEK_SET, 1) < 0)
 		err_dump("db_delete: un_lock error");
 	return(rc);
@@ -463,19 +1389,13 @@ db_delete(DBHANDLE h, const char *key)
 static void
 _db_dodelete(DB *db)
 {
-	int		i;
-	char	*ptr;
 	off_t	freeptr, saveptr;
 
 	/*
-	 * Set data buffer and key to all blanks.
+	 * Set key to all blanks.
 	 */
-	for (ptr = db->datbuf, i = 0; i < db->datlen - 1; i++)
-		*ptr++ = SPACE;
-	*ptr = 0;	/* null terminate for _db_writedat */
-	ptr = db->idxbuf;
-	while (*ptr)
-		*ptr++ = SPACE;
+	memset(db->idxbuf, SPACE, db->idxlen);
+	db->idxbuf[db->idxlen] = 0;
 
 	/*
 	 * We have to lock the free list.
@@ -484,9 +1404,14 @@ _db_dodelete(DB *db)
 		err_dump("_db_dodelete: writew_lock error");
 
 	/*
-	 * Write the data record with all blanks.
+	 * Write the data record with all blanks, leaving the newline;
+	 * but not a big one in WAL mode, where replaying the blanks
+	 * could wipe out a later record reusing the space.
 	 */
-	_db_writedat(db, db->datbuf, db->datoff, SEEK_SET);
+	if ((db->logfd < 0 || db->datlen <= DATLEN_INLINE) &&
+	  _db_write(db, ENT_DAT | ENT_DEFER | ENT_FILL, NULL, 0,
+	  db->datlen - 1, db->datoff) < 0)
+		err_dump("_db_dodelete: write error of data record");
 
 	/*
 	 * Read the free list pointer.  Its value becomes the
@@ -502,11 +1427,12 @@ _db_dodelete(DB *db)
 	saveptr = db->ptrval;
 
 	/*
-	 * Rewrite the index record.  This also rewrites the length
-	 * of the index record, the data offset, and the data length,
-	 * none of which has changed, but that's OK.
+	 * Rewrite the index record, marked deleted.  This also
+	 * rewrites the length of the key, the data offset, and the
+	 * data length, none of which has changed, but that's OK.
 	 */
-	_db_writeidx(db, db->idxbuf, db->idxoff, SEEK_SET, freeptr);
+	_db_writeidx(db, db->idxbuf, db->idxoff, SEEK_SET, freeptr,
+	  IDX_DELETED);
 
 	/*
 	 * Write the new free list pointer.
@@ -520,19 +1446,22 @@ _db_dodelete(DB *db)
 	 * contents of the deleted record's chain ptr, saveptr.
 	 */
 	_db_writeptr(db, db->ptroff, saveptr);
-	if (un_lock(db->idxfd, FREE_OFF, SEEK_SET, 1) < 0)
-		err_dump("_db_dodelete: un_lock error");
+	_db_unlockfree(db);
 }
 
 /*
- * Write a data record.  Called by _db_dodelete (to write
- * the record with blanks) and db_store.
+ * Write a data record: the data, in iovcnt pieces totalling len
+ * bytes, then a newline.  Called by _db_store.  The data goes
+ * to the file straight from the caller's buffers.
  */
 static void
-_db_writedat(DB *db, const char *data, off_t offset, int whence)
+_db_writedat(DB *db, const struct iovec *iov, int iovcnt, size_t len,
+             off_t offset, int whence)
 {
-	struct iovec	iov[2];
+	struct iovec	vec[IOV_BATCH];
 	static char		newline = NEWLINE;
+	int				rc;
+	unsigned		flags = ENT_DAT;
 
 	/*
 	 * If we're appending, we have to lock before doing the lseek
@@ -545,13 +1474,27 @@ _db_writedat(DB *db, const char *data, off_t offset, int whence)
 
 	if ((db->datoff = lseek(db->datfd, offset, whence)) == -1)
 		err_dump("_db_writedat: lseek error");
-	db->datlen = strlen(data) + 1;	/* datlen includes newline */
+	db->datlen = len + 1;	/* datlen includes newline */
+	if (len + 1 > DATLEN_INLINE)
+		flags |= ENT_SYNCED;	/* too big to log, and nothing points here */
+	else if (whence != SEEK_END)
+		flags |= ENT_DEFER;		/* overwriting */
 
-	iov[0].iov_base = (char *) data;
-	iov[0].iov_len  = db->datlen - 1;
-	iov[1].iov_base = &newline;
-	iov[1].iov_len  = 1;
-	if (writev(db->datfd, &iov[0], 2) != db->datlen)
+	/*
+	 * Usually the newline fits in the same pwritev.
+	 */
+	if (iovcnt < IOV_BATCH) {
+		memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+		vec[iovcnt].iov_base = &newline;
+		vec[iovcnt].iov_len  = 1;
+		rc = _db_write(db, flags, vec, iovcnt + 1, len + 1, db->datoff);
+	} else {
+		vec[0].iov_base = &newline;
+		vec[0].iov_len  = 1;
+		if ((rc = _db_write(db, flags, iov, iovcnt, len, db->datoff)) == 0)
+			rc = _db_write(db, flags, vec, 1, 1, db->datoff + len);
+	}
+	if (rc < 0)
 		err_dump("_db_writedat: writev error of data record");
 
 	if (whence == SEEK_END)
@@ -559,6 +1502,72 @@ _db_writedat(DB *db, const char *data, off_t offset, int whence)
 			err_dump("_db_writedat: un_lock error");
 }
 
+/*
+ * Write all of an iovec array at offset, IOV_BATCH iovecs at
+ * a time, picking up where a short write left off.
+ * Returns 0 if OK, -1 on error.
+ */
+static int
+_db_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	struct iovec	vec[IOV_BATCH];
+	ssize_t			nw;
+	int				i, n;
+
+	while (iovcnt > 0) {
+		n = iovcnt < IOV_BATCH ? iovcnt : IOV_BATCH;
+		memcpy(vec, iov, n * sizeof(struct iovec));
+		for (i = 0; i < n; ) {
+			if ((nw = pwritev(fd, vec + i, n - i, offset)) < 0) {
+				if (errno == EINTR)
+					continue;
+				return(-1);
+			}
+			offset += nw;
+			while (i < n && nw >= vec[i].iov_len)
+				nw -= vec[i++].iov_len;
+			if (i < n) {
+				vec[i].iov_base = (char *)vec[i].iov_base + nw;
+				vec[i].iov_len -= nw;
+			}
+		}
+		iov += n;
+		iovcnt -= n;
+	}
+	return(0);
+}
+
+/*
+ * Write len blanks at offset, from the data buffer set to blanks,
+ * a buffer full per iovec.  Returns 0 if OK, -1 on error.
+ */
+static int
+_db_fill(DB *db, int fd, size_t len, off_t offset)
+{
+	struct iovec	iov[IOV_BATCH];
+	size_t			bufsz, done;
+	int				i, n;
+
+	if (len == 0)
+		return(0);
+	bufsz = db->datbufsz < len ? db->datbufsz : len;
+	memset(db->datbuf, SPACE, bufsz);
+	for (i = 0; i < IOV_BATCH; i++) {
+		iov[i].iov_base = db->datbuf;
+		iov[i].iov_len = bufsz;
+	}
+	for (done = 0; done < len; done += n * bufsz) {
+		n = (len - done + bufsz - 1) / bufsz;
+		if (n > IOV_BATCH)
+			n = IOV_BATCH;
+		if (done + n * bufsz > len)		/* short last one */
+			iov[n - 1].iov_len = len - done - (n - 1) * bufsz;
+		if (_db_pwritev(fd, iov, n, offset + done) < 0)
+			return(-1);
+	}
+	return(0);
+}
+
 /*
  * Write an index record.  _db_writedat is called before
  * this function to set the datoff and datlen fields in the
@@ -566,48 +1575,68 @@ _db_writedat(DB *db, const char *data, off_t offset, int whence)
  */
 static void
 _db_writeidx(DB *db, const char *key,
-             off_t offset, int whence, off_t ptrval)
+             off_t offset, int whence, off_t ptrval, unsigned flags)
 {
-	struct iovec	iov[2];
-	char			asciiptrlen[PTR_SZ + IDXLEN_SZ + 1];
-	int				len;
-
-	if ((db->ptrval = ptrval) < 0 || ptrval > PTR_MAX)
-		err_quit("_db_writeidx: invalid ptr: %d", ptrval);
-	sprintf(db->idxbuf, "%s%c%lld%c%ld\n", key, SEP,
-	  (long long)db->datoff, SEP, (long)db->datlen);
-	len = strlen(db->idxbuf);
+	size_t	len;
+	char	flagbuf[4];
+	struct iovec	iov;
+
+	if ((db->ptrval = ptrval) < 0)
+		err_quit("_db_writeidx: invalid ptr: %lld", (long long)ptrval);
+	len = strlen(key);
 	if (len < IDXLEN_MIN || len > IDXLEN_MAX)
 		err_dump("_db_writeidx: invalid length");
-	sprintf(asciiptrlen, "%*lld%*d", PTR_SZ, (long long)ptrval,
-	  IDXLEN_SZ, len);
 
 	/*
-	 * If we're appending, we have to lock before doing the lseek
-	 * and write to make the two an atomic operation.  If we're
-	 * overwriting an existing record, we don't have to lock.
+	 * Build the record in db->recbuf.  The key may already be
+	 * there (_db_dodelete passes db->idxbuf).
 	 */
-	if (whence == SEEK_END)		/* we're appending */
-		if (writew_lock(db->idxfd, ((db->nhash+1)*PTR_SZ)+1,
-		  SEEK_SET, 0) < 0)
-			err_dump("_db_writeidx: writew_lock error");
+	_db_put64(db->recbuf + IDX_PTR, ptrval);
+	_db_put64(db->recbuf + IDX_DATOFF, db->datoff);
+	_db_put64(db->recbuf + IDX_DATLEN, db->datlen);
+	_db_put32(db->recbuf + IDX_KEYLEN, len);
+	_db_put32(db->recbuf + IDX_FLAGS, flags);
+	if (key != db->idxbuf)
+		memcpy(db->idxbuf, key, len + 1);
+	db->keyp = db->idxbuf;
+	db->idxlen = len;
+	db->idxflags = flags;
 
 	/*
-	 * Position the index file and record the offset.
+	 * If we're appending, we have to lock before finding the end
+	 * of the file and writing, to make the two an atomic operation.
+	 * If we're overwriting an existing record, we don't have to lock.
 	 */
-	if ((db->idxoff = lseek(db->idxfd, offset, whence)) == -1)
-		err_dump("_db_writeidx: lseek error");
+	if (whence == SEEK_END) {	/* we're appending */
+		if (writew_lock(db->idxfd, LOCK_APPEND, SEEK_SET, 1) < 0)
+			err_dump("_db_writeidx: writew_lock error");
+		if ((offset = lseek(db->idxfd, 0, SEEK_END)) == -1)
+			err_dump("_db_writeidx: lseek error");
+	}
 
-	iov[0].iov_base = asciiptrlen;
-	iov[0].iov_len  = PTR_SZ + IDXLEN_SZ;
-	iov[1].iov_base = db->idxbuf;
-	iov[1].iov_len  = len;
-	if (writev(db->idxfd, &iov[0], 2) != PTR_SZ + IDXLEN_SZ + len)
-		err_dump("_db_writeidx: writev error of index record");
+	/*
+	 * Record the offset and write header and key together.  An
+	 * append in WAL mode goes out pending; the commit sets the
+	 * real flags.
+	 */
+	db->idxoff = offset;
+	if (whence == SEEK_END && db->logfd >= 0)
+		_db_put32(db->recbuf + IDX_FLAGS, flags | IDX_PENDING);
+	iov.iov_base = db->recbuf;
+	iov.iov_len  = IDXHDR_SZ + len;
+	if (_db_write(db, whence == SEEK_END ? 0 : ENT_DEFER, &iov, 1,
+	  IDXHDR_SZ + len, offset) < 0)
+		err_dump("_db_writeidx: write error of index record");
+	if (whence == SEEK_END && db->logfd >= 0) {
+		_db_put32(flagbuf, flags);
+		iov.iov_base = flagbuf;
+		iov.iov_len  = 4;
+		if (_db_write(db, ENT_DEFER, &iov, 1, 4, offset + IDX_FLAGS) < 0)
+			err_dump("_db_writeidx: write error of index flags");
+	}
 
 	if (whence == SEEK_END)
-		if (un_lock(db->idxfd, ((db->nhash+1)*PTR_SZ)+1,
-		  SEEK_SET, 0) < 0)
+		if (un_lock(db->idxfd, LOCK_APPEND, SEEK_SET, 1) < 0)
 			err_dump("_db_writeidx: un_lock error");
 }
 
@@ -618,16 +1647,504 @@ _db_writeidx(DB *db, const char *key,
 static void
 _db_writeptr(DB *db, off_t offset, off_t ptrval)
 {
-	char	asciiptr[PTR_SZ + 1];
+	char	ptr[PTR_SZ];
+	struct iovec	iov;
+
+	if (ptrval < 0)
+		err_quit("_db_writeptr: invalid ptr: %lld", (long long)ptrval);
+	_db_put64(ptr, ptrval);
+	iov.iov_base = ptr;
+	iov.iov_len  = PTR_SZ;
+	if (_db_write(db, ENT_DEFER, &iov, 1, PTR_SZ, offset) < 0)
+		err_dump("_db_writeptr: write error of ptr field");
+}
+
+/*
+ * Write len bytes, gathered from an iovec array, at offset in the
+ * index file, or the data file if ENT_DAT is set.  In WAL mode
+ * the write is also added to the current transaction, and if
+ * ENT_DEFER is set, it's left for _db_commit to make.  With
+ * ENT_EXTEND, extend the file to offset instead; with ENT_FILL,
+ * write len blanks.  An ENT_SYNCED write's data isn't logged.
+ * An ENT_END entry is only logged: it says the operation's appends
+ * end at offset in the index file and len in the data file.
+ * Returns 0 if OK, -1 on error.
+ */
+static int
+_db_write(DB *db, unsigned flags, const struct iovec *iov, int iovcnt,
+          size_t len, off_t offset)
+{
+	char	*p;
+	size_t	need;
+	off_t	end;
+	int		i, fd;
+
+	fd = (flags & ENT_DAT) ? db->datfd : db->idxfd;
+	if (db->logfd >= 0) {
+		need = db->txnlen + ENT_SIZE(flags, len);
+		if (need > db->txnsz) {
+			db->txnsz = db->txnsz * 2 > need ? db->txnsz * 2 : need;
+			if ((db->txnbuf = realloc(db->txnbuf, db->txnsz)) == NULL)
+				err_dump("_db_write: realloc error");
+		}
+		p = db->txnbuf + db->txnlen;
+		memset(p, 0, ENT_HDR_SZ);
+		_db_put32(p + ENT_FLAGS, flags);
+		_db_put64(p + ENT_OFF, offset);
+		_db_put64(p + ENT_LEN, len);
+		if (!(flags & ENT_NODATA)) {
+			p += ENT_HDR_SZ;
+			for (i = 0; i < iovcnt; i++) {
+				memcpy(p, iov[i].iov_base, iov[i].iov_len);
+				p += iov[i].iov_len;
+			}
+			memset(p, 0, ENT_PAD(len) - len);
+		}
+		db->txnlen = need;
+		if (flags & ENT_SYNCED)
+			db->datsync = 1;
+		if (flags & (ENT_DEFER | ENT_END))
+			return(0);
 
-	if (ptrval < 0 || ptrval > PTR_MAX)
-		err_quit("_db_writeptr: invalid ptr: %d", ptrval);
-	sprintf(asciiptr, "%*lld", PTR_SZ, (long long)ptrval);
+		/*
+		 * Written now, so it's in the extent we commit.
+		 */
+		end = (flags & ENT_EXTEND) ? offset : offset + (off_t)len;
+		if (flags & ENT_DAT) {
+			if (end > db->datend)
+				db->datend = end;
+		} else if (end > db->idxend) {
+			db->idxend = end;
+		}
+	}
+	if (flags & ENT_EXTEND)
+		return(ftruncate(fd, offset));
+	if (flags & ENT_FILL)
+		return(_db_fill(db, fd, len, offset));
+	return(_db_pwritev(fd, iov, iovcnt, offset));
+}
 
-	if (lseek(db->idxfd, offset, SEEK_SET) == -1)
-		err_dump("_db_writeptr: lseek error to ptr field");
-	if (write(db->idxfd, asciiptr, PTR_SZ) != PTR_SZ)
-		err_dump("_db_writeptr: write error of ptr field");
+/*
+ * Copy the writes the current transaction is holding back over
+ * len bytes read from offset in the index file (file 0) or the
+ * data file (ENT_DAT), so we see our own changes.
+ */
+static void
+_db_overlay(DB *db, unsigned file, char *buf, size_t len, off_t offset)
+{
+	char		*p, *end;
+	uint32_t	flags;
+	uint64_t	eoff, elen, lo, hi;
+
+	end = db->txnbuf + db->txnlen;
+	for (p = db->txnbuf; p < end; p += ENT_SIZE(flags, elen)) {
+		flags = _db_get32(p + ENT_FLAGS);
+		eoff = _db_get64(p + ENT_OFF);
+		elen = _db_get64(p + ENT_LEN);
+		if (!(flags & ENT_DEFER) || (flags & ENT_DAT) != file)
+			continue;
+		lo = eoff > (uint64_t)offset ? eoff : (uint64_t)offset;
+		hi = eoff + elen < (uint64_t)offset + len ?
+		  eoff + elen : (uint64_t)offset + len;
+		if (lo < hi && (flags & ENT_FILL))
+			memset(buf + (lo - offset), SPACE, hi - lo);
+		else if (lo < hi)
+			memcpy(buf + (lo - offset), p + ENT_HDR_SZ + (lo - eoff),
+			  hi - lo);
+	}
+}
+
+/*
+ * End an operation.  In WAL mode, append its transaction to the
+ * log, wait until the log is on disk, then make the writes that
+ * were held back.  Called before the chain locks are released;
+ * the free list, if we changed it, is unlocked here.
+ */
+static void
+_db_commit(DB *db)
+{
+	char			hdr[TXN_HDR_SZ], *p, *end;
+	struct iovec	iov[2];
+	uint32_t		flags;
+	uint64_t		elen;
+	off_t			logend;
+	int				fd;
+
+	if (db->txnlen > 0) {
+		if (db->idxend > 0 || db->datend > 0)
+			_db_write(db, ENT_END, NULL, 0, db->datend, db->idxend);
+
+		/*
+		 * Big data records appended to the data file aren't in
+		 * the log, so they must be on disk before it refers to
+		 * them.
+		 */
+		if (db->datsync) {
+			if (fdatasync(db->datfd) < 0)
+				err_sys("_db_commit: fdatasync error");
+			db->datsync = 0;
+		}
+
+		/*
+		 * A checkpoint can't start until the transaction is
+		 * both logged and applied.  The rwlock stops our own
+		 * checkpointer: record locks don't, within a process.
+		 */
+		if (pthread_rwlock_rdlock(&db->ckptlock) != 0)
+			err_dump("_db_commit: pthread_rwlock_rdlock error");
+		if (readw_lock(db->logfd, WAL_LOCK_CKPT, SEEK_SET, 1) < 0)
+			err_dump("_db_commit: readw_lock error");
+		if (_db_pread(db->logfd, hdr + TXN_GEN, 8, WAL_GEN) < 0)
+			err_dump("_db_commit: read error of log header");
+		_db_put64(hdr + TXN_LEN, db->txnlen);
+		_db_put64(hdr + TXN_SUM, _db_hash(db, db->txnbuf, db->txnlen));
+		iov[0].iov_base = hdr;
+		iov[0].iov_len  = TXN_HDR_SZ;
+		iov[1].iov_base = db->txnbuf;
+		iov[1].iov_len  = db->txnlen;
+		if (writev(db->appendfd, iov, 2) != TXN_HDR_SZ + db->txnlen)
+			err_dump("_db_commit: write error of log");
+		if ((logend = lseek(db->appendfd, 0, SEEK_CUR)) == -1)
+			err_dump("_db_commit: lseek error");
+		_db_logsync(db, logend);
+		db->idxend = db->datend = 0;
+		db->cnt_commit++;
+
+		end = db->txnbuf + db->txnlen;
+		for (p = db->txnbuf; p < end; p += ENT_SIZE(flags, elen)) {
+			flags = _db_get32(p + ENT_FLAGS);
+			elen = _db_get64(p + ENT_LEN);
+			if (!(flags & ENT_DEFER))
+				continue;
+			fd = (flags & ENT_DAT) ? db->datfd : db->idxfd;
+			iov[0].iov_base = p + ENT_HDR_SZ;
+			iov[0].iov_len  = elen;
+			if (((flags & ENT_FILL) ?
+			  _db_fill(db, fd, elen, _db_get64(p + ENT_OFF)) :
+			  _db_pwritev(fd, iov, 1, _db_get64(p + ENT_OFF))) < 0)
+				err_dump("_db_commit: write error");
+		}
+		db->txnlen = 0;
+
+		if (un_lock(db->logfd, WAL_LOCK_CKPT, SEEK_SET, 1) < 0)
+			err_dump("_db_commit: un_lock error");
+		pthread_rwlock_unlock(&db->ckptlock);
+		if (logend >= WAL_CKPT_SIZE) {
+			pthread_mutex_lock(&db->ckptmutex);
+			pthread_cond_signal(&db->ckptcond);
+			pthread_mutex_unlock(&db->ckptmutex);
+		}
+	}
+	if (db->freelocked) {
+		db->freelocked = 0;
+		if (un_lock(db->idxfd, FREE_OFF, SEEK_SET, 1) < 0)
+			err_dump("_db_commit: un_lock error");
+	}
+}
+
+/*
+ * Make sure the log is on disk up to logend.  This is group
+ * commit: one fdatasync covers every transaction appended before
+ * it started, so whoever waited for the lock meanwhile usually
+ * finds its own transaction already synced.  Also move the
+ * committed ends in the log header past our appends, for the
+ * next checkpoint to keep; our ENT_END entry is what counts
+ * until then.
+ */
+static void
+_db_logsync(DB *db, off_t logend)
+{
+	char		buf[24];
+	struct stat	statbuff;
+
+	if (writew_lock(db->logfd, WAL_LOCK_SYNC, SEEK_SET, 1) < 0)
+		err_dump("_db_logsync: writew_lock error");
+	if (_db_pread(db->logfd, buf, 24, WAL_SYNCED) < 0)
+		err_dump("_db_logsync: read error of log header");
+	if (db->idxend > (off_t)_db_get64(buf + 8) ||
+	  db->datend > (off_t)_db_get64(buf + 16)) {
+		if (db->idxend > (off_t)_db_get64(buf + 8))
+			_db_put64(buf + 8, db->idxend);
+		if (db->datend > (off_t)_db_get64(buf + 16))
+			_db_put64(buf + 16, db->datend);
+		if (pwrite(db->logfd, buf + 8, 16, WAL_IDXEND) != 16)
+			err_dump("_db_logsync: write error of log header");
+	}
+	if ((off_t)_db_get64(buf) < logend) {
+		if (fstat(db->logfd, &statbuff) < 0)
+			err_sys("_db_logsync: fstat error");
+		if (fdatasync(db->logfd) < 0)
+			err_sys("_db_logsync: fdatasync error");
+		_db_put64(buf, statbuff.st_size);
+		if (pwrite(db->logfd, buf, 8, WAL_SYNCED) != 8)
+			err_dump("_db_logsync: write error of log header");
+		db->cnt_logsync++;
+	}
+	if (un_lock(db->logfd, WAL_LOCK_SYNC, SEEK_SET, 1) < 0)
+		err_dump("_db_logsync: un_lock error");
+}
+
+/*
+ * Unlock the free list, or in WAL mode, have _db_commit unlock
+ * it once our changes to it are made.
+ */
+static void
+_db_unlockfree(DB *db)
+{
+	if (db->txnlen > 0) {
+		db->freelocked = 1;
+		return;
+	}
+	if (un_lock(db->idxfd, FREE_OFF, SEEK_SET, 1) < 0)
+		err_dump("_db_unlockfree: un_lock error");
+}
+
+/*
+ * Open the log and start the checkpointer.  If fresh is set, or
+ * there's no valid log, start an empty one; otherwise replay what
+ * it holds.  Returns 0 if OK, -1 on error.
+ */
+static int
+_db_walopen(DB *db, int fresh)
+{
+	char		hdr[WAL_HDR_SZ];
+	struct stat	statbuff, filestat;
+	int			len, err, alone;
+
+	if (db->logfd >= 0)
+		return(0);
+	if (fstat(db->idxfd, &statbuff) < 0)
+		return(-1);
+	len = strlen(db->name) - 4;		/* name ends in .idx or .dat */
+	strcpy(db->name + len, ".wal");
+	if ((db->logfd = open(db->name, O_RDWR | O_CREAT,
+	  statbuff.st_mode & 0777)) < 0 ||
+	  (db->appendfd = open(db->name, O_WRONLY | O_APPEND)) < 0) {
+		if (db->logfd >= 0)
+			close(db->logfd);
+		db->logfd = -1;
+		return(-1);
+	}
+
+	if (!db->ckptrunning) {
+		pthread_mutex_init(&db->ckptmutex, NULL);
+		pthread_cond_init(&db->ckptcond, NULL);
+		pthread_rwlock_init(&db->ckptlock, NULL);
+	}
+
+	/*
+	 * The checkpoint lock keeps everyone else from committing
+	 * while we look at the log.  If we can write lock the open
+	 * lock, no one else has the log open, so no one is in the
+	 * middle of an append.
+	 */
+	if (writew_lock(db->logfd, WAL_LOCK_CKPT, SEEK_SET, 1) < 0)
+		err_dump("_db_walopen: writew_lock error");
+	alone = write_lock(db->logfd, WAL_LOCK_OPEN, SEEK_SET, 1) == 0;
+	if (fstat(db->logfd, &statbuff) < 0)
+		err_sys("_db_walopen: fstat error");
+	if (fresh || statbuff.st_size < WAL_HDR_SZ ||
+	  _db_pread(db->logfd, hdr, WAL_HDR_SZ, 0) < 0 ||
+	  memcmp(hdr, WAL_MAGIC, 8) != 0) {
+		/*
+		 * Everything in the files now is committed.
+		 */
+		memset(hdr, 0, sizeof(hdr));
+		memcpy(hdr, WAL_MAGIC, 8);
+		_db_put64(hdr + WAL_GEN, 1);
+		if (fstat(db->idxfd, &filestat) < 0)
+			err_sys("_db_walopen: fstat error");
+		_db_put64(hdr + WAL_IDXEND, filestat.st_size);
+		if (fstat(db->datfd, &filestat) < 0)
+			err_sys("_db_walopen: fstat error");
+		_db_put64(hdr + WAL_DATEND, filestat.st_size);
+		if (ftruncate(db->logfd, 0) < 0 ||
+		  pwrite(db->logfd, hdr, WAL_HDR_SZ, 0) != WAL_HDR_SZ ||
+		  fdatasync(db->logfd) < 0)
+			err_sys("_db_walopen: can't initialize log");
+	} else {
+		_db_recover(db, alone);
+		if (statbuff.st_size > WAL_HDR_SZ)
+			_db_logreset(db);
+	}
+	if (readw_lock(db->logfd, WAL_LOCK_OPEN, SEEK_SET, 1) < 0)
+		err_dump("_db_walopen: readw_lock error");
+	if (un_lock(db->logfd, WAL_LOCK_CKPT, SEEK_SET, 1) < 0)
+		err_dump("_db_walopen: un_lock error");
+
+	if (!db->ckptrunning) {
+		if ((err = pthread_create(&db->ckptthread, NULL, _db_ckptthread,
+		  db)) != 0)
+			err_exit(err, "_db_walopen: can't create checkpointer");
+		db->ckptrunning = 1;
+	}
+	return(0);
+}
+
+/*
+ * Replay the log: apply every transaction of the current
+ * generation, up to the first one that's incomplete or corrupt,
+ * which was never committed.  The writes are physical, so it
+ * doesn't matter if some were made before.  Then, if alone is
+ * set, cut off whatever was appended to the index and data files
+ * past the committed ends, by operations that never committed.
+ * Called with the checkpoint lock held.
+ */
+static void
+_db_recover(DB *db, int alone)
+{
+	char			hdr[TXN_HDR_SZ], gen[8], ends[16], *body, *p, *end;
+	size_t			bodysz;
+	uint64_t		len, eoff, elen, idxend, datend;
+	uint32_t		flags;
+	off_t			offset;
+	int				fd;
+	struct iovec	iov;
+	struct stat		statbuff, filestat;
+
+	if (_db_pread(db->logfd, gen, 8, WAL_GEN) < 0 ||
+	  _db_pread(db->logfd, ends, 16, WAL_IDXEND) < 0 ||
+	  fstat(db->logfd, &statbuff) < 0)
+		err_sys("_db_recover: can't read log");
+	idxend = _db_get64(ends);
+	datend = _db_get64(ends + 8);
+	body = NULL;
+	bodysz = 0;
+	for (offset = WAL_HDR_SZ; offset + TXN_HDR_SZ <= statbuff.st_size;
+	  offset += TXN_HDR_SZ + len) {
+		if (_db_pread(db->logfd, hdr, TXN_HDR_SZ, offset) < 0)
+			break;
+		len = _db_get64(hdr + TXN_LEN);
+		if (memcmp(hdr + TXN_GEN, gen, 8) != 0 ||
+		  len > (uint64_t)(statbuff.st_size - offset - TXN_HDR_SZ))
+			break;
+		if (len > bodysz) {
+			bodysz = len;
+			if ((body = realloc(body, bodysz)) == NULL)
+				err_dump("_db_recover: realloc error");
+		}
+		if (_db_pread(db->logfd, body, len, offset + TXN_HDR_SZ) < 0 ||
+		  _db_hash(db, body, len) != _db_get64(hdr + TXN_SUM))
+			break;
+
+		end = body + len;
+		for (p = body; p + ENT_HDR_SZ <= end;
+		  p += ENT_SIZE(flags, elen)) {
+			flags = _db_get32(p + ENT_FLAGS);
+			eoff = _db_get64(p + ENT_OFF);
+			elen = _db_get64(p + ENT_LEN);
+			if (!(flags & ENT_NODATA) &&
+			  elen > (uint64_t)(end - p - ENT_HDR_SZ))
+				err_quit("_db_recover: corrupt log entry");
+			if (flags & ENT_END) {
+				if (eoff > idxend)
+					idxend = eoff;
+				if (elen > datend)
+					datend = elen;
+				continue;
+			}
+			fd = (flags & ENT_DAT) ? db->datfd : db->idxfd;
+			if (flags & ENT_EXTEND) {
+				if (fstat(fd, &filestat) < 0 ||
+				  (filestat.st_size < (off_t)eoff &&
+				  ftruncate(fd, eoff) < 0))
+					err_sys("_db_recover: can't extend file");
+				continue;
+			}
+			if (flags & ENT_SYNCED)
+				continue;	/* on disk before it was logged */
+			iov.iov_base = p + ENT_HDR_SZ;
+			iov.iov_len  = elen;
+			if (((flags & ENT_FILL) ? _db_fill(db, fd, elen, eoff) :
+			  _db_pwritev(fd, &iov, 1, eoff)) < 0)
+				err_sys("_db_recover: write error");
+		}
+	}
+	if (body != NULL)
+		free(body);
+
+	if (alone) {
+		if (fstat(db->idxfd, &filestat) < 0 ||
+		  (filestat.st_size > (off_t)idxend &&
+		  ftruncate(db->idxfd, idxend) < 0))
+			err_sys("_db_recover: can't truncate index file");
+		if (fstat(db->datfd, &filestat) < 0 ||
+		  (filestat.st_size > (off_t)datend &&
+		  ftruncate(db->datfd, datend) < 0))
+			err_sys("_db_recover: can't truncate data file");
+	}
+}
+
+/*
+ * Sync the index and data files, then empty the log: bump its
+ * generation first, so if we crash before the log is truncated
+ * its old transactions aren't replayed.  Called with the
+ * checkpoint lock held.
+ */
+static void
+_db_logreset(DB *db)
+{
+	char	buf[16];
+
+	if (fdatasync(db->idxfd) < 0 || fdatasync(db->datfd) < 0)
+		err_sys("_db_logreset: fdatasync error");
+	if (_db_pread(db->logfd, buf, 8, WAL_GEN) < 0)
+		err_dump("_db_logreset: read error of log header");
+	_db_put64(buf, _db_get64(buf) + 1);
+	_db_put64(buf + 8, 0);			/* nothing synced */
+	if (pwrite(db->logfd, buf, 16, WAL_GEN) != 16 ||
+	  fdatasync(db->logfd) < 0)
+		err_sys("_db_logreset: write error of log header");
+	if (ftruncate(db->logfd, WAL_HDR_SZ) < 0)
+		err_sys("_db_logreset: ftruncate error");
+}
+
+/*
+ * Checkpoint, if there's anything in the log.  We wait for
+ * every process's transactions in flight to be applied.
+ */
+static void
+_db_checkpoint(DB *db)
+{
+	struct stat	statbuff;
+
+	if (pthread_rwlock_wrlock(&db->ckptlock) != 0)
+		err_dump("_db_checkpoint: pthread_rwlock_wrlock error");
+	if (writew_lock(db->logfd, WAL_LOCK_CKPT, SEEK_SET, 1) < 0)
+		err_dump("_db_checkpoint: writew_lock error");
+	if (fstat(db->logfd, &statbuff) < 0)
+		err_sys("_db_checkpoint: fstat error");
+	if (statbuff.st_size > WAL_HDR_SZ)
+		_db_logreset(db);
+	if (un_lock(db->logfd, WAL_LOCK_CKPT, SEEK_SET, 1) < 0)
+		err_dump("_db_checkpoint: un_lock error");
+	pthread_rwlock_unlock(&db->ckptlock);
+}
+
+/*
+ * The checkpointer thread: checkpoint every WAL_CKPT_SEC seconds,
+ * or sooner when a commit finds the log has grown past
+ * WAL_CKPT_SIZE, until db_close.
+ */
+static void *
+_db_ckptthread(void *arg)
+{
+	DB				*db = arg;
+	struct timespec	ts;
+
+	pthread_mutex_lock(&db->ckptmutex);
+	while (!db->ckptstop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += WAL_CKPT_SEC;
+		pthread_cond_timedwait(&db->ckptcond, &db->ckptmutex, &ts);
+		if (db->ckptstop)
+			break;
+		pthread_mutex_unlock(&db->ckptmutex);
+		_db_checkpoint(db);
+		pthread_mutex_lock(&db->ckptmutex);
+	}
+	pthread_mutex_unlock(&db->ckptmutex);
+	return(NULL);
 }
 
 /*
@@ -637,8 +2154,40 @@ _db_writeptr(DB *db, off_t offset, off_t ptrval)
 int
 db_store(DBHANDLE h, const char *key, const char *data, int flag)
 {
-	DB		*db = h;
-	int		rc, keylen, datlen;
+	struct iovec	iov;
+
+	iov.iov_base = (char *)data;
+	iov.iov_len  = strlen(data);
+	return(_db_store(h, key, &iov, 1, iov.iov_len, flag));
+}
+
+/*
+ * Store a record whose data is the concatenation of iovcnt
+ * buffers, written to the data file without being gathered
+ * into one.  Same return values as db_store.
+ */
+int
+db_store_iov(DBHANDLE h, const char *key, const struct iovec *iov,
+             int iovcnt, int flag)
+{
+	size_t	len = 0;
+	int		i;
+
+	if (iovcnt < 0) {
+		errno = EINVAL;
+		return(-1);
+	}
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	return(_db_store(h, key, iov, iovcnt, len, flag));
+}
+
+static int
+_db_store(DB *db, const char *key, const struct iovec *iov, int iovcnt,
+          size_t len, int flag)
+{
+	int		rc, grow = 0;
+	size_t	keylen, datlen;
 	off_t	ptrval;
 
 	if (flag != DB_INSERT && flag != DB_REPLACE &&
@@ -646,9 +2195,13 @@ db_store(DBHANDLE h, const char *key, const char *data, int flag)
 		errno = EINVAL;
 		return(-1);
 	}
+	if (!_db_keyok(key)) {
+		db->cnt_storerr++;
+		return(-1);
+	}
 	keylen = strlen(key);
-	datlen = strlen(data) + 1;		/* +1 for newline at end */
-	if (datlen < DATLEN_MIN || datlen > DATLEN_MAX)
+	datlen = len + 1;		/* +1 for newline at end */
+	if (datlen < DATLEN_MIN)
 		err_dump("db_store: invalid data length");
 
 	/*
@@ -671,14 +2224,15 @@ db_store(DBHANDLE h, const char *key, const char *data, int flag)
 		 * the chain ptr to the first index record on hash chain.
 		 */
 		ptrval = _db_readptr(db, db->chainoff);
+		grow = db->chainlen >= SPLIT_CHAIN;
 
 		if (_db_findfree(db, keylen, datlen) < 0) {
 			/*
 			 * Can't find an empty record big enough. Append the
 			 * new record to the ends of the index and data files.
 			 */
-			_db_writedat(db, data, 0, SEEK_END);
-			_db_writeidx(db, key, 0, SEEK_END, ptrval);
+			_db_writedat(db, iov, iovcnt, len, 0, SEEK_END);
+			_db_writeidx(db, key, 0, SEEK_END, ptrval, 0);
 
 			/*
 			 * db->idxoff was set by _db_writeidx.  The new
@@ -692,8 +2246,8 @@ db_store(DBHANDLE h, const char *key, const char *data, int flag)
 			 * the free list and set both db->datoff and db->idxoff.
 			 * Reused record goes to the front of the hash chain.
 			 */
-			_db_writedat(db, data, db->datoff, SEEK_SET);
-			_db_writeidx(db, key, db->idxoff, SEEK_SET, ptrval);
+			_db_writedat(db, iov, iovcnt, len, db->datoff, SEEK_SET);
+			_db_writeidx(db, key, db->idxoff, SEEK_SET, ptrval, 0);
 			_db_writeptr(db, db->chainoff, db->idxoff);
 			db->cnt_stor2++;
 		}
@@ -707,9 +2261,11 @@ db_store(DBHANDLE h, const char *key, const char *data, int flag)
 		/*
 		 * We are replacing an existing record.  We know the new
 		 * key equals the existing key, but we need to check if
-		 * the data records are the same size.
+		 * the data records are the same size.  In WAL mode a big
+		 * one is never overwritten in place.
 		 */
-		if (datlen != db->datlen) {
+		if (datlen != db->datlen ||
+		  (db->logfd >= 0 && datlen > DATLEN_INLINE)) {
 			_db_dodelete(db);	/* delete the existing record */
 
 			/*
@@ -721,8 +2277,8 @@ db_store(DBHANDLE h, const char *key, const char *data, int flag)
 			/*
 			 * Append new index and data records to end of files.
 			 */
-			_db_writedat(db, data, 0, SEEK_END);
-			_db_writeidx(db, key, 0, SEEK_END, ptrval);
+			_db_writedat(db, iov, iovcnt, len, 0, SEEK_END);
+			_db_writeidx(db, key, 0, SEEK_END, ptrval, 0);
 
 			/*
 			 * New record goes to the front of the hash chain.
@@ -733,15 +2289,18 @@ db_store(DBHANDLE h, const char *key, const char *data, int flag)
 			/*
 			 * Same size data, just replace data record.
 			 */
-			_db_writedat(db, data, db->datoff, SEEK_SET);
+			_db_writedat(db, iov, iovcnt, len, db->datoff, SEEK_SET);
 			db->cnt_stor4++;
 		}
 	}
 	rc = 0;		/* OK */
 
 doreturn:	/* unlock hash chain locked by _db_find_and_lock */
+	_db_commit(db);
 	if (un_lock(db->idxfd, db->chainoff, SEEK_SET, 1) < 0)
 		err_dump("db_store: un_lock error");
+	if (grow)
+		_db_split(db);	/* after unlocking, so we can't deadlock */
 	return(rc);
 }
 
@@ -750,7 +2309,7 @@ doreturn:	/* unlock hash chain locked by _db_find_and_lock */
  * of the correct sizes.  We're only called by db_store.
  */
 static int
-_db_findfree(DB *db, int keylen, int datlen)
+_db_findfree(DB *db, size_t keylen, size_t datlen)
 {
 	int		rc;
 	off_t	offset, nextoffset, saveoffset;
@@ -769,7 +2328,7 @@ _db_findfree(DB *db, int keylen, int datlen)
 
 	while (offset != 0) {
 		nextoffset = _db_readidx(db, offset);
-		if (strlen(db->idxbuf) == keylen && db->datlen == datlen)
+		if (db->idxlen == keylen && db->datlen == datlen)
 			break;		/* found a match */
 		saveoffset = offset;
 		offset = nextoffset;
@@ -799,8 +2358,7 @@ _db_findfree(DB *db, int keylen, int datlen)
 	/*
 	 * Unlock the free list.
 	 */
-	if (un_lock(db->idxfd, FREE_OFF, SEEK_SET, 1) < 0)
-		err_dump("_db_findfree: un_lock error");
+	_db_unlockfree(db);
 	return(rc);
 }
 
@@ -813,17 +2371,14 @@ void
 db_rewind(DBHANDLE h)
 {
 	DB		*db = h;
-	off_t	offset;
-
-	offset = (db->nhash + 1) * PTR_SZ;	/* +1 for free list ptr */
 
 	/*
-	 * We're just setting the file offset for this process
-	 * to the start of the index records; no need to lock.
-	 * +1 below for newline at end of hash table.
+	 * We're just setting where the next sequential read
+	 * starts: the first index record, right after the
+	 * hash table.  No need to lock.
 	 */
-	if ((db->idxoff = lseek(db->idxfd, offset+1, SEEK_SET)) == -1)
-		err_dump("db_rewind: lseek error");
+	db->nextoff = db->recoff;
+	db->idxoff = db->recoff;
 }
 
 /*
@@ -836,14 +2391,13 @@ char *
 db_nextrec(DBHANDLE h, char *key)
 {
 	DB		*db = h;
-	char	c;
 	char	*ptr;
 
 	/*
 	 * We read lock the free list so that we don't read
 	 * a record in the middle of its being deleted.
 	 */
-	if (readw_lock(db->idxfd, FREE_OFF, SEEK_SET, 1) < 0)
+	if (!db->nolock && readw_lock(db->idxfd, FREE_OFF, SEEK_SET, 1) < 0)
 		err_dump("db_nextrec: readw_lock error");
 
 	do {
@@ -854,22 +2408,153 @@ db_nextrec(DBHANDLE h, char *key)
 			ptr = NULL;		/* end of index file, EOF */
 			goto doreturn;
 		}
+	} while (db->idxflags & (IDX_DELETED | IDX_SEGMENT | IDX_PENDING));
+						/* skip empty and uncommitted records */
 
-		/*
-		 * Check if key is all blank (empty record).
-		 */
-		ptr = db->idxbuf;
-		while ((c = *ptr++) != 0  &&  c == SPACE)
-			;	/* skip until null byte or nonblank */
-	} while (c == 0);	/* loop until a nonblank key is found */
-
-	if (key != NULL)
-		strcpy(key, db->idxbuf);	/* return key */
+	if (key != NULL) {
+		memcpy(key, db->keyp, db->idxlen);	/* return key */
+		key[db->idxlen] = 0;
+	}
 	ptr = _db_readdat(db);	/* return pointer to data buffer */
 	db->cnt_nextrec++;
 
 doreturn:
-	if (un_lock(db->idxfd, FREE_OFF, SEEK_SET, 1) < 0)
+	if (!db->nolock && un_lock(db->idxfd, FREE_OFF, SEEK_SET, 1) < 0)
 		err_dump("db_nextrec: un_lock error");
 	return(ptr);
 }
+
+/*
+ * Convert a database whose index file is in the old ASCII format
+ * (fixed NHASH, 7-digit chain ptrs, "key:datoff:datlen\n" records)
+ * to the current format.  The data file doesn't change: we build a
+ * new index next to the old one and rename it into place.  Deleted
+ * records go on the new free list so their space is still reused.
+ * Returns 0 if OK (or already converted), -1 on error.
+ */
+int
+db_convert(const char *pathname)
+{
+	DB		*db;
+	FILE	*fp;
+	int		len, reclen;
+	char	*oldname, *p1, *p2, *k;
+	char	asciilen[OLD_IDXLEN_SZ + 1];
+	char	rec[IDXLEN_MAX + 1];
+	off_t	datoff, ptrval;
+	long	datlen;
+
+	len = strlen(pathname);
+	if ((db = _db_alloc(len + 4)) == NULL)
+		err_dump("db_convert: _db_alloc error for DB");
+	if ((oldname = malloc(len + 5)) == NULL)
+		err_dump("db_convert: malloc error for name");
+	strcpy(oldname, pathname);
+	strcat(oldname, ".idx");
+	if ((fp = fopen(oldname, "r+")) == NULL)
+		goto fail;
+
+	/*
+	 * Keep everyone else out while we convert.
+	 */
+	if (writew_lock(fileno(fp), 0, SEEK_SET, 0) < 0)
+		err_dump("db_convert: writew_lock error");
+	if (fread(rec, 1, HDR_SZ, fp) == HDR_SZ &&
+	  memcmp(rec, DB_MAGIC, 8) == 0) {
+		fclose(fp);
+		free(oldname);
+		_db_free(db);
+		return(0);		/* nothing to do */
+	}
+
+	strcpy(db->name, pathname);
+	strcat(db->name, ".dat");
+	if ((db->datfd = open(db->name, O_RDWR)) < 0)
+		goto fail;
+	strcpy(db->name + len, ".idx.new");
+	if ((db->idxfd = open(db->name, O_RDWR | O_CREAT | O_TRUNC,
+	  FILE_MODE)) < 0)
+		goto fail;
+	db->nhash = NHASH_DEF;
+	_db_inithdr(db);
+	if (_db_readhdr(db) < 0)
+		goto fail;
+
+	/*
+	 * Skip the old free list ptr, hash table and newline, then
+	 * copy each index record.  Chain order doesn't matter:
+	 * records are rehashed into the new table.
+	 */
+	if (fseek(fp, (OLD_NHASH + 1) * OLD_PTR_SZ + 1, SEEK_SET) < 0)
+		goto fail;
+	for ( ; ; ) {
+		if (fseek(fp, OLD_PTR_SZ, SEEK_CUR) < 0)
+			goto fail;
+		if (fread(asciilen, 1, OLD_IDXLEN_SZ, fp) != OLD_IDXLEN_SZ)
+			break;		/* EOF */
+		asciilen[OLD_IDXLEN_SZ] = 0;
+		reclen = atoi(asciilen);
+		if (reclen < 6 || reclen > IDXLEN_MAX ||
+		  fread(rec, 1, reclen, fp) != reclen ||
+		  rec[reclen - 1] != NEWLINE)
+			goto bad;
+		rec[reclen - 1] = 0;
+		if ((p1 = strchr(rec, OLD_SEP)) == NULL ||
+		  (p2 = strchr(p1 + 1, OLD_SEP)) == NULL)
+			goto bad;
+		*p1++ = 0;
+		*p2++ = 0;
+		datoff = atol(p1);
+		datlen = atol(p2);
+		if (rec[0] == 0 || datoff < 0 ||
+		  datlen < DATLEN_MIN)
+			goto bad;
+
+		for (k = rec; *k == SPACE; k++)
+			;
+		if (*k == 0) {
+			/*
+			 * Deleted record: push it on the free list.
+			 */
+			ptrval = _db_readptr(db, FREE_OFF);
+			db->datoff = datoff;
+			db->datlen = datlen;
+			_db_writeidx(db, rec, 0, SEEK_END, ptrval, IDX_DELETED);
+			_db_writeptr(db, FREE_OFF, db->idxoff);
+		} else {
+			/*
+			 * Insert it as db_store would, growing the table.
+			 */
+			_db_find_and_lock(db, rec, 1);
+			ptrval = _db_readptr(db, db->chainoff);
+			db->datoff = datoff;
+			db->datlen = datlen;
+			_db_writeidx(db, rec, 0, SEEK_END, ptrval, 0);
+			_db_writeptr(db, db->chainoff, db->idxoff);
+			if (un_lock(db->idxfd, db->chainoff, SEEK_SET, 1) < 0)
+				err_dump("db_convert: un_lock error");
+			if (db->chainlen >= SPLIT_CHAIN)
+				_db_split(db);
+		}
+	}
+	if (ferror(fp) || fsync(db->idxfd) < 0 ||
+	  rename(db->name, oldname) < 0)
+		goto fail;
+	fclose(fp);
+	free(oldname);
+	_db_free(db);
+	return(0);
+
+bad:
+	errno = EINVAL;
+fail:
+	len = errno;
+	if (db->idxfd >= 0)
+		unlink(db->name);
+	if (fp != NULL)
+		fclose(fp);
+	free(oldname);
+	_db_free(db);
+	errno = len;
+	return(-1);
+}
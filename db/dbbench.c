@@ -0,0 +1,97 @@
+#include "apue.h"
+#include "apue_db.h"
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define NINSERT	2000	/* default inserts per process */
+#define MAXPROC	8		/* default largest number of processes */
+
+static void	insert(const char *, int, int);
+
+/*
+ * Measure durable inserts per second into a database in WAL mode,
+ * for 1, 2, 4, ... writers.  The writers are processes: a handle
+ * belongs to one thread, and record locks only keep processes
+ * apart.  Each insert is on disk when db_store returns; with more
+ * writers, more of them share each fdatasync of the log.
+ */
+int
+main(int argc, char *argv[])
+{
+	DBHANDLE		db;
+	struct timespec	start, stop;
+	double			secs;
+	int				c, i, nproc, ninsert, maxproc, status;
+
+	ninsert = NINSERT;
+	maxproc = MAXPROC;
+	while ((c = getopt(argc, argv, "n:p:")) != -1) {
+		switch (c) {
+		case 'n':
+			ninsert = atoi(optarg);
+			break;
+		case 'p':
+			maxproc = atoi(optarg);
+			break;
+		default:
+			err_quit("usage: dbbench [-n inserts] [-p procs] <database>");
+		}
+	}
+	if (optind != argc - 1 || ninsert <= 0 || maxproc <= 0)
+		err_quit("usage: dbbench [-n inserts] [-p procs] <database>");
+
+	printf("%5s %10s %12s\n", "procs", "inserts", "inserts/sec");
+	for (nproc = 1; nproc <= maxproc; nproc *= 2) {
+		if ((db = db_open(argv[optind], O_RDWR | O_CREAT | O_TRUNC,
+		  FILE_MODE)) == NULL)
+			err_sys("db_open error");
+		if (db_wal(db) < 0)
+			err_sys("db_wal error");
+		db_close(db);
+
+		fflush(stdout);		/* don't let the children print it again */
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < nproc; i++) {
+			if ((c = fork()) < 0)
+				err_sys("fork error");
+			else if (c == 0)
+				insert(argv[optind], i, ninsert);
+		}
+		for (i = 0; i < nproc; i++) {
+			if (wait(&status) < 0)
+				err_sys("wait error");
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				err_quit("writer failed");
+		}
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+
+		secs = (stop.tv_sec - start.tv_sec) +
+		  (stop.tv_nsec - start.tv_nsec) / 1e9;
+		printf("%5d %10d %12.0f\n", nproc, nproc * ninsert,
+		  nproc * ninsert / secs);
+	}
+	exit(0);
+}
+
+/*
+ * One writer: insert n records with keys of its own.
+ */
+static void
+insert(const char *name, int id, int n)
+{
+	DBHANDLE	db;
+	char		key[32], data[64];
+	int			i;
+
+	if ((db = db_open(name, O_RDWR)) == NULL)
+		err_sys("db_open error");
+	for (i = 0; i < n; i++) {
+		sprintf(key, "w%d-%d", id, i);
+		sprintf(data, "data for writer %d, record %d", id, i);
+		if (db_store(db, key, data, DB_INSERT) != 0)
+			err_quit("db_store error for %s", key);
+	}
+	db_close(db);
+	exit(0);
+}
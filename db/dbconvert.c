@@ -0,0 +1,19 @@
+#include "apue.h"
+#include "apue_db.h"
+
+/*
+ * Convert databases from the old ASCII index format.
+ * The argument is the name given to db_open, without ".idx".
+ */
+int
+main(int argc, char *argv[])
+{
+	int		i;
+
+	if (argc < 2)
+		err_quit("usage: dbconvert <database> ...");
+	for (i = 1; i < argc; i++)
+		if (db_convert(argv[i]) < 0)
+			err_sys("can't convert %s", argv[i]);
+	exit(0);
+}
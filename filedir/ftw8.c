@@ -1,13 +1,15 @@
 #include "apue.h"
 #include <dirent.h>
 #include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include "walk.h"
 
 /* function type that is called for each filename */
 typedef	int	Myfunc(const char *, const struct stat *, int);
 
 static Myfunc	myfunc;
 static int		myftw(char *, Myfunc *);
-static int		dopath(Myfunc *);
 
 static long	nreg, ndir, nblk, nchr, nfifo, nslink, nsock, ntot;
 
@@ -50,74 +52,107 @@ main(int argc, char *argv[])
 #define	FTW_DNR	3		/* directory that can't be read */
 #define	FTW_NS	4		/* file that we can't stat */
 
-static char	*fullpath;		/* contains full pathname for every file */
-static size_t pathlen;
+/*
+ * The walk runs on several threads (see sync_common/walk.h):
+ * directories are opened relative to their parent's fd and read
+ * with large getdents64 batches, so no syscall has to resolve a
+ * full pathname.  func() itself is serialized by walk_lock.
+ */
+struct ftw_state {
+	const char		*root;
+	Myfunc			*func;
+	int				ret;
+	pthread_mutex_t	walk_lock;
+};
 
-static int					/* we return whatever func() returns */
-myftw(char *pathname, Myfunc *func)
+static int
+callfunc(struct ftw_state *sp, const char *path, const struct stat *statptr,
+  int type)
+{
+	int		ret;
+
+	pthread_mutex_lock(&sp->walk_lock);
+	ret = sp->ret;
+	if (ret == 0)
+		ret = sp->ret = sp->func(path, statptr, type);
+	pthread_mutex_unlock(&sp->walk_lock);
+	return(ret);
+}
+
+static int
+walk_entry(void *ctx, const walk_entry_t *ep, void **child)
 {
-	fullpath = path_alloc(&pathlen);	/* malloc PATH_MAX+1 bytes */
-										/* ({Prog pathalloc}) */
-	if (pathlen <= strlen(pathname)) {
-		pathlen = strlen(pathname) * 2;
-		if ((fullpath = realloc(fullpath, pathlen)) == NULL)
-			err_sys("realloc failed");
+	struct ftw_state	*sp = ctx;
+	struct stat			statbuf;
+	const struct stat	*statptr = ep->st;
+	char				path[PATH_MAX];
+
+	(void)child;
+	snprintf(path, sizeof(path), "%s/%s", sp->root, ep->path);
+	if (statptr == NULL) {		/* directory known from d_type */
+		memset(&statbuf, 0, sizeof(statbuf));
+		statbuf.st_mode = S_IFDIR;
+		statptr = &statbuf;
 	}
-	strcpy(fullpath, pathname);
-	return(dopath(func));
+	if (callfunc(sp, path, statptr,
+	  ep->type == WALK_NS ? FTW_NS : ep->type == WALK_D ? FTW_D : FTW_F) != 0)
+		return(WALK_STOP);
+	return(WALK_CONTINUE);
+}
+
+static void
+walk_done(void *ctx, const walk_entry_t *ep)
+{
+	struct ftw_state	*sp = ctx;
+	struct stat			statbuf;
+	char				path[PATH_MAX];
+
+	if (ep->type != WALK_DNR || ep->err == ECANCELED)
+		return;
+	if (ep->path_len == 0)
+		snprintf(path, sizeof(path), "%s", sp->root);
+	else
+		snprintf(path, sizeof(path), "%s/%s", sp->root, ep->path);
+	memset(&statbuf, 0, sizeof(statbuf));
+	statbuf.st_mode = S_IFDIR;
+	callfunc(sp, path, &statbuf, FTW_DNR);
 }
 
-/*
- * Descend through the hierarchy, starting at "fullpath".
- * If "fullpath" is anything other than a directory, we lstat() it,
- * call func(), and return.  For a directory, we call ourself
- * recursively for each name in the directory.
- */
 static int					/* we return whatever func() returns */
-dopath(Myfunc* func)
+myftw(char *pathname, Myfunc *func)
 {
 	struct stat		statbuf;
-	struct dirent	*dirp;
-	DIR				*dp;
-	int				ret, n;
+	struct ftw_state	state;
+	walk_options_t	opts;
+	long			ncpu;
+	int				ret;
 
-	if (lstat(fullpath, &statbuf) < 0)	/* stat error */
-		return(func(fullpath, &statbuf, FTW_NS));
+	if (lstat(pathname, &statbuf) < 0)	/* stat error */
+		return(func(pathname, &statbuf, FTW_NS));
 	if (S_ISDIR(statbuf.st_mode) == 0)	/* not a directory */
-		return(func(fullpath, &statbuf, FTW_F));
+		return(func(pathname, &statbuf, FTW_F));
 
 	/*
 	 * It's a directory.  First call func() for the directory,
-	 * then process each filename in the directory.
+	 * then walk everything below it.
 	 */
-	if ((ret = func(fullpath, &statbuf, FTW_D)) != 0)
+	if ((ret = func(pathname, &statbuf, FTW_D)) != 0)
 		return(ret);
 
-	n = strlen(fullpath);
-	if (n + NAME_MAX + 2 > pathlen) {	/* expand path buffer */
-		pathlen *= 2;
-		if ((fullpath = realloc(fullpath, pathlen)) == NULL)
-			err_sys("realloc failed");
-	}
-	fullpath[n++] = '/';
-	fullpath[n] = 0;
-
-	if ((dp = opendir(fullpath)) == NULL)	/* can't read directory */
-		return(func(fullpath, &statbuf, FTW_DNR));
-
-	while ((dirp = readdir(dp)) != NULL) {
-		if (strcmp(dirp->d_name, ".") == 0  ||
-		    strcmp(dirp->d_name, "..") == 0)
-				continue;		/* ignore dot and dot-dot */
-		strcpy(&fullpath[n], dirp->d_name);	/* append name after "/" */
-		if ((ret = dopath(func)) != 0)		/* recursive */
-			break;	/* time to leave */
-	}
-	fullpath[n-1] = 0;	/* erase everything from slash onward */
-
-	if (closedir(dp) < 0)
-		err_ret("can't close directory %s", fullpath);
-	return(ret);
+	if ((ncpu = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		ncpu = 1;
+	state.root = pathname;
+	state.func = func;
+	state.ret = 0;
+	pthread_mutex_init(&state.walk_lock, NULL);
+	opts.entry = walk_entry;
+	opts.dir_done = walk_done;
+	opts.ctx = &state;
+	opts.threads = ncpu;
+	opts.flags = 0;			/* lstat semantics, don't follow links */
+	walk_tree(pathname, NULL, &opts);
+	pthread_mutex_destroy(&state.walk_lock);
+	return(state.ret);
 }
 
 static int
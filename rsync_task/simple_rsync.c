@@ -11,6 +11,10 @@
 #include <time.h>
 #include <utime.h>
 #include <libgen.h>
+#include "copy_engine.h"
+#include "delta.h"
+#include "hash.h"
+#include "walk.h"
 
 #define BUFFER_SIZE 4096
 #define MAX_PATH_LEN 1024
@@ -18,6 +22,7 @@
 typedef struct {
     int verbose;
     int dry_run;
+    int delta;
 } sync_options_t;
 
 void print_usage(const char *program_name) {
@@ -25,13 +30,36 @@ void print_usage(const char *program_name) {
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -v    Verbose output\n");
     fprintf(stderr, "  -n    Dry run (simulate without copying)\n");
+    fprintf(stderr, "  -D    Delta transfer: rewrite only changed blocks of existing files\n");
     fprintf(stderr, "  -h    Show this help\n");
 }
 
-int copy_file_data(const char *src_path, const char *dst_path) {
+// 目标已存在且足够大时原地增量更新，返回 1 表示不适用，需要整体复制
+static int delta_file_data(int src_fd, off_t src_size, const char *dst_path,
+                           delta_stats_t *stats) {
+    struct stat dst_stat;
+    if (stat(dst_path, &dst_stat) == -1 || !S_ISREG(dst_stat.st_mode) ||
+        dst_stat.st_size < DELTA_MIN_SIZE) {
+        return 1;
+    }
+    
+    int dst_fd = open(dst_path, O_RDWR);
+    if (dst_fd == -1) {
+        return 1;
+    }
+    
+    int rc = delta_sync_fd(src_fd, src_size, dst_fd, dst_stat.st_size, stats);
+    if (rc == -1) {
+        perror("delta transfer");
+    }
+    close(dst_fd);
+    return rc;
+}
+
+int copy_file_data(const char *src_path, const char *dst_path, int delta,
+                   copy_method_t *method, delta_stats_t *stats) {
     int src_fd, dst_fd;
-    ssize_t bytes_read, bytes_written;
-    char buffer[BUFFER_SIZE];
+    struct stat src_stat;
     
     src_fd = open(src_path, O_RDONLY);
     if (src_fd == -1) {
@@ -39,25 +67,31 @@ int copy_file_data(const char *src_path, const char *dst_path) {
         return -1;
     }
     
-    dst_fd = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (dst_fd == -1) {
-        perror("open destination file");
+    if (fstat(src_fd, &src_stat) == -1) {
+        perror("fstat source file");
         close(src_fd);
         return -1;
     }
     
-    while ((bytes_read = read(src_fd, buffer, BUFFER_SIZE)) > 0) {
-        bytes_written = write(dst_fd, buffer, bytes_read);
-        if (bytes_written != bytes_read) {
-            perror("write error");
+    if (delta) {
+        int rc = delta_file_data(src_fd, src_stat.st_size, dst_path, stats);
+        if (rc != 1) {
+            *method = COPY_DELTA;
             close(src_fd);
-            close(dst_fd);
-            return -1;
+            return rc;
         }
     }
     
-    if (bytes_read == -1) {
-        perror("read error");
+    dst_fd = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst_fd == -1) {
+        perror("open destination file");
+        close(src_fd);
+        return -1;
+    }
+    
+    // reflink / copy_file_range / sendfile, falling back to read/write
+    if (copy_fd(src_fd, dst_fd, src_stat.st_size, method) == -1) {
+        perror("copy error");
         close(src_fd);
         close(dst_fd);
         return -1;
@@ -77,13 +111,13 @@ int copy_file_attributes(const char *src_path, const char *dst_path) {
         return -1;
     }
     
-    // ļȨ
+    // 复制文件权限
     if (chmod(dst_path, src_stat.st_mode) == -1) {
         perror("chmod");
         return -1;
     }
     
-    // ļʱ
+    // 复制文件时间戳
     time_buf.actime = src_stat.st_atime;
     time_buf.modtime = src_stat.st_mtime;
     if (utime(dst_path, &time_buf) == -1) {
@@ -91,13 +125,13 @@ int copy_file_attributes(const char *src_path, const char *dst_path) {
         return -1;
     }
     
-    // ļߺ飨ҪrootȨޣ
+    // 复制文件所有者和组（需要root权限）
     if (chown(dst_path, src_stat.st_uid, src_stat.st_gid) == -1) {
         if (errno != EPERM) {
             perror("chown");
             return -1;
         }
-        // rootû޷ߣ
+        // 非root用户无法更改所有者，这是正常的
     }
     
     return 0;
@@ -106,57 +140,32 @@ int copy_file_attributes(const char *src_path, const char *dst_path) {
 int files_are_identical(const char *file1, const char *file2) {
     struct stat stat1, stat2;
     int fd1, fd2;
-    ssize_t bytes1, bytes2;
-    char buf1[BUFFER_SIZE], buf2[BUFFER_SIZE];
     
     if (stat(file1, &stat1) == -1 || stat(file2, &stat2) == -1) {
         return 0;
     }
     
-    // ȽļС
+    // 比较文件大小
     if (stat1.st_size != stat2.st_size) {
         return 0;
     }
     
-    // Ƚ޸ʱ
+    // 比较修改时间
     if (stat1.st_mtime == stat2.st_mtime) {
         return 1;
     }
     
-    // ޸ʱ䲻ͬȽļ
+    // 如果修改时间不同，分段比较文件内容的哈希
     fd1 = open(file1, O_RDONLY);
     fd2 = open(file2, O_RDONLY);
     
-    if (fd1 == -1 || fd2 == -1) {
-        if (fd1 != -1) close(fd1);
-        if (fd2 != -1) close(fd2);
-        return 0;
+    int result = 0;
+    if (fd1 != -1 && fd2 != -1) {
+        result = hash_compare_fd(fd1, fd2, stat1.st_size, NULL) == 1;
     }
-    
-    while (1) {
-        bytes1 = read(fd1, buf1, BUFFER_SIZE);
-        bytes2 = read(fd2, buf2, BUFFER_SIZE);
-        
-        if (bytes1 != bytes2) {
-            close(fd1);
-            close(fd2);
-            return 0;
-        }
-        
-        if (bytes1 == 0) {
-            break;  // ļ
-        }
-        
-        if (memcmp(buf1, buf2, bytes1) != 0) {
-            close(fd1);
-            close(fd2);
-            return 0;
-        }
-    }
-    
-    close(fd1);
-    close(fd2);
-    return 1;
+    if (fd1 != -1) close(fd1);
+    if (fd2 != -1) close(fd2);
+    return result;
 }
 
 int create_directory_recursive(const char *path) {
@@ -191,18 +200,20 @@ int create_directory_recursive(const char *path) {
 int sync_file(const char *src_path, const char *dst_path, const sync_options_t *options) {
     char dst_dir[MAX_PATH_LEN];
     struct stat src_stat, dst_stat;
+    copy_method_t method;
+    delta_stats_t delta_stats;
     
     if (options->verbose) {
         printf("Checking: %s -> %s\n", src_path, dst_path);
     }
     
-    // ԴļǷ
+    // 检查源文件是否存在
     if (stat(src_path, &src_stat) == -1) {
         perror("stat source file");
         return -1;
     }
     
-    // ĿļǷڲȽ
+    // 检查目标文件是否存在并比较
     if (stat(dst_path, &dst_stat) != -1) {
         if (files_are_identical(src_path, dst_path)) {
             if (options->verbose) {
@@ -217,7 +228,7 @@ int sync_file(const char *src_path, const char *dst_path, const sync_options_t *
         return 0;
     }
     
-    // ĿĿ¼
+    // 创建目标目录
     strncpy(dst_dir, dst_path, sizeof(dst_dir));
     dirname(dst_dir);
     if (create_directory_recursive(dst_dir) == -1) {
@@ -225,77 +236,88 @@ int sync_file(const char *src_path, const char *dst_path, const sync_options_t *
         return -1;
     }
     
-    // ļ
-    if (copy_file_data(src_path, dst_path) == -1) {
+    // 复制文件内容
+    if (copy_file_data(src_path, dst_path, options->delta, &method, &delta_stats) == -1) {
         fprintf(stderr, "Failed to copy file data: %s\n", src_path);
         return -1;
     }
     
-    // ļ
+    // 复制文件属性
     if (copy_file_attributes(src_path, dst_path) == -1) {
         fprintf(stderr, "Failed to copy file attributes: %s\n", src_path);
         return -1;
     }
     
-    if (options->verbose) {
-        printf("Synced: %s -> %s\n", src_path, dst_path);
+    if (options->verbose && method == COPY_DELTA) {
+        off_t changed = delta_stats.moved_bytes + delta_stats.literal_bytes;
+        printf("Synced: %s -> %s [delta: %lld of %lld bytes rewritten]\n", src_path, dst_path,
+               (long long)changed, (long long)(delta_stats.matched_bytes + changed));
+    } else if (options->verbose) {
+        printf("Synced: %s -> %s [%s]\n", src_path, dst_path, copy_method_name(method));
     }
     
     return 0;
 }
 
-int sync_directory(const char *src_dir, const char *dst_dir, const sync_options_t *options) {
-    DIR *dir;
-    struct dirent *entry;
+// 目录同步时传给遍历回调的状态
+typedef struct {
+    const char *src_dir;
+    const char *dst_dir;
+    const sync_options_t *options;
+    int failed;
+} dir_sync_t;
+
+// 逐个同步遍历到的普通文件，出错时停止遍历
+static int sync_entry(void *ctx, const walk_entry_t *entry, void **child) {
+    dir_sync_t *sync = ctx;
     char src_path[MAX_PATH_LEN], dst_path[MAX_PATH_LEN];
-    struct stat statbuf;
+    (void)child;
     
-    if ((dir = opendir(src_dir)) == NULL) {
-        perror("opendir");
-        return -1;
+    if (sync->failed) {
+        return WALK_STOP;
     }
-    
-    while ((entry = readdir(dir)) != NULL) {
-        //  .  ..
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-        
-        snprintf(src_path, sizeof(src_path), "%s/%s", src_dir, entry->d_name);
-        snprintf(dst_path, sizeof(dst_path), "%s/%s", dst_dir, entry->d_name);
-        
-        if (stat(src_path, &statbuf) == -1) {
-            perror("stat");
-            continue;
-        }
-        
-        if (S_ISDIR(statbuf.st_mode)) {
-            // ݹͬĿ¼
-            if (sync_directory(src_path, dst_path, options) == -1) {
-                closedir(dir);
-                return -1;
-            }
-        } else if (S_ISREG(statbuf.st_mode)) {
-            // ͬͨļ
-            if (sync_file(src_path, dst_path, options) == -1) {
-                closedir(dir);
-                return -1;
-            }
-        }
+    if (entry->type == WALK_NS) {
+        fprintf(stderr, "stat: %s/%s: %s\n", sync->src_dir, entry->path, strerror(entry->err));
+        return WALK_CONTINUE;
+    }
+    if (entry->type != WALK_F || !S_ISREG(entry->st->st_mode)) {
+        return WALK_CONTINUE;
     }
     
-    closedir(dir);
-    return 0;
+    snprintf(src_path, sizeof(src_path), "%s/%s", sync->src_dir, entry->path);
+    snprintf(dst_path, sizeof(dst_path), "%s/%s", sync->dst_dir, entry->path);
+    if (sync_file(src_path, dst_path, sync->options) == -1) {
+        sync->failed = 1;
+        return WALK_STOP;
+    }
+    return WALK_CONTINUE;
+}
+
+static void sync_dir_done(void *ctx, const walk_entry_t *dir) {
+    dir_sync_t *sync = ctx;
+    if (dir->type == WALK_DNR && dir->err != ECANCELED) {
+        fprintf(stderr, "opendir: %s%s%s: %s\n", sync->src_dir, dir->path_len ? "/" : "",
+                dir->path, strerror(dir->err));
+        sync->failed = 1;
+    }
+}
+
+// 单线程按目录 fd 遍历源目录，逐个同步文件
+int sync_directory(const char *src_dir, const char *dst_dir, const sync_options_t *options) {
+    dir_sync_t sync = {src_dir, dst_dir, options, 0};
+    walk_options_t opts = {sync_entry, sync_dir_done, &sync, 1, WALK_FOLLOW};
+    walk_tree(src_dir, NULL, &opts);
+    return sync.failed ? -1 : 0;
 }
 
 int main(int argc, char *argv[]) {
-    sync_options_t options = {0, 0};
+    sync_options_t options = {0, 0, 0};
     int opt;
     char *source = NULL, *destination = NULL;
     struct stat src_stat;
     
-    // в
-    while ((opt = getopt(argc, argv, "vnh")) != -1) {
+    // 解析命令行参数
+    while ((opt = getopt(argc, argv, "vnDh")) != -1) {
         switch (opt) {
             case 'v':
                 options.verbose = 1;
@@ -303,6 +325,9 @@ int main(int argc, char *argv[]) {
             case 'n':
                 options.dry_run = 1;
                 break;
+            case 'D':
+                options.delta = 1;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -312,7 +337,7 @@ int main(int argc, char *argv[]) {
         }
     }
     
-    // 
+    // 检查参数数量
     if (optind + 2 != argc) {
         fprintf(stderr, "Error: Source and destination paths are required\n");
         print_usage(argv[0]);
@@ -326,13 +351,13 @@ int main(int argc, char *argv[]) {
         printf("=== DRY RUN MODE ===\n");
     }
     
-    // Դ·Ƿ
+    // 检查源路径是否存在
     if (stat(source, &src_stat) == -1) {
         perror("stat source");
         return 1;
     }
     
-    // ִͬ
+    // 执行同步
     if (S_ISDIR(src_stat.st_mode)) {
         if (sync_directory(source, destination, &options) == -1) {
             fprintf(stderr, "Directory synchronization failed\n");
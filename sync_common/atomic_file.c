@@ -0,0 +1,344 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "atomic_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <ctype.h>
+
+#define TEMP_SUFFIX_LEN 6
+#define TEMP_NAME_TRIES 100
+
+struct commit_item {
+    char *temp;
+    char *target;
+};
+
+// 临时文件名的随机后缀，每个线程各自生成，不需要加锁
+static __thread uint64_t name_state;
+
+static void fill_suffix(char *out) {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    if (!name_state) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        name_state = ((uint64_t)getpid() << 32) ^ (uint64_t)(uintptr_t)&name_state ^
+                     (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 20);
+    }
+    // splitmix64
+    uint64_t z = (name_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    for (int i = 0; i < TEMP_SUFFIX_LEN; i++) {
+        out[i] = chars[z % (sizeof(chars) - 1)];
+        z /= sizeof(chars) - 1;
+    }
+}
+
+int atomic_temp_name(const char *target, char *buf, size_t size) {
+    const char *slash = strrchr(target, '/');
+    int dir_len = slash ? (int)(slash - target + 1) : 0;
+    const char *base = slash ? slash + 1 : target;
+    int n = snprintf(buf, size, "%.*s.%s.%*s", dir_len, target, base, TEMP_SUFFIX_LEN, "");
+    if (n < 0 || (size_t)n >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fill_suffix(buf + n - TEMP_SUFFIX_LEN);
+    return 0;
+}
+
+int atomic_temp_base(const char *name, char *buf, size_t size) {
+    size_t len = strlen(name);
+    if (name[0] != '.' || len < 3 + TEMP_SUFFIX_LEN || name[len - TEMP_SUFFIX_LEN - 1] != '.') {
+        return 0;
+    }
+    for (size_t i = len - TEMP_SUFFIX_LEN; i < len; i++) {
+        if (!isalnum((unsigned char)name[i])) {
+            return 0;
+        }
+    }
+    size_t base_len = len - TEMP_SUFFIX_LEN - 2;
+    if (base_len >= size) {
+        return 0;
+    }
+    memcpy(buf, name + 1, base_len);
+    buf[base_len] = '\0';
+    return 1;
+}
+
+#ifdef O_TMPFILE
+// 匿名文件要通过 /proc/self/fd 才能链接，没有挂载 /proc 时不用 O_TMPFILE
+static int tmpfile_usable(void) {
+    static int state;         // 0 未检查，1 可用，-1 不可用
+    int s = __atomic_load_n(&state, __ATOMIC_RELAXED);
+    if (s == 0) {
+        s = access("/proc/self/fd", X_OK) == 0 ? 1 : -1;
+        __atomic_store_n(&state, s, __ATOMIC_RELAXED);
+    }
+    return s > 0;
+}
+#endif
+
+int atomic_open(atomic_file_t *af, const char *target, mode_t mode) {
+    af->fd = -1;
+    af->anonymous = 0;
+    if (atomic_temp_name(target, af->temp_path, sizeof(af->temp_path)) != 0) {
+        af->temp_path[0] = '\0';
+        return -1;
+    }
+
+#ifdef O_TMPFILE
+    // 文件系统不支持时（EOPNOTSUPP/EISDIR）改用有名字的临时文件
+    if (tmpfile_usable()) {
+        char dir[PATH_MAX];
+        const char *slash = strrchr(target, '/');
+        if (slash) {
+            snprintf(dir, sizeof(dir), "%.*s", (int)(slash - target), target);
+        } else {
+            strcpy(dir, ".");
+        }
+        int fd = open(dir[0] ? dir : "/", O_TMPFILE | O_WRONLY, mode);
+        if (fd >= 0) {
+            af->fd = fd;
+            af->anonymous = 1;
+            return fd;
+        }
+    }
+#endif
+
+    for (int tries = 0; tries < TEMP_NAME_TRIES; tries++) {
+        int fd = open(af->temp_path, O_WRONLY | O_CREAT | O_EXCL, mode);
+        if (fd >= 0) {
+            af->fd = fd;
+            return fd;
+        }
+        if (errno != EEXIST) {
+            break;
+        }
+        fill_suffix(af->temp_path + strlen(af->temp_path) - TEMP_SUFFIX_LEN);
+    }
+    af->temp_path[0] = '\0';
+    return -1;
+}
+
+int atomic_close(atomic_file_t *af) {
+    int rc = 0;
+    if (af->anonymous) {
+        char proc[64];
+        snprintf(proc, sizeof(proc), "/proc/self/fd/%d", af->fd);
+        rc = -1;
+        for (int tries = 0; tries < TEMP_NAME_TRIES; tries++) {
+            if (linkat(AT_FDCWD, proc, AT_FDCWD, af->temp_path, AT_SYMLINK_FOLLOW) == 0) {
+                rc = 0;
+                break;
+            }
+            if (errno != EEXIST) {
+                break;
+            }
+            fill_suffix(af->temp_path + strlen(af->temp_path) - TEMP_SUFFIX_LEN);
+        }
+        af->anonymous = 0;
+        if (rc != 0) {
+            af->temp_path[0] = '\0';
+        }
+    }
+
+    int saved_errno = errno;
+    if (close(af->fd) != 0 && rc == 0) {
+        saved_errno = errno;
+        rc = -1;
+    }
+    af->fd = -1;
+    if (rc != 0 && af->temp_path[0]) {
+        unlink(af->temp_path);
+        af->temp_path[0] = '\0';
+    }
+    errno = saved_errno;
+    return rc;
+}
+
+void atomic_abort(atomic_file_t *af) {
+    int saved_errno = errno;
+    if (af->fd >= 0) {
+        close(af->fd);
+        af->fd = -1;
+    }
+    if (!af->anonymous && af->temp_path[0]) {
+        unlink(af->temp_path);
+    }
+    af->anonymous = 0;
+    af->temp_path[0] = '\0';
+    errno = saved_errno;
+}
+
+// 改名覆盖目标，失败时删除临时文件
+static int replace_target(const char *temp, const char *target) {
+    if (rename(temp, target) == 0) {
+        return 0;
+    }
+    int saved_errno = errno;
+    unlink(temp);
+    errno = saved_errno;
+    return -1;
+}
+
+void commit_batch_init(commit_batch_t *batch, int sync_fd, commit_fail_fn on_fail, void *ctx) {
+    memset(batch, 0, sizeof(*batch));
+    batch->sync_fd = sync_fd;
+    batch->on_fail = on_fail;
+    batch->fail_ctx = ctx;
+}
+
+static void item_failed(commit_batch_t *batch, struct commit_item *item) {
+    free(item->temp);
+    item->temp = NULL;
+    if (batch->on_fail) {
+        batch->on_fail(batch->fail_ctx, item->target);
+    }
+}
+
+int commit_batch_add(commit_batch_t *batch, const char *temp, const char *target, off_t size) {
+    if (batch->sync_fd < 0) {
+        return replace_target(temp, target);
+    }
+
+    if (batch->count == batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 64;
+        batch->items = realloc(batch->items, batch->capacity * sizeof(struct commit_item));
+        if (!batch->items) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    struct commit_item *item = &batch->items[batch->count++];
+    item->temp = strdup(temp);
+    item->target = strdup(target);
+    if (!item->temp || !item->target) {
+        perror("strdup failed");
+        exit(1);
+    }
+    batch->bytes += size;
+
+    if (batch->count >= COMMIT_BATCH_FILES || batch->bytes >= COMMIT_BATCH_BYTES) {
+        commit_batch_flush(batch);
+    }
+    return 0;
+}
+
+// 目录部分的长度（含末尾的 /），没有目录时为 0
+static size_t dir_len(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? (size_t)(slash - path + 1) : 0;
+}
+
+// 先按目录再按文件名排序，同一目录的文件相邻，每个目录只 fsync 一次
+static int item_cmp(const void *a, const void *b) {
+    const char *x = ((const struct commit_item *)a)->target;
+    const char *y = ((const struct commit_item *)b)->target;
+    size_t lx = dir_len(x), ly = dir_len(y);
+    int c = memcmp(x, y, lx < ly ? lx : ly);
+    if (c != 0 || lx != ly) {
+        return c != 0 ? c : (lx < ly ? -1 : 1);
+    }
+    return strcmp(x + lx, y + ly);
+}
+
+static int fsync_dir(const char *path, size_t len) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%.*s", len ? (int)len : 1, len ? path : ".");
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return -1;
+    }
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+// 逐个文件 fdatasync，用于 syncfs 不可用时
+static int datasync_path(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    int rc = fdatasync(fd);
+    close(fd);
+    return rc;
+}
+
+int commit_batch_flush(commit_batch_t *batch) {
+    if (batch->count == 0) {
+        return 0;
+    }
+
+    // 一次 syncfs 让整批文件的数据落盘，不支持时退回逐个 fdatasync
+    int synced = 0;
+#ifdef __linux__
+    synced = syncfs(batch->sync_fd) == 0;
+#endif
+    int failed = 0;
+    for (size_t i = 0; i < batch->count; i++) {
+        struct commit_item *item = &batch->items[i];
+        if (!synced && datasync_path(item->temp) != 0) {
+            unlink(item->temp);
+            item_failed(batch, item);
+            failed++;
+        }
+    }
+
+    qsort(batch->items, batch->count, sizeof(struct commit_item), item_cmp);
+    for (size_t i = 0; i < batch->count; i++) {
+        struct commit_item *item = &batch->items[i];
+        if (item->temp && replace_target(item->temp, item->target) != 0) {
+            item_failed(batch, item);
+            failed++;
+        }
+    }
+
+    // 改名只有在目录落盘后才持久
+    size_t i = 0;
+    while (i < batch->count) {
+        const char *dir = batch->items[i].target;
+        size_t len = dir_len(dir);
+        size_t end = i;
+        int renamed = 0;
+        while (end < batch->count && dir_len(batch->items[end].target) == len &&
+               memcmp(batch->items[end].target, dir, len) == 0) {
+            renamed += batch->items[end].temp != NULL;
+            end++;
+        }
+        if (renamed > 0 && fsync_dir(dir, len) != 0) {
+            for (size_t k = i; k < end; k++) {
+                if (batch->items[k].temp) {
+                    item_failed(batch, &batch->items[k]);
+                }
+            }
+            failed += renamed;
+        }
+        i = end;
+    }
+
+    for (i = 0; i < batch->count; i++) {
+        free(batch->items[i].temp);
+        free(batch->items[i].target);
+    }
+    batch->count = 0;
+    batch->bytes = 0;
+    batch->failed += failed;
+    return failed;
+}
+
+void commit_batch_free(commit_batch_t *batch) {
+    commit_batch_flush(batch);
+    free(batch->items);
+    batch->items = NULL;
+    batch->capacity = 0;
+}
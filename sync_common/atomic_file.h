@@ -0,0 +1,69 @@
+#ifndef ATOMIC_FILE_H
+#define ATOMIC_FILE_H
+
+#include <sys/types.h>
+#include <limits.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define COMMIT_BATCH_FILES 256                  // 每批最多推迟改名的文件数
+#define COMMIT_BATCH_BYTES (256LL * 1024 * 1024) // 每批最多推迟落盘的数据量
+
+// 原子替换：新内容写入目标同目录下的临时文件 .name.XXXXXX，写完后改名覆盖目标，
+// 中途崩溃或并发读取都只会看到旧文件或完整的新文件。
+// 支持 O_TMPFILE 时先创建匿名文件，写完才用 linkat 给它起临时名字，
+// 出错或崩溃时不会在目标目录里留下残缺的临时文件
+typedef struct {
+    int fd;
+    int anonymous;            // O_TMPFILE 打开，还没有名字
+    char temp_path[PATH_MAX];
+} atomic_file_t;
+
+// 生成 target 同目录下的临时文件名 .name.XXXXXX，成功返回 0
+int atomic_temp_name(const char *target, char *buf, size_t size);
+
+// name 形如 atomic_temp_name 生成的 .name.XXXXXX 时把其中的 name 写入 buf 并返回 1
+int atomic_temp_base(const char *name, char *buf, size_t size);
+
+// 为 target 打开临时文件，成功返回可写的 fd（也保存在 af->fd），失败返回 -1 并设置 errno
+int atomic_open(atomic_file_t *af, const char *target, mode_t mode);
+
+// 写完后关闭临时文件，匿名文件在这里链接到 af->temp_path。成功返回 0
+int atomic_close(atomic_file_t *af);
+
+// 放弃临时文件
+void atomic_abort(atomic_file_t *af);
+
+// 提交写好的临时文件。sync_fd < 0 时立即改名；
+// 否则为持久模式：改名推迟到整批提交时，先用 syncfs 让整批数据一次落盘，
+// 再依次改名，最后对涉及的每个目录各 fsync 一次，而不是每个文件一次 fsync。
+// 只由一个线程使用
+typedef void (*commit_fail_fn)(void *ctx, const char *target);
+
+typedef struct {
+    struct commit_item *items;
+    size_t count;
+    size_t capacity;
+    long long bytes;
+    int sync_fd;              // 目标文件系统上打开的任一 fd，用于 syncfs
+    int failed;               // 整批提交时失败的文件数（累计）
+    commit_fail_fn on_fail;   // 整批提交中每个失败的文件调用一次，可为 NULL
+    void *fail_ctx;
+} commit_batch_t;
+
+// on_fail 让调用者知道推迟的文件中具体哪些没有替换成功（或改名后未能落盘）
+void commit_batch_init(commit_batch_t *batch, int sync_fd, commit_fail_fn on_fail, void *ctx);
+
+// 提交 temp 替换 target，size 为文件大小，用于决定何时整批落盘
+// 立即改名失败时返回 -1 并删除临时文件；推迟的文件提交失败时只计入 batch->failed
+int commit_batch_add(commit_batch_t *batch, const char *temp, const char *target, off_t size);
+
+// 提交所有推迟的文件，返回本次失败的文件数，失败的临时文件已删除
+int commit_batch_flush(commit_batch_t *batch);
+
+// 先提交剩余的文件再释放，batch->failed 保留
+void commit_batch_free(commit_batch_t *batch);
+
+#endif
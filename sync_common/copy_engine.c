@@ -0,0 +1,333 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "copy_engine.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#endif
+
+// 单次 copy_file_range/sendfile 的最大字节数
+#define KERNEL_COPY_CHUNK (64 * 1024 * 1024)
+
+static const copy_hook_t *copy_hook;
+
+void copy_set_hook(const copy_hook_t *hook) {
+    copy_hook = hook;
+}
+
+static long long hook_clock(void) {
+    if (!copy_hook) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// 写入一批之前调用，返回开始时间
+static long long hook_before(off_t bytes) {
+    if (copy_hook && bytes > 0) {
+        copy_hook->before(copy_hook->ctx, bytes);
+    }
+    return hook_clock();
+}
+
+static void hook_after(ssize_t bytes, long long start) {
+    if (copy_hook && bytes > 0) {
+        copy_hook->after(copy_hook->ctx, bytes, hook_clock() - start);
+    }
+}
+
+// 本批要复制的字节数：没有钩子时整段交给内核；有钩子时按 COPY_HOOK_BATCH 分批，
+// charge 返回按文件大小估计的本批字节数，到达预期的末尾后为 0（只是确认 EOF）
+static size_t batch_size(off_t size, off_t done, off_t *charge) {
+    size_t chunk = copy_hook ? COPY_HOOK_BATCH : KERNEL_COPY_CHUNK;
+    off_t left = size - done;
+    *charge = left <= 0 ? 0 : (left < (off_t)chunk ? left : (off_t)chunk);
+    return chunk;
+}
+
+// 这些错误表示当前方式不适用于这对文件，可以换下一种方式
+static int not_supported(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS ||
+           err == EOPNOTSUPP || err == ENOTSUP || err == ENOTTY ||
+           err == EBADF || err == EPERM;
+}
+
+#ifdef __linux__
+// 在同一文件系统（btrfs/xfs 等）上共享数据块，不复制数据
+static int try_reflink(int src_fd, int dst_fd) {
+#ifdef FICLONE
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+        return 0;
+    }
+#else
+    (void)src_fd;
+    (void)dst_fd;
+    errno = EOPNOTSUPP;
+#endif
+    return -1;
+}
+
+// 用 copy_file_range 复制到文件末尾，size 为预期大小，用于限速时估计每批的字节数
+// 返回 1 表示完成，0 表示一个字节都没复制就不支持，-1 表示出错。
+// 有些文件系统（procfs、部分 FUSE）对非空文件也直接返回 0，这时同样返回 0 交给下一种方式
+static int try_copy_file_range(int src_fd, int dst_fd, off_t size) {
+    ssize_t n;
+    off_t done = 0;
+    int copied = 0;
+
+    for (;;) {
+        off_t charge;
+        size_t want = batch_size(size, done, &charge);
+        long long start = hook_before(charge);
+        // 被信号打断（限速重载、watch 模式的退出信号）时重试，不算失败
+        do {
+            n = copy_file_range(src_fd, NULL, dst_fd, NULL, want, 0);
+        } while (n < 0 && errno == EINTR);
+        hook_after(n, start);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+        copied = 1;
+    }
+    if (n == 0) {
+        return (!copied && size > 0) ? 0 : 1;
+    }
+    return (!copied && not_supported(errno)) ? 0 : -1;
+}
+
+// 用 sendfile 复制到文件末尾，返回值同 try_copy_file_range
+static int try_sendfile(int src_fd, int dst_fd, off_t size) {
+    ssize_t n;
+    off_t done = 0;
+    int copied = 0;
+
+    for (;;) {
+        off_t charge;
+        size_t want = batch_size(size, done, &charge);
+        long long start = hook_before(charge);
+        do {
+            n = sendfile(dst_fd, src_fd, NULL, want);
+        } while (n < 0 && errno == EINTR);
+        hook_after(n, start);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+        copied = 1;
+    }
+    if (n == 0) {
+        return (!copied && size > 0) ? 0 : 1;
+    }
+    return (!copied && not_supported(errno)) ? 0 : -1;
+}
+#endif
+
+// 经过用户态缓冲区复制，所有方式都不可用时才使用
+static int copy_buffered(int src_fd, int dst_fd) {
+    char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (!buffer) {
+        return -1;
+    }
+
+    ssize_t bytes_read;
+    int rc = 0;
+    for (;;) {
+        bytes_read = read(src_fd, buffer, COPY_BUFFER_SIZE);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            break;
+        }
+        char *p = buffer;
+        ssize_t total = bytes_read;
+        long long start = hook_before(bytes_read);
+        while (bytes_read > 0) {
+            ssize_t bytes_written = write(dst_fd, p, bytes_read);
+            if (bytes_written <= 0) {
+                if (bytes_written < 0 && errno == EINTR) {
+                    continue;
+                }
+                rc = -1;
+                break;
+            }
+            p += bytes_written;
+            bytes_read -= bytes_written;
+        }
+        hook_after(total - bytes_read, start);
+        if (rc < 0) {
+            break;
+        }
+    }
+    if (bytes_read < 0) {
+        rc = -1;
+    }
+
+    int saved_errno = errno;
+    free(buffer);
+    errno = saved_errno;
+    return rc;
+}
+
+int copy_reflink(int src_fd, int dst_fd) {
+#ifdef __linux__
+    return try_reflink(src_fd, dst_fd);
+#else
+    (void)src_fd;
+    (void)dst_fd;
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+// 经过用户态缓冲区复制一个区间
+static int copy_range_buffered(int src_fd, int dst_fd, off_t offset, off_t len) {
+    char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (!buffer) {
+        return -1;
+    }
+
+    int rc = 0;
+    off_t end = offset + len;
+    while (offset < end) {
+        size_t want = end - offset < COPY_BUFFER_SIZE ? (size_t)(end - offset) : COPY_BUFFER_SIZE;
+        ssize_t n = pread(src_fd, buffer, want, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) errno = EIO;   // 源文件在复制过程中变短
+            rc = -1;
+            break;
+        }
+        long long start = hook_before(n);
+        ssize_t done = 0;
+        while (done < n) {
+            ssize_t w = pwrite(dst_fd, buffer + done, n - done, offset + done);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w <= 0) {
+                rc = -1;
+                break;
+            }
+            done += w;
+        }
+        hook_after(done, start);
+        if (rc < 0) {
+            break;
+        }
+        offset += n;
+    }
+
+    int saved_errno = errno;
+    free(buffer);
+    errno = saved_errno;
+    return rc;
+}
+
+int copy_range(int src_fd, int dst_fd, off_t offset, off_t len, copy_method_t *method) {
+    off_t end = offset + len;
+
+#ifdef __linux__
+    // 传入偏移指针时 copy_file_range 不使用也不改变 fd 的文件偏移
+    off_t in_off = offset, out_off = offset;
+    while (in_off < end) {
+        off_t charge;
+        size_t want = batch_size(end, in_off, &charge);
+        want = (off_t)want < end - in_off ? want : (size_t)(end - in_off);
+        long long start = hook_before(charge);
+        ssize_t n = copy_file_range(src_fd, &in_off, dst_fd, &out_off, want, 0);
+        hook_after(n, start);
+        if (n > 0) {
+            continue;
+        }
+        if (n == 0) {
+            // 一个字节都没复制时交给缓冲方式，真的变短了由它报错
+            if (in_off == offset) {
+                break;
+            }
+            errno = EIO;
+            return -1;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (in_off == offset && not_supported(errno)) {
+            break;
+        }
+        return -1;
+    }
+    if (in_off >= end) {
+        if (method) *method = COPY_FILE_RANGE;
+        return 0;
+    }
+#endif
+
+    if (method) *method = COPY_BUFFERED;
+    return copy_range_buffered(src_fd, dst_fd, offset, end - offset);
+}
+
+// 按优先级依次尝试各种复制方式
+int copy_fd(int src_fd, int dst_fd, off_t size, copy_method_t *method) {
+    copy_method_t used = COPY_NONE;
+    int rc = 0;
+
+    if (size == 0) {
+        // 大小为 0 时仍读一次，防止 /proc 之类报告大小为 0 的文件丢数据
+        rc = copy_buffered(src_fd, dst_fd);
+        goto done;
+    }
+
+#ifdef __linux__
+    if (try_reflink(src_fd, dst_fd) == 0) {
+        used = COPY_REFLINK;
+        goto done;
+    }
+
+    used = COPY_FILE_RANGE;
+    if ((rc = try_copy_file_range(src_fd, dst_fd, size)) != 0) {
+        rc = rc > 0 ? 0 : -1;
+        goto done;
+    }
+
+    used = COPY_SENDFILE;
+    if ((rc = try_sendfile(src_fd, dst_fd, size)) != 0) {
+        rc = rc > 0 ? 0 : -1;
+        goto done;
+    }
+#endif
+
+    used = COPY_BUFFERED;
+    rc = copy_buffered(src_fd, dst_fd);
+
+done:
+    if (method) {
+        *method = used;
+    }
+    return rc;
+}
+
+const char* copy_method_name(copy_method_t method) {
+    switch (method) {
+        case COPY_NONE:       return "none";
+        case COPY_REFLINK:    return "reflink";
+        case COPY_FILE_RANGE: return "copy_file_range";
+        case COPY_SENDFILE:   return "sendfile";
+        case COPY_BUFFERED:   return "buffered";
+        case COPY_DELTA:      return "delta";
+        case COPY_URING:      return "io_uring";
+        case COPY_LINK:       return "hardlink";
+        default:              return "unknown";
+    }
+}
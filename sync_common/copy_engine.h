@@ -0,0 +1,49 @@
+#ifndef COPY_ENGINE_H
+#define COPY_ENGINE_H
+
+#include <sys/types.h>
+
+// 文件内容的复制方式，按优先级从高到低排列
+typedef enum {
+    COPY_NONE = 0,            // 空文件，没有数据需要复制
+    COPY_REFLINK,             // ioctl(FICLONE)，同一文件系统上共享数据块
+    COPY_FILE_RANGE,          // copy_file_range，在内核中复制
+    COPY_SENDFILE,            // sendfile，在内核中复制
+    COPY_BUFFERED,            // read/write 经过用户态缓冲区，最后的后备方式
+    COPY_DELTA,               // 增量传输，只改写目标中变化的区间（见 delta.h）
+    COPY_URING,               // io_uring 异步批量复制（见 uring_copy.h）
+    COPY_LINK,                // 硬链接到内容相同、已经复制好的目标文件，不复制数据
+    COPY_METHOD_COUNT
+} copy_method_t;
+
+#define COPY_BUFFER_SIZE (128 * 1024)
+#define COPY_HOOK_BATCH (1024 * 1024)   // 设置了钩子时每次内核复制的最大字节数
+
+// 每批数据写入前后调用的钩子，用于限速：before 在写入前调用，可以阻塞；
+// after 报告这一批实际写入的字节数和耗时（纳秒）。设置后内核复制按 COPY_HOOK_BATCH 分批，
+// 以便均匀地等待；不设置时整段交给内核
+typedef struct {
+    void (*before)(void *ctx, off_t bytes);
+    void (*after)(void *ctx, off_t bytes, long long latency_ns);
+    void *ctx;
+} copy_hook_t;
+
+// 设置全进程的钩子，hook 为 NULL 时取消。应在复制开始前调用，hook 须一直有效
+void copy_set_hook(const copy_hook_t *hook);
+
+// 把 src_fd 从当前偏移开始的内容复制到 dst_fd（dst_fd 应为刚截断的空文件）
+// 依次尝试 reflink、copy_file_range、sendfile，都不支持时才用缓冲区复制
+// 成功返回 0，并通过 method 返回实际使用的方式；失败返回 -1 并设置 errno
+int copy_fd(int src_fd, int dst_fd, off_t size, copy_method_t *method);
+
+// 尝试用 reflink 让 dst_fd 共享 src_fd 的全部数据块，成功返回 0
+int copy_reflink(int src_fd, int dst_fd);
+
+// 把 src_fd 中 [offset, offset + len) 复制到 dst_fd 的同一位置，不改变两者的文件偏移，
+// 多个线程可以用同一对 fd 并行复制不同区间。优先用 copy_file_range，
+// 不支持时用 pread/pwrite。成功返回 0，失败返回 -1 并设置 errno
+int copy_range(int src_fd, int dst_fd, off_t offset, off_t len, copy_method_t *method);
+
+const char* copy_method_name(copy_method_t method);
+
+#endif
@@ -0,0 +1,337 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "delta.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define DELTA_WINDOW (8 * 1024 * 1024)   // 每次读入的字节数
+
+// 弱校验：rsync 的滚动校验，a 为字节和，b 为加权和，各取低 16 位
+static uint32_t weak_sum(const unsigned char *p, size_t len, uint32_t *a_out, uint32_t *b_out) {
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; i++) {
+        a += p[i];
+        b += (uint32_t)(len - i) * p[i];
+    }
+    a &= 0xffff;
+    b &= 0xffff;
+    if (a_out) *a_out = a;
+    if (b_out) *b_out = b;
+    return a | (b << 16);
+}
+
+static uint32_t bucket_of(const delta_sig_t *sig, uint32_t weak) {
+    return (weak ^ (weak >> 16) ^ (weak >> 7)) & sig->mask;
+}
+
+static size_t block_len(const delta_sig_t *sig, size_t idx) {
+    off_t start = (off_t)idx * sig->block_size;
+    off_t remain = sig->file_size - start;
+    return remain < (off_t)sig->block_size ? (size_t)remain : sig->block_size;
+}
+
+// 读满 len 字节（除非遇到文件尾），返回实际读到的字节数，出错返回 -1
+static ssize_t pread_full(int fd, unsigned char *buf, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, offset + done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+static int pwrite_full(int fd, const unsigned char *buf, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(fd, buf + done, len - done, offset + done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+size_t delta_block_size(off_t file_size) {
+    size_t block_size = DELTA_MIN_BLOCK;
+    while (block_size < DELTA_MAX_BLOCK && (off_t)block_size * (off_t)block_size < file_size) {
+        block_size <<= 1;
+    }
+    return block_size;
+}
+
+// 生成块签名，并建立弱校验到块号的哈希表
+int delta_signature(int fd, off_t file_size, size_t block_size, delta_sig_t *sig) {
+    memset(sig, 0, sizeof(*sig));
+    sig->block_size = block_size;
+    sig->file_size = file_size;
+    sig->count = (file_size + block_size - 1) / block_size;
+
+    uint32_t nbuckets = 16;
+    while (nbuckets < sig->count * 2) {
+        nbuckets <<= 1;
+    }
+    sig->mask = nbuckets - 1;
+
+    size_t window = (DELTA_WINDOW / block_size) * block_size;
+    if (window == 0) {
+        window = block_size;
+    }
+
+    sig->weak = malloc(sig->count * sizeof(uint32_t) + 1);
+    sig->strong = malloc(sig->count * sizeof(uint64_t) + 1);
+    sig->next = malloc(sig->count * sizeof(int) + 1);
+    sig->buckets = malloc(nbuckets * sizeof(int));
+    unsigned char *buf = malloc(window);
+    if (!sig->weak || !sig->strong || !sig->next || !sig->buckets || !buf) {
+        free(buf);
+        delta_sig_free(sig);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t idx = 0;
+    for (off_t off = 0; off < file_size; ) {
+        size_t want = window;
+        if ((off_t)want > file_size - off) {
+            want = file_size - off;
+        }
+        if (pread_full(fd, buf, want, off) != (ssize_t)want) {
+            if (errno == 0) errno = EIO;
+            free(buf);
+            delta_sig_free(sig);
+            return -1;
+        }
+        for (size_t i = 0; i < want; i += block_size) {
+            size_t len = want - i < block_size ? want - i : block_size;
+            sig->weak[idx] = weak_sum(buf + i, len, NULL, NULL);
+            sig->strong[idx] = hash_xxh64(buf + i, len, 0);
+            idx++;
+        }
+        off += want;
+    }
+    free(buf);
+
+    // 倒序插入，使链表中块号小的在前
+    for (uint32_t i = 0; i < nbuckets; i++) {
+        sig->buckets[i] = -1;
+    }
+    for (size_t i = sig->count; i-- > 0; ) {
+        uint32_t h = bucket_of(sig, sig->weak[i]);
+        sig->next[i] = sig->buckets[h];
+        sig->buckets[h] = (int)i;
+    }
+    return 0;
+}
+
+void delta_sig_free(delta_sig_t *sig) {
+    free(sig->weak);
+    free(sig->strong);
+    free(sig->buckets);
+    free(sig->next);
+    sig->weak = NULL;
+    sig->strong = NULL;
+    sig->buckets = NULL;
+    sig->next = NULL;
+    sig->count = 0;
+}
+
+// 在签名中查找与 data[0..len) 相同的块，优先选同一偏移的块
+// 找到返回块号，否则返回 -1
+static int find_match(const delta_sig_t *sig, uint32_t weak, const unsigned char *data,
+                      size_t len, off_t pos) {
+    uint64_t strong = 0;
+    int have_strong = 0;
+
+    if (pos % (off_t)sig->block_size == 0) {
+        size_t idx = pos / sig->block_size;
+        if (idx < sig->count && sig->weak[idx] == weak && block_len(sig, idx) == len) {
+            strong = hash_xxh64(data, len, 0);
+            have_strong = 1;
+            if (sig->strong[idx] == strong) {
+                return (int)idx;
+            }
+        }
+    }
+
+    for (int i = sig->buckets[bucket_of(sig, weak)]; i >= 0; i = sig->next[i]) {
+        if (sig->weak[i] != weak || block_len(sig, i) != len) {
+            continue;
+        }
+        if (!have_strong) {
+            strong = hash_xxh64(data, len, 0);
+            have_strong = 1;
+        }
+        if (sig->strong[i] == strong) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 在非对齐位置找到别处的块时，检查下一个块边界处的源数据是否
+// 与目标同一位置的块相同。相同则应回到对齐位置，否则之后的块会一直
+// 按"移动"处理而全部重写（例如全零文件中改了一个字节）
+static int realign(const delta_sig_t *sig, const unsigned char *buf, off_t buf_off,
+                   size_t buf_len, off_t pos, off_t src_size) {
+    size_t bs = sig->block_size;
+    off_t aligned = ((pos + bs - 1) / bs) * bs;
+    size_t idx = aligned / bs;
+    if (aligned == pos || idx >= sig->count) {
+        return 0;
+    }
+
+    // 不满的最后一块只有在源文件也在同一位置结束时才可能匹配
+    size_t len = block_len(sig, idx);
+    if (len < bs && aligned + (off_t)len != src_size) {
+        return 0;
+    }
+    if (aligned - buf_off + len > buf_len) {
+        return 0;
+    }
+    const unsigned char *data = buf + (aligned - buf_off);
+    return weak_sum(data, len, NULL, NULL) == sig->weak[idx] &&
+           hash_xxh64(data, len, 0) == sig->strong[idx];
+}
+
+// 按 rsync 算法逐字节滚动扫描源文件
+// 原地更新时只有与目标同一偏移相同的块可以跳过；
+// 在其他偏移找到的块可能已被前面的写入覆盖，因此仍从源文件写入
+int delta_apply_inplace(int src_fd, off_t src_size, int dst_fd,
+                        const delta_sig_t *sig, delta_stats_t *stats) {
+    size_t bs = sig->block_size;
+    size_t bufcap = DELTA_WINDOW + bs;
+    unsigned char *buf = malloc(bufcap);
+    if (!buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    off_t buf_off = 0;        // buf[0] 对应的源文件偏移
+    size_t buf_len = 0;
+    off_t pos = 0;            // 当前窗口起点
+    off_t lit_start = 0;      // 尚未写入的区间起点
+    off_t written = 0;
+    uint32_t a = 0, b = 0;
+    int have_sum = 0;
+    int rc = 0;
+
+    while (pos < src_size) {
+        size_t rel = pos - buf_off;
+
+        // 保证缓冲区中有完整窗口和滚动所需的下一个字节
+        if (rel + bs >= buf_len && buf_off + (off_t)buf_len < src_size) {
+            if (pos > lit_start) {
+                if (pwrite_full(dst_fd, buf + (lit_start - buf_off), pos - lit_start, lit_start) < 0) {
+                    rc = -1;
+                    break;
+                }
+                written += pos - lit_start;
+                lit_start = pos;
+            }
+            memmove(buf, buf + rel, buf_len - rel);
+            buf_len -= rel;
+            buf_off = pos;
+            rel = 0;
+
+            size_t want = bufcap - buf_len;
+            if ((off_t)want > src_size - (buf_off + (off_t)buf_len)) {
+                want = src_size - (buf_off + buf_len);
+            }
+            if (pread_full(src_fd, buf + buf_len, want, buf_off + buf_len) != (ssize_t)want) {
+                if (errno == 0) errno = EIO;
+                rc = -1;
+                break;
+            }
+            buf_len += want;
+        }
+
+        size_t len = buf_len - rel < bs ? buf_len - rel : bs;
+        uint32_t weak;
+        if (!have_sum || len < bs) {
+            weak = weak_sum(buf + rel, len, &a, &b);
+            have_sum = 1;
+        } else {
+            weak = a | (b << 16);
+        }
+
+        int match = find_match(sig, weak, buf + rel, len, pos);
+        if (match >= 0) {
+            off_t block_off = (off_t)match * bs;
+            if (block_off == pos) {
+                // 目标同一位置已是这些数据，先写出之前的区间再跳过
+                if (pos > lit_start) {
+                    if (pwrite_full(dst_fd, buf + (lit_start - buf_off), pos - lit_start, lit_start) < 0) {
+                        rc = -1;
+                        break;
+                    }
+                    written += pos - lit_start;
+                }
+                stats->matched_bytes += len;
+                pos += len;
+                lit_start = pos;
+            } else if (realign(sig, buf, buf_off, buf_len, pos, src_size)) {
+                // 下一个块边界处与目标同一位置相同，把到边界为止的数据
+                // 并入待写区间，回到对齐位置继续比较
+                pos = ((pos + bs - 1) / bs) * bs;
+            } else {
+                // 并入待写区间，和相邻的新数据一起写
+                stats->moved_bytes += len;
+                pos += len;
+            }
+            have_sum = 0;
+            continue;
+        }
+
+        // 窗口后面没有字节可以滚动（已到文件尾），剩下的都是新数据
+        if (len < bs || rel + len >= buf_len) {
+            pos = buf_off + buf_len;
+            break;
+        }
+
+        unsigned char out = buf[rel];
+        unsigned char in = buf[rel + len];
+        a = (a - out + in) & 0xffff;
+        b = (b - (uint32_t)len * out + a) & 0xffff;
+        pos++;
+    }
+
+    if (rc == 0 && pos > lit_start) {
+        if (pwrite_full(dst_fd, buf + (lit_start - buf_off), pos - lit_start, lit_start) < 0) {
+            rc = -1;
+        } else {
+            written += pos - lit_start;
+        }
+    }
+    free(buf);
+
+    if (rc == 0 && src_size != sig->file_size && ftruncate(dst_fd, src_size) < 0) {
+        rc = -1;
+    }
+    stats->literal_bytes = written - stats->moved_bytes;
+    return rc;
+}
+
+int delta_sync_fd(int src_fd, off_t src_size, int dst_fd, off_t dst_size,
+                  delta_stats_t *stats) {
+    delta_sig_t sig;
+    if (delta_signature(dst_fd, dst_size, delta_block_size(dst_size), &sig) < 0) {
+        return -1;
+    }
+    int rc = delta_apply_inplace(src_fd, src_size, dst_fd, &sig, stats);
+    int saved_errno = errno;
+    delta_sig_free(&sig);
+    errno = saved_errno;
+    return rc;
+}
@@ -0,0 +1,47 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define DELTA_MIN_SIZE   (1024 * 1024)   // 目标文件小于此值时直接整体复制
+#define DELTA_MIN_BLOCK  4096
+#define DELTA_MAX_BLOCK  (1024 * 1024)
+
+// 目标文件的块签名：每块一个弱校验（可滚动）和一个强哈希
+typedef struct {
+    size_t block_size;
+    off_t file_size;
+    size_t count;             // 块数，最后一块可能不满
+    uint32_t *weak;
+    uint64_t *strong;
+    int *buckets;             // 弱校验哈希表，链表头为块号，-1 表示空
+    int *next;
+    uint32_t mask;
+} delta_sig_t;
+
+// 增量传输统计
+typedef struct {
+    off_t matched_bytes;      // 与目标同一位置相同，未改写
+    off_t moved_bytes;        // 在目标其他位置找到，原地更新时仍需写入
+    off_t literal_bytes;      // 目标中没有的新数据
+} delta_stats_t;
+
+// 根据文件大小选择块大小（约为 sqrt(size)，取 2 的幂）
+size_t delta_block_size(off_t file_size);
+
+// 读取 fd 的全部内容生成块签名，成功返回 0
+int delta_signature(int fd, off_t file_size, size_t block_size, delta_sig_t *sig);
+void delta_sig_free(delta_sig_t *sig);
+
+// 用滚动校验扫描源文件，与签名比较后只把变化的区间写入 dst_fd，
+// 最后把 dst_fd 截断为源文件大小。成功返回 0
+int delta_apply_inplace(int src_fd, off_t src_size, int dst_fd,
+                        const delta_sig_t *sig, delta_stats_t *stats);
+
+// 生成签名并原地更新目标文件，dst_fd 需以 O_RDWR 打开
+int delta_sync_fd(int src_fd, off_t src_size, int dst_fd, off_t dst_size,
+                  delta_stats_t *stats);
+
+#endif
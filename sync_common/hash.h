@@ -0,0 +1,25 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define HASH_WINDOW (1024 * 1024)   // hash_fd 每次读入的字节数
+
+// xxh64 哈希，用于块签名和路径索引
+uint64_t hash_xxh64(const void *data, size_t len, uint64_t seed);
+
+// 条带哈希，按 CPU 选择 AVX2/SSE2/标量实现，结果相同。短于 256 字节时等同 hash_xxh64
+uint64_t hash_fast64(const void *data, size_t len, uint64_t seed);
+
+// 计算 fd 前 size 字节内容的哈希：按 HASH_WINDOW 分段，每段用 hash_fast64 计算，
+// 上一段的结果作为下一段的种子（不超过一段的内容即 hash_fast64(data, len, 0)）。
+// 使用 pread，不改变文件偏移。成功返回 0
+int hash_fd(int fd, off_t size, uint64_t *out);
+
+// 按同样的分段逐字节比较两个文件的前 size 字节，发现某段不同即停止
+// 相同返回 1，并通过 hash_a（可为 NULL）返回 fd_a 的 hash_fd 结果；不同返回 0，出错返回 -1
+int hash_compare_fd(int fd_a, int fd_b, off_t size, uint64_t *hash_a);
+
+#endif
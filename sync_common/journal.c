@@ -0,0 +1,328 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "journal.h"
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define JOURNAL_MAGIC "FSYNCJR1"
+#define JOURNAL_VERSION 1
+
+// 日志文件布局：文件头 | 源目录（补齐到 8 字节）| 追加的记录
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t root_len;
+} journal_header_t;
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t record_check(const journal_record_t *r) {
+    return hash_xxh64(r, offsetof(journal_record_t, check), 0x6a6f75726e616cULL);
+}
+
+uint64_t journal_path_hash(const char *path, size_t len) {
+    return hash_xxh64(path, len, 0);
+}
+
+static int record_cmp(const void *a, const void *b) {
+    const journal_record_t *x = a;
+    const journal_record_t *y = b;
+    if (x->path_hash != y->path_hash) {
+        return x->path_hash < y->path_hash ? -1 : 1;
+    }
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static int same_file(const journal_record_t *a, const journal_record_t *b) {
+    return a->ino == b->ino && a->size == b->size &&
+           a->mtime_ns == b->mtime_ns && a->ctime_ns == b->ctime_ns;
+}
+
+// 整个文件读入内存：日志只有中断时才留下，记录数与上次已完成的工作成正比
+static int read_all(int fd, char **data, size_t *len) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    char *buf = malloc(st.st_size ? st.st_size : 1);
+    if (!buf) {
+        perror("malloc failed");
+        exit(1);
+    }
+    size_t done = 0;
+    while (done < (size_t)st.st_size) {
+        ssize_t n = read(fd, buf + done, st.st_size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    *data = buf;
+    *len = done;
+    return 0;
+}
+
+// 文件头对得上时返回记录区的起始偏移，否则返回 0
+static size_t header_size(const char *data, size_t len, const char *root) {
+    const journal_header_t *header = (const journal_header_t *)data;
+    size_t root_len = strlen(root);
+    if (len < sizeof(*header) ||
+        memcmp(header->magic, JOURNAL_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != JOURNAL_VERSION ||
+        header->root_len != root_len ||
+        sizeof(*header) + align8(root_len) > len ||
+        memcmp(data + sizeof(*header), root, root_len) != 0) {
+        return 0;
+    }
+    return sizeof(*header) + align8(root_len);
+}
+
+int journal_load(journal_index_t *index, const char *file, const char *root) {
+    memset(index, 0, sizeof(*index));
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    char *data;
+    size_t len;
+    int rc = read_all(fd, &data, &len);
+    close(fd);
+    if (rc != 0) {
+        return -1;
+    }
+
+    size_t off = header_size(data, len, root);
+    if (off == 0) {
+        free(data);
+        return 0;
+    }
+    size_t n = (len - off) / sizeof(journal_record_t);
+    index->records = malloc((n ? n : 1) * sizeof(journal_record_t));
+    if (!index->records) {
+        perror("malloc failed");
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++) {
+        journal_record_t r;
+        memcpy(&r, data + off + i * sizeof(r), sizeof(r));
+        if (r.check == record_check(&r)) {
+            index->records[index->count++] = r;
+        }
+    }
+    free(data);
+    qsort(index->records, index->count, sizeof(journal_record_t), record_cmp);
+    return 0;
+}
+
+void journal_index_free(journal_index_t *index) {
+    free(index->records);
+    index->records = NULL;
+    index->count = 0;
+}
+
+// 第一条 path_hash 不小于 hash 的记录
+static size_t lower_bound(const journal_index_t *index, uint64_t hash) {
+    size_t lo = 0, hi = index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->records[mid].path_hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+const journal_record_t* journal_find(const journal_index_t *index, const journal_record_t *key) {
+    if (!index || index->count == 0) {
+        return NULL;
+    }
+    // 同一路径的记录中整文件记录排在最前
+    for (size_t i = lower_bound(index, key->path_hash);
+         i < index->count && index->records[i].path_hash == key->path_hash &&
+         index->records[i].offset == JOURNAL_WHOLE; i++) {
+        if (same_file(&index->records[i], key)) {
+            return &index->records[i];
+        }
+    }
+    return NULL;
+}
+
+int journal_ranges(const journal_index_t *index, const journal_record_t *key,
+                   journal_range_t **ranges) {
+    *ranges = NULL;
+    if (!index || index->count == 0) {
+        return 0;
+    }
+    size_t first = lower_bound(index, key->path_hash);
+    size_t last = first;
+    while (last < index->count && index->records[last].path_hash == key->path_hash) {
+        last++;
+    }
+    if (last == first) {
+        return 0;
+    }
+    journal_range_t *out = malloc((last - first) * sizeof(journal_range_t));
+    if (!out) {
+        perror("malloc failed");
+        exit(1);
+    }
+    // 记录已按 offset 排序；上次的分块大小可能与这次不同，只合并成区间，不按块对应
+    int n = 0;
+    for (size_t i = first; i < last; i++) {
+        const journal_record_t *r = &index->records[i];
+        if (r->offset < 0 || r->length <= 0 || !same_file(r, key)) {
+            continue;
+        }
+        if (n > 0 && r->offset <= out[n - 1].offset + out[n - 1].length) {
+            int64_t end = r->offset + r->length;
+            if (end > out[n - 1].offset + out[n - 1].length) {
+                out[n - 1].length = end - out[n - 1].offset;
+            }
+        } else {
+            out[n].offset = r->offset;
+            out[n].length = r->length;
+            n++;
+        }
+    }
+    if (n == 0) {
+        free(out);
+        return 0;
+    }
+    *ranges = out;
+    return n;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int journal_open(journal_t *journal, const char *file, const char *root) {
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = open(file, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (journal->fd < 0) {
+        return -1;
+    }
+    char *data;
+    size_t len;
+    if (read_all(journal->fd, &data, &len) != 0) {
+        close(journal->fd);
+        journal->fd = -1;
+        return -1;
+    }
+    size_t off = header_size(data, len, root);
+    free(data);
+
+    if (off == 0) {
+        // 不是同一源目录的日志，或根本没有：重新开始
+        size_t root_len = strlen(root);
+        size_t header_len = sizeof(journal_header_t) + align8(root_len);
+        char *header = calloc(1, header_len);
+        if (!header) {
+            perror("calloc failed");
+            exit(1);
+        }
+        journal_header_t *h = (journal_header_t *)header;
+        memcpy(h->magic, JOURNAL_MAGIC, sizeof(h->magic));
+        h->version = JOURNAL_VERSION;
+        h->root_len = root_len;
+        memcpy(header + sizeof(*h), root, root_len);
+        int rc = ftruncate(journal->fd, 0) == 0 ? write_all(journal->fd, header, header_len) : -1;
+        free(header);
+        if (rc != 0 || fdatasync(journal->fd) != 0) {
+            close(journal->fd);
+            journal->fd = -1;
+            return -1;
+        }
+    } else if ((len - off) % sizeof(journal_record_t) != 0) {
+        // 上次崩溃时最后一批只写了一部分：截掉，之后追加的记录才能对齐
+        size_t keep = off + (len - off) / sizeof(journal_record_t) * sizeof(journal_record_t);
+        if (ftruncate(journal->fd, keep) != 0) {
+            close(journal->fd);
+            journal->fd = -1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void journal_close(journal_t *journal) {
+    if (journal->fd >= 0) {
+        close(journal->fd);
+        journal->fd = -1;
+    }
+}
+
+void journal_writer_init(journal_writer_t *writer, journal_t *journal) {
+    writer->journal = journal;
+    writer->count = 0;
+    writer->first_ns = 0;
+}
+
+void journal_add(journal_writer_t *writer, const journal_record_t *record) {
+    if (writer->count == 0) {
+        writer->first_ns = now_ns();
+    }
+    journal_record_t *r = &writer->records[writer->count++];
+    *r = *record;
+    r->check = record_check(r);
+}
+
+int journal_due(const journal_writer_t *writer) {
+    return writer->count == JOURNAL_BATCH ||
+           (writer->count > 0 && now_ns() - writer->first_ns >= JOURNAL_FLUSH_NS);
+}
+
+int journal_flush(journal_writer_t *writer) {
+    if (writer->count == 0) {
+        return 0;
+    }
+    int fd = writer->journal->fd;
+    // 日志和目标在同一文件系统上，一次 syncfs 让这批记录对应的数据全部落盘
+    int rc = syncfs(fd);
+    if (rc == 0) {
+        rc = write_all(fd, writer->records, writer->count * sizeof(journal_record_t));
+    }
+    if (rc == 0) {
+        rc = fdatasync(fd);
+    }
+    __atomic_add_fetch(&writer->journal->flushes, 1, __ATOMIC_RELAXED);
+    writer->count = 0;
+    return rc;
+}
+
+void journal_discard(journal_writer_t *writer) {
+    writer->count = 0;
+}
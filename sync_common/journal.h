@@ -0,0 +1,85 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define JOURNAL_NAME ".file_sync.manifest.journal"   // 与清单同前缀，镜像模式不会删除
+#define JOURNAL_BATCH 256                            // 每个线程攒够这么多条记录写出一次
+#define JOURNAL_FLUSH_NS 2000000000LL                // 记录最多攒 2 秒
+#define JOURNAL_WHOLE (-1)                           // offset 取此值表示整个文件已完成
+
+// 一条完成记录：整个文件，或大文件中 [offset, offset + length) 这一段。
+// 文件以相对路径的 xxh64 标识，另记源文件的身份，源文件改过后记录作废
+typedef struct {
+    uint64_t path_hash;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint64_t content_hash;    // 整个文件的记录才有，0 表示没有
+    int64_t offset;
+    int64_t length;
+    uint64_t check;           // 以上字段的哈希，识别崩溃时写了一半的记录
+} journal_record_t;
+
+// 上次中断的运行留下的记录，按 (path_hash, offset) 排序
+typedef struct {
+    journal_record_t *records;
+    size_t count;
+} journal_index_t;
+
+// 一个文件已经完成的区间，按 offset 排序并合并相邻的区间
+typedef struct {
+    int64_t offset;
+    int64_t length;
+} journal_range_t;
+
+// 正在写的日志，各线程共享一个以 O_APPEND 打开的文件
+typedef struct {
+    int fd;
+    int flushes;
+} journal_t;
+
+// 每个线程一份，只由该线程使用
+typedef struct {
+    journal_t *journal;
+    int count;
+    int64_t first_ns;         // 最早一条未写出的记录加入的时间
+    journal_record_t records[JOURNAL_BATCH];
+} journal_writer_t;
+
+// 读取日志，root 为源目录，与日志中记录的不同或文件不存在时得到空索引。
+// 末尾写了一半或校验不对的记录丢弃。只有读出错才返回 -1
+int journal_load(journal_index_t *index, const char *file, const char *root);
+void journal_index_free(journal_index_t *index);
+
+// 相对路径的标识，与清单中的 path_hash 相同
+uint64_t journal_path_hash(const char *path, size_t len);
+
+// 查找与 key 的路径和源文件身份都相同的整文件记录
+const journal_record_t* journal_find(const journal_index_t *index, const journal_record_t *key);
+
+// 与 key 的路径和身份相同的分块记录合并成区间，写入 *ranges（调用者 free），返回区间数
+int journal_ranges(const journal_index_t *index, const journal_record_t *key,
+                   journal_range_t **ranges);
+
+// 打开日志准备追加：已有的日志属于同一源目录时接着写，否则重新开始。成功返回 0
+int journal_open(journal_t *journal, const char *file, const char *root);
+void journal_close(journal_t *journal);
+
+void journal_writer_init(journal_writer_t *writer, journal_t *journal);
+
+// 只放进缓冲区；journal_due 为真时调用者应当先让记录对应的数据落盘再 journal_flush
+void journal_add(journal_writer_t *writer, const journal_record_t *record);
+int journal_due(const journal_writer_t *writer);
+
+// 先 syncfs 让已复制的数据落盘，再追加记录并 fdatasync，保证记录不会先于数据。
+// 成功返回 0
+int journal_flush(journal_writer_t *writer);
+
+// 丢弃缓冲区中尚未写出的记录
+void journal_discard(journal_writer_t *writer);
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "manifest.h"
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MANIFEST_MAGIC "FSYNCMF1"
+#define MANIFEST_VERSION 2       // 2: 内容哈希改为 hash_fast64
+
+// 清单文件布局：文件头 | 源目录（补齐到 8 字节）| 记录数组 | 路径字符串区
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t root_len;
+    uint64_t count;
+    uint64_t paths_len;
+} manifest_header_t;
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+int manifest_open(manifest_t *manifest, const char *file, const char *root) {
+    memset(manifest, 0, sizeof(*manifest));
+
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(manifest_header_t)) {
+        close(fd);
+        return 0;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    // 任何一项对不上都当作没有清单，下次同步会重写
+    const manifest_header_t *header = map;
+    size_t root_len = strlen(root);
+    size_t entries_off = sizeof(*header) + align8(header->root_len);
+    if (memcmp(header->magic, MANIFEST_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != MANIFEST_VERSION ||
+        header->root_len != root_len ||
+        entries_off > (size_t)st.st_size ||
+        memcmp((const char *)map + sizeof(*header), root, root_len) != 0 ||
+        header->count > ((size_t)st.st_size - entries_off) / sizeof(manifest_entry_t) ||
+        entries_off + header->count * sizeof(manifest_entry_t) + header->paths_len != (size_t)st.st_size) {
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    manifest->map = map;
+    manifest->map_len = st.st_size;
+    manifest->entries = (const manifest_entry_t *)((const char *)map + entries_off);
+    manifest->count = header->count;
+    manifest->paths = (const char *)(manifest->entries + header->count);
+    return 0;
+}
+
+void manifest_close(manifest_t *manifest) {
+    if (manifest->map) {
+        munmap(manifest->map, manifest->map_len);
+    }
+    memset(manifest, 0, sizeof(*manifest));
+}
+
+// 按路径哈希二分查找，哈希相同的记录再比较路径
+const manifest_entry_t* manifest_lookup(const manifest_t *manifest, const char *path, size_t len) {
+    if (manifest->count == 0) {
+        return NULL;
+    }
+
+    uint64_t h = hash_xxh64(path, len, 0);
+    size_t lo = 0, hi = manifest->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (manifest->entries[mid].path_hash < h) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    size_t paths_len = (const char *)manifest->map + manifest->map_len - manifest->paths;
+    for (size_t i = lo; i < manifest->count && manifest->entries[i].path_hash == h; i++) {
+        const manifest_entry_t *e = &manifest->entries[i];
+        if (e->path_len == len && e->path_off <= paths_len && len <= paths_len - e->path_off &&
+            memcmp(manifest->paths + e->path_off, path, len) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+void manifest_builder_init(manifest_builder_t *builder) {
+    memset(builder, 0, sizeof(*builder));
+}
+
+void manifest_builder_free(manifest_builder_t *builder) {
+    free(builder->entries);
+    free(builder->paths);
+    memset(builder, 0, sizeof(*builder));
+}
+
+void manifest_builder_add(manifest_builder_t *builder, const char *path, size_t len,
+                          const manifest_entry_t *entry) {
+    if (builder->count == builder->capacity) {
+        builder->capacity = builder->capacity ? builder->capacity * 2 : 256;
+        builder->entries = realloc(builder->entries, builder->capacity * sizeof(manifest_entry_t));
+        if (!builder->entries) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    if (builder->paths_len + len > builder->paths_cap) {
+        size_t cap = builder->paths_cap ? builder->paths_cap : 16384;
+        while (cap < builder->paths_len + len) {
+            cap *= 2;
+        }
+        builder->paths = realloc(builder->paths, cap);
+        if (!builder->paths) {
+            perror("realloc failed");
+            exit(1);
+        }
+        builder->paths_cap = cap;
+    }
+
+    manifest_entry_t *e = &builder->entries[builder->count++];
+    *e = *entry;
+    e->path_hash = hash_xxh64(path, len, 0);
+    e->path_off = builder->paths_len;
+    e->path_len = len;
+    e->reserved = 0;
+    memcpy(builder->paths + builder->paths_len, path, len);
+    builder->paths_len += len;
+}
+
+static int hash_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+void manifest_builder_drop(manifest_builder_t *builder, uint64_t *hashes, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    qsort(hashes, n, sizeof(uint64_t), hash_cmp);
+    // 只压缩记录数组，被删记录的路径留在字符串区中，写清单时按偏移取用不受影响
+    size_t kept = 0;
+    for (size_t i = 0; i < builder->count; i++) {
+        if (!bsearch(&builder->entries[i].path_hash, hashes, n, sizeof(uint64_t), hash_cmp)) {
+            builder->entries[kept++] = builder->entries[i];
+        }
+    }
+    builder->count = kept;
+}
+
+static int entry_cmp(const void *a, const void *b) {
+    uint64_t x = ((const manifest_entry_t *)a)->path_hash;
+    uint64_t y = ((const manifest_entry_t *)b)->path_hash;
+    return x < y ? -1 : x > y;
+}
+
+// 多路归并用的小顶堆，元素为分片下标，按各分片当前记录的路径哈希比较
+typedef struct {
+    manifest_builder_t **parts;
+    size_t *cursor;
+    int *heap;
+    int size;
+} merge_heap_t;
+
+static uint64_t heap_key(const merge_heap_t *mh, int i) {
+    int part = mh->heap[i];
+    return mh->parts[part]->entries[mh->cursor[part]].path_hash;
+}
+
+static void heap_sift_down(merge_heap_t *mh, int i) {
+    for (;;) {
+        int smallest = i;
+        int l = 2 * i + 1, r = l + 1;
+        if (l < mh->size && heap_key(mh, l) < heap_key(mh, smallest)) smallest = l;
+        if (r < mh->size && heap_key(mh, r) < heap_key(mh, smallest)) smallest = r;
+        if (smallest == i) {
+            return;
+        }
+        int tmp = mh->heap[i];
+        mh->heap[i] = mh->heap[smallest];
+        mh->heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// 各分片先各自排序，再边归并边写出，不需要把所有记录复制到一起
+int manifest_write(const char *file, const char *root, manifest_builder_t **parts, int n) {
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", file) >= (int)sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    manifest_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.version = MANIFEST_VERSION;
+    header.root_len = strlen(root);
+
+    size_t *base = calloc(n + 1, sizeof(size_t));   // 各分片路径在字符串区中的起点
+    size_t *cursor = calloc(n + 1, sizeof(size_t));
+    int *heap = calloc(n + 1, sizeof(int));
+    if (!base || !cursor || !heap) {
+        perror("calloc failed");
+        exit(1);
+    }
+    merge_heap_t mh = {parts, cursor, heap, 0};
+    for (int i = 0; i < n; i++) {
+        qsort(parts[i]->entries, parts[i]->count, sizeof(manifest_entry_t), entry_cmp);
+        base[i] = header.paths_len;
+        header.count += parts[i]->count;
+        header.paths_len += parts[i]->paths_len;
+        if (parts[i]->count > 0) {
+            mh.heap[mh.size++] = i;
+        }
+    }
+    for (int i = mh.size / 2 - 1; i >= 0; i--) {
+        heap_sift_down(&mh, i);
+    }
+
+    FILE *fp = fopen(tmp, "wb");
+    int rc = fp ? 0 : -1;
+    if (fp) {
+        static const char pad[8];
+        fwrite(&header, sizeof(header), 1, fp);
+        fwrite(root, 1, header.root_len, fp);
+        fwrite(pad, 1, align8(header.root_len) - header.root_len, fp);
+
+        while (mh.size > 0) {
+            int part = mh.heap[0];
+            manifest_entry_t e = parts[part]->entries[cursor[part]++];
+            e.path_off += base[part];
+            fwrite(&e, sizeof(e), 1, fp);
+            if (cursor[part] == parts[part]->count) {
+                mh.heap[0] = mh.heap[--mh.size];
+            }
+            heap_sift_down(&mh, 0);
+        }
+        for (int i = 0; i < n; i++) {
+            fwrite(parts[i]->paths, 1, parts[i]->paths_len, fp);
+        }
+
+        if (ferror(fp)) {
+            rc = -1;
+        }
+        if (fclose(fp) != 0) {
+            rc = -1;
+        }
+        if (rc == 0 && rename(tmp, file) != 0) {
+            rc = -1;
+        }
+        if (rc != 0) {
+            int saved_errno = errno;
+            unlink(tmp);
+            errno = saved_errno;
+        }
+    }
+
+    free(base);
+    free(cursor);
+    free(heap);
+    return rc;
+}
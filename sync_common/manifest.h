@@ -0,0 +1,60 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define MANIFEST_NAME ".file_sync.manifest"   // 保存在目标根目录下
+#define MANIFEST_HASH_MAX (1024 * 1024)       // 不超过此大小的文件复制后记录内容哈希
+
+// 上次同步成功时源文件的状态，按 path_hash 排序存放
+typedef struct {
+    uint64_t path_hash;       // 相对路径的 xxh64
+    uint64_t path_off;        // 路径在字符串区中的偏移
+    uint32_t path_len;
+    uint32_t reserved;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint64_t content_hash;    // 0 表示没有记录
+} manifest_entry_t;
+
+// 只读映射的清单文件
+typedef struct {
+    void *map;
+    size_t map_len;
+    const manifest_entry_t *entries;
+    size_t count;
+    const char *paths;
+} manifest_t;
+
+// 写新清单时每个线程各自积累记录，最后合并，不需要加锁
+typedef struct {
+    manifest_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    char *paths;
+    size_t paths_len;
+    size_t paths_cap;
+} manifest_builder_t;
+
+// 映射清单文件，root 为源目录，与清单中记录的不同时当作空清单
+// 文件不存在或格式不对时也得到空清单，只有映射出错才返回 -1
+int manifest_open(manifest_t *manifest, const char *file, const char *root);
+void manifest_close(manifest_t *manifest);
+const manifest_entry_t* manifest_lookup(const manifest_t *manifest, const char *path, size_t len);
+
+void manifest_builder_init(manifest_builder_t *builder);
+void manifest_builder_free(manifest_builder_t *builder);
+// 添加一条记录，entry 中的路径字段由本函数填写
+void manifest_builder_add(manifest_builder_t *builder, const char *path, size_t len,
+                          const manifest_entry_t *entry);
+// 删除路径哈希在 hashes 中的记录（会对 hashes 排序），用于事后发现没有同步成功的文件
+void manifest_builder_drop(manifest_builder_t *builder, uint64_t *hashes, size_t n);
+
+// 合并各线程的记录，排序后写入临时文件再改名替换旧清单。成功返回 0
+int manifest_write(const char *file, const char *root, manifest_builder_t **parts, int n);
+
+#endif
@@ -0,0 +1,348 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+static const char *op_names[METRIC_OP_COUNT] = {"open", "stat", "compare", "copy", "utimes"};
+
+// 当前运行的统计，为 NULL 时所有记录函数立即返回
+static metrics_t *active;
+// 本线程领取的计数，tls_owner 不是 active 时说明是上一次运行的，需要重新领取
+static __thread metrics_thread_t *tls;
+static __thread metrics_t *tls_owner;
+
+int64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void metrics_init(metrics_t *m) {
+    memset(m, 0, sizeof(*m));
+    m->start_ns = metrics_now_ns();
+    m->last_mark_ns = m->start_ns;
+    __atomic_store_n(&active, m, __ATOMIC_RELEASE);
+}
+
+void metrics_free(metrics_t *m) {
+    if (m->progress_running) {
+        __atomic_store_n(&m->progress_stop, 1, __ATOMIC_RELAXED);
+        pthread_join(m->progress_thread, NULL);
+        m->progress_running = 0;
+    }
+    __atomic_store_n(&active, NULL, __ATOMIC_RELEASE);
+    int n = m->nthreads < METRICS_MAX_THREADS ? m->nthreads : METRICS_MAX_THREADS;
+    for (int i = 0; i < n; i++) {
+        free(m->threads[i]);
+        m->threads[i] = NULL;
+    }
+}
+
+// 本线程的计数，第一次调用时领取；线程数超过上限时返回 NULL，不再记录
+static metrics_thread_t* thread_slot(void) {
+    metrics_t *m = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+    if (!m) {
+        return NULL;
+    }
+    if (tls_owner == m) {
+        return tls;
+    }
+    tls_owner = m;
+    tls = NULL;
+    int idx = __atomic_fetch_add(&m->nthreads, 1, __ATOMIC_RELAXED);
+    if (idx < METRICS_MAX_THREADS) {
+        tls = calloc(1, sizeof(metrics_thread_t));
+        if (!tls) {
+            perror("calloc failed");
+            exit(1);
+        }
+        __atomic_store_n(&m->threads[idx], tls, __ATOMIC_RELEASE);
+    }
+    return tls;
+}
+
+// 对数线性分桶：小于 16 的值各占一格，之后每个 2 的幂区间分 16 格
+static int bucket_of(uint64_t v) {
+    if (v < (1u << METRICS_SUB_BITS)) {
+        return (int)v;
+    }
+    int exp = 63 - __builtin_clzll(v);
+    int sub = (int)(v >> (exp - METRICS_SUB_BITS)) & ((1 << METRICS_SUB_BITS) - 1);
+    return ((exp - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS) + sub;
+}
+
+// 分桶的代表值（区间中点）
+static uint64_t bucket_value(int b) {
+    if (b < (1 << METRICS_SUB_BITS)) {
+        return b;
+    }
+    int exp = (b >> METRICS_SUB_BITS) + METRICS_SUB_BITS - 1;
+    uint64_t sub = b & ((1 << METRICS_SUB_BITS) - 1);
+    uint64_t width = 1ULL << (exp - METRICS_SUB_BITS);
+    return (((1ULL << METRICS_SUB_BITS) + sub) << (exp - METRICS_SUB_BITS)) + width / 2;
+}
+
+int64_t metrics_start(void) {
+    return __atomic_load_n(&active, __ATOMIC_RELAXED) ? metrics_now_ns() : 0;
+}
+
+// 只有本线程写入，用原子存储只是为了让进度线程读到完整的值
+#define BUMP(field, delta) __atomic_store_n(&(field), (field) + (delta), __ATOMIC_RELAXED)
+
+void metrics_record(metric_op_t op, int64_t start) {
+    if (!start) {
+        return;
+    }
+    metrics_thread_t *t = thread_slot();
+    if (!t) {
+        return;
+    }
+    int64_t elapsed = metrics_now_ns() - start;
+    uint64_t ns = elapsed > 0 ? (uint64_t)elapsed : 0;
+    BUMP(t->count[op], 1);
+    BUMP(t->total_ns[op], ns);
+    BUMP(t->hist[op][bucket_of(ns)], 1);
+    if (ns > t->max_ns[op]) {
+        __atomic_store_n(&t->max_ns[op], ns, __ATOMIC_RELAXED);
+    }
+}
+
+void metrics_file_done(int64_t bytes) {
+    metrics_thread_t *t = thread_slot();
+    if (t) {
+        BUMP(t->files, 1);
+        BUMP(t->bytes, (uint64_t)bytes);
+    }
+}
+
+void metrics_add_bytes(int64_t bytes) {
+    metrics_thread_t *t = thread_slot();
+    if (t) {
+        BUMP(t->bytes, (uint64_t)bytes);
+    }
+}
+
+void metrics_add_found(int64_t files, int64_t bytes) {
+    metrics_t *m = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+    if (m) {
+        __atomic_add_fetch(&m->files_found, (uint64_t)files, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&m->bytes_found, (uint64_t)bytes, __ATOMIC_RELAXED);
+    }
+}
+
+void metrics_scan_done(void) {
+    metrics_t *m = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+    if (m) {
+        __atomic_store_n(&m->scan_done, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void metrics_mark(metrics_t *m, const char *phase) {
+    int64_t now = metrics_now_ns();
+    if (m->nmarks < METRICS_MAX_MARKS) {
+        m->mark_names[m->nmarks] = phase;
+        m->mark_ns[m->nmarks] = now - m->last_mark_ns;
+        m->nmarks++;
+    }
+    m->last_mark_ns = now;
+}
+
+// 汇总各线程的计数；hist 为 0 时只汇总文件数和字节数
+static void sum_threads(metrics_t *m, metrics_thread_t *sum, int hist) {
+    if (hist) {
+        memset(sum, 0, sizeof(*sum));
+    }
+    sum->files = sum->bytes = 0;
+    int n = __atomic_load_n(&m->nthreads, __ATOMIC_RELAXED);
+    n = n < METRICS_MAX_THREADS ? n : METRICS_MAX_THREADS;
+    for (int i = 0; i < n; i++) {
+        metrics_thread_t *t = __atomic_load_n(&m->threads[i], __ATOMIC_ACQUIRE);
+        if (!t) {
+            continue;
+        }
+        sum->files += __atomic_load_n(&t->files, __ATOMIC_RELAXED);
+        sum->bytes += __atomic_load_n(&t->bytes, __ATOMIC_RELAXED);
+        if (!hist) {
+            continue;
+        }
+        for (int op = 0; op < METRIC_OP_COUNT; op++) {
+            sum->count[op] += t->count[op];
+            sum->total_ns[op] += t->total_ns[op];
+            if (t->max_ns[op] > sum->max_ns[op]) {
+                sum->max_ns[op] = t->max_ns[op];
+            }
+            for (int b = 0; b < METRICS_BUCKETS; b++) {
+                sum->hist[op][b] += t->hist[op][b];
+            }
+        }
+    }
+}
+
+// 分位数 q（0-1）对应的延迟
+static uint64_t percentile(const metrics_thread_t *sum, int op, double q) {
+    uint64_t count = sum->count[op];
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * (double)count + 0.5);
+    rank = rank < 1 ? 1 : rank;
+    uint64_t seen = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        seen += sum->hist[op][b];
+        if (seen >= rank) {
+            uint64_t v = bucket_value(b);
+            return v < sum->max_ns[op] ? v : sum->max_ns[op];
+        }
+    }
+    return sum->max_ns[op];
+}
+
+static void format_eta(double seconds, char *buf, size_t size) {
+    if (seconds < 0 || seconds > 360000) {
+        snprintf(buf, size, "未知");
+    } else if (seconds >= 3600) {
+        snprintf(buf, size, "%d:%02d:%02d", (int)seconds / 3600, (int)seconds / 60 % 60,
+                 (int)seconds % 60);
+    } else {
+        snprintf(buf, size, "%d:%02d", (int)seconds / 60, (int)seconds % 60);
+    }
+}
+
+// 进度线程：按间隔汇总文件数和字节数，速率按上一个间隔计算，剩余时间按全程平均速率估计
+static void* progress_main(void *arg) {
+    metrics_t *m = arg;
+    metrics_thread_t sum;
+    uint64_t last_files = 0, last_bytes = 0;
+    int64_t last = m->start_ns;
+    int64_t next = last + (int64_t)m->progress_interval_ms * 1000000;
+    while (!__atomic_load_n(&m->progress_stop, __ATOMIC_RELAXED)) {
+        struct timespec ts = {0, 50 * 1000000};
+        nanosleep(&ts, NULL);
+        int64_t now = metrics_now_ns();
+        if (now < next) {
+            continue;
+        }
+        next = now + (int64_t)m->progress_interval_ms * 1000000;
+
+        sum_threads(m, &sum, 0);
+        uint64_t files_found = __atomic_load_n(&m->files_found, __ATOMIC_RELAXED);
+        uint64_t bytes_found = __atomic_load_n(&m->bytes_found, __ATOMIC_RELAXED);
+        int scanning = !__atomic_load_n(&m->scan_done, __ATOMIC_RELAXED);
+        double interval = (now - last) / 1e9;
+        double total = (now - m->start_ns) / 1e9;
+        double rate = total > 0 ? sum.bytes / total : 0;
+        double file_rate = total > 0 ? sum.files / total : 0;
+        double eta = -1;
+        if (bytes_found > sum.bytes && rate > 0) {
+            eta = (bytes_found - sum.bytes) / rate;
+        } else if (files_found > sum.files && file_rate > 0) {
+            eta = (files_found - sum.files) / file_rate;
+        } else if (files_found <= sum.files) {
+            eta = 0;
+        }
+        char eta_buf[32];
+        format_eta(eta, eta_buf, sizeof(eta_buf));
+        fprintf(stderr, "进度: %llu/%llu%s 文件, %.1f/%.1f%s MB, %.0f 文件/秒, %.1f MB/秒, 剩余 %s%s\n",
+                (unsigned long long)sum.files, (unsigned long long)files_found, scanning ? "+" : "",
+                sum.bytes / 1048576.0, bytes_found / 1048576.0, scanning ? "+" : "",
+                (sum.files - last_files) / interval, (sum.bytes - last_bytes) / 1048576.0 / interval,
+                eta_buf, scanning ? " (扫描中)" : "");
+        last_files = sum.files;
+        last_bytes = sum.bytes;
+        last = now;
+    }
+    return NULL;
+}
+
+int metrics_start_progress(metrics_t *m, int interval_ms) {
+    m->progress_interval_ms = interval_ms > 0 ? interval_ms : 1000;
+    if (pthread_create(&m->progress_thread, NULL, progress_main, m) != 0) {
+        return -1;
+    }
+    m->progress_running = 1;
+    return 0;
+}
+
+// 耗时总和最大的操作，用来判断慢在元数据、读还是写
+static int busiest_op(const metrics_thread_t *sum) {
+    int busiest = 0;
+    for (int op = 1; op < METRIC_OP_COUNT; op++) {
+        if (sum->total_ns[op] > sum->total_ns[busiest]) {
+            busiest = op;
+        }
+    }
+    return busiest;
+}
+
+void metrics_print(metrics_t *m, FILE *fp) {
+    metrics_thread_t *sum = malloc(sizeof(metrics_thread_t));
+    if (!sum) {
+        perror("malloc failed");
+        exit(1);
+    }
+    sum_threads(m, sum, 1);
+    fprintf(fp, "操作       次数       总耗时(ms)  平均(us)   p50(us)    p99(us)    最大(us)\n");
+    for (int op = 0; op < METRIC_OP_COUNT; op++) {
+        if (sum->count[op] == 0) {
+            continue;
+        }
+        fprintf(fp, "%-10s %-10llu %-11.1f %-10.1f %-10.1f %-10.1f %.1f\n", op_names[op],
+                (unsigned long long)sum->count[op], sum->total_ns[op] / 1e6,
+                sum->total_ns[op] / 1e3 / sum->count[op], percentile(sum, op, 0.5) / 1e3,
+                percentile(sum, op, 0.99) / 1e3, sum->max_ns[op] / 1e3);
+    }
+    for (int i = 0; i < m->nmarks; i++) {
+        fprintf(fp, "阶段 %s: %.3f 秒\n", m->mark_names[i], m->mark_ns[i] / 1e9);
+    }
+    free(sum);
+}
+
+int metrics_write_report(metrics_t *m, const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        return -1;
+    }
+    metrics_thread_t *sum = malloc(sizeof(metrics_thread_t));
+    if (!sum) {
+        perror("malloc failed");
+        exit(1);
+    }
+    sum_threads(m, sum, 1);
+    double elapsed = (metrics_now_ns() - m->start_ns) / 1e9;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"elapsed_s\": %.6f,\n", elapsed);
+    fprintf(fp, "  \"files_found\": %llu,\n", (unsigned long long)m->files_found);
+    fprintf(fp, "  \"files_done\": %llu,\n", (unsigned long long)sum->files);
+    fprintf(fp, "  \"bytes_done\": %llu,\n", (unsigned long long)sum->bytes);
+    fprintf(fp, "  \"files_per_s\": %.1f,\n", elapsed > 0 ? sum->files / elapsed : 0.0);
+    fprintf(fp, "  \"mb_per_s\": %.3f,\n", elapsed > 0 ? sum->bytes / 1048576.0 / elapsed : 0.0);
+    fprintf(fp, "  \"phases\": {");
+    for (int i = 0; i < m->nmarks; i++) {
+        fprintf(fp, "%s\n    \"%s\": %.6f", i ? "," : "", m->mark_names[i], m->mark_ns[i] / 1e9);
+    }
+    fprintf(fp, "%s},\n", m->nmarks ? "\n  " : "");
+    fprintf(fp, "  \"ops\": {");
+    for (int op = 0; op < METRIC_OP_COUNT; op++) {
+        uint64_t count = sum->count[op];
+        fprintf(fp, "%s\n    \"%s\": {\"count\": %llu, \"total_ms\": %.3f, \"mean_us\": %.3f, "
+                "\"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f}",
+                op ? "," : "", op_names[op], (unsigned long long)count, sum->total_ns[op] / 1e6,
+                count ? sum->total_ns[op] / 1e3 / count : 0.0, percentile(sum, op, 0.5) / 1e3,
+                percentile(sum, op, 0.9) / 1e3, percentile(sum, op, 0.99) / 1e3,
+                sum->max_ns[op] / 1e3);
+    }
+    fprintf(fp, "\n  },\n");
+    fprintf(fp, "  \"busiest_op\": \"%s\"\n", op_names[busiest_op(sum)]);
+    fprintf(fp, "}\n");
+    free(sum);
+
+    if (fclose(fp) != 0) {
+        return -1;
+    }
+    return 0;
+}
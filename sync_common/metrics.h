@@ -0,0 +1,89 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define METRICS_MAX_THREADS 256
+#define METRICS_SUB_BITS 4                      // 每个 2 的幂区间再分 16 格，误差约 6%
+#define METRICS_BUCKETS (64 << METRICS_SUB_BITS)
+#define METRICS_MAX_MARKS 16
+
+// 统计延迟的操作
+typedef enum {
+    METRIC_OPEN = 0,
+    METRIC_STAT,
+    METRIC_COMPARE,
+    METRIC_COPY,
+    METRIC_UTIMES,
+    METRIC_OP_COUNT
+} metric_op_t;
+
+// 每个线程一份，只由该线程写入，进度线程读取时不加锁
+typedef struct {
+    uint64_t count[METRIC_OP_COUNT];
+    uint64_t total_ns[METRIC_OP_COUNT];
+    uint64_t max_ns[METRIC_OP_COUNT];
+    uint64_t hist[METRIC_OP_COUNT][METRICS_BUCKETS];
+    uint64_t files;           // 处理完的文件数
+    uint64_t bytes;           // 处理完的字节数
+} metrics_thread_t;
+
+// 一次运行的统计：各线程第一次记录时领取自己的一份，之后只写自己的，不需要锁；
+// 汇总时把各线程的计数相加。总数由扫描线程随发现的文件累加
+typedef struct {
+    metrics_thread_t *threads[METRICS_MAX_THREADS];
+    int nthreads;
+    int64_t start_ns;
+    uint64_t files_found;
+    uint64_t bytes_found;
+    int scan_done;
+    int64_t last_mark_ns;
+    int nmarks;
+    const char *mark_names[METRICS_MAX_MARKS];
+    int64_t mark_ns[METRICS_MAX_MARKS];
+    int progress_interval_ms; // 0 表示不输出进度
+    int progress_stop;
+    int progress_running;
+    pthread_t progress_thread;
+} metrics_t;
+
+// 初始化并设为当前运行的统计；之后 metrics_start/metrics_record 才会计时
+void metrics_init(metrics_t *m);
+
+// 停止进度线程、释放各线程的计数，之后不再计时
+void metrics_free(metrics_t *m);
+
+int64_t metrics_now_ns(void);
+
+// 没有启用统计时返回 0，不读时钟
+int64_t metrics_start(void);
+
+// 记录一次操作从 start 到现在的耗时，start 为 0 时忽略
+void metrics_record(metric_op_t op, int64_t start);
+
+// 一个文件处理完成（同步、跳过或失败），bytes 为处理的数据量
+void metrics_file_done(int64_t bytes);
+
+// 大文件处理中途计入已处理的数据量，文件完成时不再重复计入
+void metrics_add_bytes(int64_t bytes);
+
+// 扫描发现了 files 个文件，其中需要处理的数据共 bytes 字节
+void metrics_add_found(int64_t files, int64_t bytes);
+void metrics_scan_done(void);
+
+// 记下一个阶段结束，耗时为上一个阶段结束（或开始）到现在
+void metrics_mark(metrics_t *m, const char *phase);
+
+// 每 interval_ms 毫秒向 stderr 输出一行进度（文件/秒、MB/秒、预计剩余时间）
+int metrics_start_progress(metrics_t *m, int interval_ms);
+
+// 各操作的次数和延迟分位数，写成可读的表格
+void metrics_print(metrics_t *m, FILE *fp);
+
+// 写出 JSON 报告：总数、吞吐、各阶段耗时和各操作的延迟分布。成功返回 0
+int metrics_write_report(metrics_t *m, const char *path);
+
+#endif
@@ -0,0 +1,235 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "throttle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+int64_t throttle_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int64_t throttle_parse_size(const char *s) {
+    char *end;
+    errno = 0;
+    double v = strtod(s, &end);
+    if (errno || end == s || v < 0) {
+        return -1;
+    }
+    switch (*end) {
+        case 'k': case 'K': v *= 1024; end++; break;
+        case 'm': case 'M': v *= 1024.0 * 1024; end++; break;
+        case 'g': case 'G': v *= 1024.0 * 1024 * 1024; end++; break;
+        default: break;
+    }
+    if (*end == 'B' || *end == 'b') {
+        end++;
+    }
+    return *end == '\0' ? (int64_t)v : -1;
+}
+
+int throttle_init(throttle_t *t, int64_t bytes_rate, int64_t ops_rate, int64_t max_latency_ms,
+                  const char *control_file) {
+    memset(t, 0, sizeof(*t));
+    t->bytes_rate = bytes_rate;
+    t->ops_rate = ops_rate;
+    t->max_latency_ns = max_latency_ms * 1000000;
+    t->control_file = control_file;
+    t->window_start = throttle_now_ns();
+    t->next_poll = t->window_start + THROTTLE_POLL_NS;
+    if (control_file) {
+        struct stat st;
+        if (stat(control_file, &st) == 0) {
+            t->control_mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+            return throttle_load(t, control_file);
+        }
+    }
+    return 0;
+}
+
+int throttle_active(const throttle_t *t) {
+    return t->bytes_rate > 0 || t->ops_rate > 0 || t->max_latency_ns > 0 || t->control_file;
+}
+
+// 控制文件中的每一项形如 key=value，以空白分隔，# 之后为注释；
+// 没有出现的项保持不变，值为 0 表示取消该项限制
+int throttle_load(throttle_t *t, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+    int64_t bytes_rate = __atomic_load_n(&t->bytes_rate, __ATOMIC_RELAXED);
+    int64_t ops_rate = __atomic_load_n(&t->ops_rate, __ATOMIC_RELAXED);
+    int64_t max_latency_ns = __atomic_load_n(&t->max_latency_ns, __ATOMIC_RELAXED);
+    int rc = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char *save;
+        for (char *tok = strtok_r(line, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save)) {
+            char *eq = strchr(tok, '=');
+            if (!eq) {
+                rc = -1;
+                continue;
+            }
+            *eq = '\0';
+            int64_t v = throttle_parse_size(eq + 1);
+            if (v < 0) {
+                rc = -1;
+            } else if (strcasecmp(tok, "bwlimit") == 0) {
+                bytes_rate = v;
+            } else if (strcasecmp(tok, "iops") == 0) {
+                ops_rate = v;
+            } else if (strcasecmp(tok, "max-latency") == 0) {
+                max_latency_ns = v * 1000000;
+            } else {
+                rc = -1;
+            }
+        }
+    }
+    fclose(fp);
+
+    // 新的限制立即生效：丢掉按旧速率排下的等待和自适应降速
+    __atomic_store_n(&t->bytes_rate, bytes_rate, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->ops_rate, ops_rate, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->max_latency_ns, max_latency_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->adaptive_rate, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->byte_tat, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->op_tat, 0, __ATOMIC_RELAXED);
+    if (rc != 0) {
+        fprintf(stderr, "警告: 限速控制文件中有无法识别的项: %s\n", path);
+    }
+    return rc;
+}
+
+void throttle_request_reload(throttle_t *t) {
+    __atomic_store_n(&t->reload, 1, __ATOMIC_RELAXED);
+}
+
+// 收到信号或到了检查时间时，由一个线程检查控制文件，其余线程不等待
+static void throttle_poll(throttle_t *t, int64_t now) {
+    if (!t->control_file) {
+        return;
+    }
+    int reload = __atomic_load_n(&t->reload, __ATOMIC_RELAXED);
+    if (!reload && now < __atomic_load_n(&t->next_poll, __ATOMIC_RELAXED)) {
+        return;
+    }
+    if (__atomic_exchange_n(&t->reloading, 1, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    __atomic_store_n(&t->reload, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->next_poll, now + THROTTLE_POLL_NS, __ATOMIC_RELAXED);
+    struct stat st;
+    if (stat(t->control_file, &st) == 0) {
+        int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        if (reload || mtime != t->control_mtime) {
+            t->control_mtime = mtime;
+            throttle_load(t, t->control_file);
+        }
+    }
+    __atomic_store_n(&t->reloading, 0, __ATOMIC_RELEASE);
+}
+
+// 从桶中取 units 个单位，返回需要等待的纳秒数。rate 为 0 时不限
+static int64_t bucket_take(int64_t *tat, int64_t rate, int64_t units, int64_t now) {
+    if (rate <= 0 || units <= 0) {
+        return 0;
+    }
+    int64_t cost = (int64_t)((double)units * 1e9 / (double)rate);
+    int64_t old = __atomic_load_n(tat, __ATOMIC_RELAXED);
+    int64_t next;
+    do {
+        // 桶空闲时从当前时间算起，积累的配额最多为突发量
+        next = (old > now ? old : now) + cost;
+    } while (!__atomic_compare_exchange_n(tat, &old, next, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    int64_t wait = next - now - THROTTLE_BURST_NS;
+    return wait > 0 ? wait : 0;
+}
+
+void throttle_acquire(throttle_t *t, int64_t bytes, int ops) {
+    if (!t) {
+        return;
+    }
+    int64_t now = throttle_now_ns();
+    throttle_poll(t, now);
+
+    int64_t rate = __atomic_load_n(&t->bytes_rate, __ATOMIC_RELAXED);
+    int64_t adaptive = __atomic_load_n(&t->adaptive_rate, __ATOMIC_RELAXED);
+    if (adaptive > 0 && (rate <= 0 || adaptive < rate)) {
+        rate = adaptive;
+    }
+    int64_t wait = bucket_take(&t->byte_tat, rate, bytes, now);
+    int64_t op_wait = bucket_take(&t->op_tat, __atomic_load_n(&t->ops_rate, __ATOMIC_RELAXED),
+                                  ops, now);
+    if (op_wait > wait) {
+        wait = op_wait;
+    }
+    if (wait > 0) {
+        __atomic_add_fetch(&t->waited_ns, wait, __ATOMIC_RELAXED);
+        struct timespec ts = {wait / 1000000000, wait % 1000000000};
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+        }
+    }
+}
+
+void throttle_report(throttle_t *t, int64_t bytes, int64_t latency_ns) {
+    if (!t) {
+        return;
+    }
+    int64_t now = throttle_now_ns();
+    __atomic_add_fetch(&t->window_bytes, bytes, __ATOMIC_RELAXED);
+    int64_t start = __atomic_load_n(&t->window_start, __ATOMIC_RELAXED);
+    if (now - start >= THROTTLE_WINDOW_NS &&
+        __atomic_compare_exchange_n(&t->window_start, &start, now, 0, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+        int64_t window = __atomic_exchange_n(&t->window_bytes, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&t->observed_rate,
+                         (int64_t)((double)window * 1e9 / (double)(now - start)), __ATOMIC_RELAXED);
+    }
+
+    int64_t max_latency = __atomic_load_n(&t->max_latency_ns, __ATOMIC_RELAXED);
+    if (max_latency <= 0) {
+        return;
+    }
+    // 每个窗口最多调整一次，避免同一阵拥塞被多个线程重复减半
+    int64_t last = __atomic_load_n(&t->last_adjust, __ATOMIC_RELAXED);
+    if (now - last < THROTTLE_WINDOW_NS) {
+        return;
+    }
+    int64_t current = __atomic_load_n(&t->adaptive_rate, __ATOMIC_RELAXED);
+    int64_t limit = __atomic_load_n(&t->bytes_rate, __ATOMIC_RELAXED);
+    if (latency_ns > max_latency) {
+        int64_t base = current > 0 ? current
+                     : limit > 0 ? limit : __atomic_load_n(&t->observed_rate, __ATOMIC_RELAXED);
+        if (base <= 0 || !__atomic_compare_exchange_n(&t->last_adjust, &last, now, 0,
+                                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return;
+        }
+        if (current == 0 && limit <= 0) {
+            __atomic_store_n(&t->backoff_from, base, __ATOMIC_RELAXED);
+        }
+        int64_t next = base / 2 < THROTTLE_MIN_RATE ? THROTTLE_MIN_RATE : base / 2;
+        __atomic_store_n(&t->adaptive_rate, next, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&t->backoffs, 1, __ATOMIC_RELAXED);
+    } else if (current > 0 && latency_ns < max_latency / 2) {
+        if (!__atomic_compare_exchange_n(&t->last_adjust, &last, now, 0,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return;
+        }
+        // 延迟恢复后每个窗口加回 1/8，回到原来的上限时解除
+        int64_t next = current + current / 8;
+        int64_t ceiling = limit > 0 ? limit : __atomic_load_n(&t->backoff_from, __ATOMIC_RELAXED);
+        __atomic_store_n(&t->adaptive_rate, next >= ceiling ? 0 : next, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define THROTTLE_BURST_NS 100000000LL      // 空闲后允许的突发量：100ms 的配额
+#define THROTTLE_WINDOW_NS 200000000LL     // 自适应调整和吞吐估计的最短间隔
+#define THROTTLE_MIN_RATE (256 * 1024)     // 自适应降速的下限（字节/秒）
+#define THROTTLE_POLL_NS 1000000000LL      // 检查控制文件是否修改的间隔
+
+// 令牌桶限速，所有工作线程共享，取令牌只用原子操作不加锁。
+// 每个桶记一个"理论到达时间"（GCRA）：取 n 个单位就把它推后 n / rate 秒，
+// 推到当前时间加突发量之后的部分就是调用者需要等待的时间。
+// 自适应模式下，单批写入延迟超过阈值时有效速率减半，延迟恢复后逐步加回（AIMD）
+typedef struct {
+    int64_t bytes_rate;       // 配置的字节/秒上限，0 表示不限
+    int64_t ops_rate;         // 配置的读写批次/秒上限，0 表示不限
+    int64_t max_latency_ns;   // 自适应阈值，0 表示不启用
+    int64_t adaptive_rate;    // 自适应后的字节/秒上限，0 表示没有降速
+    int64_t backoff_from;     // 未配置上限时第一次降速前估计的吞吐，加回到它之上即解除
+    int64_t byte_tat;
+    int64_t op_tat;
+    int64_t window_start;     // 当前吞吐统计窗口
+    int64_t window_bytes;
+    int64_t observed_rate;    // 最近一个窗口的吞吐
+    int64_t last_adjust;
+    int64_t next_poll;
+    int64_t control_mtime;
+    int64_t waited_ns;        // 统计：各线程等待令牌的总时间
+    int backoffs;             // 统计：自适应降速次数
+    int reload;               // 收到信号后置位，下一次取令牌时重新读取控制文件
+    int reloading;
+    const char *control_file; // 控制文件，内容形如 bwlimit=10M iops=500 max-latency=50
+} throttle_t;
+
+// 初始化，control_file 可以为 NULL；控制文件存在时其中的值覆盖参数。成功返回 0
+int throttle_init(throttle_t *t, int64_t bytes_rate, int64_t ops_rate, int64_t max_latency_ms,
+                  const char *control_file);
+
+// 是否设置了任何限制
+int throttle_active(const throttle_t *t);
+
+// 读写 bytes 字节、ops 个批次之前调用，超出配额时睡眠到轮到自己。t 为 NULL 时立即返回
+void throttle_acquire(throttle_t *t, int64_t bytes, int ops);
+
+// 一批写入完成后报告耗时，自适应模式据此调整速率
+void throttle_report(throttle_t *t, int64_t bytes, int64_t latency_ns);
+
+// 请求重新读取控制文件，可以在信号处理函数中调用
+void throttle_request_reload(throttle_t *t);
+
+// 读取控制文件更新限制，成功返回 0
+int throttle_load(throttle_t *t, const char *path);
+
+// 解析 10M、512K、1G 之类的大小，出错返回 -1
+int64_t throttle_parse_size(const char *s);
+
+int64_t throttle_now_ns(void);
+
+#endif
@@ -0,0 +1,488 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "uring_copy.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+// 每个槽对应一个正在复制的文件，依次经过
+// 打开源 -> 打开（截断）目标 -> 读/写循环 -> 关闭两个 fd。
+// 源打开成功后才打开目标，源打不开时目标保持原样
+enum {
+    SLOT_FREE = 0,
+    SLOT_OPEN,
+    SLOT_COPY,
+    SLOT_CLOSE
+};
+
+// user_data 低 8 位为操作类型，其余为槽号
+enum {
+    OP_OPEN_SRC = 1,
+    OP_OPEN_DST,
+    OP_READ,
+    OP_WRITE,
+    OP_CLOSE
+};
+
+typedef struct {
+    int state;
+    int pending;              // 在途的请求数
+    int err;
+    int src_fd;
+    int dst_fd;
+    off_t offset;             // 缓冲区数据在文件中的偏移
+    size_t buf_len;           // 缓冲区中读到的字节数
+    size_t buf_done;          // 其中已写入的字节数
+    int reads;                // 读到数据的次数，为 1 时缓冲区就是整个文件
+    int eof;                  // 最后一次读不满，写完后即可关闭
+    mode_t mode;              // 新建目标时的权限
+    void *user;
+    char src[PATH_MAX];
+    char dst[PATH_MAX];
+} slot_t;
+
+struct uring_copy {
+    int ring_fd;
+    unsigned depth;
+    uring_copy_done_fn done;
+
+    void *sq_ring;
+    size_t sq_ring_len;
+    void *cq_ring;
+    size_t cq_ring_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;       // 已填好、尚未交给内核的请求数
+
+    unsigned char *buffers;
+    int fixed;                // 缓冲区注册成功，读写使用 READ_FIXED/WRITE_FIXED
+    slot_t *slots;
+    int *free_slots;
+    unsigned free_count;
+    unsigned active;
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// 确认内核支持用到的操作（OPENAT/CLOSE 需要 5.6 以上）
+static int probe_ops(int ring_fd) {
+    static const int needed[] = {
+        IORING_OP_OPENAT, IORING_OP_CLOSE, IORING_OP_READ, IORING_OP_WRITE,
+        IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED
+    };
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    if (!probe) {
+        return -1;
+    }
+    int ok = sys_register(ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; ok && i < sizeof(needed) / sizeof(needed[0]); i++) {
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    if (!ok) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    return 0;
+}
+
+static int map_rings(uring_copy_t *uc, const struct io_uring_params *p) {
+    uc->sq_ring_len = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    uc->cq_ring_len = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (uc->cq_ring_len > uc->sq_ring_len) {
+            uc->sq_ring_len = uc->cq_ring_len;
+        }
+        uc->cq_ring_len = 0;
+    }
+
+    uc->sq_ring = mmap(NULL, uc->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       uc->ring_fd, IORING_OFF_SQ_RING);
+    if (uc->sq_ring == MAP_FAILED) {
+        uc->sq_ring = NULL;
+        return -1;
+    }
+    if (uc->cq_ring_len) {
+        uc->cq_ring = mmap(NULL, uc->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           uc->ring_fd, IORING_OFF_CQ_RING);
+        if (uc->cq_ring == MAP_FAILED) {
+            uc->cq_ring = NULL;
+            return -1;
+        }
+    } else {
+        uc->cq_ring = uc->sq_ring;
+    }
+    uc->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+    uc->sqes = mmap(NULL, uc->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    uc->ring_fd, IORING_OFF_SQES);
+    if (uc->sqes == MAP_FAILED) {
+        uc->sqes = NULL;
+        return -1;
+    }
+
+    char *sq = uc->sq_ring;
+    char *cq = uc->cq_ring;
+    uc->sq_head = (unsigned *)(sq + p->sq_off.head);
+    uc->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+    uc->sq_mask = (unsigned *)(sq + p->sq_off.ring_mask);
+    uc->sq_array = (unsigned *)(sq + p->sq_off.array);
+    uc->cq_head = (unsigned *)(cq + p->cq_off.head);
+    uc->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+    uc->cq_mask = (unsigned *)(cq + p->cq_off.ring_mask);
+    uc->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+    return 0;
+}
+
+static void release(uring_copy_t *uc) {
+    if (uc->sqes) munmap(uc->sqes, uc->sqes_len);
+    if (uc->cq_ring && uc->cq_ring != uc->sq_ring) munmap(uc->cq_ring, uc->cq_ring_len);
+    if (uc->sq_ring) munmap(uc->sq_ring, uc->sq_ring_len);
+    if (uc->ring_fd >= 0) close(uc->ring_fd);
+    if (uc->buffers) munmap(uc->buffers, (size_t)uc->depth * URING_COPY_BUFFER);
+    free(uc->slots);
+    free(uc->free_slots);
+    free(uc);
+}
+
+uring_copy_t* uring_copy_create(unsigned depth, uring_copy_done_fn done) {
+    uring_copy_t *uc = calloc(1, sizeof(*uc));
+    if (!uc) {
+        return NULL;
+    }
+    uc->ring_fd = -1;
+    uc->depth = depth;
+    uc->done = done;
+
+    // 每个文件最多同时有两个请求在途（关闭源和目标），提交队列不会溢出
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uc->ring_fd = sys_setup(depth * 2, &params);
+    int saved_errno;
+    if (uc->ring_fd < 0 || probe_ops(uc->ring_fd) < 0 || map_rings(uc, &params) < 0) {
+        goto fail;
+    }
+
+    uc->slots = calloc(depth, sizeof(slot_t));
+    uc->free_slots = malloc(depth * sizeof(int));
+    uc->buffers = mmap(NULL, (size_t)depth * URING_COPY_BUFFER, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (uc->buffers == MAP_FAILED) {
+        uc->buffers = NULL;
+    }
+    if (!uc->slots || !uc->free_slots || !uc->buffers) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    for (unsigned i = 0; i < depth; i++) {
+        uc->free_slots[i] = depth - 1 - i;
+    }
+    uc->free_count = depth;
+
+    // 注册缓冲区省去每次读写时的页面映射；受 RLIMIT_MEMLOCK 限制失败时用普通读写
+    struct iovec *iov = malloc(depth * sizeof(struct iovec));
+    if (iov) {
+        for (unsigned i = 0; i < depth; i++) {
+            iov[i].iov_base = uc->buffers + (size_t)i * URING_COPY_BUFFER;
+            iov[i].iov_len = URING_COPY_BUFFER;
+        }
+        uc->fixed = sys_register(uc->ring_fd, IORING_REGISTER_BUFFERS, iov, depth) == 0;
+        free(iov);
+    }
+    return uc;
+
+fail:
+    saved_errno = errno;
+    release(uc);
+    errno = saved_errno;
+    return NULL;
+}
+
+static struct io_uring_sqe* get_sqe(uring_copy_t *uc, int slot, int op) {
+    unsigned tail = *uc->sq_tail;
+    unsigned idx = tail & *uc->sq_mask;
+    struct io_uring_sqe *sqe = &uc->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = ((uint64_t)slot << 8) | op;
+    uc->sq_array[idx] = idx;
+    __atomic_store_n(uc->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uc->to_submit++;
+    uc->slots[slot].pending++;
+    return sqe;
+}
+
+static unsigned char* slot_buffer(uring_copy_t *uc, int slot) {
+    return uc->buffers + (size_t)slot * URING_COPY_BUFFER;
+}
+
+static void queue_open(uring_copy_t *uc, int slot, const char *path, int flags, mode_t mode, int op) {
+    struct io_uring_sqe *sqe = get_sqe(uc, slot, op);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->len = mode;
+    sqe->open_flags = flags | O_CLOEXEC;
+}
+
+static void queue_rw(uring_copy_t *uc, int slot, int op) {
+    slot_t *s = &uc->slots[slot];
+    struct io_uring_sqe *sqe = get_sqe(uc, slot, op);
+    unsigned char *buf = slot_buffer(uc, slot);
+    if (op == OP_READ) {
+        sqe->opcode = uc->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = s->src_fd;
+        sqe->addr = (uint64_t)(uintptr_t)buf;
+        sqe->len = URING_COPY_BUFFER;
+        sqe->off = s->offset;
+    } else {
+        sqe->opcode = uc->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = s->dst_fd;
+        sqe->addr = (uint64_t)(uintptr_t)(buf + s->buf_done);
+        sqe->len = s->buf_len - s->buf_done;
+        sqe->off = s->offset + s->buf_done;
+    }
+    if (uc->fixed) {
+        sqe->buf_index = slot;
+    }
+}
+
+// 关闭已打开的 fd；都没打开时直接结束
+static void queue_close(uring_copy_t *uc, int slot) {
+    slot_t *s = &uc->slots[slot];
+    s->state = SLOT_CLOSE;
+    int *fds[2] = {&s->src_fd, &s->dst_fd};
+    for (int i = 0; i < 2; i++) {
+        if (*fds[i] >= 0) {
+            struct io_uring_sqe *sqe = get_sqe(uc, slot, OP_CLOSE);
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = *fds[i];
+            *fds[i] = -1;
+        }
+    }
+}
+
+static void finish(uring_copy_t *uc, int slot) {
+    slot_t *s = &uc->slots[slot];
+    const void *data = (!s->err && s->reads <= 1) ? slot_buffer(uc, slot) : NULL;
+    size_t len = s->reads == 1 ? s->buf_len : 0;
+    s->state = SLOT_FREE;
+    uc->free_slots[uc->free_count++] = slot;
+    uc->active--;
+    uc->done(s->user, s->err, data, len);
+}
+
+// 处理一个完成事件，推进对应文件的状态
+static void handle_cqe(uring_copy_t *uc, uint64_t user_data, int res) {
+    int slot = (int)(user_data >> 8);
+    int op = (int)(user_data & 0xff);
+    slot_t *s = &uc->slots[slot];
+    s->pending--;
+
+    switch (op) {
+        case OP_OPEN_SRC:
+            if (res < 0) {
+                s->err = -res;
+                queue_close(uc, slot);
+            } else {
+                s->src_fd = res;
+                queue_open(uc, slot, s->dst, O_WRONLY | O_CREAT | O_TRUNC, s->mode, OP_OPEN_DST);
+            }
+            break;
+
+        case OP_OPEN_DST:
+            if (res < 0) {
+                s->err = -res;
+                queue_close(uc, slot);
+            } else {
+                s->dst_fd = res;
+                s->state = SLOT_COPY;
+                queue_rw(uc, slot, OP_READ);
+            }
+            break;
+
+        case OP_READ:
+            if (res < 0) {
+                s->err = -res;
+                queue_close(uc, slot);
+            } else if (res == 0) {
+                queue_close(uc, slot);
+            } else {
+                s->buf_len = res;
+                s->buf_done = 0;
+                s->reads++;
+                s->eof = res < URING_COPY_BUFFER;
+                queue_rw(uc, slot, OP_WRITE);
+            }
+            break;
+
+        case OP_WRITE:
+            if (res <= 0) {
+                s->err = res < 0 ? -res : EIO;
+                queue_close(uc, slot);
+                break;
+            }
+            s->buf_done += res;
+            if (s->buf_done < s->buf_len) {
+                queue_rw(uc, slot, OP_WRITE);
+            } else if (s->eof) {
+                // 普通文件读不满即为文件尾，省去一次返回 0 的读
+                queue_close(uc, slot);
+            } else {
+                s->offset += s->buf_len;
+                queue_rw(uc, slot, OP_READ);
+            }
+            break;
+
+        case OP_CLOSE:
+            if (res < 0 && !s->err) {
+                s->err = -res;
+            }
+            break;
+    }
+
+    if (s->state == SLOT_CLOSE && s->pending == 0) {
+        finish(uc, slot);
+    }
+}
+
+// 提交已填好的请求，wait 非 0 时至少等到一个完成事件，然后处理所有完成事件
+static int submit_and_reap(uring_copy_t *uc, int wait) {
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    if (uc->to_submit > 0 || wait) {
+        int n = sys_enter(uc->ring_fd, uc->to_submit, wait ? 1 : 0, flags);
+        if (n < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                return -1;
+            }
+        } else {
+            uc->to_submit -= n;
+        }
+    }
+
+    unsigned head = *uc->cq_head;
+    unsigned tail = __atomic_load_n(uc->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &uc->cqes[head & *uc->cq_mask];
+        uint64_t user_data = cqe->user_data;
+        int res = cqe->res;
+        head++;
+        __atomic_store_n(uc->cq_head, head, __ATOMIC_RELEASE);
+        handle_cqe(uc, user_data, res);
+        tail = __atomic_load_n(uc->cq_tail, __ATOMIC_ACQUIRE);
+    }
+    return 0;
+}
+
+int uring_copy_add(uring_copy_t *uc, const char *src, const char *dst, mode_t mode, void *user) {
+    if (strlen(src) >= PATH_MAX || strlen(dst) >= PATH_MAX) {
+        uc->done(user, ENAMETOOLONG, NULL, 0);
+        return 0;
+    }
+    while (uc->free_count == 0) {
+        if (submit_and_reap(uc, 1) < 0) {
+            return -1;
+        }
+    }
+
+    int slot = uc->free_slots[--uc->free_count];
+    slot_t *s = &uc->slots[slot];
+    s->state = SLOT_OPEN;
+    s->pending = 0;
+    s->err = 0;
+    s->src_fd = -1;
+    s->dst_fd = -1;
+    s->offset = 0;
+    s->buf_len = 0;
+    s->buf_done = 0;
+    s->reads = 0;
+    s->eof = 0;
+    s->mode = mode;
+    s->user = user;
+    strcpy(s->src, src);
+    strcpy(s->dst, dst);
+    uc->active++;
+
+    queue_open(uc, slot, s->src, O_RDONLY, 0, OP_OPEN_SRC);
+    // 凑够一批再提交，减少系统调用次数。请求已经排进队列，
+    // 这里提交失败也不能报告给调用者（user 此后归环所有），留给下次提交或 drain
+    if (uc->to_submit >= uc->depth / 2) {
+        submit_and_reap(uc, 0);
+    }
+    return 0;
+}
+
+int uring_copy_drain(uring_copy_t *uc) {
+    while (uc->active > 0) {
+        if (submit_and_reap(uc, 1) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void uring_copy_destroy(uring_copy_t *uc) {
+    if (!uc) {
+        return;
+    }
+    uring_copy_drain(uc);
+    release(uc);
+}
+
+#else
+
+// 没有 io_uring 的平台：创建总是失败，调用者使用 copy_fd
+
+uring_copy_t* uring_copy_create(unsigned depth, uring_copy_done_fn done) {
+    (void)depth;
+    (void)done;
+    errno = ENOSYS;
+    return NULL;
+}
+
+void uring_copy_destroy(uring_copy_t *uc) {
+    (void)uc;
+}
+
+int uring_copy_add(uring_copy_t *uc, const char *src, const char *dst, mode_t mode, void *user) {
+    (void)uc;
+    (void)src;
+    (void)dst;
+    (void)mode;
+    (void)user;
+    errno = ENOSYS;
+    return -1;
+}
+
+int uring_copy_drain(uring_copy_t *uc) {
+    (void)uc;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef URING_COPY_H
+#define URING_COPY_H
+
+#include <sys/types.h>
+#include <stddef.h>
+
+#define URING_COPY_DEPTH  128          // 同时在途的文件数
+#define URING_COPY_BUFFER (64 * 1024)  // 每个文件槽的注册缓冲区大小
+
+// 一个文件复制结束时调用，err 为 0 表示成功，否则为 errno
+// 整个文件一次就读完时 data/len 为其内容（可用于计算哈希），否则 data 为 NULL
+typedef void (*uring_copy_done_fn)(void *user, int err, const void *data, size_t len);
+
+// 基于 io_uring 的批量复制：打开、读、写、关闭都异步提交，
+// 单个线程可以让许多文件的 I/O 同时在途。只能由创建它的线程使用，
+// 完成回调也在该线程中（uring_copy_add/uring_copy_drain 内）调用
+typedef struct uring_copy uring_copy_t;
+
+// 创建 io_uring 实例并注册缓冲区。内核不支持或被禁用时返回 NULL 并设置 errno，
+// 调用者应改用 copy_fd
+uring_copy_t* uring_copy_create(unsigned depth, uring_copy_done_fn done);
+
+// 等待所有在途文件完成后释放
+void uring_copy_destroy(uring_copy_t *uc);
+
+// 把 src 复制到 dst（新建或截断，权限为 mode），路径会被复制保存
+// 没有空闲槽时先处理完成事件。返回 0 表示已排入队列，user 在 done 调用之前归环所有，
+// 调用者不能释放；等待空闲槽时 io_uring 本身出错返回 -1，这时什么都没有排队
+int uring_copy_add(uring_copy_t *uc, const char *src, const char *dst, mode_t mode, void *user);
+
+// 等待所有在途文件完成，成功返回 0
+int uring_copy_drain(uring_copy_t *uc);
+
+#endif
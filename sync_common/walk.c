@@ -0,0 +1,356 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "walk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// 待遍历或正在遍历的目录
+// 打开之前持有父目录的引用，保证父目录 fd 在 openat 时仍然有效
+typedef struct walk_dir {
+    struct walk_dir *parent;
+    struct walk_dir *next;    // 待遍历栈
+    int fd;
+    int refs;                 // 自己一个，尚未打开的子目录各一个
+    void *data;
+    const char *name;
+    size_t path_len;
+    char path[];              // 相对路径，之后是 name（根目录时）
+} walk_dir_t;
+
+typedef struct {
+    const walk_options_t *opts;
+    walk_dir_t *stack;
+    int active;               // 正在处理目录的线程数
+    int stopped;
+    int root_err;
+    int next_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} walker_t;
+
+// 每个遍历线程的缓冲区
+typedef struct {
+    int thread;
+    char *dents;
+    char path[PATH_MAX];
+} walk_thread_t;
+
+static walk_dir_t* dir_new(walk_dir_t *parent, const char *path, size_t path_len,
+                           const char *root, void *data) {
+    size_t root_len = root ? strlen(root) + 1 : 0;
+    walk_dir_t *d = malloc(sizeof(walk_dir_t) + path_len + 1 + root_len);
+    if (!d) {
+        perror("malloc failed");
+        exit(1);
+    }
+    d->parent = parent;
+    d->next = NULL;
+    d->fd = -1;
+    d->refs = 1;
+    d->data = data;
+    d->path_len = path_len;
+    memcpy(d->path, path, path_len);
+    d->path[path_len] = '\0';
+    if (root) {
+        d->name = memcpy(d->path + path_len + 1, root, root_len);
+    } else {
+        const char *slash = strrchr(d->path, '/');
+        d->name = slash ? slash + 1 : d->path;
+    }
+    if (parent) {
+        __atomic_add_fetch(&parent->refs, 1, __ATOMIC_RELAXED);
+    }
+    return d;
+}
+
+// 最后一个引用释放时关闭 fd，父目录的引用在打开时已经释放
+static void dir_put(walk_dir_t *d) {
+    if (__atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (d->fd >= 0) {
+            close(d->fd);
+        }
+        free(d);
+    }
+}
+
+static void push_dir(walker_t *w, walk_dir_t *d) {
+    pthread_mutex_lock(&w->lock);
+    d->next = w->stack;
+    w->stack = d;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+// 目录项读取：Linux 上直接用 getdents64 一次读入一大批，其他系统用 readdir
+typedef struct {
+#ifdef __linux__
+    int fd;
+    char *buf;
+    long len;
+    long pos;
+#else
+    DIR *dir;
+#endif
+} dent_reader_t;
+
+#ifdef __linux__
+struct walk_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static int reader_open(dent_reader_t *r, int fd, char *buf) {
+    r->fd = fd;
+    r->buf = buf;
+    r->len = 0;
+    r->pos = 0;
+    return 0;
+}
+
+// 返回 1 表示读到一项，0 表示读完，-1 表示出错
+static int reader_next(dent_reader_t *r, const char **name, unsigned char *type) {
+    if (r->pos >= r->len) {
+        r->len = syscall(SYS_getdents64, r->fd, r->buf, WALK_DENTS_BUFFER);
+        r->pos = 0;
+        if (r->len <= 0) {
+            return r->len == 0 ? 0 : -1;
+        }
+    }
+    struct walk_dirent64 *de = (struct walk_dirent64 *)(r->buf + r->pos);
+    r->pos += de->d_reclen;
+    *name = de->d_name;
+    *type = de->d_type;
+    return 1;
+}
+
+static void reader_close(dent_reader_t *r) {
+    (void)r;
+}
+#else
+static int reader_open(dent_reader_t *r, int fd, char *buf) {
+    (void)buf;
+    int dup_fd = dup(fd);
+    r->dir = dup_fd >= 0 ? fdopendir(dup_fd) : NULL;
+    if (!r->dir && dup_fd >= 0) {
+        close(dup_fd);
+    }
+    return r->dir ? 0 : -1;
+}
+
+static int reader_next(dent_reader_t *r, const char **name, unsigned char *type) {
+    errno = 0;
+    struct dirent *entry = readdir(r->dir);
+    if (!entry) {
+        return errno ? -1 : 0;
+    }
+    *name = entry->d_name;
+    *type = entry->d_type;
+    return 1;
+}
+
+static void reader_close(dent_reader_t *r) {
+    closedir(r->dir);
+}
+#endif
+
+static void dir_done(walker_t *w, walk_dir_t *d, int type, int err, int thread) {
+    if (!w->opts->dir_done) {
+        return;
+    }
+    walk_entry_t e;
+    e.dir_fd = d->parent ? d->parent->fd : -1;
+    e.name = d->name;
+    e.path = d->path;
+    e.path_len = d->path_len;
+    e.st = NULL;
+    e.type = type;
+    e.err = err;
+    e.dir_data = d->data;
+    e.thread = thread;
+    w->opts->dir_done(w->opts->ctx, &e);
+}
+
+// 打开一个目录并处理其中的所有目录项，子目录压入栈中
+static void walk_one(walker_t *w, walk_dir_t *d, walk_thread_t *t) {
+    const walk_options_t *opts = w->opts;
+    int follow = opts->flags & WALK_FOLLOW;
+    int open_flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | (follow ? 0 : O_NOFOLLOW);
+
+    if (__atomic_load_n(&w->stopped, __ATOMIC_RELAXED)) {
+        dir_done(w, d, WALK_DNR, ECANCELED, t->thread);
+        return;
+    }
+
+    d->fd = d->parent ? openat(d->parent->fd, d->name, open_flags) : open(d->name, open_flags);
+    if (d->fd < 0) {
+        int err = errno;
+        if (!d->parent) {
+            w->root_err = err;
+        }
+        dir_done(w, d, WALK_DNR, err, t->thread);
+        return;
+    }
+
+    dent_reader_t reader;
+    if (reader_open(&reader, d->fd, t->dents) != 0) {
+        dir_done(w, d, WALK_DNR, errno, t->thread);
+        return;
+    }
+
+    walk_entry_t e;
+    e.dir_fd = d->fd;
+    e.dir_data = d->data;
+    e.thread = t->thread;
+    const char *name;
+    unsigned char dtype;
+    int rc;
+    int err = 0;
+    struct stat st;
+    while ((rc = reader_next(&reader, &name, &dtype)) > 0) {
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        // 相对路径只在内存中拼接，系统调用都相对目录 fd
+        int n = d->path_len ? snprintf(t->path, sizeof(t->path), "%s/%s", d->path, name)
+                            : snprintf(t->path, sizeof(t->path), "%s", name);
+        e.name = name;
+        e.path = t->path;
+        e.path_len = n;
+        e.st = NULL;
+        e.err = 0;
+        if (n < 0 || n >= (int)sizeof(t->path)) {
+            e.path_len = strlen(t->path);
+            e.type = WALK_NS;
+            e.err = ENAMETOOLONG;
+        } else if (dtype == DT_DIR) {
+            e.type = WALK_D;
+        } else if (fstatat(d->fd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {
+            e.type = WALK_NS;
+            e.err = errno;
+        } else {
+            e.st = &st;
+            e.type = S_ISDIR(st.st_mode) ? WALK_D : WALK_F;
+        }
+
+        void *child = NULL;
+        int ret = opts->entry(opts->ctx, &e, &child);
+        if (ret == WALK_STOP) {
+            __atomic_store_n(&w->stopped, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        if (e.type == WALK_D && ret != WALK_SKIP) {
+            push_dir(w, dir_new(d, t->path, e.path_len, NULL, child));
+        }
+    }
+    if (rc < 0) {
+        err = errno;
+    }
+    reader_close(&reader);
+    dir_done(w, d, err ? WALK_DNR : WALK_D, err, t->thread);
+}
+
+// 遍历线程：不断从栈中取目录，栈空且没有线程在处理目录时结束
+static void* walk_thread(void *arg) {
+    walker_t *w = arg;
+    walk_thread_t *t = malloc(sizeof(walk_thread_t));
+    char *dents = malloc(WALK_DENTS_BUFFER);
+    if (!t || !dents) {
+        perror("malloc failed");
+        exit(1);
+    }
+    t->thread = __atomic_fetch_add(&w->next_thread, 1, __ATOMIC_RELAXED);
+    t->dents = dents;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->stack && w->active > 0) {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+        if (!w->stack) {
+            break;
+        }
+
+        walk_dir_t *d = w->stack;
+        w->stack = d->next;
+        w->active++;
+        pthread_mutex_unlock(&w->lock);
+
+        walk_dir_t *parent = d->parent;
+        walk_one(w, d, t);
+        // 已经打开（或打开失败），不再需要父目录
+        if (parent) {
+            dir_put(parent);
+        }
+        d->parent = NULL;
+        dir_put(d);
+
+        pthread_mutex_lock(&w->lock);
+        w->active--;
+        if (!w->stack && w->active == 0) {
+            pthread_cond_broadcast(&w->cond);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    free(dents);
+    free(t);
+    return NULL;
+}
+
+int walk_tree(const char *root, void *root_data, const walk_options_t *opts) {
+    walker_t w;
+    memset(&w, 0, sizeof(w));
+    w.opts = opts;
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    push_dir(&w, dir_new(NULL, "", 0, root, root_data));
+
+    pthread_t threads[256];
+    int count = opts->threads < 1 ? 1 : opts->threads;
+    if (count > (int)(sizeof(threads) / sizeof(threads[0]))) {
+        count = sizeof(threads) / sizeof(threads[0]);
+    }
+    int started = 0;
+    for (int i = 0; count > 1 && i < count; i++) {
+        if (pthread_create(&threads[i], NULL, walk_thread, &w) != 0) {
+            break;
+        }
+        started++;
+    }
+    // 单线程或一个线程都没启动时在当前线程中遍历
+    if (started == 0) {
+        walk_thread(&w);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&w.lock);
+    pthread_cond_destroy(&w.cond);
+    if (w.root_err) {
+        errno = w.root_err;
+        return -1;
+    }
+    return w.stopped ? WALK_STOP : 0;
+}
@@ -0,0 +1,60 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stddef.h>
+
+#define WALK_DENTS_BUFFER (128 * 1024)   // 每次 getdents64 读入的目录项缓冲区
+
+// 目录项类型
+#define WALK_F   1            // 不是目录的文件（普通文件、符号链接、设备等）
+#define WALK_D   2            // 目录
+#define WALK_DNR 3            // 无法打开或读取的目录（只出现在 dir_done 中）
+#define WALK_NS  4            // 无法 stat 的文件
+
+// 回调返回值
+#define WALK_CONTINUE 0
+#define WALK_SKIP     1       // 对目录：不进入
+#define WALK_STOP     2       // 停止整个遍历
+
+// 选项
+#define WALK_FOLLOW   0x01    // 跟随符号链接（stat 而不是 lstat，进入指向目录的链接）
+
+// 交给回调的一个目录项。所有指针只在回调期间有效
+typedef struct {
+    int dir_fd;               // 所在目录的 fd，可直接用于 openat/fstatat；根目录为 -1
+    const char *name;         // 目录项名，根目录为传给 walk_tree 的路径
+    const char *path;         // 相对根目录的路径，根目录为 ""
+    size_t path_len;
+    const struct stat *st;    // readdir 已给出是目录时不再 stat，为 NULL
+    int type;                 // WALK_F / WALK_D / WALK_DNR / WALK_NS
+    int err;                  // WALK_DNR/WALK_NS 时的 errno
+    void *dir_data;           // entry 中为所在目录的用户数据，dir_done 中为该目录自己的
+    int thread;               // 调用回调的遍历线程编号，0 <= thread < threads
+} walk_entry_t;
+
+// 每个目录项调用一次（不含 . 和 ..）。对目录可以通过 child_data 设置该目录的用户数据，
+// 之后该目录中的目录项和它的 dir_done 都会带上它
+typedef int (*walk_entry_fn)(void *ctx, const walk_entry_t *entry, void **child_data);
+
+// 一个目录的目录项都处理完后调用（不等待子目录），用于提交批量结果、释放用户数据。
+// 目录打不开时 type 为 WALK_DNR。每个进入的目录恰好调用一次，包括根目录
+typedef void (*walk_dir_fn)(void *ctx, const walk_entry_t *dir);
+
+typedef struct {
+    walk_entry_fn entry;
+    walk_dir_fn dir_done;     // 可以为 NULL
+    void *ctx;
+    int threads;              // 遍历线程数，不大于 1 时在调用线程中遍历
+    int flags;
+} walk_options_t;
+
+// 多线程遍历目录树：每个目录只打开一次，子目录相对父目录 fd 用 openat 打开，
+// 条目相对目录 fd 用 fstatat，不会反复解析完整路径；目录项用 getdents64 大批读入，
+// 待遍历的子目录放在共享栈中由空闲线程领取。回调会在多个线程中同时调用，
+// 同一目录的目录项和它的 dir_done 总在同一线程中依次调用。
+// 正常结束返回 0，被回调停止返回 WALK_STOP，根目录打不开返回 -1 并设置 errno
+int walk_tree(const char *root, void *root_data, const walk_options_t *opts);
+
+#endif